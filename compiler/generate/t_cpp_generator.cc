@@ -135,7 +135,7 @@ class t_cpp_generator : public t_oop_generator {
   void generate_sandesh_static_versionsig_def(std::ofstream& out, t_sandesh* tsandesh);
   void generate_sandesh_trace_seqnum_ctor(std::ofstream& out, t_sandesh* tsandesh);
   void generate_static_const_string_definition(std::ofstream& out, t_sandesh* tsandesh);
-  std::string generate_sandesh_no_static_const_string_function(t_sandesh *tsandesh, bool signature, bool autogen_darg, bool trace = false, bool request = false, bool ctorcall = false);
+  std::string generate_sandesh_no_static_const_string_function(t_sandesh *tsandesh, bool signature, bool autogen_darg, bool trace = false, bool request = false, bool ctorcall = false, bool skip_optional = false);
   void generate_static_const_string_definition(std::ofstream& out, std::string name,
                                                const vector<t_field*>& fields);
   std::string generate_sandesh_async_creator(t_sandesh *tsandesh, bool signature, bool expand_autogen, bool skip_autogen, 
@@ -336,6 +336,18 @@ class t_cpp_generator : public t_oop_generator {
   std::string cob_function_signature(t_function* tfunction, std::string prefix="", bool name_params=true);
   std::string argument_list(t_struct* tstruct, bool name_params=true, bool start_comma=false);
   std::string type_to_enum(t_type* ttype);
+#ifdef SANDESH
+  std::string type_to_xml_name(t_type* ttype);
+  bool generate_xml_tag_protocol(std::ofstream& out,
+                                 const vector<t_field*>& fields);
+  void generate_field_begin_tag(std::ofstream& out, t_field* tfield,
+                                bool xml_tags);
+  void generate_field_end_tag(std::ofstream& out, t_field* tfield,
+                              bool xml_tags);
+  void generate_protocol_dispatch(std::ofstream& out, const std::string& name,
+                                  const std::string& method, bool write,
+                                  bool sandesh);
+#endif
   std::string local_reflection_name(const char*, t_type* ttype, bool external=false);
 
   void generate_enum_constant_list(std::ofstream& f,
@@ -570,6 +582,8 @@ void t_cpp_generator::init_generator() {
     "#include <sandesh/sandesh_uve.h>" << endl <<
     "#include <sandesh/sandesh_http.h>" << endl <<
     "#include <sandesh/sandesh_trace.h>" << endl <<
+    "#include <sandesh/protocol/TXMLProtocol.h>" << endl <<
+    "#include <sandesh/protocol/TBinaryProtocol.h>" << endl <<
     "#include <curl/curl.h>" << endl << 
     "#include <boost/foreach.hpp>" << endl << 
     "#include <boost/assign/list_of.hpp>" << endl <<
@@ -1116,7 +1130,8 @@ void t_cpp_generator::generate_sandesh_request(ofstream& out,
  * @param tsandesh The sandesh
  */
 std::string t_cpp_generator::generate_sandesh_no_static_const_string_function(t_sandesh* tsandesh,
-		bool signature, bool autogen_darg, bool trace, bool request, bool ctorcall) {
+		bool signature, bool autogen_darg, bool trace, bool request, bool ctorcall,
+		bool skip_optional) {
 	string result = "";
 
 	// Get members
@@ -1158,7 +1173,8 @@ std::string t_cpp_generator::generate_sandesh_no_static_const_string_function(t_
 		if ((*m_iter)->get_auto_generated() && trace) {
 		    continue;
 		}
-		if(((t_base_type *)tsandesh->get_type())->is_sandesh_object() &&
+		if((((t_base_type *)tsandesh->get_type())->is_sandesh_object() ||
+		    skip_optional) &&
 		    ((*m_iter)->get_req() == t_field::T_OPTIONAL)) {
 		    continue;
 		}
@@ -2157,6 +2173,36 @@ void t_cpp_generator::generate_sandesh_definition(ofstream& out,
         out << indent() << "snh->Dispatch(sconn);" << endl;
         indent_down();
         indent(out) << "}" << endl << endl;        
+
+        // Generate a creator without the optional members, left unset, so
+        // that adding an optional member keeps the existing callers working
+        bool has_optional = false;
+        for (m_iter = members.begin(); m_iter != members.end(); ++m_iter) {
+            if ((*m_iter)->get_req() == t_field::T_OPTIONAL) {
+                has_optional = true;
+                break;
+            }
+        }
+        if (has_optional) {
+            out << indent() << "static void Request" <<
+                    generate_sandesh_no_static_const_string_function(tsandesh, true, true, false, is_request, true, true) <<
+                    " {" << endl;
+            indent_up();
+            out << indent() << tsandesh->get_name() <<
+                  " * snh = new " << tsandesh->get_name() << "();" << endl;
+            for (m_iter = members.begin(); m_iter != members.end(); ++m_iter) {
+                if (((*m_iter)->get_type())->is_static_const_string() ||
+                    (*m_iter)->get_req() == t_field::T_OPTIONAL) {
+                    continue;
+                }
+                out << indent() << "snh->set_" << (*m_iter)->get_name() <<
+                      "(" << (*m_iter)->get_name() << ");" << endl;
+            }
+            out << indent() << "snh->set_context(context);" << endl;
+            out << indent() << "snh->Dispatch(sconn);" << endl;
+            indent_down();
+            indent(out) << "}" << endl << endl;
+        }
     } else if (is_response) {
         // Sandesh response
         // Generate default constructor
@@ -2201,7 +2247,8 @@ void t_cpp_generator::generate_sandesh_definition(ofstream& out,
             " uint32_t cycle, std::string ctx = \"\");" << endl;
         indent(out) << "static void Send(const " << type_name((*f_iter)->get_type()) <<
             "& cdata, SandeshLevel::type Xlevel, SandeshUVE::SendType stype, " <<
-            "uint32_t seqno, uint32_t cycle, std::string ctx = \"\");" << endl;
+            "uint32_t seqno, uint32_t cycle, std::string ctx = \"\", " <<
+            "int collector = -1);" << endl;
     } else if (is_system) {
         generate_sandesh_systemlog_creators(out, tsandesh);
     } else if (is_flow) {
@@ -2264,8 +2311,11 @@ void t_cpp_generator::generate_sandesh_definition(ofstream& out,
             " & _data, const map<string,string> & _dsconf);" << endl;
         out << indent() << "static bool UpdateUVE(" <<  dtype <<
             " & _data, " << dtype <<
-            " & tdata, uint64_t mono_usec, SandeshLevel::type Xlevel);" << endl;
+            " & tdata, uint64_t mono_usec, SandeshLevel::type Xlevel," <<
+            " bool Xdelta = false);" << endl;
         out << indent() << "bool LoadUVE(SendType stype, uint32_t cycle);" << endl;
+        out << indent() << "static bool _PeriodicPending(const " << dtype <<
+            " & _data);" << endl;
     }
 
     out << indent() << "std::string ToString() const;" << endl;
@@ -2341,9 +2391,23 @@ void t_cpp_generator::generate_sandesh_definition(ofstream& out,
 
     out << indent() << "int32_t Read(" <<
         "boost::shared_ptr<contrail::sandesh::protocol::TProtocol> iprot);" << endl;
+    out << indent() << "int32_t Read(" <<
+        "boost::shared_ptr<contrail::sandesh::protocol::TXMLProtocol> iprot);" << endl;
+    out << indent() << "int32_t Read(" <<
+        "boost::shared_ptr<contrail::sandesh::protocol::TBinaryProtocolT<" <<
+        "contrail::sandesh::transport::TMemoryBuffer> > iprot);" << endl;
+    out << indent() << "template <class Protocol_>" << endl <<
+        indent() << "int32_t Read(Protocol_* iprot);" << endl;
 
     out << indent() << "int32_t Write(" <<
         "boost::shared_ptr<contrail::sandesh::protocol::TProtocol> oprot) const;" << endl;
+    out << indent() << "int32_t Write(" <<
+        "boost::shared_ptr<contrail::sandesh::protocol::TXMLProtocol> oprot) const;" << endl;
+    out << indent() << "int32_t Write(" <<
+        "boost::shared_ptr<contrail::sandesh::protocol::TBinaryProtocolT<" <<
+        "contrail::sandesh::transport::TMemoryBuffer> > oprot) const;" << endl;
+    out << indent() << "template <class Protocol_>" << endl <<
+        indent() << "int32_t Write(Protocol_* oprot) const;" << endl;
 
     if (((t_base_type *)t)->is_sandesh_system()) {
         out << indent() << "static bool do_rate_limit_drop_log_;" << endl;
@@ -2997,6 +3061,11 @@ void t_cpp_generator::generate_struct_definition(ofstream& out,
       out <<
         indent() << "int32_t read(" <<
         "boost::shared_ptr<contrail::sandesh::protocol::TProtocol> iprot);" << endl;
+#ifdef SANDESH
+      out <<
+        indent() << "template <class Protocol_>" << endl <<
+        indent() << "int32_t read(Protocol_* iprot);" << endl;
+#endif
     }
   }
   if (write) {
@@ -3008,6 +3077,11 @@ void t_cpp_generator::generate_struct_definition(ofstream& out,
       out <<
         indent() << "int32_t write(" <<
         "boost::shared_ptr<contrail::sandesh::protocol::TProtocol> oprot) const;" << endl;
+#ifdef SANDESH
+      out <<
+        indent() << "template <class Protocol_>" << endl <<
+        indent() << "int32_t write(Protocol_* oprot) const;" << endl;
+#endif
     }
   }
 #ifdef SANDESH
@@ -3370,9 +3444,16 @@ void t_cpp_generator::generate_struct_reader(ofstream& out,
       indent() << "int32_t " << tstruct->get_name() <<
       "::read(Protocol_* iprot) {" << endl;
   } else {
+#ifdef SANDESH
+    out <<
+      indent() << "template <class Protocol_>" << endl <<
+      indent() << "int32_t " << tstruct->get_name() <<
+      "::read(Protocol_* iprot) {" << endl;
+#else
     indent(out) <<
       "int32_t " << tstruct->get_name() <<
       "::read(boost::shared_ptr<contrail::sandesh::protocol::TProtocol> iprot) {" << endl;
+#endif
   }
   indent_up();
 
@@ -3518,6 +3599,11 @@ void t_cpp_generator::generate_struct_reader(ofstream& out,
   indent_down();
   indent(out) <<
     "}" << endl << endl;
+#ifdef SANDESH
+  if (!gen_templates_) {
+    generate_protocol_dispatch(out, tstruct->get_name(), "read", false, false);
+  }
+#endif
 }
 
 /**
@@ -3539,14 +3625,24 @@ void t_cpp_generator::generate_struct_writer(ofstream& out,
       indent() << "int32_t " << tstruct->get_name() <<
       "::write(Protocol_* oprot) const {" << endl;
   } else {
+#ifdef SANDESH
+    out <<
+      indent() << "template <class Protocol_>" << endl <<
+      indent() << "int32_t " << tstruct->get_name() <<
+      "::write(Protocol_* oprot) const {" << endl;
+#else
     indent(out) <<
       "int32_t " << tstruct->get_name() <<
       "::write(boost::shared_ptr<contrail::sandesh::protocol::TProtocol> oprot) const {" << endl;
+#endif
   }
   indent_up();
 
   out <<
     indent() << "int32_t xfer = 0, ret;" << endl;
+#ifdef SANDESH
+  bool xml_tags = !gen_templates_ && generate_xml_tag_protocol(out, fields);
+#endif
 
   indent(out) <<
     "if ((ret = oprot->writeStructBegin(\"" << name << "\")) < 0) {" << endl;
@@ -3587,6 +3683,9 @@ void t_cpp_generator::generate_struct_writer(ofstream& out,
         indent_down();
         out << indent() << "}" << endl;
     } else {
+#ifdef SANDESH
+        generate_field_begin_tag(out, *f_iter, xml_tags);
+#else
         out <<
             indent() << "if ((ret = oprot->writeFieldBegin(" <<
             "\"" << (*f_iter)->get_name() << "\", " <<
@@ -3596,6 +3695,7 @@ void t_cpp_generator::generate_struct_writer(ofstream& out,
         indent(out) << "return ret;" << endl;
         scope_down(out);
         indent(out) << "xfer += ret;" << endl;
+#endif
     }
 
     // Write field contents
@@ -3605,12 +3705,16 @@ void t_cpp_generator::generate_struct_writer(ofstream& out,
       generate_serialize_field(out, *f_iter, "this->");
     }
     // Write field closer
+#ifdef SANDESH
+    generate_field_end_tag(out, *f_iter, xml_tags);
+#else
     indent(out) <<
       "if ((ret = oprot->writeFieldEnd()) < 0) {" << endl;
     indent_up();
     indent(out) << "return ret;" << endl;
     scope_down(out);
     indent(out) << "xfer += ret;" << endl;
+#endif
     if ((*f_iter)->get_req() == t_field::T_OPTIONAL) {
       indent_down();
       indent(out) << '}' << endl;
@@ -3633,6 +3737,11 @@ void t_cpp_generator::generate_struct_writer(ofstream& out,
   indent(out) <<
     "}" << endl <<
     endl;
+#ifdef SANDESH
+  if (!gen_templates_) {
+    generate_protocol_dispatch(out, tstruct->get_name(), "write", true, false);
+  }
+#endif
 }
 
 #ifdef SANDESH
@@ -3972,6 +4081,25 @@ void t_cpp_generator::generate_sandesh_updater(ofstream& out,
   indent(out) <<  "else return true;" << endl;
   indent_down();
   indent(out) <<  "}" << endl << endl;
+
+  // A UVE needs periodic processing only while one of its periodic
+  // derived stats still has a result to flush
+  indent(out) << "bool " << tsandesh->get_name() <<
+    "::_PeriodicPending(const " << dtype << " & _data) {" << endl;
+  indent_up();
+  bool is_periodic_ds = false;
+  for (map<string,DSInfo>::const_iterator ds_iter = dsinfo.begin();
+       ds_iter != dsinfo.end(); ++ds_iter) {
+    CacheAttribute cat = ds_iter->second.cat_;
+    if ((cat != PERIODIC) && (cat != HIDDEN_PER)) continue;
+    indent(out) << "if (_data.__dsobj_" << ds_iter->first <<
+      "->IsResult()) return true;" << endl;
+    is_periodic_ds = true;
+  }
+  if (!is_periodic_ds) indent(out) << "(void)_data;" << endl;
+  indent(out) << "return false;" << endl;
+  indent_down();
+  indent(out) << "}" << endl << endl;
  
   indent(out) << "std::map<std::string, std::string> " << tsandesh->get_name() <<
     "::_DSConf(void) {" << endl;
@@ -4046,10 +4174,44 @@ void t_cpp_generator::generate_sandesh_updater(ofstream& out,
   indent_down();
   indent(out) << "}" << endl << endl;
 
+  // Derived stats of a map attribute that are computed on a member of
+  // its values read that member through an accessor, so that the map
+  // can be merged into the DS objects without being copied
+  for (s_iter = sfields.begin(); s_iter != sfields.end(); ++s_iter) {
+    string snm = (*s_iter)->get_name();
+    map<string,set<string> >::const_iterator r_iter = rawmap.find(snm);
+    if ((r_iter == rawmap.end()) || !(*s_iter)->get_type()->is_map()) {
+      continue;
+    }
+    t_type* vtype = ((t_map*)(*s_iter)->get_type())->get_val_type();
+    set<string>::const_iterator d_iter;
+    for (d_iter = r_iter->second.begin(); d_iter != r_iter->second.end(); ++d_iter) {
+      map<string,DSInfo>::const_iterator c_iter = dsinfo.find(*d_iter);
+      if (c_iter->second.compattr_.empty() || !c_iter->second.is_map_) {
+        continue;
+      }
+      string getexpr = string("get_") + c_iter->second.compattr_ +
+        string("()");
+      if (!c_iter->second.subcompattr_.empty()) {
+        getexpr += string(".get_") + c_iter->second.subcompattr_ +
+          string("()");
+      }
+      indent(out) << "struct " << tsandesh->get_name() << "_" <<
+        *d_iter << "_DSElem {" << endl;
+      indent(out) << "  " << c_iter->second.rawtype_ <<
+        " operator()(const " << type_name(vtype) <<
+        " & _val) const { return _val." << getexpr << "; }" << endl;
+      indent(out) << "};" << endl << endl;
+    }
+  }
+
+  // If Xdelta is set, inline attributes whose value is the same as in
+  // the cache are not sent
   indent(out) << "bool " << tsandesh->get_name() << 
     "::UpdateUVE(" <<  dtype <<
       " & _data, " << dtype <<
-      " & tdata, uint64_t mono_usec, SandeshLevel::type Xlevel) {" << endl;
+      " & tdata, uint64_t mono_usec, SandeshLevel::type Xlevel," <<
+      " bool Xdelta) {" << endl;
 
   indent_up();
   
@@ -4066,6 +4228,12 @@ void t_cpp_generator::generate_sandesh_updater(ofstream& out,
         if (cat != INLINE) {
           indent(out) << "if (_data.__isset." << snm << ") { _data.__isset." <<
             snm << " = false;" << endl;
+        } else if (snm.compare("deleted") != 0) {
+          indent(out) << "if (_data.__isset." << snm << ") {" << endl;
+          indent(out) << "  if (Xdelta && tdata.__isset." << snm <<
+            " && (tdata.get_" << snm << "() == _data.get_" << snm <<
+            "())) _data.__isset." << snm << " = false;" << endl;
+          indent(out) << "  else send = true;" << endl;
         } else {
           indent(out) << "if (_data.__isset." << snm << ") { send = true;" << endl;
         }
@@ -4083,17 +4251,11 @@ void t_cpp_generator::generate_sandesh_updater(ofstream& out,
       // Update all derivied stats of this raw attribute
       if (r_iter != rawmap.end()) {
         t_type* ratype = (*s_iter)->get_type();
+        string vdelete;
         if (ratype->is_map()) {
             t_type* vtype = ((t_map*)ratype)->get_val_type();
-            indent(out) << "typedef " << type_name((*s_iter)->get_type()) << 
-              " _T_" << snm << ";" << endl;
-            indent(out) << "std::map<string,bool> _delmap_" << snm
-              << ";" << endl;
-            indent(out) << "BOOST_FOREACH(const _T_" << snm <<
-              "::value_type& _tp, _data.get_" << snm << "())" << endl;
-            indent(out) << "  _delmap_" << snm <<
-              ".insert(make_pair(_tp.first, SandeshStructDeleteTrait<" <<
-              type_name(vtype) << ">::get(_tp.second)));" << endl; 
+            vdelete = string("::contrail::sandesh::DSMapRawDelete<") +
+              type_name(vtype) + string(" >()");
         }
         set<string>::const_iterator d_iter;
         for (d_iter = r_iter->second.begin(); d_iter != r_iter->second.end(); ++d_iter) {
@@ -4106,8 +4268,10 @@ void t_cpp_generator::generate_sandesh_updater(ofstream& out,
                 "->Update(_data.get_" << snm << "(), mono_usec);" << endl;
             } else {
               indent(out) << "tdata.__dsobj_" << *d_iter <<
-                "->Update(_data.get_" << snm << "(), _delmap_" << 
-                snm << ", mono_usec);" << endl;
+                "->Update(_data.get_" << snm <<
+                "(), ::contrail::sandesh::DSMapRawElem<" <<
+                c_iter->second.rawtype_ << " >(), " << vdelete <<
+                ", mono_usec);" << endl;
             }
           } else {
             string getexpr = string("get_") + c_iter->second.compattr_ +
@@ -4120,19 +4284,10 @@ void t_cpp_generator::generate_sandesh_updater(ofstream& out,
               indent(out) << "tdata.__dsobj_" << *d_iter << "->Update(_data.get_" <<
                 snm << "()." << getexpr << ", mono_usec);" << endl;
             } else {
-              indent(out) << "std::map<string," << c_iter->second.rawtype_ << "> temp_" << 
-                *d_iter << ";" << endl;
-              indent(out) << "BOOST_FOREACH(const _T_" << snm <<
-                "::value_type& _tp, _data.get_" << snm << "()) {" << endl;
-              indent_up();
-              indent(out) << "temp_" << *d_iter <<
-                ".insert(make_pair(_tp.first, _tp.second." <<
-                getexpr << "));" << endl;
-              indent_down();
-              indent(out) <<  "}" << endl;
-              indent(out) << "tdata.__dsobj_" << *d_iter << "->Update(temp_" <<
-                *d_iter << ", _delmap_" << snm << ", mono_usec);" << endl; 
-              indent(out) << "temp_" << *d_iter << ".clear();" << endl;
+              indent(out) << "tdata.__dsobj_" << *d_iter <<
+                "->Update(_data.get_" << snm << "(), " <<
+                tsandesh->get_name() << "_" << *d_iter << "_DSElem(), " <<
+                vdelete << ", mono_usec);" << endl;
             }
           }
           // If the DS is inline or mandatory
@@ -4167,9 +4322,10 @@ void t_cpp_generator::generate_sandesh_updater(ofstream& out,
  */
 void t_cpp_generator::generate_sandesh_reader(ofstream& out,
 		                                      t_sandesh* tsandesh) {
+	indent(out) << "template <class Protocol_>" << endl;
 	indent(out) <<
 			"int32_t " << tsandesh->get_name() <<
-			"::Read(boost::shared_ptr<contrail::sandesh::protocol::TProtocol> iprot) {" << endl;
+			"::Read(Protocol_* iprot) {" << endl;
 
 	indent_up();
 
@@ -4313,6 +4469,7 @@ void t_cpp_generator::generate_sandesh_reader(ofstream& out,
 	indent_down();
 	indent(out) <<
 			"}" << endl << endl;
+	generate_protocol_dispatch(out, tsandesh->get_name(), "Read", false, true);
 }
 
 /**
@@ -4327,14 +4484,16 @@ void t_cpp_generator::generate_sandesh_writer(ofstream& out,
 	const vector<t_field*>& fields = tsandesh->get_members();
 	vector<t_field*>::const_iterator f_iter;
 
+	indent(out) << "template <class Protocol_>" << endl;
 	indent(out) <<
 			"int32_t " << tsandesh->get_name() <<
-			"::Write(boost::shared_ptr<contrail::sandesh::protocol::TProtocol> oprot) const {" <<
+			"::Write(Protocol_* oprot) const {" <<
 			endl;
 
 	indent_up();
 
 	out << indent() << "int32_t xfer = 0, ret;" << endl;
+	bool xml_tags = generate_xml_tag_protocol(out, fields);
 
 	indent(out) <<
 			"if ((ret = oprot->writeSandeshBegin(\"" << name << "\")) < 0) {" << endl;
@@ -4370,25 +4529,12 @@ void t_cpp_generator::generate_sandesh_writer(ofstream& out,
                     indent_down();
                     out << indent() << "}" << endl;
                 } else {
-                    out <<
-                        indent() << "if ((ret = oprot->writeFieldBegin(" <<
-                        "\"" << (*f_iter)->get_name() << "\", " <<
-                        type_to_enum((*f_iter)->get_type()) << ", " <<
-                        (*f_iter)->get_key() << ")) < 0) {" << endl;
-                    indent_up();
-                    indent(out) << "return ret;" << endl;
-                    scope_down(out);
-                    indent(out) << "xfer += ret;" << endl;
+                    generate_field_begin_tag(out, *f_iter, xml_tags);
                 }
 		// Write field contents
 		generate_serialize_field(out, *f_iter, "this->");
 		// Write field closer
-		indent(out) <<
-				"if ((ret = oprot->writeFieldEnd()) < 0) {" << endl;
-        indent_up();
-        indent(out) << "return ret;" << endl;
-        scope_down(out);
-        indent(out) << "xfer += ret;" << endl;
+		generate_field_end_tag(out, *f_iter, xml_tags);
 		if ((*f_iter)->get_req() == t_field::T_OPTIONAL) {
 			indent_down();
 			indent(out) << '}' << endl;
@@ -4411,6 +4557,7 @@ void t_cpp_generator::generate_sandesh_writer(ofstream& out,
 	indent(out) <<
 			"}" << endl <<
 			endl;
+	generate_protocol_dispatch(out, tsandesh->get_name(), "Write", true, true);
 }
 
 /**
@@ -4451,10 +4598,11 @@ void t_cpp_generator::generate_sandesh_uve_creator(
     indent(out) << "void " << sname <<
         "::Send(const " << type_name((*f_iter)->get_type()) <<
         "& cdata, SandeshLevel::type Xlevel, SandeshUVE::SendType stype," <<
-        " uint32_t seqno, uint32_t cycle, std::string ctx) {" << endl;
+        " uint32_t seqno, uint32_t cycle, std::string ctx, int collector) {" << endl;
     indent_up();
     indent(out) << sname << " *snh = new " << sname << "(seqno, cdata);" << endl;
     indent(out) << "snh->set_level(Xlevel);" << endl;
+    indent(out) << "snh->set_collector(collector);" << endl;
     indent(out) << "if (snh->LoadUVE(stype, cycle)) {" << endl;
     indent_up();
     indent(out) << "snh->set_context(ctx); snh->set_more(!ctx.empty());" << endl;
@@ -5336,6 +5484,11 @@ void t_cpp_generator::generate_service(t_service* tservice) {
     autogen_comment();
   f_service_ <<
     "#include \"" << get_include_prefix(*get_program()) << svcname << ".h\"" << endl;
+#ifdef SANDESH
+  f_service_ <<
+    "#include <sandesh/protocol/TXMLProtocol.h>" << endl <<
+    "#include <sandesh/protocol/TBinaryProtocol.h>" << endl;
+#endif
   if (gen_cob_style_) {
     f_service_ <<
       "#include \"async/TAsyncChannel.h\"" << endl;
@@ -8658,6 +8811,181 @@ string t_cpp_generator::type_to_enum(t_type* type) {
   throw "INVALID TYPE IN type_to_enum: " + type->get_name();
 }
 
+#ifdef SANDESH
+/**
+ * Converts the parse type to the type attribute written by TXMLProtocol.
+ */
+string t_cpp_generator::type_to_xml_name(t_type* type) {
+  static const char *names[][2] = {
+    { "T_BOOL",    "bool"    },
+    { "T_BYTE",    "byte"    },
+    { "T_I16",     "i16"     },
+    { "T_I32",     "i32"     },
+    { "T_I64",     "i64"     },
+    { "T_U16",     "u16"     },
+    { "T_U32",     "u32"     },
+    { "T_U64",     "u64"     },
+    { "T_IPV4",    "ipv4"    },
+    { "T_IPADDR",  "ipaddr"  },
+    { "T_DOUBLE",  "double"  },
+    { "T_STRING",  "string"  },
+    { "T_STRUCT",  "struct"  },
+    { "T_MAP",     "map"     },
+    { "T_SET",     "set"     },
+    { "T_LIST",    "list"    },
+    { "T_SANDESH", "sandesh" },
+    { "T_XML",     "xml"     },
+    { "T_UUID",    "uuid_t"  },
+  };
+  string tenum = type_to_enum(type);
+  tenum = tenum.substr(tenum.rfind(':') + 1);
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    if (tenum == names[i][0]) {
+      return names[i][1];
+    }
+  }
+  return "unknown";
+}
+
+/**
+ * Declares the TXMLProtocol used by the precomputed field tags, if any
+ * field of the writer can use them.
+ */
+bool t_cpp_generator::generate_xml_tag_protocol(ofstream& out,
+    const vector<t_field*>& fields) {
+  vector<t_field*>::const_iterator f_iter;
+  for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
+    if ((*f_iter)->annotations_.empty()) {
+      break;
+    }
+  }
+  if (f_iter == fields.end()) {
+    return false;
+  }
+  indent(out) << "::contrail::sandesh::protocol::TXMLProtocol *xprot = " <<
+    "::contrail::sandesh::protocol::toXMLProtocol(oprot);" << endl;
+  return true;
+}
+
+/**
+ * Writes the field header. For the XML protocol the start tag is formed
+ * here, so the generic writeFieldBegin is only the fallback.
+ */
+void t_cpp_generator::generate_field_begin_tag(ofstream& out,
+    t_field* tfield, bool xml_tags) {
+  if (!xml_tags) {
+    out <<
+      indent() << "if ((ret = oprot->writeFieldBegin(" <<
+      "\"" << tfield->get_name() << "\", " <<
+      type_to_enum(tfield->get_type()) << ", " <<
+      tfield->get_key() << ")) < 0) {" << endl;
+    indent_up();
+    indent(out) << "return ret;" << endl;
+    scope_down(out);
+    indent(out) << "xfer += ret;" << endl;
+    return;
+  }
+  std::ostringstream tag;
+  tag << "<" << tfield->get_name() << " type=\"" <<
+    type_to_xml_name(tfield->get_type()) << "\" identifier=\"" <<
+    tfield->get_key() << "\">";
+  string btag(tag.str());
+  string ebtag;
+  for (string::const_iterator it = btag.begin(); it != btag.end(); ++it) {
+    if (*it == '"') {
+      ebtag += '\\';
+    }
+    ebtag += *it;
+  }
+  indent(out) << "if (xprot) {" << endl;
+  indent_up();
+  indent(out) << "ret = xprot->writeFieldBeginTag(\"" << ebtag << "\", " <<
+    btag.length() << ", " << type_to_enum(tfield->get_type()) << ");" <<
+    endl;
+  indent_down();
+  indent(out) << "} else {" << endl;
+  indent_up();
+  indent(out) << "ret = oprot->writeFieldBegin(\"" << tfield->get_name() <<
+    "\", " << type_to_enum(tfield->get_type()) << ", " <<
+    tfield->get_key() << ");" << endl;
+  scope_down(out);
+  indent(out) << "if (ret < 0) {" << endl;
+  indent_up();
+  indent(out) << "return ret;" << endl;
+  scope_down(out);
+  indent(out) << "xfer += ret;" << endl;
+}
+
+/**
+ * Generates the protocol specific entry points of a templated reader or
+ * writer. The generic TProtocol entry point instantiates the template
+ * with virtual dispatch; sandesh also get entry points for the XML and
+ * memory buffer binary protocols used on the hot paths, and structs are
+ * instantiated for those protocols so nested structs in other files link.
+ */
+void t_cpp_generator::generate_protocol_dispatch(ofstream& out,
+    const string& name, const string& method, bool write, bool sandesh) {
+  static const char *protocols[] = {
+    "::contrail::sandesh::protocol::TProtocol",
+    "::contrail::sandesh::protocol::TXMLProtocol",
+    "::contrail::sandesh::protocol::TBinaryProtocolT<"
+      "::contrail::sandesh::transport::TMemoryBuffer>",
+  };
+  size_t nprotocols = sizeof(protocols) / sizeof(protocols[0]);
+  string arg(write ? "oprot" : "iprot");
+  string cv(write ? " const" : "");
+  for (size_t i = 0; i < (sandesh ? nprotocols : 1); i++) {
+    indent(out) << "int32_t " << name << "::" << method <<
+      "(boost::shared_ptr< " << protocols[i] << " > " << arg << ")" <<
+      cv << " {" << endl;
+    indent_up();
+    indent(out) << "return " << method << "(" << arg << ".get());" << endl;
+    scope_down(out);
+    out << endl;
+  }
+  if (sandesh) {
+    return;
+  }
+  for (size_t i = 0; i < nprotocols; i++) {
+    indent(out) << "template int32_t " << name << "::" << method <<
+      "< " << protocols[i] << " >(" << protocols[i] << "* " << arg << ")" <<
+      cv << ";" << endl;
+  }
+  out << endl;
+}
+
+/**
+ * Writes the field closer matching generate_field_begin_tag.
+ */
+void t_cpp_generator::generate_field_end_tag(ofstream& out,
+    t_field* tfield, bool xml_tags) {
+  if (!xml_tags || !tfield->annotations_.empty()) {
+    indent(out) <<
+      "if ((ret = oprot->writeFieldEnd()) < 0) {" << endl;
+    indent_up();
+    indent(out) << "return ret;" << endl;
+    scope_down(out);
+    indent(out) << "xfer += ret;" << endl;
+    return;
+  }
+  string etag("</" + tfield->get_name() + ">");
+  indent(out) << "if (xprot) {" << endl;
+  indent_up();
+  indent(out) << "ret = xprot->writeFieldEndTag(\"" << etag << "\", " <<
+    etag.length() << ");" << endl;
+  indent_down();
+  indent(out) << "} else {" << endl;
+  indent_up();
+  indent(out) << "ret = oprot->writeFieldEnd();" << endl;
+  scope_down(out);
+  indent(out) << "if (ret < 0) {" << endl;
+  indent_up();
+  indent(out) << "return ret;" << endl;
+  scope_down(out);
+  indent(out) << "xfer += ret;" << endl;
+}
+#endif
+
 /**
  * Returns the symbol name of the local reflection of a type.
  */
@@ -14,6 +14,7 @@
 #define __DERIVED_STATS_H__
 
 #include <string>
+#include <map>
 #include <boost/shared_ptr.hpp>
 #include <boost/make_shared.hpp>
 #include <boost/function.hpp>
@@ -31,6 +32,41 @@ enum DSReturnType {
     DSR_OK
 };
 
+// Advance a sorted walk of the delete map up to key. Every raw
+// element is expected to have a delete indication.
+inline bool DerivedStatsDeleted(const std::map<std::string, bool> &del,
+        std::map<std::string, bool>::const_iterator &dlt,
+        const std::string &key) {
+    while ((dlt != del.end()) && (dlt->first < key)) ++dlt;
+    assert((dlt != del.end()) && (dlt->first == key));
+    return dlt->second;
+}
+
+// Generate the diff of a single raw element against the aggregate
+// and update the aggregate. ait is the caller's position in a sorted
+// walk of agg; it is left at the first element after key.
+template<typename ElemT>
+ElemT DerivedStatsAggElem(const std::string &key, const ElemT &raw,
+        bool deleted, std::map<std::string, ElemT> &agg,
+        typename std::map<std::string, ElemT>::iterator &ait) {
+    while ((ait != agg.end()) && (ait->first < key)) ++ait;
+    // The aggregate already has this element
+    if ((ait != agg.end()) && (ait->first == key)) {
+        ElemT diff = raw - ait->second;
+        // Remove from agg if this element is marked for deletion
+        // (It will still be in the diff)
+        if (!deleted) {
+            ait->second = ait->second + diff;
+            ++ait;
+        } else {
+            agg.erase(ait++);
+        }
+        return diff;
+    }
+    if (!deleted) agg.insert(ait, std::make_pair(key, raw));
+    return raw;
+}
+
 template<typename ElemT>
 std::map<std::string, ElemT> DerivedStatsAgg(const std::map<std::string, ElemT> & raw,
         std::map<std::string, ElemT> & agg,
@@ -39,36 +75,91 @@ std::map<std::string, ElemT> DerivedStatsAgg(const std::map<std::string, ElemT>
     std::map<std::string, ElemT> diff;
 
     typename std::map<std::string, ElemT>::const_iterator rit;
-    typename std::map<std::string, ElemT>::iterator ait;
-   
+    typename std::map<std::string, ElemT>::iterator ait = agg.begin();
+    std::map<std::string, bool>::const_iterator dlt = del.begin();
+
     // Go through all raw elements to generate diff and update agg 
     for (rit=raw.begin(); rit!= raw.end(); rit++) {
-        ait=agg.find(rit->first);
-        // The aggregate already has this element
-        if (ait!=agg.end()) {
-            diff[rit->first] = rit->second - ait->second;
-            // Remove from agg if this element is marked for deletion
-            // (It will still be in the diff)
-            if (!del.at(rit->first)) ait->second = ait->second + diff[rit->first];
-            else agg.erase(ait);
-        } else {
-            diff[rit->first] = rit->second;
-            if (!del.at(rit->first)) agg[rit->first] = diff[rit->first]; 
-        }
+        bool deleted = DerivedStatsDeleted(del, dlt, rit->first);
+        diff.insert(diff.end(), std::make_pair(rit->first,
+            DerivedStatsAggElem<ElemT>(rit->first, rit->second, deleted,
+                agg, ait)));
     }
     return diff;
 }  
 
- 
+// Apply a single element to the DS objects. dt is the caller's position
+// in a sorted walk of dsm; it is left at the first element after key.
 template<template<class,class> class DSTT, typename ElemT, typename ResultT>
-void DerivedStatsMerge(const std::map<std::string, ElemT> & raw,
+void DerivedStatsMergeElem(const std::string &key, const ElemT &val,
+        bool deleted,
         std::map<std::string, boost::shared_ptr<DSTT<ElemT,ResultT> > > & dsm,
-        std::string annotation, const std::map<std::string, bool> &del,
-        uint64_t mono_usec) {
+        typename std::map<std::string,
+                boost::shared_ptr<DSTT<ElemT,ResultT> > >::iterator &dt,
+        const std::string &annotation, uint64_t mono_usec) {
 
-    std::map<std::string, bool> srcmap;
-    typename std::map<std::string, ElemT>::const_iterator rit;
-    std::map<std::string, bool>::const_iterator dlt;
+    // We have no information about the DS objects before this element
+    while ((dt != dsm.end()) && (dt->first < key)) ++dt;
+
+    if ((dt != dsm.end()) && (dt->first == key)) {
+        if (deleted) {
+            // raw element is requesting deletion
+            dsm.erase(dt++);
+        } else {
+            dt->second->Update(val, mono_usec);
+            ++dt;
+        }
+    } else if (!deleted) {
+        // New entry; it goes right before dt
+        typename std::map<std::string,
+                boost::shared_ptr<DSTT<ElemT,ResultT> > >::iterator nt =
+            dsm.insert(dt, std::make_pair(key,
+                boost::make_shared<DSTT<ElemT,ResultT> >(annotation)));
+        nt->second->Update(val, mono_usec);
+    }
+}
+
+// Accessors for the elements of a raw map attribute. They let the
+// generated code merge the attribute into the DS objects as it is,
+// instead of first copying out the values and delete indications.
+template <typename ValT>
+struct DSMapRawElem {
+    const ValT & operator()(const ValT &val) const { return val; }
+};
+
+template <typename ValT>
+struct DSMapRawDelete {
+    bool operator()(const std::string &, const ValT &val) const {
+        return SandeshStructDeleteTrait<ValT>::get(val);
+    }
+};
+
+// Delete indications from a separate map, walked in order
+class DSMapDeleteMap {
+  public:
+    explicit DSMapDeleteMap(const std::map<std::string, bool> &del) :
+        del_(del), dlt_(del.begin()) {}
+    template <typename ValT>
+    bool operator()(const std::string &key, const ValT &) {
+        return DerivedStatsDeleted(del_, dlt_, key);
+    }
+  private:
+    const std::map<std::string, bool> &del_;
+    std::map<std::string, bool>::const_iterator dlt_;
+};
+
+// Merge the raw map into the DS objects in a single pass over the
+// sorted raw and DS maps. elem gives the raw value of an element, and
+// deleted its delete indication. If agg is given, the DS objects are
+// fed the diff against it instead of the raw value, and agg is updated
+// in the same pass. Once the set of keys is stable, an update does not
+// allocate.
+template<template<class,class> class DSTT, typename ElemT, typename ResultT,
+         typename RawT, typename ElemF, typename DeleteF>
+void DerivedStatsMerge(const std::map<std::string, RawT> & raw,
+        std::map<std::string, boost::shared_ptr<DSTT<ElemT,ResultT> > > & dsm,
+        const std::string &annotation, ElemF elem, DeleteF deleted,
+        uint64_t mono_usec, std::map<std::string, ElemT> *agg) {
 
     // If the new map is empty, clear all DS objects
     if (raw.empty()) {
@@ -76,49 +167,34 @@ void DerivedStatsMerge(const std::map<std::string, ElemT> & raw,
         return;
     }
 
-    for(rit=raw.begin(); rit!= raw.end(); rit++) {
-        srcmap[rit->first] = false;
-    }
-
-    // Go through all existing DS object
+    typename std::map<std::string, RawT>::const_iterator rit;
+    typename std::map<std::string, ElemT>::iterator ait;
+    if (agg) ait = agg->begin();
     typename std::map<std::string,
-            boost::shared_ptr<DSTT<
-            ElemT,ResultT> > >::iterator dt = dsm.begin();
-    while (dt != dsm.end()) {
-        rit = raw.find(dt->first);
-        dlt = del.find(dt->first);
-        if (rit != raw.end()) {
-            assert(dlt!=del.end());
-            // we have information about this element
-            srcmap[rit->first] = true;
-            if (dlt->second) {
-                // raw element is requesting deletion
-                typename std::map<std::string,
-                        boost::shared_ptr<DSTT<
-                        ElemT,ResultT> > >::iterator et = dt;
-                dt++;
-                dsm.erase(et);
-            } else {
-                dt->second->Update(rit->second, mono_usec);
-                ++dt;
-            }
+            boost::shared_ptr<DSTT<ElemT,ResultT> > >::iterator dt =
+        dsm.begin();
+
+    for (rit = raw.begin(); rit != raw.end(); ++rit) {
+        bool del = deleted(rit->first, rit->second);
+        if (agg) {
+            ElemT diff = DerivedStatsAggElem<ElemT>(rit->first,
+                    elem(rit->second), del, *agg, ait);
+            DerivedStatsMergeElem<DSTT,ElemT,ResultT>(rit->first, diff,
+                    del, dsm, dt, annotation, mono_usec);
         } else {
-            // We have no information about this element
-            ++dt;
+            DerivedStatsMergeElem<DSTT,ElemT,ResultT>(rit->first,
+                    elem(rit->second), del, dsm, dt, annotation, mono_usec);
         }
     }
+}
 
-    // Now add all new entries that are not requesting deletion
-    std::map<std::string, bool>::iterator mt;
-    for (mt = srcmap.begin(); mt != srcmap.end(); mt++) {
-        rit = raw.find(mt->first);
-        dlt = del.find(mt->first);
-        if ((mt->second == false) && (!dlt->second)) {
-            assert(dsm.find(mt->first) == dsm.end());
-            dsm[mt->first] = boost::make_shared<DSTT<ElemT,ResultT> >(annotation);
-            dsm[mt->first]->Update((raw.find(mt->first))->second, mono_usec);
-        }
-    }
+template<template<class,class> class DSTT, typename ElemT, typename ResultT>
+void DerivedStatsMerge(const std::map<std::string, ElemT> & raw,
+        std::map<std::string, boost::shared_ptr<DSTT<ElemT,ResultT> > > & dsm,
+        const std::string &annotation, const std::map<std::string, bool> &del,
+        uint64_t mono_usec, std::map<std::string, ElemT> *agg = NULL) {
+    DerivedStatsMerge<DSTT,ElemT,ResultT>(raw, dsm, annotation,
+            DSMapRawElem<ElemT>(), DSMapDeleteMap(del), mono_usec, agg);
 }
 
 template <template<class,class> class DSTT, typename ElemT, typename ResultT>
@@ -136,7 +212,6 @@ class DerivedStatsIf {
     ElemT agg_;
     std::map<std::string, ElemT> aggm_;
     ElemT diff_;
-    std::map<std::string, ElemT> diffm_;
 
     
   public:
@@ -203,25 +278,80 @@ class DerivedStatsIf {
         if (!dsm_) {
             dsm_ = boost::make_shared<result_map>();
         }
-        if (is_agg_) {
-            diffm_ = DerivedStatsAgg<ElemT>(raw, aggm_, del);
-            DerivedStatsMerge<DSTT,ElemT,ResultT>(diffm_, *dsm_, annotation_, del, mono_usec);
-        } else {
-            DerivedStatsMerge<DSTT,ElemT,ResultT>(raw, *dsm_, annotation_, del, mono_usec);
+        DerivedStatsMerge<DSTT,ElemT,ResultT>(raw, *dsm_, annotation_, del,
+                mono_usec, is_agg_ ? &aggm_ : NULL);
+    }
+
+    // Update from a raw map of any value type, through the accessors
+    // for the raw value and the delete indication of an element
+    template <typename RawT, typename ElemF, typename DeleteF>
+    void Update(const std::map<std::string, RawT> & raw, ElemF elem,
+            DeleteF deleted, uint64_t mono_usec) {
+        if (!dsm_) {
+            dsm_ = boost::make_shared<result_map>();
         }
+        DerivedStatsMerge<DSTT,ElemT,ResultT>(raw, *dsm_, annotation_, elem,
+                deleted, mono_usec, is_agg_ ? &aggm_ : NULL);
     }
 };
 
+// Return a DS object to the state it was constructed in.
+// DS objects that cannot be assigned overload this.
+template <template<class,class> class DSTT, typename ElemT, typename ResultT>
+void DSReset(DSTT<ElemT,ResultT> &ds, const std::string &annotation) {
+    ds = DSTT<ElemT,ResultT>(annotation);
+}
+
+// The DS object of a periodic DerivedStat. It is kept across periods
+// and reset in place when it is flushed, instead of being allocated
+// again for every period, and tells whether it was updated since.
+template <template<class,class> class DSTT>
+struct DSPeriodicElem {
+    template <typename ElemT, typename ResultT>
+    class type : public DSTT<ElemT,ResultT> {
+      public:
+        explicit type(const std::string &annotation) :
+            DSTT<ElemT,ResultT>(annotation), annotation_(annotation),
+            updated_(false) {}
+
+        void Update(const ElemT& raw, uint64_t mono_usec) {
+            DSTT<ElemT,ResultT>::Update(raw, mono_usec);
+            updated_ = true;
+        }
+
+        bool updated() const { return updated_; }
+
+        // Start the next period from the state of a new object, keeping
+        // the buffers that the assignment can reuse
+        void Reset() {
+            DSReset(static_cast<DSTT<ElemT,ResultT> &>(*this), annotation_);
+            updated_ = false;
+        }
+
+      private:
+        std::string annotation_;
+        bool updated_;
+    };
+};
+
 template <template<class,class> class DSTT, typename ElemT,
 typename SubResultT, typename ResultT>
 class DerivedStatsPeriodicIf {
   private:
-    typedef std::map<std::string, boost::shared_ptr<DSTT<ElemT,SubResultT> > > result_map;
+    typedef typename DSPeriodicElem<DSTT>::template type<ElemT,SubResultT>
+        ds_type;
+    typedef std::map<std::string, boost::shared_ptr<ds_type> > result_map;
+
+    // The DS objects and the results of the last period are allocated
+    // once, and reused from one period to the next. An element of the
+    // map that is not updated during a period is removed when flushed.
     boost::shared_ptr<result_map> dsm_;
-    boost::shared_ptr< std::map<std::string,ResultT> > dsm_cache_;
+    bool dsm_pending_;
+    std::map<std::string,ResultT> dsm_cache_;
 
-    boost::shared_ptr<DSTT<ElemT,SubResultT> > ds_;
-    boost::shared_ptr<ResultT> ds_cache_;
+    boost::shared_ptr<ds_type> ds_;
+    ResultT ds_cache_;
+    bool ds_cached_;
     
     std::string annotation_;
 
@@ -230,15 +360,15 @@ class DerivedStatsPeriodicIf {
     ElemT agg_;
     std::map<std::string, ElemT> aggm_;
     ElemT diff_;
-    std::map<std::string, ElemT> diffm_;
 
   public:
     DerivedStatsPeriodicIf(std::string annotation, bool is_agg=false):
-        annotation_(annotation), is_agg_(is_agg), init_(false) {}
+        dsm_pending_(false), ds_cached_(false), annotation_(annotation),
+        is_agg_(is_agg), init_(false) {}
 
     bool IsResult(void) const {
-        if (ds_ || ds_cache_) return true;
-        if (dsm_ || dsm_cache_) return true;
+        if ((ds_ && ds_->updated()) || ds_cached_) return true;
+        if (dsm_pending_ || !dsm_cache_.empty()) return true;
         return false;
     }
 
@@ -246,7 +376,7 @@ class DerivedStatsPeriodicIf {
     // on which the derived stat will be based.
     void Update(ElemT raw, uint64_t mono_usec) {
         if (!ds_) {
-            ds_ = boost::make_shared<DSTT<ElemT,SubResultT> >(annotation_);
+            ds_ = boost::make_shared<ds_type>(annotation_);
         }
         if (is_agg_) {
             if (!init_) {
@@ -266,45 +396,57 @@ class DerivedStatsPeriodicIf {
         if (!dsm_) {
             dsm_ = boost::make_shared<result_map>();
         }
-        if (is_agg_) {
-            diffm_ = DerivedStatsAgg<ElemT>(raw, aggm_, del);
-            DerivedStatsMerge<DSTT,ElemT,SubResultT>(
-                    diffm_, *dsm_, annotation_, del, mono_usec);
-        } else DerivedStatsMerge<DSTT,ElemT,SubResultT>(
-                    raw, *dsm_, annotation_, del, mono_usec);
+        DerivedStatsMerge<DSPeriodicElem<DSTT>::template type,ElemT,
+                SubResultT>(raw, *dsm_, annotation_, del, mono_usec,
+                is_agg_ ? &aggm_ : NULL);
+        dsm_pending_ = true;
+        init_ = true;
+    }
+
+    template <typename RawT, typename ElemF, typename DeleteF>
+    void Update(const std::map<std::string, RawT> & raw, ElemF elem,
+            DeleteF deleted, uint64_t mono_usec) {
+        if (!dsm_) {
+            dsm_ = boost::make_shared<result_map>();
+        }
+        DerivedStatsMerge<DSPeriodicElem<DSTT>::template type,ElemT,
+                SubResultT>(raw, *dsm_, annotation_, elem, deleted,
+                mono_usec, is_agg_ ? &aggm_ : NULL);
+        dsm_pending_ = true;
         init_ = true;
     }
 
     bool Flush(const ResultT &res) {
         (void)res;
-        if (!ds_) {
+        ds_cached_ = false;
+        if (!ds_ || !ds_->updated()) {
             // There were no updates to the DerivedStat
             // since the last flush
-            ds_cache_.reset();
-            return ds_cache_.get();
+            return false;
+        }
+        ds_cache_ = ResultT();
+        if (ds_->FillResult(ds_cache_.value)) {
+            ds_cache_.__isset.value = true;
+            ds_cached_ = true;
         }
-        ds_cache_ = boost::make_shared<ResultT>();
-        if (ds_->FillResult(ds_cache_->value)) {
-            ds_cache_->__isset.value = true;
-        } else ds_cache_.reset();
 
-        // Clear the DerivedStat
-        ds_.reset();
+        // Clear the DerivedStat for the next period
+        ds_->Reset();
 
-        return ds_cache_.get();
+        return ds_cached_;
     }
 
     // This is the interface to retrieve the current value
     // of the DerivedStat object.
     void FillResult(ResultT &res, bool& isset, bool force=false) const {
         isset = false;
-        if (ds_cache_) {
+        if (ds_cached_) {
             // Fill in previous information
-            res.value = ds_cache_->value;
+            res.value = ds_cache_.value;
             res.__isset.value = true;
             isset = true;
         }
-        if (ds_) {
+        if (ds_ && ds_->updated()) {
             // Fill in current information
             DSReturnType rt = ds_->FillResult(res.staging);
             if ((force && rt) || (!force && rt == DSR_OK)) {
@@ -314,47 +456,66 @@ class DerivedStatsPeriodicIf {
         }
     }
 
+    // The results of the period are written over those of the previous
+    // period, walking the sorted DS objects and results together
     bool Flush(const std::map<std::string, ResultT> &mres) {
         (void)mres;
-        if (!dsm_) {
-            // There were no updates to the DerivedStats
-            // since the last flush
-            dsm_cache_.reset();
-            return dsm_cache_.get();
-        }
-        dsm_cache_ = boost::make_shared<std::map<std::string,ResultT> >();
-        for (typename result_map::const_iterator dit = dsm_->begin();
-                dit != dsm_->end(); dit++) {
-            ResultT res;
-            if (dit->second->FillResult(res.value)) {
-                res.__isset.value = true;
-                dsm_cache_->insert(std::make_pair(dit->first, res));
+        dsm_pending_ = false;
+        typename std::map<std::string,ResultT>::iterator cit =
+                dsm_cache_.begin();
+        if (dsm_) {
+            typename result_map::iterator dit = dsm_->begin();
+            while (dit != dsm_->end()) {
+                if (!dit->second->updated()) {
+                    // There were no updates to this DerivedStat
+                    // since the last flush
+                    dsm_->erase(dit++);
+                    continue;
+                }
+                while ((cit != dsm_cache_.end()) &&
+                        (cit->first < dit->first)) {
+                    dsm_cache_.erase(cit++);
+                }
+                if ((cit == dsm_cache_.end()) || (cit->first != dit->first)) {
+                    cit = dsm_cache_.insert(cit,
+                            std::make_pair(dit->first, ResultT()));
+                } else {
+                    cit->second = ResultT();
+                }
+                if (dit->second->FillResult(cit->second.value)) {
+                    cit->second.__isset.value = true;
+                    ++cit;
+                } else {
+                    dsm_cache_.erase(cit++);
+                }
+
+                // Clear the DerivedStat for the next period
+                dit->second->Reset();
+                ++dit;
             }
         }
-        if (dsm_cache_->empty()) dsm_cache_.reset();
-
-        // Clear the DerivedStats
-        dsm_.reset();
-        return dsm_cache_.get();
+        dsm_cache_.erase(cit, dsm_cache_.end());
+        return !dsm_cache_.empty();
     }
 
     // This is the interface to retrieve the current value
     // of the DerivedStat object.
     void FillResult(std::map<std::string, ResultT> &mres, bool& isset, bool force=false) const {
         mres.clear();
-        if (dsm_cache_) {
-            // Fill in previous information
-            for (typename std::map<std::string,ResultT>::const_iterator dit = dsm_cache_->begin();
-                    dit != dsm_cache_->end(); dit++) {
-                ResultT res;
-                res.value = dit->second.value;
-                res.__isset.value = true;
-                mres.insert(std::make_pair(dit->first, res));
-            }
+        // Fill in previous information
+        for (typename std::map<std::string,ResultT>::const_iterator dit = dsm_cache_.begin();
+                dit != dsm_cache_.end(); dit++) {
+            ResultT res;
+            res.value = dit->second.value;
+            res.__isset.value = true;
+            mres.insert(std::make_pair(dit->first, res));
         }
         if (dsm_) {
             for (typename result_map::const_iterator dit = (*dsm_).begin();
                     dit != (*dsm_).end(); dit++) {
+                // Only the DerivedStats updated during this period
+                // have current information
+                if (!dit->second->updated()) continue;
 
                 // If this derived stat had a previous value, merge the current into it.
                 typename std::map<std::string, ResultT>::iterator wit =
@@ -433,6 +594,13 @@ class DerivedStatsPeriodicAnomalyIf {
         periodic_.Update(raw, del, mono_usec);
     }
 
+    template <typename RawT, typename ElemF, typename DeleteF>
+    void Update(const std::map<std::string, RawT> & raw, ElemF elem,
+            DeleteF deleted, uint64_t mono_usec) {
+        init_ = true;
+        periodic_.Update(raw, elem, deleted, mono_usec);
+    }
+
     bool Flush(const ResultT &res) {
         (void) res;
         if (!init_) return false;
@@ -148,6 +148,18 @@ class DSAnomaly {
     boost::scoped_ptr<DSAnomalyIf<ElemT> > impl_;
 };
 
+// DSAnomaly owns its algorithm, so it takes over the state of a new object
+template <typename ElemT, class AnomalyResT>
+void DSReset(DSAnomaly<ElemT,AnomalyResT> &ds, const std::string &annotation) {
+    DSAnomaly<ElemT,AnomalyResT> fresh(annotation);
+    ds.algo_.swap(fresh.algo_);
+    ds.config_.swap(fresh.config_);
+    ds.error_.swap(fresh.error_);
+    ds.previous_ = fresh.previous_;
+    ds.started_ = fresh.started_;
+    ds.impl_.swap(fresh.impl_);
+}
+
 template <typename ElemT, class EWMResT>
 class DSEWM {
   public:
@@ -272,7 +284,7 @@ template <typename ElemT, class SumResT>
 class DSSum {
   public:
     DSSum(const std::string &annotation): samples_(0), shifter_(0),
-            start_tbin_(0), last_tbin_(0) {
+            start_tbin_(0), last_tbin_(0), oldest_tbin_(0) {
 
         if (annotation.empty()) {
             range_usecs_ = 0;
@@ -284,13 +296,27 @@ class DSSum {
             while ((uint64_t)(1 << (shifter_ + 8)) < range_usecs_) shifter_++;
         }
     }
+
+    // Samples aggregated in one time bucket
+    struct TimeBin {
+        TimeBin() : tbin(0), samples(0) {}
+        uint64_t tbin;
+        uint64_t samples;
+        ElemT value;
+    };
+
     uint64_t samples_;
     SumResT value_;
-    map<uint64_t, pair<uint64_t,ElemT> > history_buf_;
+    // Ring of time buckets, indexed by bucket number modulo the
+    // number of buckets in the range. It is allocated on the first
+    // update, and has one slot for each bucket that can be in range.
+    vector<TimeBin> history_buf_;
     uint64_t range_usecs_;
     uint8_t shifter_;
     uint64_t start_tbin_;
     uint64_t last_tbin_;
+    // Oldest bucket that may still be in range
+    uint64_t oldest_tbin_;
 
     virtual DSReturnType FillResult(SumResT &res) const {
         static SumResT empty_val;
@@ -314,18 +340,25 @@ class DSSum {
     }
 
     virtual void Purge(uint64_t mono_usec) {
-
-        for (typename map<uint64_t, pair<uint64_t,ElemT> >::iterator it = 
-                history_buf_.begin(); it!= history_buf_.end(); ) {
-            uint64_t end_range = ((it->first + range_usecs_) >> shifter_) << shifter_;
-            if (end_range <= mono_usec) {
-                value_ = value_ - it->second.second;
-                samples_ = samples_ - it->second.first;
-                history_buf_.erase(it++);
-            } else {
-                ++it;
+        if (history_buf_.empty()) return;
+        // Buckets go out of range in order, so walk them from the
+        // oldest one, visiting each slot at most once
+        size_t visited = 0;
+        while (visited < history_buf_.size()) {
+            uint64_t end_range =
+                    ((oldest_tbin_ + range_usecs_) >> shifter_) << shifter_;
+            if (end_range > mono_usec) return;
+            TimeBin &bin = Slot(oldest_tbin_);
+            if (bin.samples && (bin.tbin == oldest_tbin_)) {
+                value_ = value_ - bin.value;
+                samples_ = samples_ - bin.samples;
+                bin.samples = 0;
             }
-        } 
+            oldest_tbin_ += ((uint64_t)1 << shifter_);
+            visited++;
+        }
+        // All buckets are out of range
+        oldest_tbin_ = (mono_usec >> shifter_) << shifter_;
     }
 
     virtual void Update(const ElemT& raw, uint64_t mono_usec) {
@@ -340,22 +373,35 @@ class DSSum {
             uint64_t tbin = (mono_usec >> shifter_) << shifter_;
             if (!start_tbin_) start_tbin_ = tbin;
             last_tbin_ = tbin;
+            if (history_buf_.empty()) {
+                size_t nbins = range_usecs_ >> shifter_;
+                history_buf_.resize(nbins ? nbins : 1);
+                oldest_tbin_ = tbin;
+            }
 
             // Subtract old entries, if there are any
             Purge(tbin);
 
-            // Record the new update, so we can subtract when needed
-            typename map<uint64_t, pair<uint64_t,ElemT> >::iterator ut =
-                    history_buf_.find(tbin);
-            if (ut == history_buf_.end()) {
-                history_buf_[tbin] = make_pair(1,raw);
+            // Record the new update, so we can subtract when needed.
+            // Once older buckets are purged, the slot is either free
+            // or holds this bucket.
+            TimeBin &bin = Slot(tbin);
+            if (!bin.samples) {
+                bin.tbin = tbin;
+                bin.samples = 1;
+                bin.value = raw;
             } else {
-                ut->second.second = ut->second.second + raw;
-                ut->second.first++;
+                bin.value = bin.value + raw;
+                bin.samples++;
             }
         }
         samples_++;
     }
+
+  private:
+    TimeBin & Slot(uint64_t tbin) {
+        return history_buf_[(tbin >> shifter_) % history_buf_.size()];
+    }
 };
 
 template <typename ElemT, class AvgResT>
@@ -374,6 +420,152 @@ class DSAvg : public DSSum<ElemT,AvgResT> {
     }
 };
 
+// Quantile sketch (DDSketch) with a bounded number of buckets.
+// Each bucket covers values within a relative accuracy of each other,
+// so quantiles are reported with that relative error.
+// The annotation is a list of percentiles, optionally followed by the
+// relative accuracy, e.g. "50,95,99:0.01"
+template <typename ElemT, class PercentileResT>
+class DSPercentile {
+  public:
+    // Once exceeded, the lowest buckets are collapsed together,
+    // preserving the accuracy of the upper percentiles.
+    static const size_t kMaxBins = 2048;
+
+    // gamma_ stays 0 for a bad annotation; such a sketch takes no
+    // samples into its buckets
+    DSPercentile(const std::string &annotation) :
+            samples_(0), gamma_(0), log_gamma_(0), zero_count_(0) {
+        size_t rpos = annotation.find(':');
+        std::string plist = annotation.substr(0, rpos);
+        double alpha = 0.01;
+        if (rpos != string::npos) {
+            std::string acc = annotation.substr(rpos+1, string::npos);
+            alpha = (double) strtod(acc.c_str(), NULL);
+            if ((alpha <= 0) || (alpha >= 1)) {
+                error_ = std::string("Invalid accuracy ") + acc;
+                return;
+            }
+        }
+        gamma_ = (1 + alpha) / (1 - alpha);
+        log_gamma_ = log(gamma_);
+        if (plist.empty()) plist = "50,95,99";
+        std::istringstream pstr(plist);
+        std::string ptok;
+        while (std::getline(pstr, ptok, ',')) {
+            char *end = NULL;
+            double pval = strtod(ptok.c_str(), &end);
+            if (ptok.empty() || *end || (pval < 0) || (pval > 100)) {
+                error_ = std::string("Invalid percentile ") + ptok;
+                quantiles_.clear();
+                return;
+            }
+            quantiles_.push_back(make_pair(std::string("p") + ptok,
+                    pval / 100));
+        }
+    }
+
+    uint64_t samples_;
+    std::string error_;
+
+    DSReturnType FillResult(PercentileResT &res) const {
+        res.set_samples(samples_);
+        if (!error_.empty()) {
+            res.set_error(error_);
+            return DSR_OK;
+        }
+        if (!samples_) return DSR_INVALID;
+        std::map<std::string, double> pmap;
+        for (vector<pair<string, double> >::const_iterator it =
+                quantiles_.begin(); it != quantiles_.end(); ++it) {
+            pmap.insert(make_pair(it->first, Quantile(it->second)));
+        }
+        res.set_percentiles(pmap);
+        return DSR_OK;
+    }
+
+    void Update(const ElemT& raw, uint64_t mono_usec) {
+        samples_++;
+        if (!error_.empty()) return;
+        double val = (double) raw;
+        if (val > kMinValue()) {
+            Add(pos_bins_, Index(val), 1);
+        } else if (val < -kMinValue()) {
+            Add(neg_bins_, Index(-val), 1);
+        } else {
+            zero_count_++;
+        }
+    }
+
+    // Fold in another sketch that was built with the same annotation
+    void Merge(const DSPercentile &other) {
+        assert(other.gamma_ == gamma_);
+        samples_ += other.samples_;
+        zero_count_ += other.zero_count_;
+        for (BinMap::const_iterator it = other.pos_bins_.begin();
+                it != other.pos_bins_.end(); ++it) {
+            Add(pos_bins_, it->first, it->second);
+        }
+        for (BinMap::const_iterator it = other.neg_bins_.begin();
+                it != other.neg_bins_.end(); ++it) {
+            Add(neg_bins_, it->first, it->second);
+        }
+    }
+
+    // q is between 0 and 1
+    double Quantile(double q) const {
+        double rank = q * (samples_ - 1);
+        uint64_t count = 0;
+        // Negative values, starting with the largest magnitude
+        for (BinMap::const_reverse_iterator it = neg_bins_.rbegin();
+                it != neg_bins_.rend(); ++it) {
+            count += it->second;
+            if (count > rank) return -Value(it->first);
+        }
+        count += zero_count_;
+        if (count > rank) return 0;
+        for (BinMap::const_iterator it = pos_bins_.begin();
+                it != pos_bins_.end(); ++it) {
+            count += it->second;
+            if (count > rank) return Value(it->first);
+        }
+        if (pos_bins_.empty()) return 0;
+        return Value(pos_bins_.rbegin()->first);
+    }
+
+  private:
+    typedef map<int32_t, uint64_t> BinMap;
+
+    static double kMinValue() { return 1e-9; }
+
+    int32_t Index(double val) const {
+        return (int32_t) ceil(log(val) / log_gamma_);
+    }
+
+    // Midpoint of the bucket, in the relative sense
+    double Value(int32_t index) const {
+        return 2 * pow(gamma_, index) / (gamma_ + 1);
+    }
+
+    void Add(BinMap &bins, int32_t index, uint64_t count) {
+        bins[index] += count;
+        if (bins.size() > kMaxBins) {
+            BinMap::iterator lowest = bins.begin();
+            BinMap::iterator next = lowest;
+            ++next;
+            next->second += lowest->second;
+            bins.erase(lowest);
+        }
+    }
+
+    double gamma_;
+    double log_gamma_;
+    vector<pair<string, double> > quantiles_;
+    uint64_t zero_count_;
+    BinMap pos_bins_;
+    BinMap neg_bins_;
+};
+
 } // namespace sandesh
 } // namespace contrail
 
@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "TXMLEscape.h"
+
+using contrail::sandesh::transport::TTransport;
+
+namespace contrail { namespace sandesh { namespace protocol {
+
+static const char kXMLEntityAmp[] = "&amp;";
+static const char kXMLEntityApos[] = "&apos;";
+static const char kXMLEntityLt[] = "&lt;";
+static const char kXMLEntityGt[] = "&gt;";
+
+static inline bool isXMLControlChar(char c) {
+  // '&' and '\'' differ only in bit 0, '<' and '>' only in bit 1
+  return (c | 1) == '\'' || (c | 2) == '>';
+}
+
+const char* xmlEscapeFind(const char* p, const char* end) {
+#if defined(__AVX2__)
+  const __m256i apos32 = _mm256_set1_epi8('\'');
+  const __m256i gt32 = _mm256_set1_epi8('>');
+  const __m256i one32 = _mm256_set1_epi8(1);
+  const __m256i two32 = _mm256_set1_epi8(2);
+  for (; end - p >= 32; p += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    __m256i m = _mm256_or_si256(
+        _mm256_cmpeq_epi8(_mm256_or_si256(v, one32), apos32),
+        _mm256_cmpeq_epi8(_mm256_or_si256(v, two32), gt32));
+    uint32_t mask = _mm256_movemask_epi8(m);
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i apos16 = _mm_set1_epi8('\'');
+  const __m128i gt16 = _mm_set1_epi8('>');
+  const __m128i one16 = _mm_set1_epi8(1);
+  const __m128i two16 = _mm_set1_epi8(2);
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i m = _mm_or_si128(
+        _mm_cmpeq_epi8(_mm_or_si128(v, one16), apos16),
+        _mm_cmpeq_epi8(_mm_or_si128(v, two16), gt16));
+    uint32_t mask = _mm_movemask_epi8(m);
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+#endif
+  for (; p != end; ++p) {
+    if (isXMLControlChar(*p)) {
+      return p;
+    }
+  }
+  return end;
+}
+
+const char* xmlFindChar(const char* p, const char* end, char c) {
+#if defined(__AVX2__)
+  const __m256i c32 = _mm256_set1_epi8(c);
+  for (; end - p >= 32; p += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, c32));
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i c16 = _mm_set1_epi8(c);
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, c16));
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+#endif
+  for (; p != end; ++p) {
+    if (*p == c) {
+      return p;
+    }
+  }
+  return end;
+}
+
+int32_t xmlEscapeWrite(TTransport* trans, const char* str, uint32_t len) {
+  const char* p = str;
+  const char* end = str + len;
+  int32_t size = 0;
+  while (p != end) {
+    const char* q = xmlEscapeFind(p, end);
+    if (q != p) {
+      if (trans->write(reinterpret_cast<const uint8_t*>(p), q - p)) {
+        return -1;
+      }
+      size += q - p;
+    }
+    if (q == end) {
+      break;
+    }
+    const char* entity;
+    uint32_t elen;
+    switch (*q) {
+     case '&':
+      entity = kXMLEntityAmp;
+      elen = sizeof(kXMLEntityAmp) - 1;
+      break;
+     case '\'':
+      entity = kXMLEntityApos;
+      elen = sizeof(kXMLEntityApos) - 1;
+      break;
+     case '<':
+      entity = kXMLEntityLt;
+      elen = sizeof(kXMLEntityLt) - 1;
+      break;
+     default:
+      entity = kXMLEntityGt;
+      elen = sizeof(kXMLEntityGt) - 1;
+      break;
+    }
+    if (trans->write(reinterpret_cast<const uint8_t*>(entity), elen)) {
+      return -1;
+    }
+    size += elen;
+    p = q + 1;
+  }
+  return size;
+}
+
+static inline bool matchXMLEntity(const char* p, const char* end,
+                                  const char* entity, size_t elen) {
+  return (size_t)(end - p) >= elen && memcmp(p, entity, elen) == 0;
+}
+
+size_t xmlUnescape(char* str, size_t len) {
+  char* end = str + len;
+  char* p = const_cast<char*>(xmlFindChar(str, end, '&'));
+  if (p == end) {
+    return len;
+  }
+  char* out = p;
+  while (p != end) {
+    // p is at an '&'
+    if (matchXMLEntity(p, end, kXMLEntityAmp, sizeof(kXMLEntityAmp) - 1)) {
+      *out++ = '&';
+      p += sizeof(kXMLEntityAmp) - 1;
+    } else if (matchXMLEntity(p, end, kXMLEntityApos,
+                              sizeof(kXMLEntityApos) - 1)) {
+      *out++ = '\'';
+      p += sizeof(kXMLEntityApos) - 1;
+    } else if (matchXMLEntity(p, end, kXMLEntityLt,
+                              sizeof(kXMLEntityLt) - 1)) {
+      *out++ = '<';
+      p += sizeof(kXMLEntityLt) - 1;
+    } else if (matchXMLEntity(p, end, kXMLEntityGt,
+                              sizeof(kXMLEntityGt) - 1)) {
+      *out++ = '>';
+      p += sizeof(kXMLEntityGt) - 1;
+    } else {
+      *out++ = *p++;
+    }
+    char* q = const_cast<char*>(xmlFindChar(p, end, '&'));
+    memmove(out, p, q - p);
+    out += q - p;
+    p = q;
+  }
+  return out - str;
+}
+
+}}} // contrail::sandesh::protocol
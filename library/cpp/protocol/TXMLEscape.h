@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#ifndef _SANDESH_PROTOCOL_TXMLESCAPE_H_
+#define _SANDESH_PROTOCOL_TXMLESCAPE_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sandesh/transport/TTransport.h>
+
+namespace contrail { namespace sandesh { namespace protocol {
+
+/**
+ * Scan and copy kernels for the XML control characters & ' < > used by
+ * the XML protocol and the collector message builder. The scans use
+ * AVX2 or SSE2 when the library is built for them, 16 or 32 bytes at a
+ * time, and fall back to a byte loop otherwise and for the tail.
+ */
+
+// Returns the first XML control character in [begin, end), or end
+const char* xmlEscapeFind(const char* begin, const char* end);
+
+// Returns the first occurrence of c in [begin, end), or end
+const char* xmlFindChar(const char* begin, const char* end, char c);
+
+// Writes str to the transport with the XML control characters replaced
+// by their entities, copying the runs in between as is. Returns the
+// number of bytes written on success, -1 otherwise
+int32_t xmlEscapeWrite(contrail::sandesh::transport::TTransport* trans,
+                       const char* str, uint32_t len);
+
+// Replaces the entities written by xmlEscapeWrite in place, in a single
+// pass. Returns the unescaped length
+size_t xmlUnescape(char* str, size_t len);
+
+}}} // contrail::sandesh::protocol
+
+#endif // #ifndef _SANDESH_PROTOCOL_TXMLESCAPE_H_
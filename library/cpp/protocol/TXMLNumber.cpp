@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "TXMLNumber.h"
+
+namespace contrail { namespace sandesh { namespace protocol {
+
+static const char kXMLDigitPairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static inline uint32_t countDigits(uint64_t value) {
+  uint32_t digits = 1;
+  while (true) {
+    if (value < 10) return digits;
+    if (value < 100) return digits + 1;
+    if (value < 1000) return digits + 2;
+    if (value < 10000) return digits + 3;
+    value /= 10000;
+    digits += 4;
+  }
+}
+
+uint32_t xmlFormatUnsigned(char* buf, uint64_t value) {
+  uint32_t len = countDigits(value);
+  char* p = buf + len;
+  while (value >= 100) {
+    uint32_t i = static_cast<uint32_t>(value % 100) * 2;
+    value /= 100;
+    *--p = kXMLDigitPairs[i + 1];
+    *--p = kXMLDigitPairs[i];
+  }
+  if (value >= 10) {
+    uint32_t i = static_cast<uint32_t>(value) * 2;
+    *--p = kXMLDigitPairs[i + 1];
+    *--p = kXMLDigitPairs[i];
+  } else {
+    *--p = static_cast<char>('0' + value);
+  }
+  return len;
+}
+
+uint32_t xmlFormatSigned(char* buf, int64_t value) {
+  if (value < 0) {
+    *buf = '-';
+    return 1 + xmlFormatUnsigned(buf + 1, 0 - static_cast<uint64_t>(value));
+  }
+  return xmlFormatUnsigned(buf, static_cast<uint64_t>(value));
+}
+
+uint32_t xmlFormatDouble(char* buf, double value) {
+  int len = 0;
+  for (int precision = 15; precision <= 17; precision++) {
+    len = snprintf(buf, kXMLNumberMaxLength, "%.*g", precision, value);
+    if (precision == 17 || strtod(buf, NULL) == value) {
+      break;
+    }
+  }
+  return len;
+}
+
+bool xmlParseDouble(const char* begin, const char* end, double& num) {
+  // strtod needs a terminated string
+  char buf[kXMLNumberMaxLength + 1];
+  size_t len = end - begin;
+  if (len == 0 || len > kXMLNumberMaxLength) {
+    num = 0;
+    return false;
+  }
+  memcpy(buf, begin, len);
+  buf[len] = '\0';
+  char* endptr;
+  num = strtod(buf, &endptr);
+  return endptr == buf + len;
+}
+
+}}} // contrail::sandesh::protocol
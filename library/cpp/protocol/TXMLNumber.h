@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#ifndef _SANDESH_PROTOCOL_TXMLNUMBER_H_
+#define _SANDESH_PROTOCOL_TXMLNUMBER_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <limits>
+
+namespace contrail { namespace sandesh { namespace protocol {
+
+/**
+ * Formatting and parsing of the numbers in the XML protocol, on caller
+ * provided buffers so that no string is allocated per number. Integers
+ * are formatted two digits at a time from a digit table, doubles with
+ * the fewest significant digits, 15 to 17, that read back as the same
+ * value.
+ */
+
+// Size of a buffer that can hold any number formatted below
+static const size_t kXMLNumberMaxLength = 32;
+
+// Formats value into buf in decimal and returns the number of characters
+// written. buf is not NUL terminated
+uint32_t xmlFormatUnsigned(char* buf, uint64_t value);
+
+uint32_t xmlFormatSigned(char* buf, int64_t value);
+
+uint32_t xmlFormatDouble(char* buf, double value);
+
+template <typename NumberType>
+inline uint32_t xmlFormatInteger(char* buf, NumberType num) {
+  if (std::numeric_limits<NumberType>::is_signed) {
+    return xmlFormatSigned(buf, static_cast<int64_t>(num));
+  }
+  return xmlFormatUnsigned(buf, static_cast<uint64_t>(num));
+}
+
+// Assembles the decimal number, with an optional sign, at the start of
+// [begin, end) into num. Returns the first character after the number
+template <typename NumberType>
+inline const char* xmlParseInteger(const char* begin, const char* end,
+                                   NumberType& num) {
+  const char* p = begin;
+  bool negative = false;
+  if (p != end && (*p == '-' || *p == '+')) {
+    negative = (*p == '-');
+    ++p;
+  }
+  uint64_t value = 0;
+  for (; p != end && *p >= '0' && *p <= '9'; ++p) {
+    value = value * 10 + (*p - '0');
+  }
+  num = static_cast<NumberType>(negative ? 0 - value : value);
+  return p;
+}
+
+// Parses the double in [begin, end) into num. Returns false if [begin,
+// end) is not entirely a number
+bool xmlParseDouble(const char* begin, const char* end, double& num);
+
+}}} // contrail::sandesh::protocol
+
+#endif // #ifndef _SANDESH_PROTOCOL_TXMLNUMBER_H_
@@ -14,6 +14,7 @@
 #include <base/string_util.h>
 
 #include "TXMLProtocol.h"
+#include "TXMLNumber.h"
 
 using std::string;
 
@@ -104,9 +105,9 @@ const std::string& TXMLProtocol::fieldTypeName(TType type) {
   }
 }
 
-TType TXMLProtocol::getTypeIDForTypeName(const std::string &name) {
+TType TXMLProtocol::getTypeIDForTypeName(const char* name, size_t len) {
   TType result = T_STOP; // Sentinel value
-  if (name.length() > 1) {
+  if (len > 1) {
     switch (name[0]) {
     case 'b':
         switch (name[1]) {
@@ -133,7 +134,7 @@ TType TXMLProtocol::getTypeIDForTypeName(const std::string &name) {
         result = T_I64;
         break;
       case 'p':
-        switch (name[2]) {
+        switch (len > 2 ? name[2] : '\0') {
         case 'a':
           result = T_IPADDR;
           break;
@@ -159,7 +160,7 @@ TType TXMLProtocol::getTypeIDForTypeName(const std::string &name) {
             result = T_SET;
             break;
         case 't':
-            switch (name[3]) {
+            switch (len > 3 ? name[3] : '\0') {
             case 'i':
                 result = T_STRING;
                 break;
@@ -192,7 +193,7 @@ TType TXMLProtocol::getTypeIDForTypeName(const std::string &name) {
     }
   }
   if (result == T_STOP) {
-    LOG(ERROR, __func__ << "Unrecognized type: " << name);
+    LOG(ERROR, __func__ << "Unrecognized type: " << std::string(name, len));
   }
   return result;
 }
@@ -205,6 +206,16 @@ static inline void formXMLAttr(std::string &dest, const std::string& name,
   dest += "\"";
 }
 
+template <typename NumberType>
+static inline void formXMLAttr(std::string &dest, const std::string& name,
+                               NumberType value) {
+  char buf[kXMLNumberMaxLength];
+  dest += name;
+  dest += "=\"";
+  dest.append(buf, xmlFormatInteger(buf, value));
+  dest += "\"";
+}
+
 void TXMLProtocol::indentUp() {
 #if TXMLPROTOCOL_DEBUG_PRETTY_PRINT
   indent_str_ += string(indent_inc, ' ');
@@ -225,15 +236,33 @@ void TXMLProtocol::indentDown() {
 
 // Returns the number of bytes written on success, -1 otherwise
 int32_t TXMLProtocol::writePlain(const string& str) {
-  int ret = trans_->write((uint8_t*)str.data(), str.length());
+  return writePlain(str.data(), str.length());
+}
+
+// Returns the number of bytes written on success, -1 otherwise
+int32_t TXMLProtocol::writePlain(const char* str, uint32_t len) {
+  int ret = trans_->write((const uint8_t*)str, len);
   if (ret) {
     return -1;
   }
-  return str.length();
+  return len;
+}
+
+// Formats the number on the stack and writes it, returns the number of
+// bytes written on success, -1 otherwise
+template <typename NumberType>
+int32_t TXMLProtocol::writeXMLInteger(NumberType num) {
+  char buf[kXMLNumberMaxLength];
+  return writePlain(buf, xmlFormatInteger(buf, num));
 }
 
 // Returns the number of bytes written on success, -1 otherwise
 int32_t TXMLProtocol::writeIndented(const string& str) {
+  return writeIndented(str.data(), str.length());
+}
+
+// Returns the number of bytes written on success, -1 otherwise
+int32_t TXMLProtocol::writeIndented(const char* str, uint32_t len) {
   int ret;
 #if TXMLPROTOCOL_DEBUG_PRETTY_PRINT
   ret = trans_->write((uint8_t*)indent_str_.data(), indent_str_.length());
@@ -241,11 +270,11 @@ int32_t TXMLProtocol::writeIndented(const string& str) {
     return -1;
   }
 #endif // !TXMLPROTOCOL_DEBUG_PRETTY_PRINT
-  ret = trans_->write((uint8_t*)str.data(), str.length());
+  ret = trans_->write((const uint8_t*)str, len);
   if (ret) {
     return -1;
   }
-  return indent_str_.length() + str.length();
+  return indent_str_.length() + len;
 }
 
 int32_t TXMLProtocol::writeMessageBegin(const std::string& name,
@@ -367,7 +396,7 @@ int32_t TXMLProtocol::writeFieldBegin(const char *name,
   xml += " ";
   formXMLAttr(xml, kXMLType, fieldTypeName(fieldType));
   xml += " ";
-  formXMLAttr(xml, kXMLIdentifier, integerToString(fieldId));
+  formXMLAttr(xml, kXMLIdentifier, fieldId);
   if (amap != NULL) {
     for (std::map<string, string>::const_iterator iter = amap->begin(); 
          iter != amap->end(); iter++) {
@@ -383,6 +412,20 @@ int32_t TXMLProtocol::writeFieldBegin(const char *name,
   }
   size += ret;
   xml_state_.push_back(sname);
+  if ((ret = pushFieldState(fieldType)) < 0) {
+    return ret;
+  }
+  size += ret;
+  return size;
+}
+
+// Records the field type so that the end tag is written the same way
+// by writeFieldEnd and writeFieldEndTag
+int32_t TXMLProtocol::pushFieldState(const TType fieldType) {
+  int32_t size = 0;
+#ifdef TXMLPROTOCOL_DEBUG_PRETTY_PRINT
+  int32_t ret;
+#endif // !TXMLPROTOCOL_DEBUG_PRETTY_PRINT
   if (fieldType == T_STRUCT) {
 	write_state_.push_back(STRUCT);
 #ifdef TXMLPROTOCOL_DEBUG_PRETTY_PRINT
@@ -432,7 +475,22 @@ int32_t TXMLProtocol::writeFieldBegin(const char *name,
   } else {
     write_state_.push_back(UNINIT);
   }
-  return size; 
+  return size;
+}
+
+int32_t TXMLProtocol::writeFieldBeginTag(const char* btag, uint32_t blen,
+                                         const TType fieldType) {
+  int32_t size = 0, ret;
+  if ((ret = writeIndented(btag, blen)) < 0) {
+    LOG(ERROR, __func__ << ": " << std::string(btag, blen) << " FAILED");
+    return ret;
+  }
+  size += ret;
+  if ((ret = pushFieldState(fieldType)) < 0) {
+    return ret;
+  }
+  size += ret;
+  return size;
 }
 
 int32_t TXMLProtocol::writeFieldEnd() {
@@ -474,6 +532,37 @@ int32_t TXMLProtocol::writeFieldEnd() {
   return size;
 }
 
+int32_t TXMLProtocol::writeFieldEndTag(const char* etag, uint32_t elen) {
+  int32_t size = 0, ret;
+  write_state_t state = write_state_.back();
+  if (state != STRUCT &&
+      state != SNDESH &&
+      state != LIST   &&
+      state != MAP    &&
+      state != SET) {
+    ret = trans_->write((const uint8_t*)etag, elen) ? -1 : (int32_t)elen;
+  } else {
+    if (state == STRUCT) {
+      indentDown();
+    }
+    ret = writeIndented(etag, elen);
+  }
+  if (ret < 0) {
+    LOG(ERROR, __func__ << ": " << std::string(etag, elen) << " " <<
+        state << " FAILED");
+    return ret;
+  }
+  size += ret;
+  if (!endl.empty()) {
+    if ((ret = writePlain(endl)) < 0) {
+      return ret;
+    }
+    size += ret;
+  }
+  write_state_.pop_back();
+  return size;
+}
+
 int32_t TXMLProtocol::writeFieldStop() {
   return 0;
 }
@@ -490,7 +579,7 @@ int32_t TXMLProtocol::writeMapBegin(const TType keyType,
   xml += " ";
   formXMLAttr(xml, kXMLValue, fieldTypeName(valType));
   xml += " ";
-  formXMLAttr(xml, kXMLSize, integerToString(size));
+  formXMLAttr(xml, kXMLSize, size);
   xml += kXMLTagC;
   xml += endl;
   // Write to transport
@@ -525,7 +614,7 @@ int32_t TXMLProtocol::writeListBegin(const TType elemType,
   xml += kXMLListTagO;
   formXMLAttr(xml, kXMLType, fieldTypeName(elemType));
   xml += " ";
-  formXMLAttr(xml, kXMLSize, integerToString(size));
+  formXMLAttr(xml, kXMLSize, size);
   xml += kXMLTagC;
   xml += endl;
   // Write to transport
@@ -561,7 +650,7 @@ int32_t TXMLProtocol::writeSetBegin(const TType elemType,
   xml += kXMLSetTagO;
   formXMLAttr(xml, kXMLType, fieldTypeName(elemType));
   xml += " ";
-  formXMLAttr(xml, kXMLSize, integerToString(size));
+  formXMLAttr(xml, kXMLSize, size);
   xml += kXMLTagC;
   xml += endl;
   // Write to transport
@@ -592,35 +681,35 @@ int32_t TXMLProtocol::writeBool(const bool value) {
 }
 
 int32_t TXMLProtocol::writeByte(const int8_t byte) {
-  return writePlain(integerToString(byte));
+  return writeXMLInteger(byte);
 }
 
 int32_t TXMLProtocol::writeI16(const int16_t i16) {
-  return writePlain(integerToString(i16));
+  return writeXMLInteger(i16);
 }
 
 int32_t TXMLProtocol::writeI32(const int32_t i32) {
-  return writePlain(integerToString(i32));
+  return writeXMLInteger(i32);
 }
 
 int32_t TXMLProtocol::writeI64(const int64_t i64) {
-  return writePlain(integerToString(i64));
+  return writeXMLInteger(i64);
 }
 
 int32_t TXMLProtocol::writeU16(const uint16_t u16) {
-  return writePlain(integerToString(u16));
+  return writeXMLInteger(u16);
 }
 
 int32_t TXMLProtocol::writeU32(const uint32_t u32) {
-  return writePlain(integerToString(u32));
+  return writeXMLInteger(u32);
 }
 
 int32_t TXMLProtocol::writeU64(const uint64_t u64) {
-  return writePlain(integerToString(u64));
+  return writeXMLInteger(u64);
 }
 
 int32_t TXMLProtocol::writeIPV4(const uint32_t ip4) {
-  return writePlain(integerToString(ip4));
+  return writeXMLInteger(ip4);
 }
 
 int32_t TXMLProtocol::writeIPADDR(const boost::asio::ip::address& ipaddress) {
@@ -628,12 +717,13 @@ int32_t TXMLProtocol::writeIPADDR(const boost::asio::ip::address& ipaddress) {
 }
 
 int32_t TXMLProtocol::writeDouble(const double dub) {
-  return writePlain(integerToString(dub));
+  char buf[kXMLNumberMaxLength];
+  return writePlain(buf, xmlFormatDouble(buf, dub));
 }
 
 int32_t TXMLProtocol::writeString(const string& str) {
-  // Escape XML control characters in the string before writing
-  return writePlain(escapeXMLControlChars(str));
+  // Escape XML control characters in the string while writing
+  return xmlEscapeWrite(trans_, str.data(), str.length());
 }
 
 int32_t TXMLProtocol::writeBinary(const string& str) {
@@ -694,7 +784,7 @@ static int32_t readSyntaxChar(TXMLProtocol::LookaheadReader &reader,
 // Reads string from the transport trans and verify that it is the
 // expected string str. Returns 1 if does, -1 if not
 static int32_t readSyntaxString(TXMLProtocol::LookaheadReader &reader,
-                                const std::string str) {
+                                const std::string &str) {
   int32_t result = 0, ret;
   for (std::string::const_iterator it = str.begin(); it != str.end(); it++) {
     if ((ret = readSyntaxChar(reader, *it)) < 0) {
@@ -705,6 +795,40 @@ static int32_t readSyntaxString(TXMLProtocol::LookaheadReader &reader,
   return result;
 }
 
+// Tag attributes are separated by any of = " and space, like
+// <name type="i32" identifier="1">. Returns the next token of the tag in
+// [p, end) via tok and len, and advances p past it. Returns false if there
+// are no more tokens
+static bool nextXMLTagToken(const char*& p, const char* end,
+                            const char** tok, size_t* len) {
+  while (p != end && (*p == '=' || *p == '"' || *p == ' ')) {
+    ++p;
+  }
+  if (p == end) {
+    return false;
+  }
+  *tok = p;
+  while (p != end && *p != '=' && *p != '"' && *p != ' ') {
+    ++p;
+  }
+  *len = p - *tok;
+  return true;
+}
+
+static inline bool isXMLTagToken(const char* tok, size_t len,
+                                 const std::string &str) {
+  return len == str.length() && memcmp(tok, str.data(), len) == 0;
+}
+
+/**
+ * The read functions below first try to work directly on the transport
+ * buffer, which is the whole message for TMemoryBuffer: delimiters are
+ * found with xmlFindChar, expected strings compared with memcmp and
+ * numbers parsed in place, and only what was decoded is consumed. When
+ * the transport does not expose its buffer, or the item is not complete
+ * in it, they fall back to reading a byte at a time through reader_.
+ */
+
 // Reads 1 byte and verifies that it matches ch. Returns 1 if it does,
 // -1 otherwise
 int32_t TXMLProtocol::readXMLSyntaxChar(uint8_t ch) {
@@ -713,14 +837,26 @@ int32_t TXMLProtocol::readXMLSyntaxChar(uint8_t ch) {
 
 // Reads a XML number or string and interprets it as a double.
 int32_t TXMLProtocol::readXMLDouble(double &num) {
-  LOG(ERROR, __func__ << ": Not implemented in TXMLProtocol");
-  assert(false);
-  return -1;
+  int32_t ret;
+  if ((ret = readXMLString(tag_)) < 0) {
+    return ret;
+  }
+  if (!xmlParseDouble(tag_.data(), tag_.data() + tag_.length(), num)) {
+    LOG(ERROR, __func__ << ": Expected a double; got \"" << tag_ << "\"");
+    return -1;
+  }
+  return ret;
 }
 
 // Reads string and verifies that it matches str. Returns 1 if it does,
 // -1 otherwise
 int32_t TXMLProtocol::readXMLSyntaxString(const std::string &str) {
+  uint32_t len = str.length();
+  const char* buf = reader_.borrow(&len);
+  if (buf && memcmp(buf, str.data(), str.length()) == 0) {
+    reader_.consume(str.length());
+    return str.length();
+  }
   return readSyntaxString(reader_, str);
 }
 
@@ -732,6 +868,21 @@ int32_t TXMLProtocol::readXMLCDATA(std::string &str) {
     return ret;
   }
   result += ret;
+  // Look for ]]> in the transport buffer
+  uint32_t len = kXMLCDATAC.length();
+  const char* buf = reader_.borrow(&len);
+  if (buf) {
+    const char* end = buf + len;
+    const char* p = buf;
+    while ((p = xmlFindChar(p, end, kcXMLSBracketC)) != end) {
+      if (end - p >= 3 && p[1] == kcXMLSBracketC && p[2] == kcXMLTagC) {
+        str.assign(buf, p);
+        reader_.consume(p + 3 - buf);
+        return result + (p + 3 - buf);
+      }
+      ++p;
+    }
+  }
   uint8_t ch = 0, ch2 = 0, ch3;
   bool ch_read = false, ch2_read = false, ch3_read = false;
   while (true) {
@@ -790,6 +941,19 @@ int32_t TXMLProtocol::readXMLString(std::string &str) {
   int32_t result = 0;
   str.clear();
   while (true) {
+    uint32_t len = 1;
+    const char* buf = reader_.borrow(&len);
+    if (buf) {
+      const char* end = buf + len;
+      const char* p = xmlFindChar(buf, end, kcXMLTagO);
+      str.append(buf, p);
+      reader_.consume(p - buf);
+      result += p - buf;
+      if (p != end) {
+        break;
+      }
+      continue;
+    }
     uint8_t ch = reader_.peek();
     if (ch == kcXMLTagO) {
       break;
@@ -803,20 +967,25 @@ int32_t TXMLProtocol::readXMLString(std::string &str) {
 
 // Decodes an XML tag and returns the string without the xml open
 // and close delimiters via str
-int32_t TXMLProtocol::readXMLTag(std::string &str, bool endTag) {
+int32_t TXMLProtocol::readXMLTag(std::string &str) {
   int32_t result = 0, ret;
   uint8_t ch;
+  uint32_t len = 1;
+  const char* buf = reader_.borrow(&len);
+  if (buf && buf[0] == kcXMLTagO) {
+    const char* end = buf + len;
+    const char* p = xmlFindChar(buf + 1, end, kcXMLTagC);
+    if (p != end) {
+      str.assign(buf + 1, p);
+      reader_.consume(p + 1 - buf);
+      return p + 1 - buf;
+    }
+  }
   str.clear();
   if ((ret = readXMLSyntaxChar(kcXMLTagO)) < 0) {
     return ret;
   }
   result += ret;
-  if (endTag) {
-    if ((ret = readXMLSyntaxChar(kcXMLSlash)) < 0) {
-      return ret;
-    }
-    result += ret;
-  }
   while (true) {
     ch = reader_.read();
     ++result;
@@ -828,6 +997,36 @@ int32_t TXMLProtocol::readXMLTag(std::string &str, bool endTag) {
   return result;
 }
 
+// Skips an XML end tag. Its name is not checked, so it is not copied
+int32_t TXMLProtocol::readXMLEndTag() {
+  int32_t result = 0, ret;
+  uint32_t len = 2;
+  const char* buf = reader_.borrow(&len);
+  if (buf && buf[0] == kcXMLTagO && buf[1] == kcXMLSlash) {
+    const char* end = buf + len;
+    const char* p = xmlFindChar(buf + 2, end, kcXMLTagC);
+    if (p != end) {
+      reader_.consume(p + 1 - buf);
+      return p + 1 - buf;
+    }
+  }
+  if ((ret = readXMLSyntaxChar(kcXMLTagO)) < 0) {
+    return ret;
+  }
+  result += ret;
+  if ((ret = readXMLSyntaxChar(kcXMLSlash)) < 0) {
+    return ret;
+  }
+  result += ret;
+  while (true) {
+    ++result;
+    if (reader_.read() == kcXMLTagC) {
+      break;
+    }
+  }
+  return result;
+}
+
 // Reads a sequence of characters, stopping at the first one that is not
 // a valid numeric character.
 int32_t TXMLProtocol::readXMLNumericChars(std::string &str) {
@@ -850,12 +1049,25 @@ int32_t TXMLProtocol::readXMLNumericChars(std::string &str) {
 template <typename NumberType>
 int32_t TXMLProtocol::readXMLInteger(NumberType &num) {
   int32_t result = 0, ret;
-  std::string str;
-  if ((ret = readXMLNumericChars(str)) < 0) {
+  uint32_t len = 1;
+  const char* buf = reader_.borrow(&len);
+  if (buf) {
+    const char* end = buf + len;
+    const char* p = buf;
+    while (p != end && isXMLNumeric(*p)) {
+      ++p;
+    }
+    if (p != end) {
+      xmlParseInteger(buf, p, num);
+      reader_.consume(p - buf);
+      return p - buf;
+    }
+  }
+  if ((ret = readXMLNumericChars(tag_)) < 0) {
     return ret;
   }
   result += ret;
-  stringToInteger(str, num);
+  xmlParseInteger(tag_.data(), tag_.data() + tag_.length(), num);
   return result;
 }
 
@@ -874,25 +1086,26 @@ int32_t TXMLProtocol::readMessageEnd() {
 }
 
 int32_t TXMLProtocol::readSandeshBegin(std::string& name) {
-  std::string str;
   int32_t result = 0, ret;
-  if ((ret = readXMLTag(str)) < 0) {
+  if ((ret = readXMLTag(tag_)) < 0) {
     LOG(ERROR, __func__ << ": FAILED");
     return ret;
   }
   result += ret;
-  boost::char_separator<char> sep("=\" ");
-  tokenizer tokens(str, sep);
+  const char* p = tag_.data();
+  const char* end = p + tag_.length();
+  const char* tok;
+  size_t len;
   // Extract the field name
-  tokenizer::iterator it = tokens.begin();
-  name = *it;
-  ++it;
-  for (; it != tokens.end(); ++it) {
-    if (*it == kXMLType) {
-      ++it;
-      if (kTypeNameSandesh != *it) {
+  if (nextXMLTagToken(p, end, &tok, &len)) {
+    name.assign(tok, len);
+  }
+  while (nextXMLTagToken(p, end, &tok, &len)) {
+    if (isXMLTagToken(tok, len, kXMLType) &&
+        nextXMLTagToken(p, end, &tok, &len)) {
+      if (!isXMLTagToken(tok, len, kTypeNameSandesh)) {
         LOG(ERROR, __func__ << ": Expected " << kTypeNameSandesh <<
-            "; got " << *it);
+            "; got " << std::string(tok, len));
         return -1;
       }
     }
@@ -901,8 +1114,7 @@ int32_t TXMLProtocol::readSandeshBegin(std::string& name) {
 }
 
 int32_t TXMLProtocol::readSandeshEnd() {
-  std::string name;
-  return readXMLTag(name, true);
+  return readXMLEndTag();
 }
 
 int32_t TXMLProtocol::readStructBegin(std::string& name) {
@@ -910,18 +1122,15 @@ int32_t TXMLProtocol::readStructBegin(std::string& name) {
 }
 
 int32_t TXMLProtocol::readStructEnd() {
-  std::string name;
-  return readXMLTag(name, true);
+  return readXMLEndTag();
 }
 
 int32_t TXMLProtocol::readContainerElementBegin() {
-  std::string name;
-  return readXMLTag(name);
+  return readXMLTag(tag_);
 }
 
 int32_t TXMLProtocol::readContainerElementEnd() {
-  std::string name;
-  return readXMLTag(name, true);
+  return readXMLEndTag();
 }
 
 int32_t TXMLProtocol::readFieldBegin(std::string& name,
@@ -929,156 +1138,155 @@ int32_t TXMLProtocol::readFieldBegin(std::string& name,
                                      int16_t& fieldId) {
   int32_t result = 0, ret;
   // Check if we hit the end of the list
-  uint8_t ch = reader_.peek2();
-  uint8_t ch1 = reader_.peek2();
+  uint32_t len = 2;
+  const char* buf = reader_.borrow(&len);
+  uint8_t ch = buf ? buf[0] : reader_.peek2();
+  uint8_t ch1 = buf ? buf[1] : reader_.peek2();
   if (ch == kcXMLTagO && ch1 == kcXMLSlash) {
     fieldType = contrail::sandesh::protocol::T_STOP;
     return result;
   }
-  std::string str;
-  if ((ret = readXMLTag(str)) < 0) {
+  if ((ret = readXMLTag(tag_)) < 0) {
     LOG(ERROR, __func__ << ": FAILED");
     return ret;
   }
   result += ret;
-  boost::char_separator<char> sep("=\" ");
-  tokenizer tokens(str, sep);
+  const char* p = tag_.data();
+  const char* end = p + tag_.length();
+  const char* tok;
+  size_t tlen;
   // Extract the field name
-  tokenizer::iterator it = tokens.begin();
-  name = *it;
-  ++it;
-  for (; it != tokens.end(); ++it) {
-    if (*it == kXMLType) {
-      ++it;
-      fieldType = getTypeIDForTypeName(*it);
+  if (nextXMLTagToken(p, end, &tok, &tlen)) {
+    name.assign(tok, tlen);
+  }
+  while (nextXMLTagToken(p, end, &tok, &tlen)) {
+    if (isXMLTagToken(tok, tlen, kXMLType) &&
+        nextXMLTagToken(p, end, &tok, &tlen)) {
+      fieldType = getTypeIDForTypeName(tok, tlen);
     }
-    if (*it == kXMLIdentifier) {
-      ++it;
-      stringToInteger(*it, fieldId);
+    if (isXMLTagToken(tok, tlen, kXMLIdentifier) &&
+        nextXMLTagToken(p, end, &tok, &tlen)) {
+      xmlParseInteger(tok, tok + tlen, fieldId);
     }
   }
   return result;
 }
 
 int32_t TXMLProtocol::readFieldEnd() {
-  string str;
-  return readXMLTag(str, true);
+  return readXMLEndTag();
 }
 
 int32_t TXMLProtocol::readMapBegin(TType& keyType,
                                    TType& valType,
                                    uint32_t& size) {
   int32_t result = 0, ret;
-  std::string str;
-  if ((ret = readXMLTag(str)) < 0) {
+  if ((ret = readXMLTag(tag_)) < 0) {
     LOG(ERROR, __func__ << ": FAILED");
     return ret;
   }
   result += ret;
-  boost::char_separator<char> sep("=\" ");
-  tokenizer tokens(str, sep);
+  const char* p = tag_.data();
+  const char* end = p + tag_.length();
+  const char* tok = p;
+  size_t len = 0;
   // Extract the field name
-  tokenizer::iterator it = tokens.begin();
-  if (*it != kTypeNameMap) {
+  if (!nextXMLTagToken(p, end, &tok, &len) ||
+      !isXMLTagToken(tok, len, kTypeNameMap)) {
     LOG(ERROR, __func__ << ": Expected \"" << kTypeNameMap <<
-        "\"; got \"" << *it << "\"");
+        "\"; got \"" << std::string(tok, len) << "\"");
     return -1;
   }
-  ++it;
-  for (; it != tokens.end(); ++it) {
-    if (*it == kXMLKey) {
-      ++it;
-      keyType = getTypeIDForTypeName(*it);
+  while (nextXMLTagToken(p, end, &tok, &len)) {
+    if (isXMLTagToken(tok, len, kXMLKey) &&
+        nextXMLTagToken(p, end, &tok, &len)) {
+      keyType = getTypeIDForTypeName(tok, len);
     }
-    if (*it == kXMLValue) {
-      ++it;
-      valType = getTypeIDForTypeName(*it);
+    if (isXMLTagToken(tok, len, kXMLValue) &&
+        nextXMLTagToken(p, end, &tok, &len)) {
+      valType = getTypeIDForTypeName(tok, len);
     }
-    if (*it == kXMLSize) {
-      ++it;
-      stringToInteger(*it, size);
+    if (isXMLTagToken(tok, len, kXMLSize) &&
+        nextXMLTagToken(p, end, &tok, &len)) {
+      xmlParseInteger(tok, tok + len, size);
     }
   }
   return result;
 }
 
 int32_t TXMLProtocol::readMapEnd() {
-  std::string str;
-  return readXMLTag(str, true);
+  return readXMLEndTag();
 }
 
 int32_t TXMLProtocol::readListBegin(TType& elemType,
                                     uint32_t& size) {
   int32_t result = 0, ret;
-  std::string str;
-  if ((ret = readXMLTag(str)) < 0) {
+  if ((ret = readXMLTag(tag_)) < 0) {
     LOG(ERROR, __func__ << ": FAILED");
     return ret;
   }
   result += ret;
-  boost::char_separator<char> sep("=\" ");
-  tokenizer tokens(str, sep);
+  const char* p = tag_.data();
+  const char* end = p + tag_.length();
+  const char* tok = p;
+  size_t len = 0;
   // Extract the field name
-  tokenizer::iterator it = tokens.begin();
-  if (*it != kTypeNameList) {
+  if (!nextXMLTagToken(p, end, &tok, &len) ||
+      !isXMLTagToken(tok, len, kTypeNameList)) {
     LOG(ERROR, __func__ << ": Expected \"" << kTypeNameList <<
-        "\"; got \"" << *it << "\"");
+        "\"; got \"" << std::string(tok, len) << "\"");
     return -1;
   }
-  ++it;
-  for (; it != tokens.end(); ++it) {
-    if (*it == kXMLType) {
-      ++it;
-      elemType = getTypeIDForTypeName(*it);
+  while (nextXMLTagToken(p, end, &tok, &len)) {
+    if (isXMLTagToken(tok, len, kXMLType) &&
+        nextXMLTagToken(p, end, &tok, &len)) {
+      elemType = getTypeIDForTypeName(tok, len);
     }
-    if (*it == kXMLSize) {
-      ++it;
-      stringToInteger(*it, size);
+    if (isXMLTagToken(tok, len, kXMLSize) &&
+        nextXMLTagToken(p, end, &tok, &len)) {
+      xmlParseInteger(tok, tok + len, size);
     }
   }
   return result;
 }
 
 int32_t TXMLProtocol::readListEnd() {
-  std::string str;
-  return readXMLTag(str, true);
+  return readXMLEndTag();
 }
 
 int32_t TXMLProtocol::readSetBegin(TType& elemType,
                                    uint32_t& size) {
   int32_t result = 0, ret;
-  std::string str;
-  if ((ret = readXMLTag(str)) < 0) {
+  if ((ret = readXMLTag(tag_)) < 0) {
     LOG(ERROR, __func__ << ": FAILED");
     return ret;
   }
   result += ret;
-  boost::char_separator<char> sep("=\" ");
-  tokenizer tokens(str, sep);
+  const char* p = tag_.data();
+  const char* end = p + tag_.length();
+  const char* tok = p;
+  size_t len = 0;
   // Extract the field name
-  tokenizer::iterator it = tokens.begin();
-  if (*it != kTypeNameSet) {
+  if (!nextXMLTagToken(p, end, &tok, &len) ||
+      !isXMLTagToken(tok, len, kTypeNameSet)) {
     LOG(ERROR, __func__ << ": Expected \"" << kTypeNameSet <<
-        "\"; got \"" << *it << "\"");
+        "\"; got \"" << std::string(tok, len) << "\"");
     return -1;
   }
-  ++it;
-  for (; it != tokens.end(); ++it) {
-    if (*it == kXMLType) {
-      ++it;
-      elemType = getTypeIDForTypeName(*it);
+  while (nextXMLTagToken(p, end, &tok, &len)) {
+    if (isXMLTagToken(tok, len, kXMLType) &&
+        nextXMLTagToken(p, end, &tok, &len)) {
+      elemType = getTypeIDForTypeName(tok, len);
     }
-    if (*it == kXMLSize) {
-      ++it;
-      stringToInteger(*it, size);
+    if (isXMLTagToken(tok, len, kXMLSize) &&
+        nextXMLTagToken(p, end, &tok, &len)) {
+      xmlParseInteger(tok, tok + len, size);
     }
   }
   return result;
 }
 
 int32_t TXMLProtocol::readSetEnd() {
-  std::string str;
-  return readXMLTag(str, true);
+  return readXMLEndTag();
 }
 
 int32_t TXMLProtocol::readI16(int16_t& i16) {
@@ -1134,19 +1342,18 @@ int32_t TXMLProtocol::readString(std::string &str) {
 }
 
 int32_t TXMLProtocol::readBool(bool& value) {
-  std::string str;
   int32_t result = 0, ret;
-  if ((ret = readXMLString(str)) < 0) {
+  if ((ret = readXMLString(tag_)) < 0) {
     return ret;
   }
   result += ret;
-  if (str == kXMLBoolTrue) {
+  if (tag_ == kXMLBoolTrue) {
     value = true;
-  } else if (str == kXMLBoolFalse) {
+  } else if (tag_ == kXMLBoolFalse) {
     value = false;
   } else {
     LOG(ERROR, __func__ << ": Expected \"" << kXMLBoolTrue <<
-        "\" or \"" << kXMLBoolFalse << "\"; got \"" << str << "\"");
+        "\" or \"" << kXMLBoolFalse << "\"; got \"" << tag_ << "\"");
   }
   return result;
 }
@@ -7,6 +7,7 @@
 
 #include <string.h>
 #include "TVirtualProtocol.h"
+#include "TXMLEscape.h"
 
 #include <boost/shared_ptr.hpp>
 #include <boost/tokenizer.hpp>
@@ -67,7 +68,8 @@ class TXMLProtocol : public TVirtualProtocol<TXMLProtocol> {
   }
 
   static std::string escapeXMLControlChars(const std::string& str) {
-    if (strpbrk(str.c_str(), "&'<>") != NULL) {
+    const char* end = str.data() + str.length();
+    if (xmlEscapeFind(str.data(), end) != end) {
       return escapeXMLControlCharsInternal(str);
     } else {
       return str;
@@ -75,10 +77,9 @@ class TXMLProtocol : public TVirtualProtocol<TXMLProtocol> {
   }
 
   static void unescapeXMLControlChars(std::string& str) {
-      boost::replace_all(str, "&amp;", "&");
-      boost::replace_all(str, "&apos;", "\'");
-      boost::replace_all(str, "&lt;", "<");
-      boost::replace_all(str, "&gt;", ">");
+    if (!str.empty()) {
+      str.resize(xmlUnescape(&str[0], str.length()));
+    }
   }
 
   /**
@@ -110,6 +111,17 @@ class TXMLProtocol : public TVirtualProtocol<TXMLProtocol> {
 
   int32_t writeFieldEnd();
 
+  /**
+   * Used by generated writers: btag is the complete start tag of the
+   * field and etag its end tag, both formed at compile time, so the
+   * output is the same as writeFieldBegin/writeFieldEnd without
+   * building the tags per message.
+   */
+  int32_t writeFieldBeginTag(const char* btag, uint32_t blen,
+                             const TType fieldType);
+
+  int32_t writeFieldEndTag(const char* etag, uint32_t elen);
+
   int32_t writeFieldStop();
 
   int32_t writeMapBegin(const TType keyType,
@@ -285,6 +297,20 @@ class TXMLProtocol : public TVirtualProtocol<TXMLProtocol> {
       return first ? data2_[0] : data2_[1];
     }
 
+    // Returns the unread bytes of the transport buffer, at least *len of
+    // them, if the transport exposes its buffer and no lookahead byte is
+    // pending; NULL otherwise. The bytes used must be consumed
+    const char* borrow(uint32_t* len) {
+      if (hasData_ || has2Data_) {
+        return NULL;
+      }
+      return reinterpret_cast<const char*>(trans_->borrow(NULL, len));
+    }
+
+    void consume(uint32_t len) {
+      trans_->consume(len);
+    }
+
    private:
     TTransport *trans_;
     bool hasData_;
@@ -295,16 +321,15 @@ class TXMLProtocol : public TVirtualProtocol<TXMLProtocol> {
   };
 
  private:
-  typedef boost::tokenizer<boost::char_separator<char> >
-      tokenizer;
-
   int32_t readXMLSyntaxChar(uint8_t ch);
 
   int32_t readXMLSyntaxString(const std::string &str);
 
   int32_t readXMLString(std::string &str);
 
-  int32_t readXMLTag(std::string &str, bool endTag = false);
+  int32_t readXMLTag(std::string &str);
+
+  int32_t readXMLEndTag();
 
   int32_t readXMLNumericChars(std::string &str);
 
@@ -320,10 +345,15 @@ class TXMLProtocol : public TVirtualProtocol<TXMLProtocol> {
   void indentUp();
   void indentDown();
   int32_t writePlain(const std::string& str);
+  int32_t writePlain(const char* str, uint32_t len);
+  template <typename NumberType>
+  int32_t writeXMLInteger(NumberType num);
   int32_t writeIndented(const std::string& str);
+  int32_t writeIndented(const char* str, uint32_t len);
+  int32_t pushFieldState(const TType fieldType);
 
   static const std::string& fieldTypeName(TType type);
-  static TType getTypeIDForTypeName(const std::string &name);
+  static TType getTypeIDForTypeName(const char* name, size_t len);
 
   TTransport* trans_;
 
@@ -338,8 +368,28 @@ class TXMLProtocol : public TVirtualProtocol<TXMLProtocol> {
 
   std::vector<std::string> xml_state_;
   LookaheadReader reader_;
+  // Scratch buffer for the tags decoded by the read functions
+  std::string tag_;
 };
 
+/**
+ * Used by generated code to take the XML only paths. Resolved at compile
+ * time when the protocol type is known, checked at runtime for TProtocol.
+ */
+inline TXMLProtocol* toXMLProtocol(TXMLProtocol* prot) {
+  return prot;
+}
+
+inline TXMLProtocol* toXMLProtocol(TProtocol* prot) {
+  return dynamic_cast<TXMLProtocol*>(prot);
+}
+
+template <class Protocol_>
+inline TXMLProtocol* toXMLProtocol(Protocol_* prot) {
+  (void) prot;
+  return NULL;
+}
+
 /**
  * Constructs XML protocol handlers
  */
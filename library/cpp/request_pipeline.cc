@@ -11,7 +11,8 @@
 //   It contains multiple stages inside it.
 //
 // - The StageImpl class hold a given stage of the Pipeline
-//   It contains multiple instances inside it.
+//   It contains multiple instances inside it. In chunked mode, it also
+//   hands out the stage's chunks to whichever instance asks next.
 //
 // - The StageWorker class is a Task which runs the Client's callback functions
 //
@@ -42,7 +43,7 @@ public:
     
     const StageData* GetStageData(int stage) const;
 
-    bool RunInstance(int instNum);
+    bool RunInstance(int instNum, int *chunk);
 
     void DoneInstance(void);
     
@@ -70,18 +71,28 @@ public:
         return (prev == 1 ? true : false);
     }
 
+    // Claim the next unprocessed chunk of a chunked stage.
+    // Returns -1 when all chunks have been claimed.
+    int NextChunk() {
+        int chunk = nextChunk_.fetch_and_increment();
+        return (chunk < chunks_ ? chunk : -1);
+    }
+
     StageData data_;
     tbb::atomic<int> remainingInst_;
+    tbb::atomic<int> nextChunk_;
+    const int chunks_;
 };
 
 class RequestPipeline::StageWorker : public Task {
 public:
     StageWorker(PipeImpl& pImpl, int taskId, int instId, int instNum) :
-        Task(taskId, instId) , pImpl_(pImpl), instNum_(instNum) {}
+        Task(taskId, instId) , pImpl_(pImpl), instNum_(instNum),
+        chunk_(-1) {}
 
     virtual bool Run() {
        
-        if (!pImpl_.RunInstance(instNum_)) return false;
+        if (!pImpl_.RunInstance(instNum_, &chunk_)) return false;
 
         pImpl_.DoneInstance();
 
@@ -91,6 +102,8 @@ public:
 private:
     PipeImpl& pImpl_;
     const int instNum_;
+    // Chunk currently being processed, when the stage is chunked
+    int chunk_;
 };
 
 tbb::mutex  RequestPipeline::PipeImpl::mutex_;
@@ -179,14 +192,32 @@ RequestPipeline::PipeImpl::DoneInstance(void) {
 // The StageWorker calls this function to drive execution
 // of the client callback function.
 //
+// For a chunked stage, the instance works on one chunk at a time. Once
+// the callback completes a chunk, the instance claims the next free chunk
+// and yields, so that it is picked up again on its next run.
+//
 // Returns true if this instance's execution is complete
 //         false if the callback needs to be scheduled again.
 bool
-RequestPipeline::PipeImpl::RunInstance(int instNum) {
+RequestPipeline::PipeImpl::RunInstance(int instNum, int *chunk) {
     const StageSpec &ss = spec_.stages_[currentStage_];
-    return ss.cbFn_(spec_.snhRequest_.get(), spec_,
-                currentStage_, instNum, (ss.allocFn_.empty() ?
-                    NULL : &(stageImpls_[currentStage_].data_[instNum])));
+    StageImpl &si = stageImpls_[currentStage_];
+    if (!ss.chunks_) {
+        return ss.cbFn_(spec_.snhRequest_.get(), spec_,
+                    currentStage_, instNum, (ss.allocFn_.empty() ?
+                        NULL : &(si.data_[instNum])));
+    }
+    if (*chunk < 0) {
+        *chunk = si.NextChunk();
+        if (*chunk < 0) return true;
+    }
+    if (!ss.cbFn_(spec_.snhRequest_.get(), spec_,
+            currentStage_, *chunk, (ss.allocFn_.empty() ?
+                NULL : &(si.data_[*chunk])))) {
+        return false;
+    }
+    *chunk = si.NextChunk();
+    return (*chunk < 0);
 }
 
 // This function allows the client callback function to look into
@@ -203,10 +234,14 @@ RequestPipeline::PipeImpl::GetStageData(int stage) const {
 
 // Contructor for StageImpl
 // Creates the StageWorker for each Instance of this Stage
-// Also Creates the Client Data for each Instance.
-RequestPipeline::StageImpl::StageImpl(const StageSpec& spec, int stage) {
+// Also Creates the Client Data for each Instance, or for each
+// chunk if this is a chunked stage.
+RequestPipeline::StageImpl::StageImpl(const StageSpec& spec, int stage) :
+        chunks_(spec.chunks_) {
     remainingInst_ = spec.instances_.size(); 
-    for (int i=0; i<remainingInst_; i++) {
+    nextChunk_ = 0;
+    int ndata = (chunks_ ? chunks_ : static_cast<int>(remainingInst_));
+    for (int i=0; i<ndata; i++) {
         if (!spec.allocFn_.empty()) data_.push_back(spec.allocFn_(stage));
     }
 }
@@ -51,11 +51,29 @@ public:
     // callback and an allocator function for allocating InstData
     // If the allocator function is not provided, NULL will be passed
     // back in the callback function for that stage
+    //
+    // If chunks_ is non-zero, the stage runs in chunked mode: the work is
+    // split into chunks_ pieces, and the launched instances pick up the
+    // next unclaimed chunk whenever they finish one, so a large chunk does
+    // not hold back the other instances. The callback is then invoked with
+    // the chunk number in place of instNum, InstData is allocated per chunk,
+    // and later stages see the StageData in chunk order.
+    //
+    // The number of chunks is 0 unless it is set, also when the StageSpec
+    // is brace-initialized without it, as StageSpec stays an aggregate.
+    class Chunks {
+    public:
+        Chunks(int chunks = 0) : chunks_(chunks) {}
+        operator int() const { return chunks_; }
+    private:
+        int chunks_;
+    };
     struct StageSpec {
         int taskId_;
         std::vector<int> instances_;
         CallbackFunc cbFn_;
         DataFactory allocFn_;
+        Chunks chunks_;
     };
     // The pipespec is used to pass in the stages, and
     // also has an interface (GetStageData) that the callback can use to
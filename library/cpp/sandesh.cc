@@ -20,6 +20,7 @@
 #include <sandesh/transport/TSimpleFileTransport.h>
 #include <sandesh/protocol/TBinaryProtocol.h>
 #include <sandesh/protocol/TProtocol.h>
+#include <sandesh/protocol/TXMLProtocol.h>
 
 #include <sandesh/sandesh_types.h>
 #include <sandesh/sandesh.h>
@@ -39,6 +40,8 @@ using boost::asio::ip::address;
 using namespace contrail::sandesh::protocol;
 using namespace contrail::sandesh::transport;
 
+typedef TBinaryProtocolT<TMemoryBuffer> TMemoryBinaryProtocol;
+
 // Statics
 Sandesh::SandeshRole::type Sandesh::role_ = SandeshRole::Invalid;
 bool Sandesh::enable_local_log_ = false;
@@ -152,6 +155,14 @@ bool Sandesh::Initialize(SandeshRole::type role,
     event_manager_  = evm;
 
     set_send_rate_limit(config.system_logs_rate_limit);
+    SandeshUVETypeMaps::set_full_refresh_interval(
+        config.uve_full_refresh_interval);
+    if (role == SandeshRole::Generator && !config.uve_snapshot_file.empty()) {
+        uint32_t restored(SandeshUVETypeMaps::ReadSnapshot(
+            config.uve_snapshot_file));
+        SANDESH_LOG(INFO, "SANDESH: UVE SNAPSHOT     : " <<
+            config.uve_snapshot_file << " restored " << restored);
+    }
     DisableSendingObjectLogs(config.disable_object_logs);
     InitReceive(Task::kTaskInstanceAny);
     bool success(SandeshHttp::Init(evm, module, http_port,
@@ -534,6 +545,22 @@ bool Sandesh::ProcessRecv(SandeshRequest *rsnh) {
 
 void SandeshRequest::Release() { self_.reset(); }
 
+int32_t Sandesh::Read(boost::shared_ptr<TXMLProtocol> iprot) {
+    return Read(boost::shared_ptr<TProtocol>(iprot));
+}
+
+int32_t Sandesh::Read(boost::shared_ptr<TMemoryBinaryProtocol> iprot) {
+    return Read(boost::shared_ptr<TProtocol>(iprot));
+}
+
+int32_t Sandesh::Write(boost::shared_ptr<TXMLProtocol> oprot) const {
+    return Write(boost::shared_ptr<TProtocol>(oprot));
+}
+
+int32_t Sandesh::Write(boost::shared_ptr<TMemoryBinaryProtocol> oprot) const {
+    return Write(boost::shared_ptr<TProtocol>(oprot));
+}
+
 int32_t Sandesh::WriteBinary(u_int8_t *buf, u_int32_t buf_len,
         int *error) {
     int32_t xfer;
@@ -541,8 +568,8 @@ int32_t Sandesh::WriteBinary(u_int8_t *buf, u_int32_t buf_len,
             boost::shared_ptr<TMemoryBuffer>(
                     new TMemoryBuffer(buf, buf_len));
     btrans->setWriteBuffer(buf, buf_len);
-    boost::shared_ptr<TBinaryProtocol> prot =
-            boost::shared_ptr<TBinaryProtocol>(new TBinaryProtocol(btrans));
+    boost::shared_ptr<TMemoryBinaryProtocol> prot(
+            new TMemoryBinaryProtocol(btrans));
     xfer = Write(prot);
     if (xfer < 0) {
         SANDESH_LOG(DEBUG, __func__ << "Write sandesh to " << buf_len <<
@@ -559,8 +586,8 @@ int32_t Sandesh::ReadBinary(u_int8_t *buf, u_int32_t buf_len,
     boost::shared_ptr<TMemoryBuffer> btrans =
             boost::shared_ptr<TMemoryBuffer>(
                     new TMemoryBuffer(buf, buf_len));
-    boost::shared_ptr<TBinaryProtocol> prot =
-            boost::shared_ptr<TBinaryProtocol>(new TBinaryProtocol(btrans));
+    boost::shared_ptr<TMemoryBinaryProtocol> prot(
+            new TMemoryBinaryProtocol(btrans));
     xfer = Read(prot);
     if (xfer < 0) {
         SANDESH_LOG(DEBUG, __func__ << "Read sandesh from " << buf_len <<
@@ -612,8 +639,8 @@ int32_t Sandesh::ReceiveBinaryMsgOne(u_int8_t *buf, u_int32_t buf_len,
     boost::shared_ptr<TMemoryBuffer> btrans =
             boost::shared_ptr<TMemoryBuffer>(
                     new TMemoryBuffer(buf, buf_len));
-    boost::shared_ptr<TBinaryProtocol> prot =
-            boost::shared_ptr<TBinaryProtocol>(new TBinaryProtocol(btrans));
+    boost::shared_ptr<TMemoryBinaryProtocol> prot(
+            new TMemoryBinaryProtocol(btrans));
     // Extract sandesh name
     xfer = prot->readSandeshBegin(sandesh_name);
     if (xfer < 0) {
@@ -633,7 +660,8 @@ int32_t Sandesh::ReceiveBinaryMsgOne(u_int8_t *buf, u_int32_t buf_len,
     // Reinitialize buffer and protocol
     btrans = boost::shared_ptr<TMemoryBuffer>(
                     new TMemoryBuffer(buf, buf_len));
-    prot = boost::shared_ptr<TBinaryProtocol>(new TBinaryProtocol(btrans));
+    prot = boost::shared_ptr<TMemoryBinaryProtocol>(
+            new TMemoryBinaryProtocol(btrans));
     xfer = sandesh->Read(prot);
     if (xfer < 0) {
         SANDESH_LOG(DEBUG, __func__ << " Decoding " << sandesh_name << " FAILED" <<
@@ -737,15 +765,9 @@ bool SandeshUVE::Dispatch(SandeshConnection * sconn) {
             Release();
             return false;
         }
-        // SandeshUVE has an implicit send level of SandeshLevel::SYS_UVE
-        // which is irrespective of the level set by the user in the Send.
-        // This is needed so that the send queue does not grow unbounded.
-        // Once the send queue's sending level reaches SandeshLevel::SYS_UVE
-        // we will reset the connection to the collector to initiate resync
-        // of the UVE cache
-        if (SandeshLevel::SYS_UVE >= SendingLevel()) {
-            client_->CloseSMSession();
-        }
+        // The session to each collector is reset to resync the UVE cache
+        // once its send queue reaches SandeshLevel::SYS_UVE, when the
+        // UVE is queued to it
         if (!client_->SendSandeshUVE(this)) {
             SANDESH_LOG(ERROR, "SandeshUVE : Send FAILED: " << ToString());
             UpdateTxMsgFailStats(Name(), 0,
@@ -853,6 +875,12 @@ void Sandesh::UpdateTxMsgStats(const std::string &msg_name,
     msg_stats_.UpdateSend(msg_name, bytes);
 }
 
+void Sandesh::UpdateTxMsgEncodeStats(const std::string &msg_name,
+                                     uint64_t encode_time_usec) {
+    tbb::mutex::scoped_lock lock(stats_mutex_);
+    msg_stats_.UpdateEncode(msg_name, encode_time_usec);
+}
+
 void Sandesh::UpdateTxMsgFailStats(const std::string &msg_name,
     uint64_t bytes, SandeshTxDropReason::type dreason) {
     tbb::mutex::scoped_lock lock(stats_mutex_);
@@ -880,8 +908,8 @@ void Sandesh::SetSendQueue(bool enable) {
             (enable ? "ENABLED" : "DISABLED"));
         send_queue_enabled_ = enable;
         if (enable) {
-            if (client_ && client_->IsSession()) {
-                client_->session()->send_queue()->MayBeStartRunner();
+            if (client_) {
+                client_->StartSendQueues();
             }
         } 
     }
@@ -940,10 +968,7 @@ bool Sandesh::HandleTest(SandeshLevel::type level,
 
 SandeshLevel::type Sandesh::SendingLevel() {
     if (client_) {
-        SandeshSession *sess = client_->session();
-        if (sess) {
-            return sess->SendingLevel();
-        }
+        return client_->SendingLevel();
     }
     return SandeshLevel::INVALID;
 }
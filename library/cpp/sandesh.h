@@ -85,6 +85,7 @@
 #include <boost/ptr_container/ptr_map.hpp>
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/tuple/tuple.hpp>
+#include <tbb/atomic.h>
 #include <base/contrail_ports.h>
 #include <base/logging.h>
 #include <base/queue_task.h>
@@ -102,6 +103,11 @@ class EventManager;
 class SandeshClient;
 class SandeshSession;
 
+namespace contrail { namespace sandesh { namespace protocol {
+class TXMLProtocol;
+template <class Transport_> class TBinaryProtocolT;
+}}}
+
 // Sandesh Context
 class SandeshContext {
     // Abstract base class for users of sandesh library to
@@ -251,6 +257,8 @@ public:
     static void UpdateRxMsgFailStats(const std::string &msg_name,
         uint64_t bytes, SandeshRxDropReason::type dreason);
     static void UpdateTxMsgStats(const std::string &msg_name, uint64_t bytes);
+    static void UpdateTxMsgEncodeStats(const std::string &msg_name,
+        uint64_t encode_time_usec);
     static void UpdateTxMsgFailStats(const std::string &msg_name,
         uint64_t bytes, SandeshTxDropReason::type dreason);
     static void GetMsgStats(
@@ -270,6 +278,18 @@ public:
              boost::shared_ptr<contrail::sandesh::protocol::TProtocol> iprot) = 0;
     virtual int32_t Write(
              boost::shared_ptr<contrail::sandesh::protocol::TProtocol> oprot) const = 0;
+    // Generated sandesh override these to encode/decode with the
+    // protocol known at compile time
+    virtual int32_t Read(
+             boost::shared_ptr<contrail::sandesh::protocol::TXMLProtocol> iprot);
+    virtual int32_t Read(
+             boost::shared_ptr<contrail::sandesh::protocol::TBinaryProtocolT<
+                 contrail::sandesh::transport::TMemoryBuffer> > iprot);
+    virtual int32_t Write(
+             boost::shared_ptr<contrail::sandesh::protocol::TXMLProtocol> oprot) const;
+    virtual int32_t Write(
+             boost::shared_ptr<contrail::sandesh::protocol::TBinaryProtocolT<
+                 contrail::sandesh::transport::TMemoryBuffer> > oprot) const;
     virtual const uint32_t seqnum() { return seqnum_; }
     virtual const int32_t versionsig() const = 0;
     virtual const char *Name() const { return name_.c_str(); }
@@ -425,12 +445,45 @@ private:
     static tbb::atomic<uint32_t> sandesh_send_ratelimit_;
 };
 
+// A sandesh encoded once, in its envelope, to be queued to more than one
+// session. The buffer is not written to once encoded
+struct SandeshEncodedMessage {
+    SandeshEncodedMessage(const std::string &name, SandeshType::type type,
+            SandeshLevel::type level,
+            boost::shared_ptr<contrail::sandesh::transport::TMemoryBuffer>
+                buffer, size_t size) :
+        name_(name), type_(type), level_(level), buffer_(buffer),
+        size_(size) {
+        sent_ = false;
+    }
+    // Whether this is the first session to send the message, which is
+    // then counted as sent once however many collectors it is sent to
+    bool FirstSend() const {
+        return !sent_.fetch_and_store(true);
+    }
+    const std::string name_;
+    const SandeshType::type type_;
+    const SandeshLevel::type level_;
+    const boost::shared_ptr<contrail::sandesh::transport::TMemoryBuffer>
+        buffer_;
+    const size_t size_;
+private:
+    mutable tbb::atomic<bool> sent_;
+};
+
+typedef boost::shared_ptr<const SandeshEncodedMessage> SandeshEncodedMessagePtr;
+
 struct SandeshElement {
     Sandesh *snh_;
+    // Set instead of snh_ when the sandesh is already encoded
+    SandeshEncodedMessagePtr encoded_;
     //Explicit constructor creating only if Sandesh is passed as arg
     explicit SandeshElement(Sandesh *snh):snh_(snh),size_(snh->GetSize()) {
     }
-    SandeshElement():size_(0) { }
+    explicit SandeshElement(SandeshEncodedMessagePtr encoded) :
+        snh_(NULL), encoded_(encoded), size_(encoded->size_) {
+    }
+    SandeshElement():snh_(NULL),size_(0) { }
     size_t GetSize() const {
         return size_;
     }
@@ -550,15 +603,20 @@ public:
         ST_MAX = 3
     } SendType;
     virtual std::string DataLog(void) { return std::string(); }
+    // Collector that the UVE is sent to, when resynced to one collector,
+    // or -1 for all collectors
+    int collector() const { return collector_; }
 protected:
     SandeshUVE(const std::string& name, uint32_t seqno,
                SandeshType::type t = SandeshType::UVE) :
-        Sandesh(t, name, seqno), more_(false) {}
+        Sandesh(t, name, seqno), more_(false), collector_(-1) {}
     bool Dispatch(SandeshConnection * sconn = NULL);
     void set_more(const bool val) { more_=val; }
+    void set_collector(int collector) { collector_ = collector; }
   
  private:
     bool more_;
+    int collector_;
 };
 
 class SandeshAlarm : public SandeshUVE {
@@ -574,7 +632,9 @@ struct WorkQueueDelete<SandeshElement> {
         SandeshElement element;
         while (q.try_pop(element)) {
             Sandesh *sandesh(element.snh_);
-            sandesh->Release();
+            if (sandesh) {
+                sandesh->Release();
+            }
         }
     }
 };
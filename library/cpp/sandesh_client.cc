@@ -72,9 +72,36 @@ SandeshClient::SandeshClient(EventManager *evm,
         dscp_value_(0),
         collectors_(collectors),
         sm_(SandeshClientSM::CreateClientSM(evm, this, sm_task_instance_, sm_task_id_, periodicuve)),
+        encode_on_send_(config.sandesh_encode_on_send),
         session_wm_info_(kSessionWaterMarkInfo),
-        session_close_interval_msec_(0),
-        session_close_time_usec_(0) {
+        admin_up_(false),
+        snapshot_file_(config.uve_snapshot_file),
+        snapshot_interval_msec_(config.uve_snapshot_interval * 1000),
+        snapshot_reconcile_msec_(config.uve_snapshot_reconcile_time * 1000),
+        snapshot_timer_(TimerManager::CreateTimer(*evm->io_service(),
+            "Client UVE Snapshot timer", sm_task_id_, sm_task_instance_)),
+        reconcile_timer_(TimerManager::CreateTimer(*evm->io_service(),
+            "Client UVE Reconcile timer", sm_task_id_, sm_task_instance_)) {
+    for (size_t i = 1; i < config.collector_fanout; i++) {
+        FanoutMgr *mgr(new FanoutMgr(this, i));
+        fanout_mgrs_.push_back(mgr);
+        SandeshClientSM *sm(SandeshClientSM::CreateClientSM(evm, mgr,
+            sm_task_instance_, sm_task_id_, false));
+        sm->SetCollectorOffset(i);
+        fanout_sms_.push_back(sm);
+    }
+    if (encode_on_send()) {
+        for (size_t i = 0; i < session_wm_info_.size(); i++) {
+            boost::get<0>(session_wm_info_[i]) *= kEncodedSizeScale;
+        }
+    }
+    for (size_t i = 0; i < collector_fanout(); i++) {
+        resync_timers_.push_back(TimerManager::CreateTimer(*evm->io_service(),
+            "Client UVE Resync timer", sm_task_id_, sm_task_instance_));
+    }
+    session_close_interval_msec_.resize(collector_fanout(), 0);
+    session_close_time_usec_.resize(collector_fanout(), 0);
+    active_fanout_ = ActiveFanout(collectors_.size());
     // Set task policy for exclusion between state machine and session tasks since
     // session delete happens in state machine task
     if (!task_policy_set_) {
@@ -130,7 +157,16 @@ SandeshClient::SandeshClient(EventManager *evm,
     }
 }
 
-SandeshClient::~SandeshClient() {}
+SandeshClient::~SandeshClient() {
+    for (size_t i = 0; i < resync_timers_.size(); i++) {
+        resync_timers_[i]->Cancel();
+        TimerManager::DeleteTimer(resync_timers_[i]);
+    }
+    snapshot_timer_->Cancel();
+    TimerManager::DeleteTimer(snapshot_timer_);
+    reconcile_timer_->Cancel();
+    TimerManager::DeleteTimer(reconcile_timer_);
+}
 
 void SandeshClient::ReConfigCollectors(
         const std::vector<std::string>& collector_list) {
@@ -145,28 +181,200 @@ void SandeshClient::ReConfigCollectors(
         }
         collector_endpoints.push_back(ep);
     }
-    sm_->SetCollectors(collector_endpoints);
+    SetCollectors(collector_endpoints);
+}
+
+// There can be no more state machines sending than there are collectors,
+// as each would otherwise connect to a collector that another one already
+// sends to
+size_t SandeshClient::ActiveFanout(size_t collectors) const {
+    return std::min(collector_fanout(),
+        std::max(collectors, static_cast<size_t>(1)));
+}
+
+// The state machines beyond the number of collectors are kept idle, and
+// are started once there are enough collectors
+void SandeshClient::SetCollectors(const std::vector<Endpoint> &collectors) {
+    collectors_ = collectors;
+    size_t active(ActiveFanout(collectors.size()));
+    for (size_t i = 0; i < collector_fanout(); i++) {
+        SandeshClientSM *sm(StateMachine(i));
+        if (i < active) {
+            sm->SetCollectors(collectors);
+            if (admin_up_ && i >= active_fanout_) {
+                sm->SetAdminState(false);
+            }
+        } else if (admin_up_ && i < active_fanout_) {
+            sm->SetAdminState(true);
+        }
+    }
+    active_fanout_ = active;
 }
 
 void SandeshClient::Initiate() {
-    sm_->SetAdminState(false);
-    if (collectors_.size())
-        sm_->SetCollectors(collectors_);
+    admin_up_ = true;
+    for (size_t i = 0; i < active_fanout_; i++) {
+        SandeshClientSM *sm(StateMachine(i));
+        sm->SetAdminState(false);
+        if (collectors_.size())
+            sm->SetCollectors(collectors_);
+    }
+    if (snapshot_file_.empty()) {
+        return;
+    }
+    // Restored UVEs are reconciled even if the cache is not saved
+    // periodically
+    reconcile_timer_->Start(snapshot_reconcile_msec_,
+        boost::bind(&SandeshClient::ReconcileTimerExpired, this),
+        boost::bind(&SandeshClient::TimerErrorHandler, this, _1, _2));
+    if (snapshot_interval_msec_ > 0) {
+        snapshot_timer_->Start(snapshot_interval_msec_,
+            boost::bind(&SandeshClient::SnapshotTimerExpired, this),
+            boost::bind(&SandeshClient::TimerErrorHandler, this,
+                        _1, _2));
+    }
 }
 
 void SandeshClient::Shutdown() {
-    sm_->SetAdminState(true);
+    for (size_t i = 0; i < resync_timers_.size(); i++) {
+        resync_timers_[i]->Cancel();
+    }
+    snapshot_timer_->Cancel();
+    reconcile_timer_->Cancel();
+    admin_up_ = false;
+    for (size_t i = 0; i < collector_fanout(); i++) {
+        StateMachine(i)->SetAdminState(true);
+    }
 }
 
 bool SandeshClient::SendSandesh(Sandesh *snh) {
-    return sm_->SendSandesh(snh);
+    if (!encode_on_send()) {
+        return sm_->SendSandesh(snh);
+    }
+    return SendEncodedSandesh(snh);
+}
+
+// UVEs resynced to a collector are sent to that collector only
+bool SandeshClient::SendSandeshUVE(SandeshUVE *snh_uve) {
+    if (!encode_on_send()) {
+        return sm_->SendSandeshUVE(snh_uve);
+    }
+    int collector(snh_uve->collector());
+    if (collector >= 0 &&
+            static_cast<size_t>(collector) < collector_fanout()) {
+        return SendEncodedSandesh(snh_uve, StateMachine(collector));
+    }
+    return SendEncodedSandesh(snh_uve);
+}
+
+// Each session drops the messages at or above its own sending level when
+// they are queued, so only the messages that no session would send are
+// dropped by the sender
+SandeshLevel::type SandeshClient::SendingLevel() {
+    SandeshLevel::type level(SandeshLevel::SYS_UVE);
+    for (size_t i = 0; i < active_fanout_; i++) {
+        SandeshSession *sess = StateMachine(i)->session();
+        if (!sess) {
+            return SandeshLevel::INVALID;
+        }
+        level = std::max(level, sess->SendingLevel());
+    }
+    return level;
 }
 
-bool SandeshClient::ReceiveCtrlMsg(const std::string &msg,
+// Whether the level of the sandesh is granted no credits by the collector
+// of sm, or by each collector if sm is NULL, so that it is not encoded
+bool SandeshClient::FlowCreditShed(const Sandesh *snh, SandeshClientSM *sm) {
+    if (sm) {
+        SandeshSession *sess = sm->session();
+        return sess && sess->FlowCreditShed(snh->type(), snh->level());
+    }
+    for (size_t i = 0; i < active_fanout_; i++) {
+        SandeshSession *sess = StateMachine(i)->session();
+        if (!sess || !sess->FlowCreditShed(snh->type(), snh->level())) {
+            return false;
+        }
+    }
+    return active_fanout_ != 0;
+}
+
+// Encode the sandesh once, in the caller's context, and queue the encoded
+// message to the state machine sm, or to that of each collector if sm is
+// NULL. The send queues then hold the exact size of the message
+bool SandeshClient::SendEncodedSandesh(Sandesh *snh, SandeshClientSM *sm) {
+    if (FlowCreditShed(snh, sm)) {
+        Sandesh::UpdateTxMsgFailStats(snh->Name(), 0,
+            SandeshTxDropReason::NoCredits);
+        snh->Release();
+        return true;
+    }
+    SandeshTxDropReason::type reason;
+    uint64_t encode_start_usec(ClockMonotonicUsec());
+    boost::shared_ptr<TMemoryBuffer> buffer(
+        SandeshWriter::Encode(snh, &reason));
+    if (!buffer) {
+        Sandesh::UpdateTxMsgFailStats(snh->Name(), 0, reason);
+        snh->Release();
+        return true;
+    }
+    Sandesh::UpdateTxMsgEncodeStats(snh->Name(),
+        ClockMonotonicUsec() - encode_start_usec);
+    if (snh->IsLoggingAllowed()) {
+        snh->Log();
+    }
+    SandeshEncodedMessagePtr msg(new SandeshEncodedMessage(snh->Name(),
+        snh->type(), snh->level(), buffer, buffer->available_read()));
+    snh->Release();
+    if (sm) {
+        return sm->SendEncodedSandesh(msg);
+    }
+    for (size_t i = 0; i < active_fanout_; i++) {
+        StateMachine(i)->SendEncodedSandesh(msg);
+    }
+    return true;
+}
+
+bool SandeshClient::ReceiveCtrlMsg(size_t index, const std::string &msg,
         const SandeshHeader &header, const std::string &sandesh_name,
         const uint32_t header_offset) {
+    SandeshClientSM *sm(StateMachine(index));
 
     Sandesh * sandesh = SandeshSession::DecodeCtrlSandesh(msg, header, sandesh_name, header_offset);
+    if (sandesh == NULL) {
+        return false;
+    }
+
+    const SandeshCtrlFlowCredit *csnh =
+        dynamic_cast<const SandeshCtrlFlowCredit *>(sandesh);
+    if (csnh) {
+        SandeshSession *sess = sm->session();
+        if (sess) {
+            sess->SetFlowCredits(csnh->get_credits());
+        }
+        sandesh->Release();
+        return true;
+    }
+
+    const SandeshCtrlAdmissionDeferred *dsnh =
+        dynamic_cast<const SandeshCtrlAdmissionDeferred *>(sandesh);
+    if (dsnh) {
+        SANDESH_LOG(DEBUG, "Received Ctrl Message : Connection with server "
+            "deferred, wait " << dsnh->get_wait_msec() << " msec");
+        sm->set_admission_wait(dsnh->get_wait_msec());
+        sandesh->Release();
+        return true;
+    }
+
+    const SandeshCtrlRetryAfter *rsnh =
+        dynamic_cast<const SandeshCtrlRetryAfter *>(sandesh);
+    if (rsnh) {
+        SANDESH_LOG(INFO, "Received Ctrl Message : Connection with server "
+            "deferred, retry after " << rsnh->get_retry_after_msec() <<
+            " msec");
+        sm->set_retry_after(rsnh->get_retry_after_msec());
+        sandesh->Release();
+        return false;
+    }
 
     const SandeshCtrlServerToClient * snh = dynamic_cast<const SandeshCtrlServerToClient *>(sandesh);
     if (!snh) {
@@ -180,28 +388,88 @@ bool SandeshClient::ReceiveCtrlMsg(const std::string &msg,
         return false;
     }
     SANDESH_LOG(DEBUG, "Received Ctrl Message with size " << snh->get_type_info().size());
+    if (snh->__isset.load) {
+        sm->SetCollectorLoad(snh->get_load());
+    }
 
     map<string,uint32_t> sMap;
     const vector<UVETypeInfo> & vu = snh->get_type_info();
     for(uint32_t i = 0; i < vu.size(); i++) {
         sMap.insert(std::make_pair(vu[i].get_type_name(), vu[i].get_seq_num()));
     }
-    SandeshUVETypeMaps::SyncAllMaps(sMap);
+    // Send the first slice right away, and pace the rest so that the
+    // send queue does not hit its watermarks and close the session
+    SandeshUVETypeMaps::ResyncStart(sMap, index);
+    if (!ResyncStep(index)) {
+        Timer *resync_timer(resync_timers_[index]);
+        resync_timer->Cancel();
+        resync_timer->Start(kResyncIntervalMSec,
+            boost::bind(&SandeshClient::ResyncTimerExpired, this, index),
+            boost::bind(&SandeshClient::TimerErrorHandler, this,
+                        _1, _2));
+    }
 
     sandesh->Release();
     return true;
 }
 
+size_t SandeshClient::ResyncSendQueueLimit() const {
+    return encode_on_send() ? kResyncSendQueueLimit * kEncodedSizeScale :
+        kResyncSendQueueLimit;
+}
+
+// Each collector is resynced with the seqnos it has received, so the
+// UVEs sent by the slice go to that collector only
+bool SandeshClient::ResyncStep(size_t index) {
+    return SandeshUVETypeMaps::ResyncStep(kResyncBudget, index);
+}
+
+bool SandeshClient::ResyncTimerExpired(size_t index) {
+    SandeshSession *sess = StateMachine(index)->session();
+    // The resync is restarted on the next connect
+    if (!sess) return false;
+    if (sess->send_queue()->Length() >= ResyncSendQueueLimit()) {
+        SandeshUVETypeMaps::ResyncDefer(index);
+        return true;
+    }
+    return !ResyncStep(index);
+}
+
+bool SandeshClient::SnapshotTimerExpired() {
+    SandeshUVETypeMaps::WriteSnapshot(snapshot_file_);
+    return true;
+}
+
+bool SandeshClient::ReconcileTimerExpired() {
+    // Restored UVEs that the application has not published again by
+    // now are gone
+    uint32_t count = SandeshUVETypeMaps::ExpireRestored();
+    SANDESH_LOG(INFO, "Expired " << count << " restored UVEs");
+    return false;
+}
+
+void SandeshClient::TimerErrorHandler(std::string name,
+                                            std::string error) {
+    SANDESH_LOG(ERROR, name + " error: " + error);
+}
+
 
 bool SandeshClient::ReceiveMsg(const std::string& msg,
         const SandeshHeader &header, const std::string &sandesh_name,
         const uint32_t header_offset) {
+    return ReceiveMsg(0, msg, header, sandesh_name, header_offset);
+}
+
+bool SandeshClient::ReceiveMsg(size_t index, const std::string& msg,
+        const SandeshHeader &header, const std::string &sandesh_name,
+        const uint32_t header_offset) {
 
     namespace sandesh_prot = contrail::sandesh::protocol;
     namespace sandesh_trans = contrail::sandesh::transport;
 
     if (header.get_Hints() & g_sandesh_constants.SANDESH_CONTROL_HINT) {
-        bool success = ReceiveCtrlMsg(msg, header, sandesh_name, header_offset);
+        bool success = ReceiveCtrlMsg(index, msg, header, sandesh_name,
+            header_offset);
         if (success) {
             Sandesh::UpdateRxMsgStats(sandesh_name, msg.size());
         } else {
@@ -246,6 +514,15 @@ SandeshCtrlServerToClient::HandleRequest() const { }
 void
 SandeshCtrlClientToServer::HandleRequest() const { }
 
+void
+SandeshCtrlFlowCredit::HandleRequest() const { }
+
+void
+SandeshCtrlRetryAfter::HandleRequest() const { }
+
+void
+SandeshCtrlAdmissionDeferred::HandleRequest() const { }
+
 
 SandeshSession *SandeshClient::CreateSMSession(
         TcpSession::EventObserver eocb,
@@ -285,6 +562,11 @@ SandeshSession *SandeshClient::CreateSMSession(
 }
 
 void SandeshClient::InitializeSMSession(int count) {
+    InitializeSMSession(0, count);
+}
+
+// The control message is sent to the collector being connected to only
+void SandeshClient::InitializeSMSession(size_t index, int count) {
     std::vector<string> stv;
 
     SandeshUVETypeMaps::uve_global_map::const_iterator it =
@@ -296,14 +578,22 @@ void SandeshClient::InitializeSMSession(int count) {
         Sandesh::module() << ":" << Sandesh::instance_id() << ":" <<
         Sandesh::node_type() << " count " << count);
 
-    SandeshCtrlClientToServer::Request(Sandesh::source(), Sandesh::module(),
-            count, stv, getpid(), Sandesh::http_port(),
-            Sandesh::node_type(), Sandesh::instance_id(), "ctrl");
-
+    SandeshCtrlClientToServer *snh = new SandeshCtrlClientToServer();
+    snh->set_source(Sandesh::source());
+    snh->set_module_name(Sandesh::module());
+    snh->set_sucessful_connections(count);
+    snh->set_uve_types(stv);
+    snh->set_pid(getpid());
+    snh->set_http_port(Sandesh::http_port());
+    snh->set_node_type_name(Sandesh::node_type());
+    snh->set_instance_id_name(Sandesh::instance_id());
+    snh->set_context("ctrl");
+    snh->set_hints(g_sandesh_constants.SANDESH_CONTROL_HINT);
+    StateMachine(index)->SendSandesh(snh);
 }
 
-bool SandeshClient::CloseSMSessionInternal() {
-    SandeshSession *session(sm_->session());
+bool SandeshClient::CloseSMSessionInternal(size_t index) {
+    SandeshSession *session(StateMachine(index)->session());
     if (session) {
         session->EnqueueClose();
         return true;
@@ -354,14 +644,35 @@ bool DoCloseSMSession(uint64_t now_usec, uint64_t last_close_usec,
 }
 
 bool SandeshClient::CloseSMSession() {
+    return CloseSMSession(0);
+}
+
+bool SandeshClient::CollectorInUse(const Endpoint &collector) {
+    return CollectorInUse(0, collector);
+}
+
+// Whether a state machine other than the one at index sends to the
+// collector. The idle state machines beyond the number of collectors
+// keep their last collector, and are not counted
+bool SandeshClient::CollectorInUse(size_t index, const Endpoint &collector) {
+    for (size_t i = 0; i < active_fanout_; i++) {
+        if (i != index && StateMachine(i)->server() == collector) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The close of each session is backed off on its own
+bool SandeshClient::CloseSMSession(size_t index) {
     uint64_t now_usec(UTCTimestampUsec());
     int close_interval_msec(0);
-    bool close(DoCloseSMSession(now_usec, session_close_time_usec_,
-        session_close_interval_msec_ * 1000, &close_interval_msec));
+    bool close(DoCloseSMSession(now_usec, session_close_time_usec_[index],
+        session_close_interval_msec_[index] * 1000, &close_interval_msec));
     if (close) {
-        session_close_time_usec_ = now_usec;
-        session_close_interval_msec_ = close_interval_msec;
-        return CloseSMSessionInternal();
+        session_close_time_usec_[index] = now_usec;
+        session_close_interval_msec_[index] = close_interval_msec;
+        return CloseSMSessionInternal(index);
     }
     return false;
 }
@@ -439,6 +750,8 @@ void SandeshClient::SendUVE(int count,
              magg_stats.get_messages_sent_dropped_sending_disabled()));
     csev.insert(make_pair("dropped_sending_to_syslog",
              magg_stats.get_messages_sent_dropped_sending_to_syslog()));
+    csev.insert(make_pair("dropped_no_credits",
+             magg_stats.get_messages_sent_dropped_no_credits()));
     mcs.set_tx_msg_agg(csev);
 
     map <string,SandeshMessageStats> csevm;
@@ -473,6 +786,8 @@ void SandeshClient::SendUVE(int count,
             src_sms.get_messages_sent_dropped_sending_disabled());
         res_sms.set_messages_sent_dropped_sending_to_syslog(
             src_sms.get_messages_sent_dropped_sending_to_syslog());
+        res_sms.set_messages_sent_dropped_no_credits(
+            src_sms.get_messages_sent_dropped_no_credits());
         csevm.insert(make_pair(smit->get_message_type(), res_sms));
     }
     mcs.set_msg_type_agg(csevm);
@@ -480,19 +795,24 @@ void SandeshClient::SendUVE(int count,
     SandeshModuleClientTrace::Send(mcs);
 }
 
+// The watermarks apply to the send queue of each session on its own
 void SandeshClient::SetSessionWaterMarkInfo(
     Sandesh::QueueWaterMarkInfo &scwm) {
-    SandeshSession *session = sm_->session();
-    if (session) {
-        session->SetSendQueueWaterMark(scwm);
+    for (size_t i = 0; i < collector_fanout(); i++) {
+        SandeshSession *session = StateMachine(i)->session();
+        if (session) {
+            session->SetSendQueueWaterMark(scwm);
+        }
     }
     session_wm_info_.push_back(scwm);
 }
 
 void SandeshClient::ResetSessionWaterMarkInfo() {
-    SandeshSession *session = sm_->session();
-    if (session) {
-        session->ResetSendQueueWaterMark();
+    for (size_t i = 0; i < collector_fanout(); i++) {
+        SandeshSession *session = StateMachine(i)->session();
+        if (session) {
+            session->ResetSendQueueWaterMark();
+        }
     }
     session_wm_info_.clear();
 }    
@@ -513,9 +833,21 @@ void SandeshClient::SetDscpValue(uint8_t value) {
         return;
 
     dscp_value_ = value;
-    SandeshSession *sess = session();
-    if (sess) {
-        sess->SetDscpSocketOption(value);
+    for (size_t i = 0; i < collector_fanout(); i++) {
+        SandeshSession *sess = StateMachine(i)->session();
+        if (sess) {
+            sess->SetDscpSocketOption(value);
+        }
     }
 
 }
+
+// Called when the send queue is enabled again
+void SandeshClient::StartSendQueues() {
+    for (size_t i = 0; i < collector_fanout(); i++) {
+        SandeshSession *sess = StateMachine(i)->session();
+        if (sess) {
+            sess->send_queue()->MayBeStartRunner();
+        }
+    }
+}
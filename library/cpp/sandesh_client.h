@@ -16,6 +16,7 @@
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <boost/ptr_container/ptr_map.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
 #include <boost/tuple/tuple.hpp>
 
 #include <tbb/mutex.h>
@@ -42,6 +43,19 @@ class SandeshClient : public SslServer, public SandeshClientSM::Mgr {
 public:
     static const int kInitialSMSessionCloseIntervalMSec = 10 * 1000;
     static const int kMaxSMSessionCloseIntervalMSec = 60 * 1000;
+    // UVE resync after a (re)connect is done in slices of kResyncBudget
+    // UVEs, every kResyncIntervalMSec, as long as the send queue is
+    // below kResyncSendQueueLimit bytes
+    static const int kResyncIntervalMSec = 10;
+    static const uint32_t kResyncBudget = 1000;
+    static const size_t kResyncSendQueueLimit = 1 * 1024 * 1024;
+    // The send queue holds the encoded size of the messages when they are
+    // encoded by the sender, which includes the XML markup that the size
+    // of a sandesh does not. The default watermarks and the resync limit
+    // are then scaled up by kEncodedSizeScale, so that they do not trip
+    // earlier for the same messages. Watermarks set through introspect
+    // are used as they are
+    static const size_t kEncodedSizeScale = 2;
     
     SandeshClient(EventManager *evm, const std::vector<Endpoint> &collectors,
              const SandeshConfig &config,
@@ -61,7 +75,9 @@ public:
     void DeleteSMSession(SandeshSession * session) {
         DeleteSession(session);
     } 
+    // Closes the session of the first collector
     bool CloseSMSession();
+    bool CollectorInUse(const Endpoint &collector);
     bool ReceiveMsg(const std::string& msg,
         const SandeshHeader &header, const std::string &sandesh_name,
         const uint32_t header_offset);
@@ -70,11 +86,10 @@ public:
         const Endpoint & server_ip, const std::vector<Endpoint> & collector_eps);
 
     bool SendSandesh(Sandesh *snh);
+    bool SendSandeshUVE(SandeshUVE *snh_uve);
+    // Messages at or above this level are not sent to any collector
+    SandeshLevel::type SendingLevel();
 
-    bool SendSandeshUVE(Sandesh *snh_uve) {
-        return sm_->SendSandeshUVE(snh_uve);
-    }
-    
     SandeshClientSM::State state() {
         return sm_->state();
     }
@@ -92,7 +107,31 @@ public:
         return sm_.get();
     }
 
+    // State machine of the collector at index, below collector_fanout()
+    SandeshClientSM *state_machine(size_t index) {
+        return StateMachine(index);
+    }
+
+    // Number of state machines, one for each collector that messages
+    // can be sent to
+    size_t collector_fanout() const {
+        return 1 + fanout_sms_.size();
+    }
+
+    // Number of collectors each message is sent to, which is at most
+    // the number of collectors configured
+    size_t active_fanout() const {
+        return active_fanout_;
+    }
+
+    // Whether messages are encoded by the sender, and queued encoded
+    bool encode_on_send() const {
+        return encode_on_send_ || !fanout_sms_.empty();
+    }
+
     void SetDscpValue(uint8_t value);
+    // Runs the send queue of the session to each collector
+    void StartSendQueues();
 
     void SetSessionWaterMarkInfo(Sandesh::QueueWaterMarkInfo &scwm);
     void ResetSessionWaterMarkInfo();
@@ -100,19 +139,61 @@ public:
         std::vector<Sandesh::QueueWaterMarkInfo> &scwm_info) const;
     void ReConfigCollectors(const std::vector<std::string>&);
 
-    int session_close_interval_msec() const {
-        return session_close_interval_msec_;
+    int session_close_interval_msec(size_t index = 0) const {
+        return session_close_interval_msec_[index];
     }
-    uint64_t session_close_time_usec() const {
-        return session_close_time_usec_;
+    uint64_t session_close_time_usec(size_t index = 0) const {
+        return session_close_time_usec_[index];
     }
 
     friend class CollectorInfoRequest;
 protected:
     virtual SslSession *AllocSession(SslSocket *socket);
-    bool CloseSMSessionInternal();
+    bool CloseSMSessionInternal(size_t index);
 
 private:
+    // Tells the client which of the state machines of the other
+    // collectors calls back
+    class FanoutMgr : public SandeshClientSM::Mgr {
+    public:
+        FanoutMgr(SandeshClient *client, size_t index) :
+            client_(client), index_(index) {
+        }
+        virtual ~FanoutMgr() {}
+        virtual bool ReceiveMsg(const std::string& msg,
+            const SandeshHeader &header, const std::string &sandesh_name,
+            const uint32_t header_offset) {
+            return client_->ReceiveMsg(index_, msg, header, sandesh_name,
+                header_offset);
+        }
+        // The generator state is sent for the first collector only
+        virtual void SendUVE(int count,
+            const std::string & stateName, const std::string & server,
+            const Endpoint & server_ip,
+            const std::vector<Endpoint> & collector_eps) {
+        }
+        virtual SandeshSession *CreateSMSession(
+            SslSession::EventObserver eocb, SandeshReceiveMsgCb rmcb,
+            TcpServer::Endpoint ep) {
+            return client_->CreateSMSession(eocb, rmcb, ep);
+        }
+        virtual void InitializeSMSession(int connects) {
+            client_->InitializeSMSession(index_, connects);
+        }
+        virtual void DeleteSMSession(SandeshSession * session) {
+            client_->DeleteSMSession(session);
+        }
+        virtual bool CloseSMSession() {
+            return client_->CloseSMSession(index_);
+        }
+        virtual bool CollectorInUse(const Endpoint &collector) {
+            return client_->CollectorInUse(index_, collector);
+        }
+    private:
+        SandeshClient *client_;
+        size_t index_;
+    };
+
     static const int kSMTaskInstance = 0;
     static const std::string kSMTask;
     static const int kSessionTaskInstance = Task::kTaskInstanceAny;
@@ -128,12 +209,51 @@ private:
     uint8_t dscp_value_;
     std::vector<Endpoint> collectors_;
     boost::scoped_ptr<SandeshClientSM> sm_;
+    // State machines of the other collectors, when each message is sent
+    // to more than one. The message is encoded once for all of them
+    boost::ptr_vector<FanoutMgr> fanout_mgrs_;
+    boost::ptr_vector<SandeshClientSM> fanout_sms_;
+    // Encode each message in the sender's context even when there is one
+    // collector, so that the send queue holds its exact encoded size
+    bool encode_on_send_;
     std::vector<Sandesh::QueueWaterMarkInfo> session_wm_info_;
     static bool task_policy_set_;
-    int session_close_interval_msec_;
-    uint64_t session_close_time_usec_;
+    // Session close backoff of each state machine
+    std::vector<int> session_close_interval_msec_;
+    std::vector<uint64_t> session_close_time_usec_;
+    // UVE resync timer of each state machine
+    std::vector<Timer *> resync_timers_;
+    // State machines beyond the number of collectors are kept idle
+    tbb::atomic<size_t> active_fanout_;
+    bool admin_up_;
+    // UVE cache snapshot, if enabled
+    std::string snapshot_file_;
+    int snapshot_interval_msec_;
+    // Time after which UVEs restored from the snapshot are expired
+    int snapshot_reconcile_msec_;
+    Timer *snapshot_timer_;
+    Timer *reconcile_timer_;
 
-    bool ReceiveCtrlMsg(const std::string &msg,
+    SandeshClientSM *StateMachine(size_t index) {
+        return index == 0 ? sm_.get() : &fanout_sms_[index - 1];
+    }
+    bool SendEncodedSandesh(Sandesh *snh, SandeshClientSM *sm = NULL);
+    bool FlowCreditShed(const Sandesh *snh, SandeshClientSM *sm);
+    size_t ActiveFanout(size_t collectors) const;
+    void SetCollectors(const std::vector<Endpoint> &collectors);
+    bool CloseSMSession(size_t index);
+    bool CollectorInUse(size_t index, const Endpoint &collector);
+    size_t ResyncSendQueueLimit() const;
+    bool ResyncStep(size_t index);
+    bool ResyncTimerExpired(size_t index);
+    void TimerErrorHandler(std::string name, std::string error);
+    bool SnapshotTimerExpired();
+    bool ReconcileTimerExpired();
+    void InitializeSMSession(size_t index, int connects);
+    bool ReceiveMsg(size_t index, const std::string& msg,
+        const SandeshHeader &header, const std::string &sandesh_name,
+        const uint32_t header_offset);
+    bool ReceiveCtrlMsg(size_t index, const std::string &msg,
         const SandeshHeader &header, const std::string &sandesh_name,
         const uint32_t header_offset);
 
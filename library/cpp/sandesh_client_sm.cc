@@ -8,8 +8,11 @@
 // Sandesh Client State Machine
 //
 
+#include <algorithm>
 #include <typeinfo>
 #include <boost/bind.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/statechart/custom_reaction.hpp>
 #include <boost/statechart/event.hpp>
@@ -169,6 +172,16 @@ struct EvSandeshSend : sc::event<EvSandeshSend> {
     Sandesh* snh;
 };
 
+struct EvSandeshEncodedSend : sc::event<EvSandeshEncodedSend> {
+    EvSandeshEncodedSend(SandeshEncodedMessagePtr msg) :
+        msg(msg) {
+    }
+    static const char * Name() {
+        return "EvSandeshEncodedSend";
+    }
+    SandeshEncodedMessagePtr msg;
+};
+
 struct EvSandeshMessageRecv : sc::event<EvSandeshMessageRecv> {
     EvSandeshMessageRecv(const std::string &msg, const SandeshHeader& header,
             const std::string &msg_type, const uint32_t &header_offset) :
@@ -203,6 +216,12 @@ struct ReleaseSandesh {
             &SandeshClientSMImpl::ReleaseSandesh<Ev> > reaction;
 };
 
+template <class Ev>
+struct ReleaseEncodedSandesh {
+    typedef sc::in_state_reaction<Ev, SandeshClientSMImpl,
+            &SandeshClientSMImpl::ReleaseEncodedSandesh<Ev> > reaction;
+};
+
 template <class Ev>
 struct DeleteTcpSession {
     typedef sc::in_state_reaction<Ev, SandeshClientSMImpl,
@@ -217,6 +236,7 @@ struct Idle : public sc::state<Idle, SandeshClientSMImpl> {
             sc::custom_reaction<EvIdleHoldTimerExpired>,
             sc::custom_reaction<EvCollectorUpdate>,
             ReleaseSandesh<EvSandeshSend>::reaction,
+            ReleaseEncodedSandesh<EvSandeshEncodedSend>::reaction,
             DeleteTcpSession<EvTcpDeleteSession>::reaction
         > reactions;
 
@@ -237,14 +257,14 @@ struct Idle : public sc::state<Idle, SandeshClientSMImpl> {
         if (state_machine->idle_hold_time()) {
             // Update connection info
             ConnectionState::GetInstance()->Update(ConnectionType::COLLECTOR,
-                std::string(), ConnectionStatus::INIT,
+                state_machine->connection_name(), ConnectionStatus::INIT,
                 state_machine->server(),
                 state_machine->StateName() + " : " + event.Name());
             state_machine->StartIdleHoldTimer();
         } else {
             // Update connection info
             ConnectionState::GetInstance()->Update(ConnectionType::COLLECTOR,
-                std::string(), ConnectionStatus::DOWN,
+                state_machine->connection_name(), ConnectionStatus::DOWN,
                 state_machine->server(),
                 state_machine->StateName() + " : " + event.Name() + 
                     " -> Disconnect");
@@ -268,7 +288,7 @@ struct Idle : public sc::state<Idle, SandeshClientSMImpl> {
         SandeshClientSMImpl *state_machine = &context<SandeshClientSMImpl>();
         // Update connection info
         ConnectionState::GetInstance()->Update(ConnectionType::COLLECTOR,
-            std::string(), ConnectionStatus::INIT,
+            state_machine->connection_name(), ConnectionStatus::INIT,
             state_machine->server(),
             state_machine->StateName() + " : " + event.Name() + " -> Connect");
         return transit<Connect>();
@@ -280,6 +300,7 @@ struct Disconnect : public sc::state<Disconnect, SandeshClientSMImpl> {
             TransitToIdle<EvStop>::reaction,
             sc::custom_reaction<EvCollectorUpdate>,
             ReleaseSandesh<EvSandeshSend>::reaction,
+            ReleaseEncodedSandesh<EvSandeshEncodedSend>::reaction,
             DeleteTcpSession<EvTcpDeleteSession>::reaction
         > reactions;
 
@@ -295,7 +316,7 @@ struct Disconnect : public sc::state<Disconnect, SandeshClientSMImpl> {
         state_machine->CollectorUpdate(event.collectors_);
         // Update connection info
         ConnectionState::GetInstance()->Update(ConnectionType::COLLECTOR,
-            std::string(), ConnectionStatus::INIT,
+            state_machine->connection_name(), ConnectionStatus::INIT,
             state_machine->server(),
             state_machine->StateName() + " : " + event.Name() +
                 " -> Connect");
@@ -312,6 +333,7 @@ struct Connect : public sc::state<Connect, SandeshClientSMImpl> {
             sc::custom_reaction<EvTcpClose>,
             sc::custom_reaction<EvCollectorUpdate>,
             ReleaseSandesh<EvSandeshSend>::reaction,
+            ReleaseEncodedSandesh<EvSandeshEncodedSend>::reaction,
             DeleteTcpSession<EvTcpDeleteSession>::reaction
         > reactions;
 
@@ -322,6 +344,7 @@ struct Connect : public sc::state<Connect, SandeshClientSMImpl> {
         state_machine->set_state(SandeshClientSM::CONNECT);
         StartSession(state_machine);
         state_machine->connect_attempts_inc();
+        state_machine->OnConnectStart();
         SM_LOG(DEBUG, state_machine->StateName() << " : " << "Start Connect timer " <<
             state_machine->server());
         state_machine->StartConnectTimer(state_machine->GetConnectTime());
@@ -353,10 +376,11 @@ struct Connect : public sc::state<Connect, SandeshClientSMImpl> {
         SM_LOG(DEBUG, state_machine->StateName() << " : " <<
                 event.Name() << " : " << "Cancelling Connect timer");
         state_machine->CancelConnectTimer();
+        state_machine->OnConnected();
         SandeshSession *session = event.session;
         // Update connection info
         ConnectionState::GetInstance()->Update(ConnectionType::COLLECTOR,
-            std::string(), ConnectionStatus::INIT, session->remote_endpoint(),
+            state_machine->connection_name(), ConnectionStatus::INIT, session->remote_endpoint(),
             state_machine->StateName() + " : " + event.Name());       
         // Start the send queue runner XXX move this to Established or later
         session->send_queue()->MayBeStartRunner();
@@ -394,10 +418,10 @@ struct Connect : public sc::state<Connect, SandeshClientSMImpl> {
         const char *event_name) {
         // Update connection info
         ConnectionState::GetInstance()->Update(ConnectionType::COLLECTOR,
-            std::string(), ConnectionStatus::DOWN,
+            state_machine->connection_name(), ConnectionStatus::DOWN,
             state_machine->session()->remote_endpoint(),
             state_machine->StateName() + " : " + event_name);       
-        state_machine->set_idle_hold_time(state_machine->GetConnectTime() * 1000);
+        state_machine->set_idle_hold_time(state_machine->GetIdleHoldTime());
         state_machine->OnIdle<EvStop>(EvStop());
         state_machine->StartIdleHoldTimer();
         return transit<Idle>();
@@ -411,6 +435,7 @@ struct ClientInit : public sc::state<ClientInit, SandeshClientSMImpl> {
         sc::custom_reaction<EvTcpClose>,
         sc::custom_reaction<EvSandeshMessageRecv>,
         sc::custom_reaction<EvSandeshSend>,
+        sc::custom_reaction<EvSandeshEncodedSend>,
         sc::custom_reaction<EvCollectorUpdate>,
         DeleteTcpSession<EvTcpDeleteSession>::reaction
     > reactions;
@@ -419,6 +444,7 @@ struct ClientInit : public sc::state<ClientInit, SandeshClientSMImpl> {
         SandeshClientSMImpl *state_machine = &context<SandeshClientSMImpl>();
         state_machine->set_state(SandeshClientSM::CLIENT_INIT);
         SM_LOG(DEBUG, state_machine->StateName());
+        state_machine->set_admission_wait(0);
         state_machine->CancelConnectTimer();
         state_machine->StartConnectTimer(state_machine->GetConnectTime());
         state_machine->GetMgr()->InitializeSMSession(state_machine->connects_inc());
@@ -454,10 +480,20 @@ struct ClientInit : public sc::state<ClientInit, SandeshClientSMImpl> {
         }
         state_machine->set_collector_name(event.header.get_Source());
 
+        // The server defers the reply to the control message, wait for as
+        // long as it asks instead of moving on to another collector
+        int admission_wait(state_machine->admission_wait());
+        if (admission_wait > 0) {
+            state_machine->set_admission_wait(0);
+            state_machine->CancelConnectTimer();
+            state_machine->StartConnectTimer((admission_wait + 999) / 1000);
+            return discard_event();
+        }
+
         if (event.header.get_Hints() & g_sandesh_constants.SANDESH_CONTROL_HINT) {
             // Update connection info
             ConnectionState::GetInstance()->Update(ConnectionType::COLLECTOR,
-                std::string(), ConnectionStatus::UP,
+                state_machine->connection_name(), ConnectionStatus::UP,
                 state_machine->session()->remote_endpoint(),
                 state_machine->StateName() + " : Control " + event.Name());       
             return transit<Established>();
@@ -488,6 +524,23 @@ struct ClientInit : public sc::state<ClientInit, SandeshClientSMImpl> {
         return discard_event();
     }
 
+    sc::result react(const EvSandeshEncodedSend &event) {
+        SandeshClientSMImpl *state_machine = &context<SandeshClientSMImpl>();
+        const SandeshEncodedMessage &msg(*event.msg);
+        SM_LOG(DEBUG, state_machine->StateName() << " : " << event.Name() <<
+            " : " << msg.name_);
+        if (msg.type_ == SandeshType::UVE || msg.type_ == SandeshType::ALARM) {
+            Sandesh::UpdateTxMsgFailStats(msg.name_, 0,
+                SandeshTxDropReason::WrongClientSMState);
+            SM_LOG(INFO, "Received UVE message in wrong state : " << msg.name_);
+            return discard_event();
+        }
+        if (!state_machine->send_session(event.msg)) {
+            SM_LOG(INFO, "Could not EnQ Sandesh :" << msg.name_);
+        }
+        return discard_event();
+    }
+
     sc::result react(const EvCollectorUpdate &event) {
         SandeshClientSMImpl *state_machine = &context<SandeshClientSMImpl>();
         if (state_machine->CollectorUpdate(event.collectors_)) {
@@ -500,12 +553,21 @@ struct ClientInit : public sc::state<ClientInit, SandeshClientSMImpl> {
         const char *event_name) {
         // Update connection info
         ConnectionState::GetInstance()->Update(ConnectionType::COLLECTOR,
-            std::string(), ConnectionStatus::DOWN,
+            state_machine->connection_name(), ConnectionStatus::DOWN,
             state_machine->session()->remote_endpoint(),
             state_machine->StateName() + " : " + event_name);
         state_machine->OnIdle<EvStop>(EvStop());
+        // Connect again only after the delay asked for by the collector,
+        // without changing the idle hold time for later disconnects
+        int idle_hold_time(state_machine->idle_hold_time());
+        int retry_after(state_machine->retry_after());
+        state_machine->set_retry_after(0);
+        if (retry_after > idle_hold_time) {
+            state_machine->set_idle_hold_time(retry_after);
+        }
         state_machine->StartIdleHoldTimer();
         SM_LOG(INFO, "Return to idle with " << state_machine->idle_hold_time()); 
+        state_machine->set_idle_hold_time(idle_hold_time);
         return transit<Idle>();
     }
 };
@@ -516,6 +578,7 @@ struct Established : public sc::state<Established, SandeshClientSMImpl> {
         sc::custom_reaction<EvTcpClose>,
         sc::custom_reaction<EvSandeshMessageRecv>,
         sc::custom_reaction<EvSandeshSend>,
+        sc::custom_reaction<EvSandeshEncodedSend>,
         sc::custom_reaction<EvCollectorUpdate>,
         DeleteTcpSession<EvTcpDeleteSession>::reaction
     > reactions;
@@ -525,9 +588,10 @@ struct Established : public sc::state<Established, SandeshClientSMImpl> {
         state_machine->set_state(SandeshClientSM::ESTABLISHED);
         SM_LOG(DEBUG, state_machine->StateName());
         state_machine->connect_attempts_clear();
+        state_machine->OnEstablished();
         // Update connection info
         ConnectionState::GetInstance()->Update(ConnectionType::COLLECTOR,
-            std::string(), ConnectionStatus::UP,
+            state_machine->connection_name(), ConnectionStatus::UP,
             state_machine->session()->remote_endpoint(),
             state_machine->StateName());
         state_machine->SendUVE();
@@ -536,6 +600,7 @@ struct Established : public sc::state<Established, SandeshClientSMImpl> {
     ~Established() {
         SandeshClientSMImpl *state_machine = &context<SandeshClientSMImpl>();
         state_machine->set_collector_name(string());
+        state_machine->OnDisconnected();
     }
 
     sc::result react(const EvTcpClose &event) {
@@ -544,7 +609,7 @@ struct Established : public sc::state<Established, SandeshClientSMImpl> {
         if (state_machine->CollectorChange()) {
             // Update connection info
             ConnectionState::GetInstance()->Update(ConnectionType::COLLECTOR,
-                std::string(), ConnectionStatus::INIT,
+                state_machine->connection_name(), ConnectionStatus::INIT,
                 state_machine->session()->remote_endpoint(),
                 state_machine->StateName() + " : " + event.Name() + 
                     " -> Connect");
@@ -576,12 +641,20 @@ struct Established : public sc::state<Established, SandeshClientSMImpl> {
         return discard_event();
     }
 
+    sc::result react(const EvSandeshEncodedSend &event) {
+        SandeshClientSMImpl *state_machine = &context<SandeshClientSMImpl>();
+        if (!state_machine->send_session(event.msg)) {
+            SM_LOG(ERROR, "Could not EnQ Sandesh :" << event.msg->name_);
+        }
+        return discard_event();
+    }
+
     sc::result react(const EvCollectorUpdate &event) {
         SandeshClientSMImpl *state_machine = &context<SandeshClientSMImpl>();
         if (state_machine->CollectorUpdate(event.collectors_)) {
             // Update connection info
             ConnectionState::GetInstance()->Update(ConnectionType::COLLECTOR,
-                std::string(), ConnectionStatus::INIT,
+                state_machine->connection_name(), ConnectionStatus::INIT,
                 state_machine->session()->remote_endpoint(),
                 state_machine->StateName() + " : " + event.Name() + 
                     " -> Connect");
@@ -595,7 +668,7 @@ struct Established : public sc::state<Established, SandeshClientSMImpl> {
         const char *event_name) {
         // Update connection info
         ConnectionState::GetInstance()->Update(ConnectionType::COLLECTOR,
-            std::string(), ConnectionStatus::DOWN,
+            state_machine->connection_name(), ConnectionStatus::DOWN,
             state_machine->session()->remote_endpoint(),
             state_machine->StateName() + " : " + event_name);
         state_machine->OnIdle<EvStop>(EvStop());
@@ -645,6 +718,14 @@ void SandeshClientSMImpl::ReleaseSandesh(const Ev &event) {
     snh->Release();
 }
 
+template <class Ev>
+void SandeshClientSMImpl::ReleaseEncodedSandesh(const Ev &event) {
+    Sandesh::UpdateTxMsgFailStats(event.msg->name_, 0,
+        SandeshTxDropReason::WrongClientSMState);
+    SM_LOG(DEBUG, "Wrong state: " << StateName() << " for event: " <<
+       event.Name() << " message: " << event.msg->name_);
+}
+
 template <class Ev>
 void SandeshClientSMImpl::DeleteTcpSession(const Ev &event) {
     GetMgr()->DeleteSMSession(event.session);
@@ -743,6 +824,36 @@ void SandeshClientSMImpl::OnSessionEvent(
     }
 }
 
+// Returns false if the message is to be dropped, as it is at or above
+// the sending level of the session, or at a level granted no credits by
+// the collector.
+// UVEs have an implicit sending level of SandeshLevel::SYS_UVE, which is
+// irrespective of the level set by the user in the Send, so that the send
+// queue does not grow unbounded. Once the sending level of the session
+// reaches SandeshLevel::SYS_UVE, the session is reset to initiate a resync
+// of the UVE cache with its collector
+bool SandeshClientSMImpl::CheckSendingLevel(const std::string &name,
+        SandeshType::type type, SandeshLevel::type level) {
+    SandeshLevel::type sending_level(session()->SendingLevel());
+    if (type == SandeshType::UVE || type == SandeshType::ALARM) {
+        if (SandeshLevel::SYS_UVE >= sending_level) {
+            mgr_->CloseSMSession();
+        }
+        return true;
+    }
+    if (SandeshSession::IsFlowControlled(type) && level >= sending_level) {
+        Sandesh::UpdateTxMsgFailStats(name, 0,
+            SandeshTxDropReason::QueueLevel);
+        return false;
+    }
+    if (session()->FlowCreditShed(type, level)) {
+        Sandesh::UpdateTxMsgFailStats(name, 0,
+            SandeshTxDropReason::NoCredits);
+        return false;
+    }
+    return true;
+}
+
 bool SandeshClientSMImpl::SendSandeshUVE(Sandesh * snh) {
     Enqueue(scm::EvSandeshSend(snh));
     return true;
@@ -753,6 +864,11 @@ bool SandeshClientSMImpl::SendSandesh(Sandesh * snh) {
     return true;
 }
 
+bool SandeshClientSMImpl::SendEncodedSandesh(SandeshEncodedMessagePtr msg) {
+    Enqueue(scm::EvSandeshEncodedSend(msg));
+    return true;
+}
+
 bool SandeshClientSMImpl::OnMessage(SandeshSession *session,
                                     const std::string &msg) {
     // Demux based on Sandesh message type
@@ -804,6 +920,37 @@ int SandeshClientSMImpl::GetConnectTime() const {
     return std::min(backoff ? 1 << (backoff - 1) : 0, kConnectInterval);
 }
 
+// Backoff in msec between half and all of the connect time, so that the
+// generators of a failed collector do not all retry at the same time
+int SandeshClientSMImpl::GetIdleHoldTime() {
+    int connect_time(GetConnectTime() * 1000);
+    if (connect_time == 0) {
+        return 0;
+    }
+    boost::random::uniform_int_distribution<int> jitter(connect_time / 2,
+        connect_time);
+    return jitter(rng_);
+}
+
+void SandeshClientSMImpl::OnConnectStart() {
+    connect_start_usec_ = ClockMonotonicUsec();
+}
+
+void SandeshClientSMImpl::OnConnected() {
+    connect_latency_usec_ = ClockMonotonicUsec() - connect_start_usec_;
+}
+
+void SandeshClientSMImpl::OnEstablished() {
+    if (disconnect_usec_ != 0) {
+        failover_time_usec_ = ClockMonotonicUsec() - disconnect_usec_;
+        disconnect_usec_ = 0;
+    }
+}
+
+void SandeshClientSMImpl::OnDisconnected() {
+    disconnect_usec_ = ClockMonotonicUsec();
+}
+
 void SandeshClientSMImpl::UpdateEventEnqueue(const sc::event_base &event) {
     UpdateEventStats(event, true, false);
 }
@@ -834,7 +981,9 @@ bool SandeshClientSMImpl::DequeueEvent(SandeshClientSMImpl::EventContainer ec) {
 
     set_last_event(TYPE_NAME(*ec.event));
     if (ec.validate.empty() || ec.validate(this)) {
-        if ((state()!=ESTABLISHED)||(TYPE_NAME(*ec.event)!="scm::EvSandeshSend"))
+        if ((state()!=ESTABLISHED)||
+            ((TYPE_NAME(*ec.event)!="scm::EvSandeshSend") &&
+             (TYPE_NAME(*ec.event)!="scm::EvSandeshEncodedSend")))
             SM_LOG(DEBUG, "Processing " << TYPE_NAME(*ec.event) << " in state "
                 << StateName());
         UpdateEventDequeue(*ec.event);
@@ -897,6 +1046,8 @@ void SandeshClientSMImpl::Enqueue(const Ev &event) {
 SandeshClientSMImpl::SandeshClientSMImpl(EventManager *evm, Mgr *mgr,
         int sm_task_instance, int sm_task_id, bool periodicuve)
     :   SandeshClientSM(mgr),
+        collector_index_(0),
+        collector_offset_(0),
         work_queue_(sm_task_id, sm_task_instance,
                 boost::bind(&SandeshClientSMImpl::DequeueEvent, this, _1)),
         connect_timer_(TimerManager::CreateTimer(*evm->io_service(), "Client Connect timer", sm_task_id, sm_task_instance)),
@@ -906,6 +1057,8 @@ SandeshClientSMImpl::SandeshClientSMImpl(EventManager *evm, Mgr *mgr,
         statistics_timer_interval_(kTickInterval),
         periodicuve_(periodicuve),
         attempts_(0),
+        connect_start_usec_(0),
+        disconnect_usec_(0),
         deleted_(false),
         in_dequeue_(false),
         connects_(0),
@@ -913,6 +1066,8 @@ SandeshClientSMImpl::SandeshClientSMImpl(EventManager *evm, Mgr *mgr,
     state_ = IDLE;
     generator_key_ = Sandesh::source() + ":" + Sandesh::node_type() + ":" + 
         Sandesh::module() + ":" + Sandesh::instance_id();
+    rng_.seed(static_cast<uint32_t>(boost::hash<std::string>()(generator_key_) ^
+        UTCTimestampUsec()));
     initiate();
     StartStatisticsTimer();
 }
@@ -962,8 +1117,9 @@ void SandeshClientSMImpl::StartStatisticsTimer() {
                     _2));
 }
 
+// The generator state is sent by the first state machine only
 bool SandeshClientSMImpl::StatisticsTimerExpired() {
-    if (deleted_ || generator_key_.empty()) {
+    if (deleted_ || generator_key_.empty() || collector_offset_ != 0) {
         return true;
     }
     std::vector<SandeshStateMachineEvStats> ev_stats;
@@ -1016,7 +1172,7 @@ void SandeshClientSMImpl::GetCollectors(
 
 TcpServer::Endpoint SandeshClientSMImpl::GetCollector() const {
     if (collectors_.size()) {
-        return collectors_[collector_index_];
+        return collectors_[collector_order_[collector_index_]];
     }
     return TcpServer::Endpoint();
 }
@@ -1026,16 +1182,113 @@ TcpServer::Endpoint SandeshClientSMImpl::GetNextCollector() {
         if (++collector_index_ == collectors_.size()) {
             collector_index_ = 0;
         }
-        return collectors_[collector_index_];
+        SkipCollectorsInUse();
+        return collectors_[collector_order_[collector_index_]];
     }
     return TcpServer::Endpoint();
 }
 
+// Move the collector index past the collectors that the state machines of
+// the other collectors send to, so that no two of them send to the same
+// collector. The index comes back to where it was if all are in use
+void SandeshClientSMImpl::SkipCollectorsInUse() {
+    for (size_t i = 0; i < collectors_.size() &&
+         mgr_->CollectorInUse(GetCollector()); i++) {
+        if (++collector_index_ == collectors_.size()) {
+            collector_index_ = 0;
+        }
+    }
+}
+
+// Collectors are tried in the order of a hash of the generator and the
+// collector. The generators of a failed collector thus fail over to
+// different collectors, rather than all to the next one in the configured
+// list. The collectors with a known load hint then trade places among
+// themselves in the order of their load, while those without one keep
+// their place
+void SandeshClientSMImpl::RankCollectors() {
+    typedef std::pair<std::pair<uint32_t, size_t>, size_t> CollectorRank;
+    std::vector<CollectorRank> ranks;
+    for (size_t i = 0; i < collectors_.size(); i++) {
+        size_t hash(0);
+        boost::hash_combine(hash, generator_key_);
+        boost::hash_combine(hash, collectors_[i].address().to_string());
+        boost::hash_combine(hash, collectors_[i].port());
+        ranks.push_back(std::make_pair(std::make_pair(0U, hash), i));
+    }
+    std::sort(ranks.begin(), ranks.end());
+    std::vector<size_t> loaded_slots;
+    std::vector<CollectorRank> loaded_ranks;
+    for (size_t i = 0; i < ranks.size(); i++) {
+        std::map<TcpServer::Endpoint, uint32_t>::const_iterator it(
+            collector_loads_.find(collectors_[ranks[i].second]));
+        if (it != collector_loads_.end()) {
+            ranks[i].first.first = it->second;
+            loaded_slots.push_back(i);
+            loaded_ranks.push_back(ranks[i]);
+        }
+    }
+    std::sort(loaded_ranks.begin(), loaded_ranks.end());
+    for (size_t i = 0; i < loaded_slots.size(); i++) {
+        ranks[loaded_slots[i]] = loaded_ranks[i];
+    }
+    collector_order_.clear();
+    for (size_t i = 0; i < ranks.size(); i++) {
+        collector_order_.push_back(ranks[i].second);
+    }
+}
+
+// Point the collector index at the collector, if it is configured
+bool SandeshClientSMImpl::SetCollectorIndex(
+        const TcpServer::Endpoint &collector) {
+    for (size_t i = 0; i < collector_order_.size(); i++) {
+        if (collectors_[collector_order_[i]] == collector) {
+            collector_index_ = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void SandeshClientSMImpl::SetCollectorLoad(uint32_t load) {
+    collector_load_ = load;
+    TcpServer::Endpoint collector(server());
+    collector_loads_[collector] = load;
+    RankCollectors();
+    SetCollectorIndex(collector);
+}
+
+// Called before the collectors are set
+void SandeshClientSMImpl::SetCollectorOffset(size_t offset) {
+    collector_offset_ = offset;
+    if (offset != 0) {
+        connection_name_ = integerToString(offset);
+    }
+}
+
 bool SandeshClientSMImpl::CollectorUpdate(
         const std::vector<TcpServer::Endpoint>& collectors) {
     collectors_ = collectors;
-    collector_index_ = 0;
-    TcpServer::Endpoint collector(GetCollector());
+    // Forget the load of collectors no longer configured
+    for (std::map<TcpServer::Endpoint, uint32_t>::iterator it =
+         collector_loads_.begin(); it != collector_loads_.end();) {
+        if (std::find(collectors_.begin(), collectors_.end(), it->first) ==
+                collectors_.end()) {
+            collector_loads_.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+    RankCollectors();
+    collector_index_ = collectors_.empty() ? 0 :
+        collector_offset_ % collectors_.size();
+    // Stay with the current collector while it is configured, and not
+    // sent to by another state machine
+    TcpServer::Endpoint collector(server());
+    if (!SetCollectorIndex(collector) || mgr_->CollectorInUse(collector)) {
+        SkipCollectorsInUse();
+        collector = GetCollector();
+    }
     if (server() != collector) {
         set_server(collector);
         SendUVE();
@@ -47,6 +47,10 @@ public:
                         TcpServer::Endpoint ep) = 0;
             virtual void InitializeSMSession(int connects) = 0;
             virtual void DeleteSMSession(SandeshSession * session) = 0;
+            virtual bool CloseSMSession() = 0;
+            // Whether the state machine of another server connects, or is
+            // connected, to the server
+            virtual bool CollectorInUse(const TcpServer::Endpoint &server) = 0;
         protected:
             Mgr() {}
             virtual ~Mgr() {}
@@ -83,10 +87,46 @@ public:
     // This function is used to send sandesh's to the server
     virtual bool SendSandesh(Sandesh* snh) = 0;
 
+    // This function is used to send sandesh's already encoded, and
+    // shared with the state machines of other servers
+    virtual bool SendEncodedSandesh(SandeshEncodedMessagePtr msg) = 0;
+
+    // This function is used to start at another server than the first one
+    // in the order the servers are tried, when there is more than one
+    // state machine
+    virtual void SetCollectorOffset(size_t offset) = 0;
+
+    // This function is used to update the load hint of the server
+    virtual void SetCollectorLoad(uint32_t load) = 0;
+
+    // Load hint of the server, time taken by the last connect, and by the
+    // last failover from an established session to the next one
+    uint32_t collector_load() const { return collector_load_; }
+    uint64_t connect_latency_usec() const { return connect_latency_usec_; }
+    uint64_t failover_time_usec() const { return failover_time_usec_; }
+
+    // Delay in msec before connecting again, as asked for by the server
+    int retry_after() const { return retry_after_; }
+    void set_retry_after(int retry_after) { retry_after_ = retry_after; }
+
+    // Time in msec to keep waiting for the reply to the control message,
+    // as asked for by the server while it defers the admission
+    int admission_wait() const { return admission_wait_; }
+    void set_admission_wait(int admission_wait) {
+        admission_wait_ = admission_wait;
+    }
+
     virtual ~SandeshClientSM() {}
 
 protected:
-    SandeshClientSM(Mgr *mgr):  mgr_(mgr), session_(), server_() { state_ = IDLE; }
+    SandeshClientSM(Mgr *mgr):  mgr_(mgr), session_(), server_() {
+        state_ = IDLE;
+        retry_after_ = 0;
+        admission_wait_ = 0;
+        collector_load_ = 0;
+        connect_latency_usec_ = 0;
+        failover_time_usec_ = 0;
+    }
 
     virtual void EnqueDelSession(SandeshSession * session) = 0;
 
@@ -104,6 +144,10 @@ protected:
     bool send_session(Sandesh *snh) {
         return snh->Enqueue(session_->send_queue());
     }
+
+    bool send_session(SandeshEncodedMessagePtr msg) {
+        return session_->send_queue()->Enqueue(SandeshElement(msg));
+    }
    
     void set_server(TcpServer::Endpoint e) {
         tbb::mutex::scoped_lock l(mtex_); server_ = e;
@@ -111,6 +155,11 @@ protected:
 
     Mgr * const mgr_;
     tbb::atomic<State> state_;
+    tbb::atomic<int> retry_after_;
+    tbb::atomic<int> admission_wait_;
+    tbb::atomic<uint32_t> collector_load_;
+    tbb::atomic<uint64_t> connect_latency_usec_;
+    tbb::atomic<uint64_t> failover_time_usec_;
 
 private:
     tbb::mutex mtex_;
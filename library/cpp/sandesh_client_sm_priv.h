@@ -11,7 +11,9 @@
 #ifndef __SANDESH_CLIENT_SM_PRIV_H__
 #define __SANDESH_CLIENT_SM_PRIV_H__
 
+#include <map>
 #include <boost/asio.hpp>
+#include <boost/random/mersenne_twister.hpp>
 #include <boost/statechart/state_machine.hpp>
 #include <tbb/mutex.h>
 #include <tbb/atomic.h>
@@ -54,9 +56,23 @@ public:
     void set_session(SandeshSession * session, bool enq = true) {
         SandeshClientSM::set_session(session, enq);
     }
+    // Messages are dropped at the sending level of this session, since
+    // the send queue to each collector fills up on its own
     bool send_session(Sandesh *snh) {
+        if (!CheckSendingLevel(snh->Name(), snh->type(), snh->level())) {
+            snh->Release();
+            return true;
+        }
         return SandeshClientSM::send_session(snh);
     }
+    bool send_session(SandeshEncodedMessagePtr msg) {
+        if (!CheckSendingLevel(msg->name_, msg->type_, msg->level_)) {
+            return true;
+        }
+        return SandeshClientSM::send_session(msg);
+    }
+    bool CheckSendingLevel(const std::string &name, SandeshType::type type,
+            SandeshLevel::type level);
 
     void SetAdminState(bool down);
     void SetCollectors(const std::vector<TcpServer::Endpoint>& collectors);
@@ -65,6 +81,9 @@ public:
     TcpServer::Endpoint GetNextCollector();
     bool SendSandeshUVE(Sandesh* snh);
     bool SendSandesh(Sandesh* snh);
+    bool SendEncodedSandesh(SandeshEncodedMessagePtr msg);
+    void SetCollectorLoad(uint32_t load);
+    void SetCollectorOffset(size_t offset);
     void EnqueDelSession(SandeshSession * session);
 
     // Feed session events into the state machine.
@@ -78,6 +97,7 @@ public:
 
     // In state reactions
     template <class Ev> void ReleaseSandesh(const Ev &event);
+    template <class Ev> void ReleaseEncodedSandesh(const Ev &event);
     template <class Ev> void DeleteTcpSession(const Ev &event);
 
     void StartConnectTimer(int seconds);
@@ -95,6 +115,13 @@ public:
 
     // Calculate Timer value for active to connect transition.
     int GetConnectTime() const;
+    int GetIdleHoldTime();
+
+    // Connect latency and failover time measurement
+    void OnConnectStart();
+    void OnConnected();
+    void OnEstablished();
+    void OnDisconnected();
 
     const std::string &StateName() const;
     const std::string &StateName(SandeshClientSM::State state) const;
@@ -134,6 +161,9 @@ public:
 
     void set_collector_name(const std::string& cname) { coll_name_ = cname; }
     std::string collector_name() { return coll_name_; }
+    // Name of the collector connection state, empty for the first
+    // state machine
+    const std::string &connection_name() const { return connection_name_; }
     
     void unconsumed_event(const sc::event_base &event);
     void SendUVE () {
@@ -160,9 +190,17 @@ private:
     void UpdateEventEnqueue(const sc::event_base &event);
     void UpdateEventEnqueueFail(const sc::event_base &event);
     void UpdateEventStats(const sc::event_base &event, bool enqueue, bool fail);
+    void RankCollectors();
+    bool SetCollectorIndex(const TcpServer::Endpoint &collector);
+    void SkipCollectorsInUse();
 
     std::vector<TcpServer::Endpoint> collectors_;
-    int collector_index_;
+    // Indices into collectors_ in the order they are tried
+    std::vector<size_t> collector_order_;
+    std::map<TcpServer::Endpoint, uint32_t> collector_loads_;
+    size_t collector_index_;
+    size_t collector_offset_;
+    std::string connection_name_;
     TcpServer::Endpoint active_;
     WorkQueue<EventContainer> work_queue_;
     Timer *connect_timer_;
@@ -172,6 +210,9 @@ private:
     int statistics_timer_interval_;
     bool periodicuve_;
     int attempts_;
+    boost::random::mt19937 rng_;
+    uint64_t connect_start_usec_;
+    uint64_t disconnect_usec_;
     bool deleted_;
     bool in_dequeue_;
     int connects_;
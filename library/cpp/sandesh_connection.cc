@@ -111,6 +111,16 @@ void SandeshConnection::Shutdown() {
     deleter()->Delete();
 }
 
+bool SandeshConnection::ProcessSandeshMessages(
+        const std::vector<const SandeshMessage *> &msgs, bool resource) {
+    for (size_t i = 0; i < msgs.size(); i++) {
+        if (!ProcessSandeshMessage(msgs[i], resource)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 bool SandeshConnection::MayDelete() const {
     // XXX Do we have any dependencies?
     return true;
@@ -159,19 +169,14 @@ void SandeshServerConnection::ManagedDelete() {
     deleter_->Delete();
 }
 
-bool SandeshServerConnection::ProcessSandeshCtrlMessage(const std::string &msg,
-        const SandeshHeader &header, const std::string sandesh_name,
-        const uint32_t header_offset) {
+bool SandeshServerConnection::ProcessSandeshCtrlMessage(
+        const Sandesh *ctrl_snh) {
     SandeshServer *sserver = dynamic_cast<SandeshServer *>(server());
     if (!sserver) {
         CONNECTION_LOG(ERROR, __func__ << " No Server");
         return false;
     }
-    Sandesh *ctrl_snh = SandeshSession::DecodeCtrlSandesh(msg, header, sandesh_name,
-                                                          header_offset);
-    bool ret = sserver->ReceiveSandeshCtrlMsg(state_machine(), session(), ctrl_snh);
-    ctrl_snh->Release();
-    return ret;
+    return sserver->ReceiveSandeshCtrlMsg(state_machine(), session(), ctrl_snh);
 }
 
 bool SandeshServerConnection::ProcessResourceUpdate(bool rsc) {
@@ -194,6 +199,17 @@ bool SandeshServerConnection::ProcessSandeshMessage(
     return true;
 }
 
+bool SandeshServerConnection::ProcessSandeshMessages(
+        const std::vector<const SandeshMessage *> &msgs, bool resource) {
+    SandeshServer *sserver = dynamic_cast<SandeshServer *>(server());
+    if (!sserver) {
+        CONNECTION_LOG(ERROR, __func__ << " No Server");
+        return false;
+    }
+    sserver->ReceiveSandeshMsgBatch(session(), msgs, resource);
+    return true;
+}
+
 void SandeshServerConnection::ProcessDisconnect(SandeshSession * sess) {
     SandeshServer *sserver = dynamic_cast<SandeshServer *>(server());
     if (!sserver) {
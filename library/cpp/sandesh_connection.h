@@ -69,9 +69,9 @@ public:
     virtual bool ProcessResourceUpdate(bool res) { return true; }
     virtual bool ProcessSandeshMessage(const SandeshMessage *msg,
             bool resource) = 0;
-    virtual bool ProcessSandeshCtrlMessage(const std::string &msg,
-            const SandeshHeader &header, const std::string sandesh_name,
-            const uint32_t header_offset) = 0;
+    virtual bool ProcessSandeshMessages(
+            const std::vector<const SandeshMessage *> &msgs, bool resource);
+    virtual bool ProcessSandeshCtrlMessage(const Sandesh *ctrl_snh) = 0;
     virtual void ProcessDisconnect(SandeshSession * sess) = 0;
 
     virtual void ManagedDelete() = 0;
@@ -105,9 +105,9 @@ public:
     virtual bool ProcessResourceUpdate(bool res); 
     virtual bool ProcessSandeshMessage(const SandeshMessage *msg,
             bool resource);
-    virtual bool ProcessSandeshCtrlMessage(const std::string &msg,
-            const SandeshHeader &header, const std::string sandesh_name,
-            const uint32_t header_offset);    
+    virtual bool ProcessSandeshMessages(
+            const std::vector<const SandeshMessage *> &msgs, bool resource);
+    virtual bool ProcessSandeshCtrlMessage(const Sandesh *ctrl_snh);
     virtual void ProcessDisconnect(SandeshSession *session);
 
     virtual void ManagedDelete();
@@ -2,27 +2,161 @@
  * Copyright (c) 2014 Juniper Networks, Inc. All rights reserved.
  */
 
+#include <algorithm>
+
 #include <sandesh/sandesh_message_builder.h>
+#include <sandesh/protocol/TXMLEscape.h>
 
 using namespace pugi;
 using namespace std;
+using contrail::sandesh::protocol::xmlFindChar;
 
 // SandeshMessage
 SandeshMessage::~SandeshMessage() {
 }
 
-static bool ParseInteger(const pugi::xml_node &node, int *valuep) {
+static bool ParseInteger(const char *value, int *valuep) {
     char *endp;
-    *valuep = strtoul(node.child_value(), &endp, 10);
+    *valuep = strtoul(value, &endp, 10);
     return endp[0] == '\0';
 }
 
-static bool ParseUnsignedLong(const pugi::xml_node &node, uint64_t *valuep) {
+static bool ParseUnsignedLong(const char *value, uint64_t *valuep) {
     char *endp;
-    *valuep = strtoull(node.child_value(), &endp, 10);
+    *valuep = strtoull(value, &endp, 10);
     return endp[0] == '\0';
 }
 
+static bool ParseHeaderField(SandeshHeader *header, int identifier,
+    const char *value) {
+    switch (identifier) {
+    case 1:
+        header->set_Namespace(value);
+        break;
+    case 2:
+        uint64_t Timestamp;
+        if (!ParseUnsignedLong(value, &Timestamp)) return false;
+        header->set_Timestamp(Timestamp);
+        break;
+    case 3:
+        header->set_Module(value);
+        break;
+    case 4:
+        header->set_Source(value);
+        break;
+    case 5:
+        header->set_Context(value);
+        break;
+    case 6:
+        int SequenceNum;
+        if (!ParseInteger(value, &SequenceNum)) return false;
+        header->set_SequenceNum(SequenceNum);
+        break;
+    case 7:
+        int VersionSig;
+        if (!ParseInteger(value, &VersionSig)) return false;
+        header->set_VersionSig(VersionSig);
+        break;
+    case 8:
+        int Type;
+        if (!ParseInteger(value, &Type)) return false;
+        header->set_Type(static_cast<SandeshType::type>(Type));
+        break;
+    case 9:
+        int Hints;
+        if (!ParseInteger(value, &Hints)) return false;
+        header->set_Hints(Hints);
+        break;
+    case 10:
+        int Level;
+        if (!ParseInteger(value, &Level)) return false;
+        header->set_Level(static_cast<SandeshLevel::type>(Level));
+        break;
+    case 11:
+        header->set_Category(value);
+        break;
+    case 12:
+        header->set_NodeType(value);
+        break;
+    case 13:
+        header->set_InstanceId(value);
+        break;
+    case 14:
+        header->set_IPAddress(value);
+        break;
+    case 15:
+        int Pid;
+        if (!ParseInteger(value, &Pid)) return false;
+        header->set_Pid(Pid);
+        break;
+    default:
+        SANDESH_LOG(ERROR, __func__ << ": Unknown identifier: " << identifier);
+        break;
+    }
+    return true;
+}
+
+// Scanner for the start tag at p, <name attr="value" ...>. Returns the
+// position after the tag, or NULL if it is not a well formed start tag.
+// identifier is set to the value of the identifier attribute, or -1.
+static const char *ScanStartTag(const char *p, const char *end,
+    const char **name, size_t *name_len, int *identifier, bool *empty) {
+    if (p == end || *p != '<') return NULL;
+    const char *nb = ++p;
+    while (p != end && *p != '>' && *p != '/' && !isspace(static_cast<unsigned char>(*p))) ++p;
+    if (p == nb) return NULL;
+    *name = nb;
+    *name_len = p - nb;
+    *identifier = -1;
+    *empty = false;
+    while (true) {
+        while (p != end && isspace(static_cast<unsigned char>(*p))) ++p;
+        if (p == end) return NULL;
+        if (*p == '>') return p + 1;
+        if (*p == '/') {
+            if (p + 1 == end || p[1] != '>') return NULL;
+            *empty = true;
+            return p + 2;
+        }
+        const char *ab = p;
+        while (p != end && *p != '=' && *p != '>' && !isspace(static_cast<unsigned char>(*p))) ++p;
+        size_t alen = p - ab;
+        if (p == end || *p != '=' || alen == 0) return NULL;
+        if (++p == end || (*p != '"' && *p != '\'')) return NULL;
+        char quote = *p++;
+        const char *vb = p;
+        p = xmlFindChar(p, end, quote);
+        if (p == end) return NULL;
+        if (alen == 10 && memcmp(ab, "identifier", alen) == 0) {
+            int value = 0;
+            for (const char *vp = vb; vp != p; ++vp) {
+                if (!isdigit(static_cast<unsigned char>(*vp))) return NULL;
+                value = value * 10 + (*vp - '0');
+            }
+            *identifier = value;
+        }
+        ++p;
+    }
+}
+
+// Scanner for the end tag of name at p
+static const char *ScanEndTag(const char *p, const char *end,
+    const char *name, size_t name_len) {
+    if ((size_t)(end - p) < name_len + 3 || p[0] != '<' || p[1] != '/' ||
+        memcmp(p + 2, name, name_len) != 0) {
+        return NULL;
+    }
+    p += name_len + 2;
+    while (p != end && isspace(static_cast<unsigned char>(*p))) ++p;
+    if (p == end || *p != '>') return NULL;
+    return p + 1;
+}
+
+static const char *ScanSpace(const char *p, const char *end) {
+    while (p != end && isspace(static_cast<unsigned char>(*p))) ++p;
+    return p;
+}
+
 // SandeshXMLMessage
 SandeshXMLMessage::~SandeshXMLMessage() {
 }
@@ -31,104 +165,177 @@ bool SandeshXMLMessage::ParseHeader(const xml_node& root,
     SandeshHeader& header) {
     for (xml_node node = root.first_child(); node;
          node = node.next_sibling()) {
-        const char *name(node.name());
         assert(strcmp(node.last_attribute().name(), "identifier") == 0);
         int identifier(node.last_attribute().as_int());
-        switch (identifier) {
-        case 1:
-            header.set_Namespace(node.child_value());
-            break;
-        case 2:
-            uint64_t Timestamp;
-            if (!ParseUnsignedLong(node, &Timestamp)) return false;
-            header.set_Timestamp(Timestamp);
-            break;
-        case 3:
-            header.set_Module(node.child_value());
-            break;
-        case 4:
-            header.set_Source(node.child_value());
-            break;
-        case 5:
-            header.set_Context(node.child_value());
-            break;
-        case 6:
-            int SequenceNum;
-            if (!ParseInteger(node, &SequenceNum)) return false;
-            header.set_SequenceNum(SequenceNum);
-            break;
-        case 7:
-            int VersionSig;
-            if (!ParseInteger(node, &VersionSig)) return false;
-            header.set_VersionSig(VersionSig);
-            break;
-        case 8:
-            int Type;
-            if (!ParseInteger(node, &Type)) return false;
-            header.set_Type(static_cast<SandeshType::type>(Type));
-            break;
-        case 9:
-            int Hints;
-            if (!ParseInteger(node, &Hints)) return false;
-            header.set_Hints(Hints);
-            break;
-        case 10:
-            int Level;
-            if (!ParseInteger(node, &Level)) return false;
-            header.set_Level(static_cast<SandeshLevel::type>(Level));
-            break;
-        case 11:
-            header.set_Category(node.child_value());
-            break;
-        case 12:
-            header.set_NodeType(node.child_value());
-            break;
-        case 13:
-            header.set_InstanceId(node.child_value());
-            break;
-        case 14:
-            header.set_IPAddress(node.child_value());
-            break;
-        case 15:
-            int Pid;
-            if (!ParseInteger(node, &Pid)) return false;
-            header.set_Pid(Pid);
-            break;
-        default:
-            SANDESH_LOG(ERROR, __func__ << ": Unknown identifier: " << identifier);
-            break;
+        if (!ParseHeaderField(&header, identifier, node.child_value())) {
+            return false;
         }
     }
     return true;
 }
 
 bool SandeshXMLMessage::Parse(const uint8_t *xml_msg, size_t size) {
-    xml_parse_result result = xdoc_.load_buffer(xml_msg, size,
-        parse_default & ~parse_escapes);
+    header_ = SandeshHeader();
+    message_offset_ = std::string::npos;
+    message_end_ = 0;
+    size_ = 0;
+    // Parse in place from the one copy of the received XML. The
+    // terminating nul is parsed too, so that pugixml does not overwrite
+    // the last character. End of line and whitespace conversions would
+    // move or change the text, which ExtractMessage hands out.
+    buf_.resize(size + 1);
+    char *xml = &buf_[0];
+    memcpy(xml, xml_msg, size);
+    xml[size] = '\0';
+    xml_parse_result result = xdoc_.load_buffer_inplace(xml, size + 1,
+        parse_default & ~(parse_escapes | parse_eol | parse_wconv_attribute));
     if (!result) {
         SANDESH_LOG(ERROR, __func__ << ": Unable to load Sandesh XML. (status=" <<
             result.status << ", offset=" << result.offset << "): " << 
-            xml_msg);
+            std::string(reinterpret_cast<const char *>(xml_msg), size));
         return false;
     }
     xml_node header_node = xdoc_.first_child();
     if (!ParseHeader(header_node, header_)) {
         SANDESH_LOG(ERROR, __func__ << ": Sandesh header parse FAILED: " <<
-            xml_msg);
+            std::string(reinterpret_cast<const char *>(xml_msg), size));
         return false;
     }
     message_node_ = header_node.next_sibling();
     message_type_ = message_node_.name();
     if (message_type_.empty()) {
         SANDESH_LOG(ERROR, __func__ << ": Message type NOT PRESENT: " <<
-            xml_msg);
+            std::string(reinterpret_cast<const char *>(xml_msg), size));
         return false;
     }
+    // The node name points into the buffer, right after the '<' of the
+    // message start tag, and the message runs to the end of the buffer
+    const char *name(message_node_.name());
+    if (name > xml && name < xml + size && name[-1] == '<') {
+        message_offset_ = name - xml - 1;
+        message_end_ = size;
+        while (message_end_ > message_offset_ && isspace(
+                   static_cast<unsigned char>(xml[message_end_ - 1]))) {
+            --message_end_;
+        }
+    }
     size_ = size;
     return true;
 }
 
+void SandeshXMLMessage::Clear(size_t max_buffer_size) {
+    xdoc_.reset();
+    message_node_ = xml_node();
+    message_offset_ = std::string::npos;
+    if (buf_.capacity() > max_buffer_size) {
+        std::vector<char>().swap(buf_);
+    }
+}
+
+// Parsing in place, pugixml writes a nul over the character that ends
+// each name and value. The functions below tell which character it was,
+// from the nodes and the characters around it, so that the message can
+// be handed out as received. Whitespace is put back as a space.
+
+// Where the node starts in the buffer
+static const char *NodeStart(const xml_node &node) {
+    switch (node.type()) {
+    case node_element:
+        return node.name() - 1;
+    case node_cdata:
+        return node.value() - 9;
+    default:
+        return node.value();
+    }
+}
+
+// The end of an element name is followed by the attributes, the end of
+// the start tag, or the content
+static char ElementNameEnd(const xml_node &node, const char *pos) {
+    if (node.first_attribute()) {
+        return ' ';
+    }
+    xml_node child(node.first_child());
+    if (child) {
+        // Unless it is the end of the start tag, there is one before
+        // the content
+        const char *start(NodeStart(child));
+        return std::find(pos + 1, start, '>') != start ? ' ' : '>';
+    }
+    const char *p(pos + 1);
+    while (isspace(static_cast<unsigned char>(*p))) ++p;
+    if (*p == '/') {
+        return ' ';
+    }
+    if (*p != '>') {
+        return '>';
+    }
+    if (p != pos + 1) {
+        return ' ';
+    }
+    // Either <name/> or <name ></name>. The end tag that follows is
+    // taken as the one of the parent when it has the same name.
+    size_t len(strlen(node.name()));
+    for (++p; isspace(static_cast<unsigned char>(*p)); ++p) {
+    }
+    if (p[0] == '<' && p[1] == '/' && strncmp(p + 2, node.name(), len) == 0 &&
+        (p[len + 2] == '>' || isspace(static_cast<unsigned char>(p[len + 2]))) &&
+        (node.next_sibling() || strcmp(node.parent().name(), node.name()))) {
+        return ' ';
+    }
+    return '/';
+}
+
+static void RestoreChar(const char *pos, char c, const char *base,
+    std::string *message) {
+    size_t offset(pos - base);
+    if (offset < message->size()) {
+        (*message)[offset] = c;
+    }
+}
+
+static void RestoreElement(const xml_node &node, const char *base,
+    std::string *message) {
+    const char *pos(node.name() + strlen(node.name()));
+    RestoreChar(pos, ElementNameEnd(node, pos), base, message);
+    for (xml_attribute attr = node.first_attribute(); attr;
+         attr = attr.next_attribute()) {
+        // The name is followed by the '=', maybe after whitespace
+        pos = attr.name() + strlen(attr.name());
+        const char *p(pos + 1);
+        while (isspace(static_cast<unsigned char>(*p))) ++p;
+        RestoreChar(pos, *p == '=' ? ' ' : '=', base, message);
+        // The value ends with the quote it started with
+        RestoreChar(attr.value() + strlen(attr.value()), attr.value()[-1],
+            base, message);
+    }
+    for (xml_node child = node.first_child(); child;
+         child = child.next_sibling()) {
+        switch (child.type()) {
+        case node_element:
+            RestoreElement(child, base, message);
+            break;
+        case node_pcdata:
+            RestoreChar(child.value() + strlen(child.value()), '<', base,
+                message);
+            break;
+        case node_cdata:
+            RestoreChar(child.value() + strlen(child.value()), ']', base,
+                message);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
 const std::string SandeshXMLMessage::ExtractMessage() const {
+    if (message_offset_ != std::string::npos) {
+        const char *data(&buf_[0] + message_offset_);
+        std::string message(data, message_end_ - message_offset_);
+        RestoreElement(message_node_, data, &message);
+        return message;
+    }
     ostringstream sstream;
     message_node_.print(sstream, "", format_raw | format_no_declaration | 
         format_no_escapes);
@@ -164,22 +371,141 @@ SandeshMessageBuilder *SandeshMessageBuilder::GetInstance(
     return NULL;
 }
 
+// Fully parse the message, for builders that have no header scanner.
+// The message offset is only known for XML messages.
+bool SandeshMessageBuilder::ScanHeader(const uint8_t *data, size_t size,
+    SandeshHeader *header, std::string *message_type,
+    uint32_t *message_offset) const {
+    SandeshMessage *msg = Create(data, size);
+    if (msg == NULL) {
+        return false;
+    }
+    const SandeshXMLMessage *xmsg =
+        dynamic_cast<const SandeshXMLMessage *>(msg);
+    if (xmsg == NULL || xmsg->GetMessageOffset() == std::string::npos) {
+        Release(msg);
+        return false;
+    }
+    *header = msg->GetHeader();
+    *message_type = msg->GetMessageType();
+    *message_offset = xmsg->GetMessageOffset();
+    Release(msg);
+    return true;
+}
+
+void SandeshMessageBuilder::Release(const SandeshMessage *msg) const {
+    delete msg;
+}
+
 // SandeshXMLMessageBuilder
 SandeshMessage *SandeshXMLMessageBuilder::Create(
     const uint8_t *xml_msg, size_t size) const {
-    SandeshXMLMessage *msg = new SandeshXMLMessage;
+    SandeshXMLMessage *msg = NULL;
+    {
+        tbb::mutex::scoped_lock lock(mutex_);
+        if (!free_list_.empty()) {
+            msg = free_list_.back();
+            free_list_.pop_back();
+        }
+    }
+    if (msg == NULL) {
+        msg = new SandeshXMLMessage;
+    }
     if (!msg->Parse(xml_msg, size)) {
-        delete msg;
+        Release(msg);
         return NULL;
     }
     return msg;
 }
 
+void SandeshXMLMessageBuilder::Release(const SandeshMessage *msg) const {
+    // Only messages created by this builder are released to it
+    SandeshXMLMessage *xmsg(const_cast<SandeshXMLMessage *>(
+        static_cast<const SandeshXMLMessage *>(msg)));
+    {
+        tbb::mutex::scoped_lock lock(mutex_);
+        if (free_list_.size() < kMaxPooledMessages) {
+            // Pooled messages keep no DOM, and no large buffer
+            xmsg->Clear(kMaxPooledBufferSize);
+            free_list_.push_back(xmsg);
+            return;
+        }
+    }
+    delete xmsg;
+}
+
+// Walks the header fields and the message start tag in the raw XML,
+// without building the DOM. The field values are taken as is, like
+// Parse() does with escapes disabled.
+bool SandeshXMLMessageBuilder::ScanHeader(const uint8_t *data, size_t size,
+    SandeshHeader *header, std::string *message_type,
+    uint32_t *message_offset) const {
+    const char *p(reinterpret_cast<const char *>(data));
+    const char *end(p + size);
+    const char *hname, *fname;
+    size_t hname_len, fname_len;
+    int identifier;
+    bool hempty, empty;
+    std::string value;
+    p = ScanStartTag(ScanSpace(p, end), end, &hname, &hname_len,
+        &identifier, &hempty);
+    if (p == NULL) {
+        SANDESH_LOG(ERROR, __func__ << ": Sandesh header scan FAILED");
+        return false;
+    }
+    while (!hempty) {
+        p = ScanSpace(p, end);
+        const char *q = ScanEndTag(p, end, hname, hname_len);
+        if (q != NULL) {
+            p = q;
+            break;
+        }
+        p = ScanStartTag(p, end, &fname, &fname_len, &identifier, &empty);
+        if (p == NULL || identifier < 0) {
+            SANDESH_LOG(ERROR, __func__ << ": Sandesh header scan FAILED");
+            return false;
+        }
+        value.clear();
+        if (!empty) {
+            const char *vb = p;
+            p = xmlFindChar(p, end, '<');
+            value.assign(vb, p - vb);
+            p = ScanEndTag(p, end, fname, fname_len);
+            if (p == NULL) {
+                SANDESH_LOG(ERROR, __func__ << ": Sandesh header scan FAILED");
+                return false;
+            }
+        }
+        if (!ParseHeaderField(header, identifier, value.c_str())) {
+            SANDESH_LOG(ERROR, __func__ << ": Sandesh header parse FAILED");
+            return false;
+        }
+    }
+    const char *mname;
+    size_t mname_len;
+    p = ScanSpace(p, end);
+    if (ScanStartTag(p, end, &mname, &mname_len, &identifier,
+            &empty) == NULL) {
+        SANDESH_LOG(ERROR, __func__ << ": Message type NOT PRESENT");
+        return false;
+    }
+    message_type->assign(mname, mname_len);
+    *message_offset = p - reinterpret_cast<const char *>(data);
+    return true;
+}
+
 SandeshXMLMessageBuilder SandeshXMLMessageBuilder::instance_;
 
 SandeshXMLMessageBuilder::SandeshXMLMessageBuilder() {
 }
 
+SandeshXMLMessageBuilder::~SandeshXMLMessageBuilder() {
+    for (std::vector<SandeshXMLMessage *>::iterator it = free_list_.begin();
+         it != free_list_.end(); ++it) {
+        delete *it;
+    }
+}
+
 SandeshXMLMessageBuilder *SandeshXMLMessageBuilder::GetInstance() {
     return &instance_;
 }
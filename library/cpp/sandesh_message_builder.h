@@ -5,6 +5,8 @@
 #ifndef __SANDESH_MESSAGE_BUILDER_H__
 #define __SANDESH_MESSAGE_BUILDER_H__
 
+#include <vector>
+#include <tbb/mutex.h>
 #include <pugixml/pugixml.hpp>
 
 #include <sandesh/sandesh_types.h>
@@ -30,16 +32,29 @@ protected:
 
 class SandeshXMLMessage : public SandeshMessage {
 public:
-    SandeshXMLMessage() {}
+    SandeshXMLMessage() : message_offset_(std::string::npos),
+        message_end_(0) {}
     virtual ~SandeshXMLMessage();
     virtual bool Parse(const uint8_t *data, size_t size);
+    // The message XML as received
     virtual const std::string ExtractMessage() const;
+    // Drop the DOM, and the buffer if its capacity is over max_buffer_size
+    void Clear(size_t max_buffer_size);
+    // Offset of the message start tag in the received XML, or
+    // std::string::npos if it could not be located
+    size_t GetMessageOffset() const { return message_offset_; }
     const pugi::xml_node& GetMessageNode() const { return message_node_; }
 
 protected:
     bool ParseHeader(const pugi::xml_node& root,
         SandeshHeader& header);
 
+    // The received XML, parsed in place, in a buffer that keeps its
+    // capacity when the message is reused. pugixml still allocates the
+    // DOM pages on every parse.
+    std::vector<char> buf_;
+    size_t message_offset_;
+    size_t message_end_;
     pugi::xml_document xdoc_;
     pugi::xml_node message_node_;
 
@@ -65,17 +80,39 @@ public:
         SYSLOG,
     };
     virtual SandeshMessage *Create(const uint8_t *data, size_t size) const = 0;
+    // Extract only the header, the message type and the offset of the
+    // message in data, so that the message can be dropped or routed
+    // before it is fully parsed. By default the message is parsed with
+    // Create(), which only yields the offset of XML messages.
+    virtual bool ScanHeader(const uint8_t *data, size_t size,
+        SandeshHeader *header, std::string *message_type,
+        uint32_t *message_offset) const;
+    // Hand back a message obtained from Create()
+    virtual void Release(const SandeshMessage *msg) const;
     static SandeshMessageBuilder *GetInstance(Type type);
 };
 
 class SandeshXMLMessageBuilder : public SandeshMessageBuilder {
 public:
+    // Released messages kept for reuse, along with their pugixml
+    // document and buffers
+    static const size_t kMaxPooledMessages = 128;
+    // Larger buffers are freed when the message is pooled
+    static const size_t kMaxPooledBufferSize = 64 * 1024;
+
     SandeshXMLMessageBuilder();
+    ~SandeshXMLMessageBuilder();
     virtual SandeshMessage *Create(const uint8_t *data, size_t size) const;
+    virtual bool ScanHeader(const uint8_t *data, size_t size,
+        SandeshHeader *header, std::string *message_type,
+        uint32_t *message_offset) const;
+    virtual void Release(const SandeshMessage *msg) const;
     static SandeshXMLMessageBuilder *GetInstance();
 
 private:
     static SandeshXMLMessageBuilder instance_;
+    mutable tbb::mutex mutex_;
+    mutable std::vector<SandeshXMLMessage *> free_list_;
     DISALLOW_COPY_AND_ASSIGN(SandeshXMLMessageBuilder);
 };
 
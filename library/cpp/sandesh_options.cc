@@ -38,6 +38,47 @@ void AddOptions(opt::options_description *sandesh_options,
          opt::value<uint32_t>()->default_value(
          g_sandesh_constants.DEFAULT_SANDESH_SEND_RATELIMIT),
          "System logs send rate limit in messages per second per message type")
+        ("SANDESH.uve_full_refresh_interval",
+         opt::value<uint32_t>()->default_value(0),
+         "Send only changed UVE attributes, with all attributes sent on "
+         "every Nth update of a UVE (0 to always send all attributes)")
+        ("SANDESH.uve_snapshot_file",
+         opt::value<std::string>()->default_value(""),
+         "File to save the UVE cache to, and restore it from on restart "
+         "(empty to disable)")
+        ("SANDESH.uve_snapshot_interval",
+         opt::value<uint32_t>()->default_value(60),
+         "Interval in seconds between saves of the UVE cache")
+        ("SANDESH.uve_snapshot_reconcile_time",
+         opt::value<uint32_t>()->default_value(300),
+         "Time in seconds after which restored UVEs that have not been "
+         "published again are deleted")
+        ("SANDESH.sandesh_ingest_workers",
+         opt::value<uint32_t>()->default_value(0),
+         "Process received sandesh messages in batches on the task of "
+         "their connection, bypassing the state machine events "
+         "(0 to disable)")
+        ("SANDESH.sandesh_flow_credits",
+         opt::bool_switch(&sandesh_config->sandesh_flow_credits),
+         "Grant generators credits to send messages, instead of dropping "
+         "them on receipt when overloaded")
+        ("SANDESH.sandesh_max_syncing_connections",
+         opt::value<uint32_t>()->default_value(0),
+         "Maximum number of generators resyncing their state at a time "
+         "after connecting (0 to disable admission control)")
+        ("SANDESH.sandesh_max_pending_admissions",
+         opt::value<uint32_t>()->default_value(256),
+         "Maximum number of generators waiting to resync, others are "
+         "asked to connect again later")
+        ("SANDESH.collector_fanout",
+         opt::value<uint32_t>()->default_value(1),
+         "Number of collectors each message is sent to at a time, not more "
+         "than the number of collectors configured")
+        ("SANDESH.sandesh_encode_on_send",
+         opt::bool_switch(&sandesh_config->sandesh_encode_on_send),
+         "Encode messages when they are sent, and queue the encoded bytes, "
+         "so that the send queue is accounted in bytes on the wire, with "
+         "the default send queue watermarks scaled to match")
         ;
 }
 
@@ -57,6 +98,29 @@ void ProcessOptions(const opt::variables_map &var_map,
                       "SANDESH.disable_object_logs");
     GetOptValue<uint32_t>(var_map, sandesh_config->system_logs_rate_limit,
                           "DEFAULT.sandesh_send_rate_limit");
+    GetOptValue<uint32_t>(var_map, sandesh_config->uve_full_refresh_interval,
+                          "SANDESH.uve_full_refresh_interval");
+    GetOptValue<std::string>(var_map, sandesh_config->uve_snapshot_file,
+                             "SANDESH.uve_snapshot_file");
+    GetOptValue<uint32_t>(var_map, sandesh_config->uve_snapshot_interval,
+                          "SANDESH.uve_snapshot_interval");
+    GetOptValue<uint32_t>(var_map,
+                          sandesh_config->uve_snapshot_reconcile_time,
+                          "SANDESH.uve_snapshot_reconcile_time");
+    GetOptValue<uint32_t>(var_map, sandesh_config->sandesh_ingest_workers,
+                          "SANDESH.sandesh_ingest_workers");
+    GetOptValue<bool>(var_map, sandesh_config->sandesh_flow_credits,
+                      "SANDESH.sandesh_flow_credits");
+    GetOptValue<uint32_t>(var_map,
+                          sandesh_config->sandesh_max_syncing_connections,
+                          "SANDESH.sandesh_max_syncing_connections");
+    GetOptValue<uint32_t>(var_map,
+                          sandesh_config->sandesh_max_pending_admissions,
+                          "SANDESH.sandesh_max_pending_admissions");
+    GetOptValue<uint32_t>(var_map, sandesh_config->collector_fanout,
+                          "SANDESH.collector_fanout");
+    GetOptValue<bool>(var_map, sandesh_config->sandesh_encode_on_send,
+                      "SANDESH.sandesh_encode_on_send");
 }
 
 }  // namespace options
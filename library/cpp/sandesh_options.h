@@ -18,7 +18,17 @@ struct SandeshConfig {
         introspect_ssl_enable(false),
         disable_object_logs(false),
         system_logs_rate_limit(
-            g_sandesh_constants.DEFAULT_SANDESH_SEND_RATELIMIT) {
+            g_sandesh_constants.DEFAULT_SANDESH_SEND_RATELIMIT),
+        uve_full_refresh_interval(0),
+        uve_snapshot_file(),
+        uve_snapshot_interval(60),
+        uve_snapshot_reconcile_time(300),
+        sandesh_ingest_workers(0),
+        sandesh_flow_credits(false),
+        sandesh_max_syncing_connections(0),
+        sandesh_max_pending_admissions(256),
+        collector_fanout(1),
+        sandesh_encode_on_send(false) {
     }
     ~SandeshConfig() {
     }
@@ -30,6 +40,16 @@ struct SandeshConfig {
     bool introspect_ssl_enable;
     bool disable_object_logs;
     uint32_t system_logs_rate_limit;
+    uint32_t uve_full_refresh_interval;
+    std::string uve_snapshot_file;
+    uint32_t uve_snapshot_interval;
+    uint32_t uve_snapshot_reconcile_time;
+    uint32_t sandesh_ingest_workers;
+    bool sandesh_flow_credits;
+    uint32_t sandesh_max_syncing_connections;
+    uint32_t sandesh_max_pending_admissions;
+    uint32_t collector_fanout;
+    bool sandesh_encode_on_send;
 };
 
 namespace sandesh {
@@ -150,13 +150,29 @@ void SandeshSendQueueStatus::HandleRequest() const {
     SendSandeshSendQueueResponse(context());
 }
 
+template <typename T>
+static void SetCollectorInfo(SandeshClientSM *sm, T *info) {
+    TcpServer::Endpoint server(sm->server());
+    info->set_ip(server.address().to_string());
+    info->set_port(server.port());
+    info->set_status(sm->StateName());
+    info->set_load(sm->collector_load());
+    info->set_connect_latency_usec(sm->connect_latency_usec());
+    info->set_failover_time_usec(sm->failover_time_usec());
+}
+
 void CollectorInfoRequest::HandleRequest() const {
     CollectorInfoResponse *resp (new CollectorInfoResponse());
     SandeshClient *client = Sandesh::client();
     if (client) {
-        resp->set_ip(client->sm_->server().address().to_string());
-        resp->set_port(client->sm_->server().port());
-        resp->set_status(client->sm_->StateName());
+        SetCollectorInfo(client->sm_.get(), resp);
+        std::vector<CollectorConnectionInfo> collectors;
+        for (size_t i = 0; i < client->active_fanout(); i++) {
+            CollectorConnectionInfo info;
+            SetCollectorInfo(client->StateMachine(i), &info);
+            collectors.push_back(info);
+        }
+        resp->set_collectors(collectors);
     }
     resp->set_context(context());
     resp->Response();
@@ -8,15 +8,19 @@
 // Sandesh server implementation
 //
 
+#include <algorithm>
 #include <boost/bind.hpp>
 #include <boost/assign.hpp>
 
+#include <base/timer.h>
 #include <sandesh/protocol/TXMLProtocol.h>
 #include <sandesh/sandesh_types.h>
 #include <sandesh/sandesh.h>
 #include <sandesh/sandesh_ctrl_types.h>
+#include <sandesh/sandesh_message_builder.h>
 #include "sandesh_connection.h"
 #include "sandesh_session.h"
+#include "sandesh_state_machine.h"
 #include "sandesh_server.h"
 
 using namespace std;
@@ -50,11 +54,19 @@ SandeshServer::SandeshServer(EventManager *evm, const SandeshConfig &config)
       sm_task_id_(TaskScheduler::GetInstance()->GetTaskId(kStateMachineTask)),
       session_reader_task_id_(TaskScheduler::GetInstance()->GetTaskId(kSessionReaderTask)),
       lifetime_mgr_task_id_(TaskScheduler::GetInstance()->GetTaskId(kLifetimeMgrTask)),
+      ingest_enabled_(config.sandesh_ingest_workers != 0),
+      flow_credits_(config.sandesh_flow_credits),
+      max_syncing_connections_(config.sandesh_max_syncing_connections),
+      max_pending_admissions_(config.sandesh_max_pending_admissions),
+      admission_timer_(NULL),
+      admission_wait_ticks_(0),
       lifetime_manager_(new LifetimeManager(lifetime_mgr_task_id_)),
       deleter_(new DeleteActor(this)) {
     // Set task policy for exclusion between :
     // 1. State machine and lifetime mgr since state machine delete happens
     //    in lifetime mgr task
+    // Ingest batches run on the state machine task instance of their
+    // connection, so they need no policy of their own.
     if (!task_policy_set_) {
         TaskPolicy lm_task_policy = boost::assign::list_of
                 (TaskExclusion(sm_task_id_))
@@ -62,6 +74,14 @@ SandeshServer::SandeshServer(EventManager *evm, const SandeshConfig &config)
         TaskScheduler::GetInstance()->SetPolicy(lifetime_mgr_task_id_, lm_task_policy);
         task_policy_set_ = true;
     }
+    if (AdmissionEnabled()) {
+        admission_timer_ = TimerManager::CreateTimer(*evm->io_service(),
+            "Sandesh admission timer");
+        admission_timer_->Start(kAdmissionTimerInterval,
+            boost::bind(&SandeshServer::AdmissionTimerExpired, this),
+            boost::bind(&SandeshServer::AdmissionTimerErrorHandler, this,
+                _1, _2));
+    }
     if (config.sandesh_ssl_enable) {
         boost::asio::ssl::context *ctx = context();
         boost::system::error_code ec;
@@ -109,6 +129,9 @@ SandeshServer::SandeshServer(EventManager *evm, const SandeshConfig &config)
 }
 
 SandeshServer::~SandeshServer() {
+    if (admission_timer_) {
+        TimerManager::DeleteTimer(admission_timer_);
+    }
     TcpServer::ClearSessions();
 }
 
@@ -160,6 +183,14 @@ void SandeshServer::FreeConnectionIndex(int id) {
     conn_bmap_.clear();
 }
 
+bool SandeshServer::ReceiveSandeshMsgBatch(SandeshSession *session,
+    const std::vector<const SandeshMessage *> &msgs, bool resource) {
+    for (size_t i = 0; i < msgs.size(); i++) {
+        ReceiveSandeshMsg(session, msgs[i], resource);
+    }
+    return true;
+}
+
 TcpSession *SandeshServer::CreateSession() {
     typedef boost::asio::detail::socket_option::boolean<
 #ifdef __APPLE__
@@ -267,10 +298,103 @@ bool SandeshServer::ReceiveSandeshCtrlMsg(SandeshStateMachine *sm,
     }
     SANDESH_LOG(DEBUG, "Received Ctrl Message from " << snh->get_module_name());
     std::vector<UVETypeInfo> vu;
-    SandeshCtrlServerToClient::Request(vu, true, "ctrl", session->connection());
+    SandeshCtrlServerToClient *csnh = new SandeshCtrlServerToClient();
+    csnh->set_type_info(vu);
+    csnh->set_success(true);
+    csnh->set_load(ConnectionsCount());
+    csnh->set_context("ctrl");
+    csnh->Dispatch(session->connection());
     return true;
 }
 
+// Generators resync their state, sending all their UVEs, once the reply to
+// their control message is received. Connections beyond the syncing limit
+// wait for a slot with their control message held, and once the pending
+// list is full too the generators are asked to connect again later
+SandeshServer::AdmissionResult SandeshServer::Admit(
+        SandeshStateMachine *state_machine) {
+    tbb::mutex::scoped_lock lock(admission_mutex_);
+    if (admission_syncing_.find(state_machine) != admission_syncing_.end()) {
+        return ADMITTED;
+    }
+    if (std::find(admission_pending_.begin(), admission_pending_.end(),
+            state_machine) != admission_pending_.end()) {
+        return DEFERRED;
+    }
+    if (admission_syncing_.size() < max_syncing_connections_ &&
+        admission_pending_.empty()) {
+        admission_syncing_.insert(std::make_pair(state_machine,
+            ClockMonotonicUsec()));
+        return ADMITTED;
+    }
+    if (admission_pending_.size() < max_pending_admissions_) {
+        admission_pending_.push_back(state_machine);
+        return DEFERRED;
+    }
+    return REJECTED;
+}
+
+void SandeshServer::ReleaseAdmission(SandeshStateMachine *state_machine) {
+    tbb::mutex::scoped_lock lock(admission_mutex_);
+    admission_pending_.remove(state_machine);
+    if (admission_syncing_.erase(state_machine)) {
+        AdmitPendingLocked();
+    }
+}
+
+// Spread the reconnects out over the retry interval
+uint32_t SandeshServer::AdmissionRetryTime(int connection_index) const {
+    uint32_t spread(connection_index < 0 ? 0 :
+        connection_index % kAdmissionRetryTime);
+    return (kAdmissionRetryTime + spread) * 1000;
+}
+
+void SandeshServer::AdmitPendingLocked() {
+    while (admission_syncing_.size() < max_syncing_connections_ &&
+           !admission_pending_.empty()) {
+        SandeshStateMachine *state_machine(admission_pending_.front());
+        admission_pending_.pop_front();
+        admission_syncing_.insert(std::make_pair(state_machine,
+            ClockMonotonicUsec()));
+        state_machine->OnAdmitted();
+    }
+}
+
+// The collector is not told when a generator is done resyncing, so the
+// sync is taken as complete once the connection queue drains after a
+// minimum time, or after the maximum time
+bool SandeshServer::AdmissionTimerExpired() {
+    tbb::mutex::scoped_lock lock(admission_mutex_);
+    uint64_t now(ClockMonotonicUsec());
+    for (AdmissionSyncMap::iterator it = admission_syncing_.begin();
+         it != admission_syncing_.end();) {
+        SandeshStateMachine *state_machine(it->first);
+        uint64_t duration(now - it->second);
+        if (duration >= kMaxSyncTime ||
+            (duration >= kMinSyncTime && state_machine->IsSyncDone())) {
+            state_machine->AdmissionSynced(duration);
+            admission_syncing_.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+    AdmitPendingLocked();
+    if (++admission_wait_ticks_ >= kAdmissionWaitRefresh) {
+        admission_wait_ticks_ = 0;
+        for (AdmissionPendingList::const_iterator it =
+             admission_pending_.begin(); it != admission_pending_.end();
+             ++it) {
+            (*it)->OnAdmissionWait();
+        }
+    }
+    return true;
+}
+
+void SandeshServer::AdmissionTimerErrorHandler(std::string name,
+                                               std::string error) {
+    SANDESH_LOG(ERROR, name + " error: " + error);
+}
+
 LifetimeActor *SandeshServer::deleter() {
     return deleter_.get();
 }
@@ -15,8 +15,12 @@
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/ptr_container/ptr_map.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/dynamic_bitset.hpp>
+#include <list>
+#include <map>
 #include <base/lifetime.h>
+#include <base/queue_task.h>
 #include <sandesh/sandesh.h>
 #include <io/ssl_server.h>
 #include <io/tcp_session.h>
@@ -27,6 +31,7 @@ class SandeshStateMachine;
 class LifetimeActor;
 class LifetimeManager;
 class SandeshMessage;
+class Timer;
 
 class SandeshServer : public SslServer {
 public:
@@ -51,6 +56,9 @@ public:
             bool rsc) { return true; } 
     virtual bool ReceiveSandeshMsg(SandeshSession *session,
         const SandeshMessage *msg, bool resource) = 0;
+    // Batch of messages in the order received on the session
+    virtual bool ReceiveSandeshMsgBatch(SandeshSession *session,
+        const std::vector<const SandeshMessage *> &msgs, bool resource);
     virtual bool ReceiveSandeshCtrlMsg(SandeshStateMachine *state_machine,
             SandeshSession *session, const Sandesh *sandesh);
     virtual void DisconnectSession(SandeshSession *session) {}
@@ -58,6 +66,27 @@ public:
     int AllocConnectionIndex();
     void FreeConnectionIndex(int);
 
+    // Data messages received in established state bypass the connection
+    // state machine events and are processed in batches, on the task
+    // instance of the state machine
+    bool IngestEnabled() const { return ingest_enabled_; }
+    // Generators are granted credits to send the messages that would
+    // otherwise be dropped on receipt
+    bool FlowCreditsEnabled() const { return flow_credits_; }
+
+    // Admission control of generators resyncing their state on connect,
+    // to spread out the load of reconnect storms
+    enum AdmissionResult {
+        ADMITTED,
+        DEFERRED,
+        REJECTED,
+    };
+    bool AdmissionEnabled() const { return max_syncing_connections_ != 0; }
+    AdmissionResult Admit(SandeshStateMachine *state_machine);
+    void ReleaseAdmission(SandeshStateMachine *state_machine);
+    uint32_t AdmissionRetryTime(int connection_index) const;
+    uint32_t AdmissionWaitTime() const { return kAdmissionWaitTime; }
+
 protected:
     virtual SslSession *AllocSession(SslSocket *socket);
     virtual bool AcceptSession(TcpSession *session);
@@ -67,6 +96,14 @@ protected:
 
 private:
     static const int kMaxInitRetries = 5;
+    static const int kAdmissionTimerInterval = 1000; // msec
+    static const uint64_t kMinSyncTime = 5 * 1000000; // usec
+    static const uint64_t kMaxSyncTime = 120 * 1000000; // usec
+    static const uint32_t kAdmissionRetryTime = 30; // sec
+    // Deferred generators are told to wait again every few admission timer
+    // intervals, well within the time they are told to wait
+    static const uint32_t kAdmissionWaitTime = 15000; // msec
+    static const int kAdmissionWaitRefresh = 5;
     static const std::string kSessionReaderTask;
     static const std::string kStateMachineTask;
     static const std::string kLifetimeMgrTask;
@@ -74,6 +111,7 @@ private:
     
     class DeleteActor;
     friend class DeleteActor;
+    friend class SandeshServerStateMachineTest;
 
     typedef boost::ptr_map<boost::asio::ip::tcp::endpoint,
                            SandeshConnection> SandeshConnectionMap;
@@ -82,11 +120,29 @@ private:
                    SandeshConnection *const> SandeshConnectionPair;
     bool Compare(const Endpoint &peer_addr, const SandeshConnectionPair &) const;
 
+    // Syncing connections with the time they were admitted at
+    typedef std::map<SandeshStateMachine *, uint64_t> AdmissionSyncMap;
+    typedef std::list<SandeshStateMachine *> AdmissionPendingList;
+    void AdmitPendingLocked();
+    void StartAdmissionTimerLocked();
+    bool AdmissionTimerExpired();
+    void AdmissionTimerErrorHandler(std::string name, std::string error);
+
     SandeshConnectionMap connection_;
     boost::dynamic_bitset<> conn_bmap_;
     int sm_task_id_;
     int session_reader_task_id_;
     int lifetime_mgr_task_id_;
+    bool ingest_enabled_;
+    bool flow_credits_;
+    uint32_t max_syncing_connections_;
+    uint32_t max_pending_admissions_;
+    AdmissionSyncMap admission_syncing_;
+    AdmissionPendingList admission_pending_;
+    Timer *admission_timer_;
+    int admission_wait_ticks_;
+    // Protect admission sync map and pending list
+    tbb::mutex admission_mutex_;
     boost::scoped_ptr<LifetimeManager> lifetime_manager_;
     boost::scoped_ptr<DeleteActor> deleter_;
     // Protect connection map and bmap
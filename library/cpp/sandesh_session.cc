@@ -8,6 +8,7 @@
 // Sandesh session
 //
 
+#include <algorithm>
 #include <boost/bind.hpp>
 #include <boost/assign.hpp>
 #include <boost/algorithm/string.hpp>
@@ -18,8 +19,11 @@
 #include <sandesh/common/vns_constants.h>
 #include <sandesh/transport/TBufferTransports.h>
 #include <sandesh/protocol/TXMLProtocol.h>
+#include <sandesh/protocol/TXMLNumber.h>
 #include "sandesh/sandesh_types.h"
 #include "sandesh/sandesh.h"
+#include "sandesh/sandesh_ctrl_types.h"
+#include "sandesh/sandesh_message_builder.h"
 
 #include "sandesh_connection.h"
 #include "sandesh_session.h"
@@ -69,14 +73,56 @@ void SandeshWriter::WriteReady(const boost::system::error_code &ec) {
     session_->send_queue()->MayBeStartRunner();
 }
 
-void SandeshWriter::SendMsg(Sandesh *sandesh, bool more) {
+// Free list of encode buffers, shared by the sessions and the senders
+// encoding messages. It is never deleted, since encoded messages can be
+// released during static destruction
+struct SandeshEncodeBufferPool {
+    tbb::mutex mutex_;
+    std::vector<TMemoryBuffer *> buffers_;
+};
+
+static SandeshEncodeBufferPool *EncodeBufferPool() {
+    static SandeshEncodeBufferPool *pool = new SandeshEncodeBufferPool;
+    return pool;
+}
+
+boost::shared_ptr<TMemoryBuffer> SandeshWriter::AllocEncodeBuffer() {
+    SandeshEncodeBufferPool *pool(EncodeBufferPool());
+    TMemoryBuffer *buffer(NULL);
+    {
+        tbb::mutex::scoped_lock lock(pool->mutex_);
+        if (!pool->buffers_.empty()) {
+            buffer = pool->buffers_.back();
+            pool->buffers_.pop_back();
+        }
+    }
+    if (buffer == NULL) {
+        buffer = new TMemoryBuffer(kEncodeBufferSize);
+    }
+    return boost::shared_ptr<TMemoryBuffer>(buffer,
+        &SandeshWriter::FreeEncodeBuffer);
+}
+
+void SandeshWriter::FreeEncodeBuffer(TMemoryBuffer *buffer) {
+    buffer->resetBuffer();
+    if (buffer->available_write() <= kEncodeBufferPoolMaxSize) {
+        SandeshEncodeBufferPool *pool(EncodeBufferPool());
+        tbb::mutex::scoped_lock lock(pool->mutex_);
+        if (pool->buffers_.size() < kEncodeBufferPoolSize) {
+            pool->buffers_.push_back(buffer);
+            return;
+        }
+    }
+    delete buffer;
+}
+
+boost::shared_ptr<TMemoryBuffer> SandeshWriter::Encode(Sandesh *sandesh,
+        SandeshTxDropReason::type *reason) {
     SandeshHeader header;
-    std::stringstream ss;
     uint8_t *buffer;
     int32_t xfer = 0, ret;
     uint32_t offset;
-    boost::shared_ptr<TMemoryBuffer> btrans(
-                    new TMemoryBuffer(kEncodeBufferSize));
+    boost::shared_ptr<TMemoryBuffer> btrans(AllocEncodeBuffer());
     boost::shared_ptr<TXMLProtocol> prot(
                     new TXMLProtocol(btrans));
     // Populate the header
@@ -99,16 +145,13 @@ void SandeshWriter::SendMsg(Sandesh *sandesh, bool more) {
     memcpy(buffer, sandesh_open_.c_str(), sandesh_open_.length());
     btrans->wroteBytes(sandesh_open_.length());
     // Write the sandesh header
-    if ((ret = header.write(prot)) < 0) {
+    if ((ret = header.write(prot.get())) < 0) {
         SANDESH_LOG(ERROR, __func__ << ": Sandesh header write FAILED: " <<
             sandesh->Name() << " : " << sandesh->source() << ":" <<
             sandesh->module() << ":" << sandesh->instance_id() <<
             " Sequence Number:" << sandesh->seqnum());
-        session_->increment_send_msg_fail();
-        Sandesh::UpdateTxMsgFailStats(sandesh->Name(), 0,
-            SandeshTxDropReason::HeaderWriteFailed);
-        sandesh->Release();
-        return;
+        *reason = SandeshTxDropReason::HeaderWriteFailed;
+        return boost::shared_ptr<TMemoryBuffer>();
     }
     xfer += ret;
     // Write the sandesh
@@ -117,11 +160,8 @@ void SandeshWriter::SendMsg(Sandesh *sandesh, bool more) {
             sandesh->Name() << " : " << sandesh->source() << ":" <<
             sandesh->module() << ":" << sandesh->instance_id() <<
             " Sequence Number:" << sandesh->seqnum());
-        session_->increment_send_msg_fail();
-        Sandesh::UpdateTxMsgFailStats(sandesh->Name(), 0,
-            SandeshTxDropReason::WriteFailed);
-        sandesh->Release();
-        return;
+        *reason = SandeshTxDropReason::WriteFailed;
+        return boost::shared_ptr<TMemoryBuffer>();
     }
     xfer += ret;
     // Write the sandesh close envelope
@@ -133,19 +173,55 @@ void SandeshWriter::SendMsg(Sandesh *sandesh, bool more) {
     // Sanity
     assert(sandesh_open_.length() + xfer + sandesh_close_.length() ==
             offset);
-    // Update the sandesh open envelope length;
-    char prev = ss.fill('0');
+    // Update the sandesh open envelope length, zero padded
+    char length[kXMLNumberMaxLength];
+    uint32_t length_size = xmlFormatUnsigned(length, offset);
     // Adjust for '">'
-    ss.width(sandesh_open_.length() - sandesh_open_attr_length_.length() - 2);
-    ss << offset;
-    ss.fill(prev);
-    memcpy(buffer + sandesh_open_attr_length_.length(), ss.str().c_str(),
-            ss.str().length());
+    size_t width = sandesh_open_.length() -
+            sandesh_open_attr_length_.length() - 2;
+    uint8_t *lbuffer = buffer + sandesh_open_attr_length_.length();
+    if (length_size < width) {
+        memset(lbuffer, '0', width - length_size);
+        lbuffer += width - length_size;
+    }
+    memcpy(lbuffer, length, length_size);
+    return btrans;
+}
+
+void SandeshWriter::SendMsg(Sandesh *sandesh, bool more) {
+    SandeshTxDropReason::type reason;
+    boost::shared_ptr<TMemoryBuffer> btrans(Encode(sandesh, &reason));
+    if (!btrans) {
+        session_->increment_send_msg_fail();
+        Sandesh::UpdateTxMsgFailStats(sandesh->Name(), 0, reason);
+        sandesh->Release();
+        return;
+    }
+    uint8_t *buffer;
+    uint32_t offset;
+    btrans->getBuffer(&buffer, &offset);
 
     // Update sandesh stats
     Sandesh::UpdateTxMsgStats(sandesh->Name(), offset);
     session_->increment_send_msg();
 
+    SendEncoded(btrans, more);
+    sandesh->Release();
+}
+
+// The buffer of an encoded message is shared with the other sessions it
+// is queued to, and is only read from here
+void SandeshWriter::SendEncodedMsg(const SandeshEncodedMessage &msg,
+        bool more) {
+    if (msg.FirstSend()) {
+        Sandesh::UpdateTxMsgStats(msg.name_, msg.size_);
+    }
+    session_->increment_send_msg();
+    SendEncoded(msg.buffer_, more);
+}
+
+void SandeshWriter::SendEncoded(boost::shared_ptr<TMemoryBuffer> btrans,
+        bool more) {
     if (send_buf()) {
         if (more) {
             // There are more messages in the send_queue_. 
@@ -161,7 +237,6 @@ void SandeshWriter::SendMsg(Sandesh *sandesh, bool more) {
         // Send the message
         SendInternal(btrans);
     }
-    sandesh->Release();
 }
 
 // Package as many sandesh messages as possible [not more than 
@@ -293,6 +368,9 @@ SandeshSession::SandeshSession(SslServer *client, SslSocket *socket,
     tcp_user_timeout_(kSessionTcpUserTimeout),
     reader_task_id_(reader_task_id),
     sending_level_(SandeshLevel::INVALID) {
+    std::fill(flow_credits_, flow_credits_ + kFlowCreditLevels, -1);
+    flow_credit_shed_ = 0;
+    flow_credit_blocked_ = false;
     if (Sandesh::role() == Sandesh::SandeshRole::Collector) {
         send_buffer_queue_.reset(new Sandesh::SandeshBufferQueue(writer_task_id,
                 task_instance,
@@ -303,11 +381,12 @@ SandeshSession::SandeshSession(SslServer *client, SslSocket *socket,
 }
 
 SandeshSession::~SandeshSession() {
+    DropFlowCreditHeld();
 }
 
 bool SandeshSession::SessionSendReady() {
     return (IsEstablished() && writer_->SendReady() &&
-            Sandesh::IsSendQueueEnabled());
+            Sandesh::IsSendQueueEnabled() && !flow_credit_blocked_);
 }
 
 void SandeshSession::SetSendQueueWaterMark(
@@ -340,11 +419,135 @@ SandeshLevel::type SandeshSession::SendingLevel() const {
     return sending_level_;
 }
 
+void SandeshSession::SetFlowCredits(
+    const std::vector<SandeshFlowCredit> &credits) {
+    {
+        tbb::mutex::scoped_lock lock(send_mutex_);
+        std::fill(flow_credits_, flow_credits_ + kFlowCreditLevels, -1);
+        uint32_t shed(0);
+        for (size_t i = 0; i < credits.size(); i++) {
+            uint32_t level(credits[i].get_level());
+            if (level < static_cast<uint32_t>(kFlowCreditLevels)) {
+                flow_credits_[level] = credits[i].get_credits();
+                if (flow_credits_[level] == 0) {
+                    shed |= 1 << level;
+                }
+            }
+        }
+        flow_credit_shed_ = shed;
+        // The held message goes out ahead of those still queued
+        if (flow_credit_blocked_) {
+            SandeshElement element(flow_credit_held_);
+            flow_credit_held_ = SandeshElement();
+            flow_credit_blocked_ = false;
+            if (!IsEstablished()) {
+                DropElement(element,
+                    SandeshTxDropReason::SessionNotConnected);
+            } else if (FlowCreditAdmit(element)) {
+                SendElement(element);
+            }
+        }
+        if (flow_credit_blocked_) {
+            return;
+        }
+    }
+    send_queue_->MayBeStartRunner();
+}
+
+bool SandeshSession::IsFlowControlled(SandeshType::type stype) {
+    return stype == SandeshType::SYSTEM ||
+        stype == SandeshType::OBJECT ||
+        stype == SandeshType::FLOW ||
+        stype == SandeshType::SESSION;
+}
+
+bool SandeshSession::FlowCreditShed(SandeshType::type stype,
+    SandeshLevel::type level) const {
+    if (!IsFlowControlled(stype) || level < 0 ||
+        level >= kFlowCreditLevels) {
+        return false;
+    }
+    return (flow_credit_shed_ & (1 << level)) != 0;
+}
+
+// Called with the send mutex held
+bool SandeshSession::ConsumeFlowCredit(SandeshType::type stype, int level) {
+    if (!IsFlowControlled(stype)) {
+        return true;
+    }
+    if (level < 0 || level >= kFlowCreditLevels ||
+        flow_credits_[level] < 0) {
+        return true;
+    }
+    if (flow_credits_[level] == 0) {
+        return false;
+    }
+    flow_credits_[level]--;
+    return true;
+}
+
+// Called with the send mutex held. Returns false if the element is not
+// to be sent now: it is dropped if its level is granted no credits, and
+// held back, stopping the send queue, if its level ran out of credits.
+// The messages behind it stay queued, subject to the watermarks
+bool SandeshSession::FlowCreditAdmit(const SandeshElement &element) {
+    SandeshType::type stype(element.encoded_ ? element.encoded_->type_ :
+        element.snh_->type());
+    SandeshLevel::type level(element.encoded_ ? element.encoded_->level_ :
+        element.snh_->level());
+    if (FlowCreditShed(stype, level)) {
+        DropElement(element, SandeshTxDropReason::NoCredits);
+        return false;
+    }
+    if (!ConsumeFlowCredit(stype, level)) {
+        flow_credit_held_ = element;
+        flow_credit_blocked_ = true;
+        return false;
+    }
+    return true;
+}
+
+// Called with the send mutex held
+void SandeshSession::SendElement(const SandeshElement &element) {
+    bool more = !send_queue_->IsQueueEmpty();
+    if (element.encoded_) {
+        // The message was logged when encoded
+        writer_->SendEncodedMsg(*element.encoded_, more);
+        return;
+    }
+    if (element.snh_->IsLoggingAllowed()) {
+        element.snh_->Log();
+    }
+    writer_->SendMsg(element.snh_, more);
+}
+
+void SandeshSession::DropElement(const SandeshElement &element,
+    SandeshTxDropReason::type reason) {
+    increment_send_msg_fail();
+    if (element.encoded_) {
+        Sandesh::UpdateTxMsgFailStats(element.encoded_->name_, 0, reason);
+        return;
+    }
+    Sandesh::UpdateTxMsgFailStats(element.snh_->Name(), 0, reason);
+    element.snh_->Release();
+}
+
+void SandeshSession::DropFlowCreditHeld() {
+    tbb::mutex::scoped_lock lock(send_mutex_);
+    if (!flow_credit_blocked_) {
+        return;
+    }
+    DropElement(flow_credit_held_, SandeshTxDropReason::SessionNotConnected);
+    flow_credit_held_ = SandeshElement();
+    flow_credit_blocked_ = false;
+}
+
 void SandeshSession::Shutdown() {
     if (Sandesh::role() == Sandesh::SandeshRole::Collector) {
         send_buffer_queue_->Shutdown();
     }
     send_queue_->Shutdown();
+    DropFlowCreditHeld();
 }
 
 std::string SandeshSession::ToString() const {
@@ -367,24 +570,20 @@ void SandeshSession::OnRead(Buffer buffer) {
 }
 
 bool SandeshSession::SendMsg(SandeshElement element) {
-    Sandesh *sandesh = element.snh_;
     tbb::mutex::scoped_lock lock(send_mutex_);
     if (!IsEstablished()) {
-        if (Sandesh::IsLoggingDroppedAllowed(sandesh->type())) {
+        if (!element.encoded_ &&
+            Sandesh::IsLoggingDroppedAllowed(element.snh_->type())) {
             SANDESH_LOG(ERROR, __func__ << " Not Connected : Dropping Message: " <<
-                sandesh->ToString());
+                element.snh_->ToString());
         }
-        increment_send_msg_fail();
-        Sandesh::UpdateTxMsgFailStats(sandesh->Name(), 0,
-            SandeshTxDropReason::SessionNotConnected);
-        sandesh->Release();
+        DropElement(element, SandeshTxDropReason::SessionNotConnected);
         return true;
     }
-    if (sandesh->IsLoggingAllowed()) {
-        sandesh->Log();
+    if (!FlowCreditAdmit(element)) {
+        return true;
     }
-    bool more = !send_queue_->IsQueueEmpty();
-    writer_->SendMsg(sandesh, more);
+    SendElement(element);
     return true;
 }
 
@@ -467,27 +666,16 @@ SandeshReader::SandeshReader(SandeshSession *session) :
 SandeshReader::~SandeshReader() {
 }
 
+// Shared by the generator and the collector, so that the header of a
+// message is decoded once, without setting up a Thrift reader
 int SandeshReader::ExtractMsgHeader(const std::string& msg,
         SandeshHeader& header, std::string& msg_type, uint32_t& header_offset) {
-    int32_t xfer = 0, ret;
-    boost::shared_ptr<TMemoryBuffer> btrans =
-            boost::shared_ptr<TMemoryBuffer>(
-                    new TMemoryBuffer((uint8_t *)msg.c_str(), msg.size()));
-    boost::shared_ptr<TXMLProtocol> prot =
-            boost::shared_ptr<TXMLProtocol>(new TXMLProtocol(btrans));
-    // Read the sandesh header and note the offset
-    if ((ret = header.read(prot)) <= 0) {
+    if (!SandeshXMLMessageBuilder::GetInstance()->ScanHeader(
+            reinterpret_cast<const uint8_t *>(msg.c_str()), msg.size(),
+            &header, &msg_type, &header_offset)) {
         SANDESH_LOG(ERROR, __func__ << ": Sandesh header read FAILED: " << msg);
         return EINVAL;
     }
-    xfer += ret;
-    header_offset = xfer;
-    // Extract the message name
-    if ((ret = prot->readSandeshBegin(msg_type)) <= 0) {
-        SANDESH_LOG(ERROR, __func__ << ": Sandesh begin read FAILED: " << msg);
-        return EINVAL;
-    }
-    xfer += ret;
     return 0;
 }
 
@@ -537,9 +725,7 @@ bool SandeshReader::ExtractMsgLength(size_t &msg_length, int *result) {
             SandeshWriter::sandesh_open_attr_length_.size();
     // Adjust for double quote
     --end;
-    string length = string(st, end);
-
-    stringToInteger(length.c_str(), msg_length);
+    xmlParseInteger(&*st, &*end, msg_length);
     if (msg_length == 0) {
 	*result = -3;
 	return false;
@@ -11,6 +11,7 @@
 #ifndef __SANDESH_SESSION_H__
 #define __SANDESH_SESSION_H__
 
+#include <tbb/atomic.h>
 #include <tbb/mutex.h>
 
 #include <boost/system/error_code.hpp>
@@ -32,10 +33,20 @@ class SandeshWriter {
 public:
     static const uint32_t kEncodeBufferSize = 2048;
     static const unsigned int kDefaultSendSize = 16384;
+    // Encode buffers are reused once the message is sent, up to
+    // kEncodeBufferPoolSize of them, unless grown beyond
+    // kEncodeBufferPoolMaxSize
+    static const size_t kEncodeBufferPoolSize = 1024;
+    static const uint32_t kEncodeBufferPoolMaxSize = 65536;
 
     SandeshWriter(SandeshSession *session);
     ~SandeshWriter();
+    // Encode the sandesh and its header in the sandesh envelope. Returns
+    // an empty buffer, and sets the drop reason, on failure
+    static boost::shared_ptr<TMemoryBuffer> Encode(Sandesh *sandesh,
+            SandeshTxDropReason::type *reason);
     void SendMsg(Sandesh *sandesh, bool more);
+    void SendEncodedMsg(const SandeshEncodedMessage &msg, bool more);
     void SendBuffer(boost::shared_ptr<TMemoryBuffer> sbuffer,
             bool more = false) {
         SendInternal(sbuffer);
@@ -62,6 +73,9 @@ private:
 
     SandeshSession *session_;
 
+    static boost::shared_ptr<TMemoryBuffer> AllocEncodeBuffer();
+    static void FreeEncodeBuffer(TMemoryBuffer *buffer);
+    void SendEncoded(boost::shared_ptr<TMemoryBuffer> btrans, bool more);
     void SendInternal(boost::shared_ptr<TMemoryBuffer>);
     void ConnectTimerExpired(const boost::system::error_code &error);
     size_t send_buf_offset() { return send_buf_offset_; }
@@ -136,6 +150,7 @@ private:
 };
 
 class SandeshConnection;
+class SandeshFlowCredit;
 
 class SandeshSession : public SslSession {
 public:
@@ -210,6 +225,16 @@ public:
     void SetSendQueueWaterMark(Sandesh::QueueWaterMarkInfo &wm_info);
     void ResetSendQueueWaterMark();
     SandeshLevel::type SendingLevel() const;
+    // Credits granted by the collector. Sending stops when a level runs
+    // out of credits, until the next grant
+    void SetFlowCredits(const std::vector<SandeshFlowCredit> &credits);
+    // Messages at levels granted no credits are dropped by the sender,
+    // before they are encoded or queued
+    bool FlowCreditShed(SandeshType::type stype,
+        SandeshLevel::type level) const;
+    // Message types that the collector drops when overloaded, and hence
+    // are flow controlled
+    static bool IsFlowControlled(SandeshType::type stype);
 
 protected:
     virtual int reader_task_id() const {
@@ -225,11 +250,18 @@ private:
     static const int kSessionKeepaliveProbes = 5; // count
     static const int kSessionTcpUserTimeout = 30000; // ms
     static const int kQueueSize = 200 * 1024 * 1024; // 200 MB
+    static const int kFlowCreditLevels = SandeshLevel::SYS_DEBUG + 1;
 
     bool SendMsg(SandeshElement element);
     bool SendBuffer(boost::shared_ptr<TMemoryBuffer> sbuffer);
     bool SessionSendReady();
     void SetSendingLevel(size_t count, SandeshLevel::type level);
+    bool ConsumeFlowCredit(SandeshType::type stype, int level);
+    bool FlowCreditAdmit(const SandeshElement &element);
+    void SendElement(const SandeshElement &element);
+    void DropElement(const SandeshElement &element,
+        SandeshTxDropReason::type reason);
+    void DropFlowCreditHeld();
 
     int instance_;
     boost::scoped_ptr<SandeshWriter> writer_;
@@ -245,6 +277,15 @@ private:
     int tcp_user_timeout_;
     int reader_task_id_;
     SandeshLevel::type sending_level_;
+    // Credits left per level, -1 if the level is not flow controlled.
+    // Protected by the send mutex
+    int64_t flow_credits_[kFlowCreditLevels];
+    // Bit per level granted no credits
+    tbb::atomic<uint32_t> flow_credit_shed_;
+    // The message dequeued when its level ran out of credits, sent first
+    // on the next grant. The send queue is not run until then
+    SandeshElement flow_credit_held_;
+    tbb::atomic<bool> flow_credit_blocked_;
 
     // Session statistics
     SandeshSessionStats sstats_;
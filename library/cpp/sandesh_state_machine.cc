@@ -31,8 +31,10 @@
 #include <sandesh/sandesh_session.h>
 #include <sandesh/sandesh_uve_types.h>
 #include <sandesh/sandesh_message_builder.h>
+#include <sandesh/sandesh_ctrl_types.h>
 #include "sandesh_statistics.h"
 #include "sandesh_connection.h"
+#include "sandesh_server.h"
 #include "sandesh_state_machine.h"
 
 using namespace std;
@@ -85,6 +87,18 @@ struct EvIdleHoldTimerExpired : sc::event<EvIdleHoldTimerExpired> {
     Timer *timer_;
 };
 
+struct EvRejectCloseTimerExpired : sc::event<EvRejectCloseTimerExpired> {
+    EvRejectCloseTimerExpired(Timer *timer)  : timer_(timer) {
+    }
+    static const char * Name() {
+        return "EvRejectCloseTimerExpired";
+    }
+    bool validate() const {
+        return !timer_->cancelled();
+    }
+    Timer *timer_;
+};
+
 struct EvTcpPassiveOpen : sc::event<EvTcpPassiveOpen> {
     EvTcpPassiveOpen(SandeshSession *session) : session(session) {
         SESSION_LOG(session);
@@ -121,7 +135,12 @@ struct EvTcpDeleteSession : sc::event<EvTcpDeleteSession> {
 };
 
 struct EvSandeshMessageRecv : sc::event<EvSandeshMessageRecv> {
-    EvSandeshMessageRecv(const SandeshMessage *msg) :
+    EvSandeshMessageRecv(const SandeshMessage *msg,
+            const SandeshMessageBuilder *builder) :
+        msg(msg, boost::bind(&SandeshMessageBuilder::Release, builder, _1)) {
+    };
+    explicit EvSandeshMessageRecv(
+            const boost::shared_ptr<const SandeshMessage> &msg) :
         msg(msg) {
     };
     static const char * Name() {
@@ -131,19 +150,38 @@ struct EvSandeshMessageRecv : sc::event<EvSandeshMessageRecv> {
 };
 
 struct EvSandeshCtrlMessageRecv : sc::event<EvSandeshCtrlMessageRecv> {
-    EvSandeshCtrlMessageRecv(const std::string &msg,
-            const SandeshHeader& header,
-            const std::string &msg_type, const uint32_t &header_offset) :
-        msg(msg), header(header), msg_type(msg_type),
-        header_offset(header_offset) {
+    EvSandeshCtrlMessageRecv(Sandesh *snh, const SandeshHeader& header) :
+        snh(snh, boost::bind(&Sandesh::Release, _1)), header(header) {
     };
     static const char * Name() {
         return "EvSandeshCtrlMessageRecv";
     }
-    const std::string msg;
+    boost::shared_ptr<Sandesh> snh;
     const SandeshHeader header;
-    const std::string msg_type;
-    const uint32_t header_offset;
+};
+
+// Processing of messages handed over to the ingest queue failed
+struct EvSandeshIngestFail : sc::event<EvSandeshIngestFail> {
+    EvSandeshIngestFail(SandeshSession *session) : session(session) {
+    };
+    static const char * Name() {
+        return "EvSandeshIngestFail";
+    }
+    SandeshSession *session;
+};
+
+// Deferred admission to resync granted by the server
+struct EvAdmitted : sc::event<EvAdmitted> {
+    static const char * Name() {
+        return "EvAdmitted";
+    }
+};
+
+// Deferred admission still pending at the server
+struct EvAdmissionWait : sc::event<EvAdmissionWait> {
+    static const char * Name() {
+        return "EvAdmissionWait";
+    }
 };
 
 struct EvResourceUpdate : sc::event<EvResourceUpdate> {
@@ -275,17 +313,27 @@ struct ServerInit : public sc::state<ServerInit, SandeshStateMachine> {
         TransitToIdle<EvStop>::reaction,
         sc::custom_reaction<EvTcpClose>,
         sc::custom_reaction<EvSandeshCtrlMessageRecv>,
+        sc::custom_reaction<EvAdmitted>,
+        sc::custom_reaction<EvAdmissionWait>,
+        sc::custom_reaction<EvRejectCloseTimerExpired>,
         sc::custom_reaction<EvSandeshMessageRecv>,
         DeleteTcpSession<EvTcpDeleteSession>::reaction
     > reactions;
 
-    ServerInit(my_context ctx) : my_base(ctx) {
+    ServerInit(my_context ctx) : my_base(ctx), established_(false) {
         SandeshStateMachine *state_machine = &context<SandeshStateMachine>();
         state_machine->set_state(ssm::SERVER_INIT);
         SM_LOG(DEBUG, state_machine->StateName());
     }
 
     ~ServerInit() {
+        SandeshStateMachine *state_machine = &context<SandeshStateMachine>();
+        state_machine->set_pending_ctrl_message(boost::shared_ptr<Sandesh>());
+        state_machine->CancelRejectCloseTimer();
+        // The admission is kept while resyncing in established state
+        if (!established_) {
+            state_machine->ReleaseAdmission();
+        }
     }
 
     sc::result react(const EvTcpClose &event) {
@@ -298,13 +346,57 @@ struct ServerInit : public sc::state<ServerInit, SandeshStateMachine> {
     sc::result react(const EvSandeshCtrlMessageRecv &event) {
         SandeshStateMachine *state_machine = &context<SandeshStateMachine>();
         SM_LOG(DEBUG, state_machine->StateName() << " : " << event.Name());
-        SandeshConnection *connection = state_machine->connection();
-        if (!connection->ProcessSandeshCtrlMessage(event.msg, event.header,
-                event.msg_type, event.header_offset)) {
-            state_machine->set_session(NULL);
-            return transit<Idle>();
+        SandeshServer *server = state_machine->admission_server();
+        if (server != NULL) {
+            state_machine->AdmissionAccepted();
+            switch (server->Admit(state_machine)) {
+            case SandeshServer::DEFERRED:
+                state_machine->AdmissionDeferred();
+                state_machine->set_pending_ctrl_message(event.snh);
+                return discard_event();
+            case SandeshServer::REJECTED:
+                // Give the generator the time to read the retry after
+                // message, and close the session if it does not
+                state_machine->AdmissionRejected();
+                state_machine->StartRejectCloseTimer();
+                return discard_event();
+            default:
+                state_machine->AdmissionAdmitted();
+                break;
+            }
         }
-        return transit<Established>();
+        return ProcessCtrlMessage(state_machine, event.snh.get());
+    }
+
+    sc::result react(const EvRejectCloseTimerExpired &event) {
+        SandeshStateMachine *state_machine = &context<SandeshStateMachine>();
+        SM_LOG(DEBUG, state_machine->StateName() << " : " << event.Name());
+        state_machine->set_session(NULL);
+        return transit<Idle>();
+    }
+
+    sc::result react(const EvAdmitted &event) {
+        SandeshStateMachine *state_machine = &context<SandeshStateMachine>();
+        SM_LOG(DEBUG, state_machine->StateName() << " : " << event.Name());
+        boost::shared_ptr<Sandesh> snh(state_machine->pending_ctrl_message());
+        // Admission granted to an earlier session
+        if (!snh || state_machine->admission_server()->Admit(state_machine) !=
+                SandeshServer::ADMITTED) {
+            return discard_event();
+        }
+        state_machine->set_pending_ctrl_message(boost::shared_ptr<Sandesh>());
+        state_machine->AdmissionAdmitted();
+        return ProcessCtrlMessage(state_machine, snh.get());
+    }
+
+    // Keep the generator waiting for the reply to its control message
+    sc::result react(const EvAdmissionWait &event) {
+        SandeshStateMachine *state_machine = &context<SandeshStateMachine>();
+        SM_LOG(DEBUG, state_machine->StateName() << " : " << event.Name());
+        if (state_machine->pending_ctrl_message()) {
+            state_machine->SendAdmissionWait();
+        }
+        return discard_event();
     }
 
     sc::result react(const EvSandeshMessageRecv &event) {
@@ -317,6 +409,19 @@ struct ServerInit : public sc::state<ServerInit, SandeshStateMachine> {
         }
         return discard_event();
     }
+
+    sc::result ProcessCtrlMessage(SandeshStateMachine *state_machine,
+                                  const Sandesh *snh) {
+        SandeshConnection *connection = state_machine->connection();
+        if (!connection->ProcessSandeshCtrlMessage(snh)) {
+            state_machine->set_session(NULL);
+            return transit<Idle>();
+        }
+        established_ = true;
+        return transit<Established>();
+    }
+
+    bool established_;
 };
             
 struct Established : public sc::state<Established, SandeshStateMachine> {
@@ -324,6 +429,7 @@ struct Established : public sc::state<Established, SandeshStateMachine> {
         TransitToIdle<EvStop>::reaction,
         sc::custom_reaction<EvTcpClose>,
         sc::custom_reaction<EvSandeshMessageRecv>,
+        sc::custom_reaction<EvSandeshIngestFail>,
         DeleteTcpSession<EvTcpDeleteSession>::reaction,
         sc::custom_reaction<EvResourceUpdate>
     > reactions;
@@ -333,11 +439,13 @@ struct Established : public sc::state<Established, SandeshStateMachine> {
         state_machine->set_state(ssm::ESTABLISHED);
         state_machine->set_resource(true);
         SM_LOG(DEBUG, state_machine->StateName());
+        state_machine->SendFlowCredits();
     }
 
     ~Established() {
         SandeshStateMachine *state_machine = &context<SandeshStateMachine>();
         state_machine->set_resource(false);
+        state_machine->ReleaseAdmission();
     }
 
     sc::result react(const EvTcpClose &event) {
@@ -372,8 +480,19 @@ struct Established : public sc::state<Established, SandeshStateMachine> {
             state_machine->set_session(NULL);
             return transit<Idle>();
         }
+        state_machine->FlowCreditsUsed(event.msg.get());
         return discard_event();
     }
+
+    sc::result react(const EvSandeshIngestFail &event) {
+        SandeshStateMachine *state_machine = &context<SandeshStateMachine>();
+        SM_LOG(DEBUG, state_machine->StateName() << " : " << event.Name());
+        if (event.session != state_machine->session()) {
+            return discard_event();
+        }
+        state_machine->set_session(NULL);
+        return transit<Idle>();
+    }
 };
 
 } // namespace ssm
@@ -392,11 +511,38 @@ SandeshStateMachine::SandeshStateMachine(const char *prefix, SandeshConnection *
               connection->GetTaskId(),
               connection->GetTaskInstance())),
       idle_hold_time_(0),
+      reject_close_timer_(TimerManager::CreateTimer(
+              *connection->server()->event_manager()->io_service(),
+              "Reject close timer",
+              connection->GetTaskId(),
+              connection->GetTaskInstance())),
       deleted_(false),
       resource_(false),
       builder_(SandeshMessageBuilder::GetInstance(SandeshMessageBuilder::XML)),
-      message_drop_level_(SandeshLevel::INVALID) {
+      message_drop_level_(SandeshLevel::INVALID),
+      flow_credits_(false),
+      admission_server_(NULL),
+      admission_accept_time_(0) {
     state_ = ssm::IDLE;
+    queued_messages_ = 0;
+    defer_dequeue_ = false;
+    ingest_count_ = 0;
+    for (int level = 0; level < kFlowCreditLevels; level++) {
+        flow_credits_used_[level] = 0;
+    }
+    SandeshServer *server(
+        dynamic_cast<SandeshServer *>(connection->server()));
+    if (server != NULL && server->IngestEnabled()) {
+        ingest_queue_.reset(new IngestQueue(connection->GetTaskId(),
+            connection->GetTaskInstance(),
+            boost::bind(&SandeshStateMachine::IngestDequeue, this, _1)));
+    }
+    if (server != NULL) {
+        flow_credits_ = server->FlowCreditsEnabled();
+        if (server->AdmissionEnabled()) {
+            admission_server_ = server;
+        }
+    }
     initiate();
 }
 
@@ -405,6 +551,10 @@ SandeshStateMachine::~SandeshStateMachine() {
     deleted_ = true;
 
     work_queue_.Shutdown();
+    // Messages still on the ingest queue are dropped
+    if (ingest_queue_) {
+        ingest_queue_->Shutdown();
+    }
 
     assert(session() == NULL);
 
@@ -420,6 +570,7 @@ SandeshStateMachine::~SandeshStateMachine() {
     // possible reference to the timers being deleted any more
     //
     TimerManager::DeleteTimer(idle_hold_timer_);
+    TimerManager::DeleteTimer(reject_close_timer_);
 }
 
 void SandeshStateMachine::Initialize() {
@@ -512,12 +663,31 @@ bool SandeshStateMachine::IdleHoldTimerRunning() {
     return idle_hold_timer_->running();
 }
 
+void SandeshStateMachine::StartRejectCloseTimer() {
+    reject_close_timer_->Start(kRejectCloseTime,
+            boost::bind(&SandeshStateMachine::RejectCloseTimerExpired, this),
+            boost::bind(&SandeshStateMachine::TimerErrorHandler, this, _1,
+                    _2));
+}
+
+void SandeshStateMachine::CancelRejectCloseTimer() {
+    reject_close_timer_->Cancel();
+}
+
+bool SandeshStateMachine::RejectCloseTimerRunning() {
+    return reject_close_timer_->running();
+}
+
 //
 // Test Only API : Start
 //
 void SandeshStateMachine::IdleHoldTimerFired() {
     idle_hold_timer_->Fire();
 }
+
+void SandeshStateMachine::RejectCloseTimerFired() {
+    reject_close_timer_->Fire();
+}
 //
 // Test Only API : End
 //
@@ -530,7 +700,7 @@ bool SandeshStateMachine::GetQueueCount(uint64_t &queue_count) const {
     if (deleted_ || generator_key_.empty()) {
         return false;
     }
-    queue_count = work_queue_.Length();
+    queue_count = work_queue_.Length() + ingest_count_;
     return true;
 }
 
@@ -568,6 +738,10 @@ void SandeshStateMachine::GetDetailMessageStatistics(
     mlock.release();
     detail_msg_stats->set_type_stats(v_detail_type_stats);
     detail_msg_stats->set_aggregate_stats(detail_agg_stats);
+    if (admission_server_ != NULL) {
+        tbb::mutex::scoped_lock alock(smutex_);
+        detail_msg_stats->set_admission_stats(admission_stats_);
+    }
 }
 
 void SandeshStateMachine::GetBasicMessageStatistics(
@@ -627,6 +801,11 @@ bool SandeshStateMachine::IdleHoldTimerExpired() {
     return false;
 }
 
+bool SandeshStateMachine::RejectCloseTimerExpired() {
+    Enqueue(ssm::EvRejectCloseTimerExpired(reject_close_timer_));
+    return false;
+}
+
 void SandeshStateMachine::OnSessionEvent(
         TcpSession *session, TcpSession::Event event) {
     SandeshSession *sandesh_session = dynamic_cast<SandeshSession *>(session);
@@ -668,72 +847,293 @@ void SandeshStateMachine::UpdateRxMsgFailStats(const std::string &msg_name,
 
 bool SandeshStateMachine::OnSandeshMessage(SandeshSession *session,
                                            const std::string &msg) {
-    // Demux based on Sandesh messkage type
-    SandeshMessage *xmessage = builder_->Create(
-        reinterpret_cast<const uint8_t *>(msg.c_str()), msg.size());
-    if (xmessage == NULL) {
+    // Demux based on Sandesh message type, using only the header, so
+    // that messages we drop are not fully parsed
+    SandeshHeader header;
+    std::string message_type;
+    uint32_t xml_offset = 0;
+    if (!builder_->ScanHeader(reinterpret_cast<const uint8_t *>(msg.c_str()),
+            msg.size(), &header, &message_type, &xml_offset)) {
         // Update message statistics
         UpdateRxMsgFailStats(std::string(), msg.size(),
             SandeshRxDropReason::DecodingFailed);
         return false;
     }
-    const SandeshHeader &header(xmessage->GetHeader());
-    const std::string &message_type(xmessage->GetMessageType());
     // Drop ? 
     if (DoDropSandeshMessage(header, message_drop_level_)) {
         // Update message statistics
         UpdateRxMsgFailStats(message_type, msg.size(),
             SandeshRxDropReason::QueueLevel);
-        delete xmessage;
         return true;
     }
     if (header.get_Hints() & g_sandesh_constants.SANDESH_CONTROL_HINT) {
-        SandeshHeader ctrl_header;
-        std::string ctrl_message_type;
-        uint32_t ctrl_xml_offset = 0;
-        // Extract the header and message type
-        int ret = SandeshReader::ExtractMsgHeader(msg, ctrl_header,
-            ctrl_message_type, ctrl_xml_offset);
-        if (ret) {
+        // Decode the control sandesh right after the scanned header
+        Sandesh *ctrl_snh = SandeshSession::DecodeCtrlSandesh(msg, header,
+            message_type, xml_offset);
+        if (ctrl_snh == NULL) {
             SM_LOG(ERROR, "OnMessage control in state: " << StateName() <<
-                " session " << session->ToString() << ": Extract FAILED ("
-                << ret << ")");
+                " session " << session->ToString() << ": Decode FAILED (" <<
+                message_type << ")");
             // Update message statistics
             UpdateRxMsgFailStats(message_type, msg.size(),
                 SandeshRxDropReason::ControlMsgFailed);
-            delete xmessage;
-            return false;
-        }
-        if (header != ctrl_header ||
-            message_type != ctrl_message_type) {
-            SM_LOG(ERROR, "OnMessage control in state: " << StateName() <<
-                " session " << session->ToString() << ": Header or message "
-                << "type (" << ctrl_message_type << ") MISMATCH");
-            // Update message statistics
-            UpdateRxMsgFailStats(message_type, msg.size(),
-                SandeshRxDropReason::ControlMsgFailed);
-            delete xmessage;
             return false;
         }
         SM_LOG(DEBUG, "OnMessage control in state: " << StateName() <<
                 " session " << session->ToString());
         // Update message statistics
         UpdateRxMsgStats(message_type, msg.size());
-        Enqueue(ssm::EvSandeshCtrlMessageRecv(msg, ctrl_header,
-                ctrl_message_type, ctrl_xml_offset));
-        delete xmessage;
+        Enqueue(ssm::EvSandeshCtrlMessageRecv(ctrl_snh, header));
     } else {
+        // The message is kept, build the DOM
+        SandeshMessage *xmessage = builder_->Create(
+            reinterpret_cast<const uint8_t *>(msg.c_str()), msg.size());
+        if (xmessage == NULL) {
+            // Update message statistics
+            UpdateRxMsgFailStats(message_type, msg.size(),
+                SandeshRxDropReason::DecodingFailed);
+            return false;
+        }
         // Update message statistics
         UpdateRxMsgStats(message_type, msg.size());
-        Enqueue(ssm::EvSandeshMessageRecv(xmessage));
+        // Hand over to the ingest queue while earlier messages are on
+        // it, as they go back to the state machine queue, in order, if
+        // they cannot be processed. Otherwise only once the earlier
+        // messages on the state machine queue are processed.
+        if (ingest_queue_ && (ingest_count_ != 0 ||
+            (state_ == ssm::ESTABLISHED && !defer_dequeue_ &&
+             queued_messages_ == 0))) {
+            IngestMessage(session, xmessage);
+        } else {
+            queued_messages_++;
+            Enqueue(ssm::EvSandeshMessageRecv(xmessage, builder_));
+        }
+    }
+    return true;
+}
+
+void SandeshStateMachine::IngestMessage(SandeshSession *session,
+                                        SandeshMessage *msg) {
+    IngestEntry entry;
+    entry.session = session;
+    entry.msg.reset(msg, boost::bind(&SandeshMessageBuilder::Release,
+        builder_, _1));
+    UpdateIngestCount(msg->GetSize(), true);
+    ingest_queue_->Enqueue(entry);
+}
+
+bool SandeshStateMachine::IngestDequeue(IngestEntry entry) {
+    ingest_batch_.push_back(entry);
+    // The batch is flushed when full or when the queue drains, the next
+    // dequeue will flush it otherwise
+    if (ingest_batch_.size() >= kIngestBatchSize ||
+        ingest_queue_->Length() == 0) {
+        IngestFlush();
     }
     return true;
 }
 
+// Hand over the batch per session, keeping the order they were received
+void SandeshStateMachine::IngestFlush() {
+    std::vector<boost::shared_ptr<const SandeshMessage> > msgs;
+    msgs.reserve(ingest_batch_.size());
+    IngestBatch::const_iterator it = ingest_batch_.begin();
+    while (it != ingest_batch_.end()) {
+        IngestBatch::const_iterator next = it;
+        size_t msgs_size = 0;
+        msgs.clear();
+        for (; next != ingest_batch_.end() &&
+               next->session == it->session; ++next) {
+            msgs.push_back(next->msg);
+            msgs_size += next->msg->GetSize();
+        }
+        OnIngestBatch(it->session, msgs, msgs_size);
+        it = next;
+    }
+    ingest_batch_.clear();
+}
+
+void SandeshStateMachine::OnIngestBatch(SandeshSession *session,
+        const std::vector<boost::shared_ptr<const SandeshMessage> > &msgs,
+        size_t msgs_size) {
+    // Messages received on an earlier session or after leaving established
+    // state are discarded, as they would be by the state machine
+    if (!deleted_ && state_ == ssm::ESTABLISHED && session_ == session) {
+        if (defer_dequeue_ || queued_messages_ != 0) {
+            // Held on the state machine queue, behind the messages there
+            for (size_t i = 0; i < msgs.size(); i++) {
+                queued_messages_++;
+                Enqueue(ssm::EvSandeshMessageRecv(msgs[i]));
+            }
+        } else {
+            std::vector<const SandeshMessage *> batch;
+            batch.reserve(msgs.size());
+            for (size_t i = 0; i < msgs.size(); i++) {
+                batch.push_back(msgs[i].get());
+            }
+            if (!connection_->ProcessSandeshMessages(batch, resource_)) {
+                Enqueue(ssm::EvSandeshIngestFail(session));
+            } else {
+                for (size_t i = 0; i < msgs.size(); i++) {
+                    FlowCreditsUsed(msgs[i].get());
+                }
+            }
+        }
+    }
+    // Only once the messages are processed or queued, see OnSandeshMessage
+    UpdateIngestCount(msgs_size, false);
+}
+
+// Apply the queue watermarks to the bytes on the ingest queue, in the
+// same way as the state machine queue does
+void SandeshStateMachine::UpdateIngestCount(size_t msg_size, bool enqueue) {
+    size_t prev, curr;
+    if (enqueue) {
+        prev = ingest_count_.fetch_and_add(msg_size);
+        curr = prev + msg_size;
+    } else {
+        prev = ingest_count_.fetch_and_add((size_t)(0-msg_size));
+        curr = prev - msg_size;
+    }
+    tbb::mutex::scoped_lock lock(ingest_mutex_);
+    const Sandesh::QueueWaterMarkInfo *wm(NULL);
+    if (enqueue) {
+        // Highest high watermark crossed
+        for (size_t i = 0; i < ingest_high_wm_.size(); i++) {
+            size_t count(boost::get<0>(ingest_high_wm_[i]));
+            if (prev < count && curr >= count &&
+                (wm == NULL || count > boost::get<0>(*wm))) {
+                wm = &ingest_high_wm_[i];
+            }
+        }
+    } else {
+        // Lowest low watermark crossed
+        for (size_t i = 0; i < ingest_low_wm_.size(); i++) {
+            size_t count(boost::get<0>(ingest_low_wm_[i]));
+            if (prev > count && curr <= count &&
+                (wm == NULL || count < boost::get<0>(*wm))) {
+                wm = &ingest_low_wm_[i];
+            }
+        }
+    }
+    if (wm == NULL) {
+        return;
+    }
+    boost::function<void (void)> cb;
+    if (boost::get<3>(*wm)) {
+        cb = boost::bind(&SandeshStateMachine::SetDeferSessionReader, this,
+            enqueue);
+    }
+    SetSandeshMessageDropLevel(curr, boost::get<1>(*wm), cb);
+}
+
 void SandeshStateMachine::ResourceUpdate(bool rsc) {
     Enqueue(ssm::EvResourceUpdate(rsc));
 }
 
+// The generator stops sending messages at and above the drop level, since
+// they would be dropped on receipt, and gets a window of messages for the
+// other levels
+void SandeshStateMachine::SendFlowCredits() {
+    if (!flow_credits_ || state_ != ssm::ESTABLISHED) {
+        return;
+    }
+    // Each grant replaces the credits left for all the levels
+    std::vector<SandeshFlowCredit> credits;
+    for (int level = SandeshLevel::SYS_EMERG;
+         level <= SandeshLevel::SYS_DEBUG; level++) {
+        flow_credits_used_[level] = 0;
+        SandeshFlowCredit credit;
+        credit.set_level(level);
+        credit.set_credits(level >= message_drop_level_ ? 0 :
+            kFlowCreditWindow);
+        credits.push_back(credit);
+    }
+    SandeshCtrlFlowCredit::Request(credits, "ctrl", connection_);
+}
+
+// Only the messages that consumed a credit on the generator count
+void SandeshStateMachine::FlowCreditsUsed(const SandeshMessage *msg) {
+    if (!flow_credits_) {
+        return;
+    }
+    const SandeshHeader &header(msg->GetHeader());
+    int level(header.get_Level());
+    if (!SandeshSession::IsFlowControlled(header.get_Type()) ||
+        level < 0 || level >= kFlowCreditLevels) {
+        return;
+    }
+    // Replenish once half of the window of the level is used
+    if (flow_credits_used_[level].fetch_and_increment() + 1 >=
+            kFlowCreditWindow / 2) {
+        SendFlowCredits();
+    }
+}
+
+void SandeshStateMachine::ReleaseAdmission() {
+    if (admission_server_ != NULL) {
+        admission_server_->ReleaseAdmission(this);
+    }
+}
+
+// Called by the server with the admission lock held
+void SandeshStateMachine::OnAdmitted() {
+    Enqueue(ssm::EvAdmitted());
+}
+
+// Called by the server with the admission lock held
+void SandeshStateMachine::OnAdmissionWait() {
+    Enqueue(ssm::EvAdmissionWait());
+}
+
+bool SandeshStateMachine::IsSyncDone() const {
+    return work_queue_.IsQueueEmpty() && ingest_count_ == 0;
+}
+
+void SandeshStateMachine::AdmissionAccepted() {
+    tbb::mutex::scoped_lock lock(smutex_);
+    admission_stats_.set_accepts(admission_stats_.get_accepts() + 1);
+    admission_accept_time_ = ClockMonotonicUsec();
+}
+
+void SandeshStateMachine::AdmissionAdmitted() {
+    tbb::mutex::scoped_lock lock(smutex_);
+    admission_stats_.set_admits(admission_stats_.get_admits() + 1);
+    admission_stats_.set_last_admission_wait_usec(
+        ClockMonotonicUsec() - admission_accept_time_);
+}
+
+void SandeshStateMachine::AdmissionDeferred() {
+    tbb::mutex::scoped_lock lock(smutex_);
+    admission_stats_.set_admits_deferred(
+        admission_stats_.get_admits_deferred() + 1);
+    lock.release();
+    SendAdmissionWait();
+}
+
+// The generator would otherwise time out waiting for the reply to its
+// control message, and connect to another collector
+void SandeshStateMachine::SendAdmissionWait() {
+    SandeshCtrlAdmissionDeferred::Request(
+        admission_server_->AdmissionWaitTime(), "ctrl", connection_);
+}
+
+void SandeshStateMachine::AdmissionRejected() {
+    uint32_t retry_after_msec(admission_server_->AdmissionRetryTime(
+        connection_->GetTaskInstance()));
+    SM_LOG(INFO, "Admission rejected, retry after " << retry_after_msec <<
+        " msec");
+    tbb::mutex::scoped_lock lock(smutex_);
+    admission_stats_.set_rejects(admission_stats_.get_rejects() + 1);
+    lock.release();
+    SandeshCtrlRetryAfter::Request(retry_after_msec, "ctrl", connection_);
+}
+
+void SandeshStateMachine::AdmissionSynced(uint64_t duration_usec) {
+    tbb::mutex::scoped_lock lock(smutex_);
+    admission_stats_.set_last_sync_duration_usec(duration_usec);
+}
+
 static const std::string state_names[] = {
     "Idle",
     "Active",
@@ -788,6 +1188,9 @@ bool SandeshStateMachine::DequeueEvent(SandeshStateMachine::EventContainer &ec)
     if (deleted_) {
         return true;
     }
+    if (dynamic_cast<const ssm::EvSandeshMessageRecv *>(ec.event.get())) {
+        queued_messages_--;
+    }
     set_last_event(TYPE_NAME(*ec.event));
     if (ec.validate.empty() || ec.validate(this)) {
         // Log only relevant events and states
@@ -862,6 +1265,7 @@ void SandeshStateMachine::SetSandeshMessageDropLevel(size_t queue_count,
             Sandesh::LevelToString(level) << "], SM QUEUE COUNT: " <<
             queue_count);
         message_drop_level_ = level;
+        SendFlowCredits();
     }
     // Always invoke the callback
     if (!cb.empty()) {
@@ -881,6 +1285,14 @@ void SandeshStateMachine::SetQueueWaterMarkInfo(
     bool high(boost::get<2>(wm));
     size_t queue_count(boost::get<0>(wm));
     bool defer_undefer(boost::get<3>(wm));
+    if (ingest_queue_) {
+        tbb::mutex::scoped_lock lock(ingest_mutex_);
+        if (high) {
+            ingest_high_wm_.push_back(wm);
+        } else {
+            ingest_low_wm_.push_back(wm);
+        }
+    }
     boost::function<void (void)> cb;
     if (high) {
         if (defer_undefer) {
@@ -906,6 +1318,9 @@ void SandeshStateMachine::SetQueueWaterMarkInfo(
 void SandeshStateMachine::ResetQueueWaterMarkInfo() {
     work_queue_.ResetHighWaterMark();
     work_queue_.ResetLowWaterMark();
+    tbb::mutex::scoped_lock lock(ingest_mutex_);
+    ingest_high_wm_.clear();
+    ingest_low_wm_.clear();
 }
 
 bool GetEvSandeshMessageRecvSize(
@@ -944,5 +1359,6 @@ size_t SandeshStateMachine::EventQueue::AtomicDecrementQueueCount(
 
 void SandeshStateMachine::SetDeferDequeue(bool defer_dequeue) {
     SM_LOG(INFO, "SANDESH Set Defer Dequeue: " << defer_dequeue);
+    defer_dequeue_ = defer_dequeue;
     work_queue_.set_disable(defer_dequeue);
 }
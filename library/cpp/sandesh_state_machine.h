@@ -13,6 +13,8 @@
 
 #include <boost/asio.hpp>
 #include <boost/ptr_container/ptr_map.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/statechart/state_machine.hpp>
 #include <tbb/mutex.h>
 #include <tbb/atomic.h>
@@ -51,6 +53,8 @@ class SandeshStateMachineStats;
 class SandeshGeneratorStats;
 class SandeshMessageStatistics;
 class SandeshMessageBuilder;
+class SandeshMessage;
+class SandeshServer;
 
 typedef boost::function<bool(SandeshStateMachine *)> EvValidate;
 
@@ -59,6 +63,11 @@ class SandeshStateMachine :
 public:
     static const int kIdleHoldTime = 5000; //5 sec .. specified in milliseconds
     static const int kQueueSize = 200 * 1024 * 1024; // 200 MB
+    static const uint32_t kFlowCreditWindow = 4096; // messages per level
+    // Time for the retry after message to go out before a rejected
+    // session is closed
+    static const int kRejectCloseTime = 1000; // msec
+    static const int kFlowCreditLevels = SandeshLevel::SYS_DEBUG + 1;
         
     SandeshStateMachine(const char *prefix, SandeshConnection *connection);
     ~SandeshStateMachine();
@@ -79,6 +88,10 @@ public:
     void CancelIdleHoldTimer();
     bool IdleHoldTimerRunning();
     void IdleHoldTimerFired();
+    void StartRejectCloseTimer();
+    void CancelRejectCloseTimer();
+    bool RejectCloseTimerRunning();
+    void RejectCloseTimerFired();
 
     // Feed session events into the state machine.
     void OnSessionEvent(TcpSession *session, TcpSession::Event event);
@@ -92,9 +105,38 @@ public:
     // Receive incoming sandesh message
     bool OnSandeshMessage(SandeshSession *session, const std::string &msg);
 
+    // Receive a batch of data messages from the ingest queue
+    void OnIngestBatch(SandeshSession *session,
+        const std::vector<boost::shared_ptr<const SandeshMessage> > &msgs,
+        size_t msgs_size);
+
     // In established state, the SM accepts updates to resource state
     void ResourceUpdate(bool rsc);
 
+    // Grant credits to the generator, replenished per level as the flow
+    // controlled messages of the level are processed
+    void SendFlowCredits();
+    void FlowCreditsUsed(const SandeshMessage *msg);
+
+    // Admission control of the resync on connect, when enabled
+    SandeshServer *admission_server() const { return admission_server_; }
+    void ReleaseAdmission();
+    void OnAdmitted();
+    void OnAdmissionWait();
+    bool IsSyncDone() const;
+    void AdmissionAccepted();
+    void AdmissionAdmitted();
+    void AdmissionDeferred();
+    void SendAdmissionWait();
+    void AdmissionRejected();
+    void AdmissionSynced(uint64_t duration_usec);
+    const boost::shared_ptr<Sandesh> &pending_ctrl_message() const {
+        return pending_ctrl_message_;
+    }
+    void set_pending_ctrl_message(const boost::shared_ptr<Sandesh> &snh) {
+        pending_ctrl_message_ = snh;
+    }
+
     const std::string &StateName() const;
     const std::string &LastStateName() const;
 
@@ -170,12 +212,22 @@ private:
         EvValidate validate;
     };
 
+    // Data message handed over by the session reader to the ingest queue
+    struct IngestEntry {
+        SandeshSession *session;
+        boost::shared_ptr<const SandeshMessage> msg;
+    };
+    typedef WorkQueue<IngestEntry> IngestQueue;
+    typedef std::vector<IngestEntry> IngestBatch;
+    static const size_t kIngestBatchSize = 64;
+
     friend class WorkQueue<EventContainer>;
     friend bool GetEvSandeshMessageRecvSize(EventContainer *ec,
         size_t *msg_size);
 
     void TimerErrorHandler(std::string name, std::string error);
     bool IdleHoldTimerExpired();
+    bool RejectCloseTimerExpired();
 
     template <typename Ev> void Enqueue(const Ev &event);
     bool DequeueEvent(EventContainer &ec);
@@ -196,6 +248,10 @@ private:
         SandeshLevel::type level, boost::function<void (void)> cb);
     void SetDeferSessionReader(bool defer_reader);
     bool IsValid() const;
+    void IngestMessage(SandeshSession *session, SandeshMessage *msg);
+    bool IngestDequeue(IngestEntry entry);
+    void IngestFlush();
+    void UpdateIngestCount(size_t msg_size, bool enqueue);
 
     const char *prefix_;
     typedef WorkQueue<EventContainer> EventQueue;
@@ -204,6 +260,7 @@ private:
     SandeshSession *session_;
     Timer *idle_hold_timer_;
     int idle_hold_time_;
+    Timer *reject_close_timer_;
     bool deleted_;
     tbb::atomic<ssm::SsmState> state_;
     bool resource_;
@@ -218,6 +275,27 @@ private:
     SandeshMessageStatistics message_stats_;
     SandeshMessageBuilder *builder_;
     SandeshLevel::type message_drop_level_;
+    // Data messages on the state machine queue. Messages go to the ingest
+    // queue while some are with them, or once none are queued here, so
+    // that both paths together keep the order of the session.
+    tbb::atomic<size_t> queued_messages_;
+    tbb::atomic<bool> defer_dequeue_;
+    // Runs on the task instance of the state machine, so that the
+    // batches are processed exclusive of the state machine events
+    boost::scoped_ptr<IngestQueue> ingest_queue_;
+    IngestBatch ingest_batch_;
+    tbb::atomic<size_t> ingest_count_;
+    tbb::mutex ingest_mutex_;
+    std::vector<Sandesh::QueueWaterMarkInfo> ingest_high_wm_;
+    std::vector<Sandesh::QueueWaterMarkInfo> ingest_low_wm_;
+    bool flow_credits_;
+    // Flow controlled messages processed per level since the last grant
+    tbb::atomic<uint32_t> flow_credits_used_[kFlowCreditLevels];
+    SandeshServer *admission_server_;
+    // Control message held while waiting for admission
+    boost::shared_ptr<Sandesh> pending_ctrl_message_;
+    uint64_t admission_accept_time_;
+    SandeshAdmissionStats admission_stats_;
             
     DISALLOW_COPY_AND_ASSIGN(SandeshStateMachine);
 };
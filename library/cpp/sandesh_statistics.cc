@@ -151,6 +151,12 @@ static void UpdateDetailStatsDrops(SandeshMessageStats *smstats,
                 smstats->get_bytes_sent_dropped_sending_to_syslog() +
                 bytes);
             break;
+          case SandeshTxDropReason::NoCredits:
+            smstats->set_messages_sent_dropped_no_credits(
+                smstats->get_messages_sent_dropped_no_credits() + 1);
+            smstats->set_bytes_sent_dropped_no_credits(
+                smstats->get_bytes_sent_dropped_no_credits() + bytes);
+            break;
           default:
             assert(0);
         }
@@ -208,6 +214,25 @@ void SandeshMessageStatistics::UpdateSend(const std::string &msg_name,
         SandeshTxDropReason::NoDrop, SandeshRxDropReason::NoDrop);
 }
 
+void SandeshMessageStatistics::UpdateEncode(const std::string &msg_name,
+    uint64_t encode_time_usec) {
+    DetailStatsMap::iterator it = detail_type_stats_map_.find(msg_name);
+    if (it == detail_type_stats_map_.end()) {
+        std::string name(msg_name);
+        SandeshMessageTypeStats *n_detail_mtstats(new SandeshMessageTypeStats);
+        n_detail_mtstats->message_type = name;
+        it = (detail_type_stats_map_.insert(name, n_detail_mtstats)).first;
+    }
+    SandeshMessageStats *d_smstats(&it->second->stats);
+    d_smstats->set_messages_encoded(d_smstats->get_messages_encoded() + 1);
+    d_smstats->set_encode_time_usec(d_smstats->get_encode_time_usec() +
+        encode_time_usec);
+    detail_agg_stats_.set_messages_encoded(
+        detail_agg_stats_.get_messages_encoded() + 1);
+    detail_agg_stats_.set_encode_time_usec(
+        detail_agg_stats_.get_encode_time_usec() + encode_time_usec);
+}
+
 void SandeshMessageStatistics::UpdateSendFailed(const std::string &msg_name,
     uint64_t bytes, SandeshTxDropReason::type dreason) {
     UpdateInternal(msg_name, bytes, true, true, dreason,
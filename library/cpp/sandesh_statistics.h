@@ -13,6 +13,7 @@ public:
     SandeshMessageStatistics() {}
 
     void UpdateSend(const std::string &msg_name, uint64_t bytes);
+    void UpdateEncode(const std::string &msg_name, uint64_t encode_time_usec);
     void UpdateSendFailed(const std::string &msg_name, uint64_t bytes,
                           SandeshTxDropReason::type dreason);
     void UpdateRecv(const std::string &msg_name, uint64_t bytes);
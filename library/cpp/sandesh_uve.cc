@@ -8,6 +8,16 @@
 // file to handle requests for Sending Sandesh UVEs
 //
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
+#include <algorithm>
+#include <limits>
+
+#include <sandesh/transport/TFDTransport.h>
+#include <sandesh/protocol/TBinaryProtocol.h>
+
 #include "sandesh_uve.h"
 #include "../common/sandesh_uve_types.h"
 #include "sandesh_session.h"
@@ -16,10 +26,27 @@
 
 using std::string;
 using std::map; 
+using namespace contrail::sandesh::protocol;
+using namespace contrail::sandesh::transport;
+
+static const std::string kSnapshotMagic("SandeshUVESnapshot");
+static const int32_t kSnapshotVersion = 1;
 
 SandeshUVETypeMaps::uve_global_map* SandeshUVETypeMaps::map_ = NULL;
+tbb::atomic<uint32_t> SandeshUVETypeMaps::full_refresh_interval_;
+tbb::mutex SandeshUVETypeMaps::resync_mutex_;
+std::vector<SandeshUVETypeMaps::ResyncState> SandeshUVETypeMaps::resync_;
 int PullSandeshUVE = 0;
 
+void
+SandeshUVETypeMaps::set_full_refresh_interval(uint32_t interval) {
+    if (full_refresh_interval_ != interval) {
+        SANDESH_LOG(INFO, "SANDESH: UVE Full Refresh Interval: " <<
+            full_refresh_interval_ << " -> " << interval);
+        full_refresh_interval_ = interval;
+    }
+}
+
 
 bool 
 SandeshUVETypeMaps::InitDerivedStats(
@@ -88,6 +115,234 @@ SandeshUVETypeMaps::SyncAllMaps(const map<string,uint32_t> & inpMap, bool period
     }
 }
 
+//
+// Snapshot file layout, in the binary protocol:
+//   magic, version,
+//   for each UVE type: type name, version signature, encoded UVEs,
+//   empty type name
+// The UVEs of a type are encoded as a single binary field, so that
+// types that are unknown or have changed can be skipped.
+//
+bool
+SandeshUVETypeMaps::WriteSnapshot(const std::string &path) {
+    std::string tpath(path + ".tmp");
+    int fd = ::open(tpath.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                    S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        SANDESH_LOG(ERROR, __func__ << " Cannot open " << tpath);
+        return false;
+    }
+    uint32_t types = 0;
+    int32_t ret = 0;
+    {
+        boost::shared_ptr<TFDTransport> ftrans(
+            new TFDTransport(fd, TFDTransport::CLOSE_ON_DESTROY));
+        boost::shared_ptr<TBinaryProtocol> fprot(new TBinaryProtocol(ftrans));
+        if ((ret = fprot->writeString(kSnapshotMagic)) >= 0) {
+            ret = fprot->writeI32(kSnapshotVersion);
+        }
+        for (uve_global_map::iterator it = GetMap()->begin();
+                ret >= 0 && it != GetMap()->end(); it++) {
+            boost::shared_ptr<TMemoryBuffer> btrans(new TMemoryBuffer());
+            boost::shared_ptr<TBinaryProtocol> bprot(
+                new TBinaryProtocol(btrans));
+            if ((ret = it->second.second->WriteSnapshot(bprot)) < 0) break;
+            if ((ret = fprot->writeString(it->first)) < 0) break;
+            if ((ret = fprot->writeI32(it->second.second->VersionSig())) < 0) {
+                break;
+            }
+            ret = fprot->writeBinary(btrans->getBufferAsString());
+            types++;
+        }
+        if (ret >= 0) {
+            ret = fprot->writeString(std::string());
+        }
+        // The snapshot must be on disk before it replaces the old one
+        if (ret >= 0 && ::fsync(fd) != 0) {
+            ret = -1;
+        }
+    }
+    if (ret < 0 || std::rename(tpath.c_str(), path.c_str()) != 0) {
+        SANDESH_LOG(ERROR, __func__ << " Writing " << path << " FAILED");
+        ::unlink(tpath.c_str());
+        return false;
+    }
+    SANDESH_LOG(DEBUG, __func__ << " Wrote " << types << " types to " <<
+        path);
+    return true;
+}
+
+uint32_t
+SandeshUVETypeMaps::ReadSnapshot(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        SANDESH_LOG(INFO, __func__ << " No snapshot at " << path);
+        return 0;
+    }
+    boost::shared_ptr<TFDTransport> ftrans(
+        new TFDTransport(fd, TFDTransport::CLOSE_ON_DESTROY));
+    struct stat st;
+    if (::fstat(fd, &st) != 0 ||
+            st.st_size > std::numeric_limits<int32_t>::max()) {
+        SANDESH_LOG(ERROR, __func__ << " Cannot stat " << path);
+        return 0;
+    }
+    // No string in the file can be longer than the file, so that a
+    // corrupt length is rejected before it is allocated
+    boost::shared_ptr<TBinaryProtocol> fprot(new TBinaryProtocol(ftrans));
+    fprot->setStringSizeLimit(std::max((int32_t)st.st_size, 1));
+    std::string magic;
+    int32_t version;
+    if (fprot->readString(magic) < 0 || magic != kSnapshotMagic ||
+            fprot->readI32(version) < 0 || version != kSnapshotVersion) {
+        SANDESH_LOG(ERROR, __func__ << " Invalid snapshot " << path);
+        return 0;
+    }
+    uint32_t total = 0;
+    while (true) {
+        std::string tname, blob;
+        int32_t sig;
+        if (fprot->readString(tname) < 0) break;
+        if (tname.empty()) break;
+        if (fprot->readI32(sig) < 0 || fprot->readBinary(blob) < 0) break;
+        uve_global_map::iterator it = GetMap()->find(tname);
+        if (it == GetMap()->end()) {
+            SANDESH_LOG(INFO, __func__ << " Skipping unknown type " << tname);
+            continue;
+        }
+        if (sig != it->second.second->VersionSig()) {
+            SANDESH_LOG(INFO, __func__ << " Skipping " << tname <<
+                ", version signature changed from " << sig << " to " <<
+                it->second.second->VersionSig());
+            continue;
+        }
+        boost::shared_ptr<TMemoryBuffer> btrans(new TMemoryBuffer(
+            (uint8_t *)blob.data(), blob.size()));
+        boost::shared_ptr<TBinaryProtocol> bprot(new TBinaryProtocol(btrans));
+        bprot->setStringSizeLimit(std::max((int32_t)blob.size(), 1));
+        bprot->setContainerSizeLimit(std::max((int32_t)blob.size(), 1));
+        uint32_t count = 0;
+        if (it->second.second->ReadSnapshot(bprot, &count) < 0) {
+            SANDESH_LOG(ERROR, __func__ << " Decoding " << tname << " FAILED");
+        }
+        SANDESH_LOG(INFO, __func__ << " for " << tname << " restored " <<
+            count);
+        total += count;
+    }
+    return total;
+}
+
+uint32_t
+SandeshUVETypeMaps::ExpireRestored() {
+    uint32_t count = 0;
+    for (uve_global_map::iterator it = GetMap()->begin();
+            it != GetMap()->end(); it++) {
+        uint32_t subcount = it->second.second->ExpireRestored();
+        if (subcount != 0) {
+            SANDESH_LOG(INFO, __func__ << " for " << it->first <<
+                " expired " << subcount);
+            count += subcount;
+        }
+    }
+    return count;
+}
+
+void
+SandeshUVETypeMaps::ResyncStart(const map<string,uint32_t> & inpMap,
+        size_t collector) {
+    tbb::mutex::scoped_lock lock(resync_mutex_);
+    ResyncState &resync(Resync(collector));
+    if (resync.in_progress) {
+        SANDESH_LOG(INFO, __func__ << " Restarting resync at " <<
+            resync.tname << " after " << resync.uves_synced << " of " <<
+            resync.uves_total << " UVEs");
+    }
+    resync = ResyncState();
+    resync.in_progress = true;
+    resync.seqnos = inpMap;
+    resync.start_usec = ClockMonotonicUsec();
+    for (uve_global_map::iterator it = GetMap()->begin();
+            it != GetMap()->end(); it++) {
+        resync.uves_total += it->second.second->Size();
+    }
+    SANDESH_LOG(INFO, __func__ << " types " << GetMap()->size() <<
+        " UVEs " << resync.uves_total);
+}
+
+bool
+SandeshUVETypeMaps::ResyncStep(uint32_t budget, size_t collector) {
+    tbb::mutex::scoped_lock lock(resync_mutex_);
+    ResyncState &resync(Resync(collector));
+    if (!resync.in_progress) return true;
+    resync.slices++;
+    uve_global_map::iterator it = GetMap()->lower_bound(resync.tname);
+    for (; it != GetMap()->end(); it++) {
+        if (it->first != resync.tname) {
+            resync.tname = it->first;
+            resync.cursor = SandeshUVESyncCursor();
+        }
+        map<string,uint32_t>::const_iterator iit =
+            resync.seqnos.find(it->first);
+        uint32_t seqno = (iit == resync.seqnos.end()) ? 0 : iit->second;
+        uint32_t remaining = budget;
+        uint32_t count = 0;
+        bool done = it->second.second->ResyncUVE(seqno, &resync.cursor,
+            &remaining, &count, static_cast<int>(collector));
+        resync.uves_synced += budget - remaining;
+        resync.uves_sent += count;
+        budget = remaining;
+        if (!done) return false;
+        SANDESH_LOG(DEBUG, __func__ << " for " << it->first <<
+            " with seqno " << seqno << " done");
+    }
+    resync.in_progress = false;
+    SANDESH_LOG(INFO, __func__ << " done, synced " << resync.uves_synced <<
+        " UVEs, sent " << resync.uves_sent << " in " << resync.slices <<
+        " slices, deferred " << resync.slices_deferred);
+    return true;
+}
+
+void
+SandeshUVETypeMaps::ResyncDefer(size_t collector) {
+    tbb::mutex::scoped_lock lock(resync_mutex_);
+    ResyncState &resync(Resync(collector));
+    resync.slices_deferred++;
+}
+
+template <typename S, typename T>
+static void SetResyncStatus(const S &resync, T *status) {
+    status->set_in_progress(resync.in_progress);
+    status->set_uves_synced(resync.uves_synced);
+    status->set_uves_total(resync.uves_total);
+    status->set_uves_sent(resync.uves_sent);
+    status->set_slices(resync.slices);
+    status->set_slices_deferred(resync.slices_deferred);
+    if (!resync.in_progress) return;
+    status->set_type_name(resync.tname);
+    // The total is a snapshot taken at the start, and the cache may
+    // have grown since
+    if (resync.uves_synced != 0 &&
+            resync.uves_total > resync.uves_synced) {
+        uint64_t elapsed = ClockMonotonicUsec() - resync.start_usec;
+        uint64_t left = resync.uves_total - resync.uves_synced;
+        status->set_eta_secs((elapsed * left / resync.uves_synced) / 1000000);
+    }
+}
+
+void
+SandeshUVETypeMaps::GetResyncStatus(SandeshUVEResyncResp *resp) {
+    tbb::mutex::scoped_lock lock(resync_mutex_);
+    SetResyncStatus(Resync(0), resp);
+    std::vector<SandeshUVEResyncStatus> collectors;
+    for (size_t i = 0; i < resync_.size(); i++) {
+        SandeshUVEResyncStatus status;
+        status.set_collector(i);
+        SetResyncStatus(resync_[i], &status);
+        collectors.push_back(status);
+    }
+    resp->set_collectors(collectors);
+}
+
 void
 SandeshUVETypeMaps::SyncIntrospect(
        std::string tname, std::string table, std::string key) {
@@ -149,7 +404,20 @@ SandeshUVECacheReq::HandleRequest() const {
 
     SandeshUVECacheResp *sur = new SandeshUVECacheResp();
     sur->set_returned(returned);
-    if (um.second) sur->set_period(um.first);
+    if (um.second) {
+        sur->set_period(um.first);
+        sur->set_uves(um.second->Size());
+        sur->set_encoded_size(um.second->GetEncodedSize());
+        sur->set_memory_size(um.second->GetMemorySize());
+    }
+    sur->set_context(context());
+    sur->Response();
+}
+
+void
+SandeshUVEResyncReq::HandleRequest() const {
+    SandeshUVEResyncResp *sur = new SandeshUVEResyncResp();
+    SandeshUVETypeMaps::GetResyncStatus(sur);
     sur->set_context(context());
     sur->Response();
 }
@@ -13,16 +13,34 @@
 #define __SANDESH_UVE_H__
 
 #include <map>
+#include <set>
 #include <vector>
 #include <boost/ptr_container/ptr_map.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
 #include <boost/assign/ptr_map_inserter.hpp>
 #include <sandesh/sandesh_types.h>
 #include <sandesh/sandesh.h>
+#include <tbb/atomic.h>
 #include <tbb/mutex.h>
-#include <tbb/concurrent_hash_map.h>
 #include <boost/functional/hash.hpp>
+#include <boost/unordered_map.hpp>
 
 class SandeshUVEPerTypeMap;
+class SandeshUVEResyncResp;
+
+// Position of a resumable walk over a per-SandeshUVE-type cache.
+// The native UVE map is walked first, followed by the partitions of
+// each proxy group, in order of proxy name.
+struct SandeshUVESyncCursor {
+    SandeshUVESyncCursor() : partition(-1), stripe(0), started(false) {}
+    std::string proxy;
+    // -1 for the native UVE map
+    int partition;
+    size_t stripe;
+    // Last UVE-Key walked in the stripe, valid if started is set
+    std::string key;
+    bool started;
+};
 
 // This class holds a map of all per-SandeshUVE-type caches.
 // Each cache registers with this class during static initialization.
@@ -55,11 +73,85 @@ public:
         const std::map<std::string, ds_conf_elem> &);
     static void SyncIntrospect(std::string tname, std::string table, std::string key);
 
+    // Memory used by a node of a std::map or std::set that holds a value
+    // of the given size, and by the buffer of a string, as counted in the
+    // memory size of the caches
+    static size_t TreeNodeSize(size_t value_size) {
+        return value_size + 4 * sizeof(void *);
+    }
+    static size_t StringSize(const std::string &s) {
+        return s.capacity() + 1;
+    }
+
     static uve_global_map::const_iterator Begin() { return GetMap()->begin(); }
     static uve_global_map::const_iterator End() { return GetMap()->end(); }
     static const int kProxyPartitions = 30;
+
+    // If non-zero, UVE updates only carry the attributes that have
+    // changed from the cached UVE, except for every Nth update of a
+    // UVE, which carries all attributes set by the caller.
+    static void set_full_refresh_interval(uint32_t interval);
+    static uint32_t full_refresh_interval() {
+        return full_refresh_interval_;
+    }
+
+    // Snapshot of the UVE caches, so that a restarted generator starts
+    // with the UVEs it had published instead of an empty cache.
+    // Only the native UVE maps are saved, since the partitions of the
+    // proxy groups are owned afresh after a restart. The UVEs of a type
+    // are restored only if the type's version signature is unchanged.
+    // Restored UVEs are synced to the collector like any other, and are
+    // deleted by ExpireRestored unless the application has published
+    // them again in the meantime.
+    static bool WriteSnapshot(const std::string &path);
+    static uint32_t ReadSnapshot(const std::string &path);
+    static uint32_t ExpireRestored();
+
+    // The sync of all caches after a (re)connect is done in slices, so
+    // that the send queue is not flooded with the whole cache at once.
+    // ResyncStart resets the walk, and each call to ResyncStep sends at
+    // most budget UVEs, resuming where the previous call stopped.
+    // ResyncStep returns true when there is nothing left to sync.
+    // The walk is kept per collector, when sending to more than one,
+    // and the UVEs of a step are sent to that collector only.
+    static void ResyncStart(const std::map<std::string,uint32_t> &,
+            size_t collector = 0);
+    static bool ResyncStep(uint32_t budget, size_t collector = 0);
+    // Account for a slice that was skipped because the send queue
+    // has not drained yet
+    static void ResyncDefer(size_t collector = 0);
+    // Status of the resync to each collector
+    static void GetResyncStatus(SandeshUVEResyncResp *resp);
 private:
+    struct ResyncState {
+        ResyncState() : in_progress(false), uves_synced(0), uves_total(0),
+                uves_sent(0), slices(0), slices_deferred(0), start_usec(0) {
+        }
+        bool in_progress;
+        // Type name to the last seqno received by the collector
+        std::map<std::string, uint32_t> seqnos;
+        std::string tname;
+        SandeshUVESyncCursor cursor;
+        uint32_t uves_synced;
+        uint32_t uves_total;
+        uint32_t uves_sent;
+        uint32_t slices;
+        uint32_t slices_deferred;
+        uint64_t start_usec;
+    };
+
     static uve_global_map *map_;
+    static tbb::atomic<uint32_t> full_refresh_interval_;
+    static tbb::mutex resync_mutex_;
+    static std::vector<ResyncState> resync_;
+
+    // Called with the resync mutex held
+    static ResyncState &Resync(size_t collector) {
+        if (collector >= resync_.size()) {
+            resync_.resize(collector + 1);
+        }
+        return resync_[collector];
+    }
 
     static uve_global_map * GetMap() {
         if (!map_) {
@@ -78,6 +170,18 @@ public:
     virtual uint32_t TypeSeq() const = 0;
     virtual uint32_t SyncUVE(const std::string &table, SandeshUVE::SendType st,
             uint32_t seqno, uint32_t cycle, const std::string &ctx) = 0;
+    virtual bool ResyncUVE(uint32_t seqno, SandeshUVESyncCursor *cursor,
+            uint32_t *budget, uint32_t *count, int collector) = 0;
+    virtual uint32_t Size(void) const = 0;
+    virtual uint64_t GetEncodedSize(void) const = 0;
+    virtual uint64_t GetMemorySize(void) const = 0;
+    virtual int32_t VersionSig(void) const = 0;
+    virtual int32_t WriteSnapshot(boost::shared_ptr<
+            contrail::sandesh::protocol::TProtocol> oprot) const = 0;
+    virtual int32_t ReadSnapshot(boost::shared_ptr<
+            contrail::sandesh::protocol::TProtocol> iprot,
+            uint32_t *count) = 0;
+    virtual uint32_t ExpireRestored(void) = 0;
     virtual bool InitDerivedStats(
             const std::map<std::string,std::string> & dsconf) = 0;
     virtual bool SendUVE(const std::string& table, const std::string& name,
@@ -88,6 +192,68 @@ public:
 };
 
 
+// Index of the UVE-Keys in the proxy groups of a SandeshUVE type, so
+// that a lookup by UVE-Key does not need to visit every partition of
+// every group.
+// The cache of a partition adds a UVE-Key when it is first cached and
+// removes it when its last UVE is gone, with the lock of the UVE-Key's
+// stripe held, so the index is not touched by other updates.
+class SandeshUVEKeyIndex {
+public:
+    // Proxy group and partition of a UVE-Key
+    typedef std::pair<std::string, int> Location;
+    typedef std::set<Location> LocationSet;
+
+    void Add(const std::string &key, const Location &loc) {
+        tbb::mutex::scoped_lock lock(mutex_);
+        map_[key].insert(loc);
+    }
+
+    void Remove(const std::string &key, const Location &loc) {
+        tbb::mutex::scoped_lock lock(mutex_);
+        KeyMap::iterator it = map_.find(key);
+        if (it == map_.end()) return;
+        it->second.erase(loc);
+        if (it->second.empty()) map_.erase(it);
+    }
+
+    LocationSet Find(const std::string &key) const {
+        tbb::mutex::scoped_lock lock(mutex_);
+        KeyMap::const_iterator it = map_.find(key);
+        if (it == map_.end()) return LocationSet();
+        return it->second;
+    }
+
+    size_t Size() const {
+        tbb::mutex::scoped_lock lock(mutex_);
+        return map_.size();
+    }
+
+    // Memory used by the index, in bytes
+    uint64_t GetMemorySize() const {
+        tbb::mutex::scoped_lock lock(mutex_);
+        uint64_t size = map_.bucket_count() * sizeof(void *);
+        for (KeyMap::const_iterator it = map_.begin(); it != map_.end();
+                ++it) {
+            size += sizeof(KeyMap::value_type) + sizeof(void *) +
+                SandeshUVETypeMaps::StringSize(it->first);
+            for (LocationSet::const_iterator lit = it->second.begin();
+                    lit != it->second.end(); ++lit) {
+                size += SandeshUVETypeMaps::TreeNodeSize(sizeof(Location)) +
+                    SandeshUVETypeMaps::StringSize(lit->first);
+            }
+        }
+        return size;
+    }
+
+private:
+    typedef boost::unordered_map<std::string, LocationSet> KeyMap;
+
+    mutable tbb::mutex mutex_;
+    KeyMap map_;
+};
+
+
 // This is the per-SandeshUVE-type cache.
 // 
 //
@@ -97,6 +263,8 @@ public:
 // - Has a single element called "data", of the UVE type.
 // - Provides static "Send" function.
 // - Per-object sequence number is available as "lseqnum()"
+// - Provides static "_PeriodicPending" function, which tells if a
+//   cached UVE has periodic derived stats that remain to be flushed
 //
 // Assumptions about UVE Type
 // - Can be constructed with 0 arguments (default constructor)
@@ -109,31 +277,64 @@ template<typename T, typename U, int P, int TM>
 class SandeshUVEPerTypeMapImpl {
 public:
 
-    struct HashCompare { 
-        static size_t hash( const std::string& key )
-            { return boost::hash_value(key); } 
-        static bool   equal( const std::string& key1, const std::string& key2 )
-            { return ( key1 == key2 ); } 
-    }; 
-
     struct UVEMapEntry {
         UVEMapEntry(const std::string &table, uint32_t seqnum,
                     SandeshLevel::type level):
-                data(table), seqno(seqnum), level(level) {
+                data(table), seqno(seqnum), level(level), updates(0),
+                restored(false) {
         }
         U data;
         uint32_t seqno;
         SandeshLevel::type level;
+        // Updates since the entry was created, for full refreshes
+        uint32_t updates;
+        // Restored from a snapshot, and not updated since
+        bool restored;
     };
 
-    // The key is the table name
-    typedef boost::ptr_map<std::string, UVEMapEntry> uve_table_map;
+    // The UVEs of a UVE-Key, one per table.
+    // There are only a few tables, so the entries are kept inline in a
+    // vector, and looked up by the table name in the UVE itself. A
+    // UVE-Key with a single table costs a single allocation.
+    typedef std::vector<UVEMapEntry> uve_table_map;
 
     // The key is the UVE-Key
-    typedef tbb::concurrent_hash_map<std::string, uve_table_map, HashCompare > uve_cmap;
+    typedef std::map<std::string, uve_table_map> uve_smap;
+
+    // The cache is split into stripes by the hash of the UVE-Key, and
+    // each stripe has its own lock. Updates and deletes lock only the
+    // stripe of their UVE-Key, and walks over the cache lock one stripe
+    // at a time, so that a sync of a large cache does not stall UVE
+    // updates in the rest of the cache.
+    static const size_t kStripes = 64;
+
+    // For periodic UVE types, each stripe also keeps the set of UVE-Keys
+    // that need periodic processing, either because they were updated,
+    // or because they still have periodic derived stats or deletes to
+    // send. Periodic processing visits only these, except on the cycles
+    // where UVEs are timed out.
+    // The set holds the map entries of the UVE-Keys rather than copies
+    // of the UVE-Keys, and an entry is removed from the set before it is
+    // removed from the map.
+    typedef std::set<typename uve_smap::value_type *> dirty_set;
+    struct UVEStripe {
+        tbb::mutex mutex;
+        uve_smap map;
+        dirty_set dirty;
+    };
 
     SandeshUVEPerTypeMapImpl() : 
-            dsconf_(T::_DSConf()) {}
+            dsconf_(T::_DSConf()), index_(NULL) {
+        uves_ = 0;
+    }
+
+    // Keep the given index of UVE-Keys up to date with this cache,
+    // which is the given partition of a proxy group
+    void SetKeyIndex(SandeshUVEKeyIndex *index, const std::string &proxy,
+            int partition) {
+        index_ = index;
+        loc_ = SandeshUVEKeyIndex::Location(proxy, partition);
+    }
 
     // This function is called whenever a SandeshUVE is sent from
     // the generator to the collector.
@@ -141,129 +342,242 @@ public:
     bool UpdateUVE(U& data, uint32_t seqnum, uint64_t mono_usec,
                    SandeshLevel::type level) {
         bool send = false;
-        tbb::mutex::scoped_lock lock;
         const std::string &table = data.table_;
         assert(!table.empty());
         const std::string &s = data.get_name();
         if (!mono_usec) mono_usec = ClockMonotonicUsec();
- 
-        // pickup DS Config
-        lock.acquire(uve_mutex_);
-        std::map<string,string> dsconf = dsconf_;
-
-        // If we are going to erase, we need a global lock
-        // to coordinate with iterators 
-        // To prevent deadlock, we always acquire global lock
-        // before accessor
-        if (!data.get_deleted()) {
-            lock.release();
-        }
-        typename uve_cmap::accessor a;
 
-        // Ensure that the entry exists, and we have an accessor to it
-        while (true) {
-            if (cmap_.find(a, s)) break;
-            else {
-                if (cmap_.insert(a, s)) break;
-            }
+        UVEStripe &stripe = GetStripe(s);
+        tbb::mutex::scoped_lock lock(stripe.mutex);
+        typename uve_smap::iterator git = stripe.map.find(s);
+        if (git == stripe.map.end()) {
+            git = InsertKey(stripe, s);
         }
 
-        typename uve_table_map::iterator imapentry = a->second.find(table); 
-        if (imapentry == a->second.end()) {
-            std::auto_ptr<UVEMapEntry> ume(new
-                    UVEMapEntry(data.table_, seqnum, level));
-            T::_InitDerivedStats(ume->data, dsconf);
-            send = T::UpdateUVE(data, ume->data, mono_usec, level);
-            imapentry = a->second.insert(table, ume).first;
+        typename uve_table_map::iterator imapentry =
+                FindTable(git->second, table);
+        if (imapentry == git->second.end()) {
+            imapentry = AddEntry(git->second, data, seqnum, mono_usec, level,
+                    &send);
         } else {
+            imapentry->restored = false;
             if (TM != 0) {
                 // If we get an update , mark this UVE so that it is not 
                 // deleted during the next round of periodic processing
-                imapentry->second->data.set_deleted(false);
+                imapentry->data.set_deleted(false);
             }
-            send = T::UpdateUVE(data, imapentry->second->data, mono_usec,
-                                level);
-            imapentry->second->seqno = seqnum;
+            uint32_t interval = SandeshUVETypeMaps::full_refresh_interval();
+            bool delta = (interval != 0) &&
+                    ((++imapentry->updates % interval) != 0);
+            send = T::UpdateUVE(data, imapentry->data, mono_usec,
+                                level, delta);
+            imapentry->seqno = seqnum;
         }
+        if (P != 0) stripe.dirty.insert(&*git);
         if (data.get_deleted()) {
-            a->second.erase(imapentry);
-            if (a->second.empty()) cmap_.erase(a);
-            lock.release();
+            git->second.erase(imapentry);
+            uves_--;
+            if (git->second.empty()) {
+                EraseKey(stripe, git);
+            }
         }
         
         return send;
     }
 
+    // Encode the UVEs of the cache for a snapshot, each as its table
+    // name, level and UVE, followed by an empty table name
+    int32_t WriteSnapshot(boost::shared_ptr<
+            contrail::sandesh::protocol::TProtocol> oprot) const {
+        int32_t xfer = 0, ret;
+        for (size_t idx = 0; idx < kStripes; idx++) {
+            UVEStripe &stripe = stripes_[idx];
+            tbb::mutex::scoped_lock lock(stripe.mutex);
+            for (typename uve_smap::const_iterator git = stripe.map.begin();
+                    git != stripe.map.end(); ++git) {
+                for (typename uve_table_map::const_iterator uit =
+                        git->second.begin();
+                        uit != git->second.end(); ++uit) {
+                    if ((ret = oprot->writeString(uit->data.table_)) < 0) {
+                        return ret;
+                    }
+                    xfer += ret;
+                    if ((ret = oprot->writeI32(uit->level)) < 0) {
+                        return ret;
+                    }
+                    xfer += ret;
+                    if ((ret = uit->data.write(oprot)) < 0) {
+                        return ret;
+                    }
+                    xfer += ret;
+                }
+            }
+        }
+        if ((ret = oprot->writeString(std::string())) < 0) {
+            return ret;
+        }
+        xfer += ret;
+        return xfer;
+    }
+
+    // Add the UVEs of a snapshot to the cache, without sending them.
+    // UVEs that are already in the cache have been published by the
+    // application since the restart, and are left alone.
+    int32_t ReadSnapshot(boost::shared_ptr<
+            contrail::sandesh::protocol::TProtocol> iprot, uint32_t *count) {
+        int32_t xfer = 0, ret;
+        uint64_t mono_usec = ClockMonotonicUsec();
+        while (true) {
+            std::string table;
+            if ((ret = iprot->readString(table)) < 0) {
+                return ret;
+            }
+            xfer += ret;
+            if (table.empty()) break;
+            int32_t level;
+            if ((ret = iprot->readI32(level)) < 0) {
+                return ret;
+            }
+            xfer += ret;
+            U data(table);
+            if ((ret = data.read(iprot)) < 0) {
+                return ret;
+            }
+            xfer += ret;
+            // UVEs marked for timeout are restored as they are
+            data.set_deleted(false);
+
+            const std::string &s = data.get_name();
+            UVEStripe &stripe = GetStripe(s);
+            tbb::mutex::scoped_lock lock(stripe.mutex);
+            typename uve_smap::iterator git = stripe.map.find(s);
+            if (git == stripe.map.end()) {
+                git = InsertKey(stripe, s);
+            } else if (FindTable(git->second, table) != git->second.end()) {
+                continue;
+            }
+            bool send;
+            typename uve_table_map::iterator uit = AddEntry(git->second,
+                    data, 0, mono_usec, (SandeshLevel::type)level, &send);
+            uit->restored = true;
+            if (P != 0) stripe.dirty.insert(&*git);
+            (*count)++;
+        }
+        return xfer;
+    }
+
+    // Delete the restored UVEs that the application has not published
+    // again since the restart
+    uint32_t ExpireRestored(void) {
+        uint32_t count = 0;
+        for (size_t idx = 0; idx < kStripes; idx++) {
+            UVEStripe &stripe = stripes_[idx];
+            tbb::mutex::scoped_lock lock(stripe.mutex);
+            typename uve_smap::iterator git = stripe.map.begin();
+            while (git != stripe.map.end()) {
+                typename uve_table_map::iterator uit = git->second.begin();
+                while (uit != git->second.end()) {
+                    if (!uit->restored) {
+                        ++uit;
+                        continue;
+                    }
+                    SANDESH_LOG(INFO, __func__ << " Expiring " <<
+                        uit->data.table_ << " val " << uit->data.log());
+                    uit->data.set_deleted(true);
+                    T::Send(uit->data, uit->level, SandeshUVE::ST_SYNC,
+                            uit->seqno, 0, "");
+                    uit = git->second.erase(uit);
+                    uves_--;
+                    count++;
+                }
+                if (git->second.empty()) {
+                    EraseKey(stripe, git++);
+                } else {
+                    ++git;
+                }
+            }
+        }
+        return count;
+    }
+
     // Clear all UVEs in this cache
     // This is used ONLY with proxy groups
     uint32_t ClearUVEs(void) {
-
-        // Global lock is needed for iterator
-        tbb::mutex::scoped_lock lock(uve_mutex_);
         uint32_t count = 0;
-        (const_cast<SandeshUVEPerTypeMapImpl<T,U,P,TM> *>(this))->cmap_.rehash();
-        typename uve_cmap::iterator git = cmap_.begin();
-        while (git != cmap_.end()) {
-            typename uve_cmap::accessor a;
-            if (!cmap_.find(a, git->first)) continue;
-            typename uve_table_map::iterator uit = a->second.begin();
-            while (uit != a->second.end()) {
-                typename uve_table_map::iterator dit = a->second.end();
-                SANDESH_LOG(INFO, __func__ << " Clearing " << uit->first << 
-                    " val " << uit->second->data.log() << " proxy " <<
-                    SandeshStructProxyTrait<U>::get(uit->second->data) << 
-                    " seq " << uit->second->seqno);
-                uit->second->data.set_deleted(true);
-                T::Send(uit->second->data, uit->second->level,
-                        SandeshUVE::ST_SYNC, uit->second->seqno, 0, "");
-                count++;
-                ++uit;
+        for (size_t idx = 0; idx < kStripes; idx++) {
+            UVEStripe &stripe = stripes_[idx];
+            tbb::mutex::scoped_lock lock(stripe.mutex);
+            for (typename uve_smap::iterator git = stripe.map.begin();
+                    git != stripe.map.end(); ++git) {
+                for (typename uve_table_map::iterator uit =
+                        git->second.begin();
+                        uit != git->second.end(); ++uit) {
+                    SANDESH_LOG(INFO, __func__ << " Clearing " <<
+                        uit->data.table_ << " val " << uit->data.log() <<
+                        " proxy " << SandeshStructProxyTrait<U>::get(uit->data) <<
+                        " seq " << uit->seqno);
+                    uit->data.set_deleted(true);
+                    T::Send(uit->data, uit->level,
+                            SandeshUVE::ST_SYNC, uit->seqno, 0, "");
+                    count++;
+                }
+                if (index_) index_->Remove(git->first, loc_);
             }
-            ++git;
+            stripe.map.clear();
+            stripe.dirty.clear();
         }
-        cmap_.clear();
+        uves_ -= count;
         return count;
     }
 
     bool InitDerivedStats(const std::map<std::string,std::string> & dsconf) {
+        // Config updates are applied one at a time, so that the entries
+        // are left with the config that dsconf_ ends up with
+        tbb::mutex::scoped_lock update_lock(dsconf_update_mutex_);
 
-        // Global lock is needed for iterator
-        tbb::mutex::scoped_lock lock(uve_mutex_);
+        std::map<std::string,std::string> dsnew;
+        {
+            tbb::mutex::scoped_lock lock(uve_mutex_);
 
-        // Copy the existing configuration
-        // We will be replacing elements in it.
-        std::map<std::string,std::string> dsnew = dsconf_;
+            // Copy the existing configuration
+            // We will be replacing elements in it.
+            dsnew = dsconf_;
         
-        bool failure = false;
-        for (map<std::string,std::string>::const_iterator n_iter = dsconf.begin();
-                n_iter != dsconf.end(); n_iter++) {
-            if (dsnew.find(n_iter->first) != dsnew.end()) {
-                SANDESH_LOG(INFO, __func__ << " Overide DSConf for " <<
-                    n_iter->first << " , " << dsnew[n_iter->first] <<
-                    " with " << n_iter->second);
-                dsnew[n_iter->first] = n_iter->second;
-            } else {
-                SANDESH_LOG(INFO, __func__ << " Cannot find DSConf for " <<
-                    n_iter->first << " , " << n_iter->second);
-                failure = true;
+            bool failure = false;
+            for (map<std::string,std::string>::const_iterator n_iter = dsconf.begin();
+                    n_iter != dsconf.end(); n_iter++) {
+                if (dsnew.find(n_iter->first) != dsnew.end()) {
+                    SANDESH_LOG(INFO, __func__ << " Overide DSConf for " <<
+                        n_iter->first << " , " << dsnew[n_iter->first] <<
+                        " with " << n_iter->second);
+                    dsnew[n_iter->first] = n_iter->second;
+                } else {
+                    SANDESH_LOG(INFO, __func__ << " Cannot find DSConf for " <<
+                        n_iter->first << " , " << n_iter->second);
+                    failure = true;
+                }
             }
-        }
         
-        if (failure) return false;
-
-        // Copy the new conf into the old one if there we no errors
-        dsconf_ = dsnew;
-
-        (const_cast<SandeshUVEPerTypeMapImpl<T,U,P,TM> *>(this))->cmap_.rehash();
-        for (typename uve_cmap::iterator git = cmap_.begin();
-                git != cmap_.end(); git++) {
-            typename uve_cmap::accessor a;
-            if (!cmap_.find(a, git->first)) continue;
-            for (typename uve_table_map::iterator uit = a->second.begin();
-                    uit != a->second.end(); uit++) {
-                SANDESH_LOG(INFO, __func__ << " Reset Derived Stats for " <<
-                    git->first);
-                T::_InitDerivedStats(uit->second->data, dsconf_);
+            if (failure) return false;
+
+            // Copy the new conf into the old one if there we no errors
+            dsconf_ = dsnew;
+        }
+
+        // The config lock is not held while walking the stripes;
+        // UpdateUVE reads the config with a stripe lock held.
+        for (size_t idx = 0; idx < kStripes; idx++) {
+            UVEStripe &stripe = stripes_[idx];
+            tbb::mutex::scoped_lock lock(stripe.mutex);
+            for (typename uve_smap::iterator git = stripe.map.begin();
+                    git != stripe.map.end(); git++) {
+                for (typename uve_table_map::iterator uit =
+                        git->second.begin();
+                        uit != git->second.end(); uit++) {
+                    SANDESH_LOG(INFO, __func__ << " Reset Derived Stats for " <<
+                        git->first);
+                    T::_InitDerivedStats(uit->data, dsnew);
+                }
             }
         }
         return true;
@@ -273,78 +587,263 @@ public:
             SandeshUVE::SendType st,
             uint32_t seqno, uint32_t cycle,
             const std::string &ctx) {
-        // Global lock is needed for iterator
-        tbb::mutex::scoped_lock lock(uve_mutex_);
+        // Only the dirty UVEs need to be visited for periodic processing,
+        // unless UVEs are due to be timed out in this cycle
+        bool dirty_only = ((st == SandeshUVE::ST_PERIODIC) &&
+                ((TM == 0) || ((cycle % TM) != 0)));
         uint32_t count = 0;
-        (const_cast<SandeshUVEPerTypeMapImpl<T,U,P,TM> *>(this))->cmap_.rehash();
-        typename uve_cmap::iterator git = cmap_.begin();
-        while (git != cmap_.end()) {
-            typename uve_cmap::accessor a;
-            if (!cmap_.find(a, git->first)) continue;
-            typename uve_table_map::iterator uit = a->second.begin();
-            while (uit != a->second.end()) {
-                typename uve_table_map::iterator dit = a->second.end();
-                if (!table.empty() && uit->first != table) continue;
-                if ((seqno < uit->second->seqno) || (seqno == 0)) {
-                    if (ctx.empty()) {
-                        SANDESH_LOG(INFO, __func__ << " Syncing " << uit->first << 
-                            " val " << uit->second->data.log() << " proxy " <<
-                            SandeshStructProxyTrait<U>::get(uit->second->data) << 
-                            " seq " << uit->second->seqno);
+        for (size_t idx = 0; idx < kStripes; idx++) {
+            UVEStripe &stripe = stripes_[idx];
+            tbb::mutex::scoped_lock lock(stripe.mutex);
+            if (dirty_only) {
+                typename dirty_set::iterator dit = stripe.dirty.begin();
+                while (dit != stripe.dirty.end()) {
+                    bool pending = false;
+                    count += SyncTableMap((*dit)->second, table, st, seqno,
+                            cycle, ctx, &pending);
+                    if (!pending) {
+                        stripe.dirty.erase(dit++);
+                    } else {
+                        ++dit;
                     }
-                    T::Send(uit->second->data, uit->second->level, st,
-                            uit->second->seqno, cycle, ctx);
-                    if ((TM != 0) && (st == SandeshUVE::ST_PERIODIC)) {
-                        if ((cycle % TM) == 0) {
-                            if (uit->second->data.get_deleted()) {
-                                // This UVE was marked for deletion during the
-                                // last periodic processing round, and there
-                                // have been no UVE updates
-                                dit = uit;
-                            } else {
-                                // Mark this UVE to be deleted during the next
-                                // periodic processing round, unless it is updated
-                                uit->second->data.set_deleted(true);
-                            }
-                        }
+                }
+                continue;
+            }
+            typename uve_smap::iterator git = stripe.map.begin();
+            while (git != stripe.map.end()) {
+                bool pending = false;
+                count += SyncTableMap(git->second, table, st, seqno, cycle,
+                        ctx, &pending);
+                if (st == SandeshUVE::ST_PERIODIC) {
+                    if (pending) {
+                        stripe.dirty.insert(&*git);
+                    } else {
+                        stripe.dirty.erase(&*git);
                     }
-                    count++;
                 }
-                ++uit;
-                if (dit != a->second.end()) a->second.erase(dit);
+                if (git->second.empty()) {
+                    EraseKey(stripe, git++);
+                } else {
+                    ++git;
+                }
             }
-            ++git;
-            if (a->second.empty()) cmap_.erase(a);
         }
         return count;
     }
 
+    // Resumable sync of the cache, walking the UVE-Keys after the
+    // cursor until the budget of UVEs is used up. The UVEs are sent
+    // to the given collector only.
+    // Returns true once the walk is complete.
+    bool ResyncUVE(uint32_t seqno, SandeshUVESyncCursor *cursor,
+            uint32_t *budget, uint32_t *count, int collector) {
+        for (; cursor->stripe < kStripes; cursor->stripe++) {
+            UVEStripe &stripe = stripes_[cursor->stripe];
+            tbb::mutex::scoped_lock lock(stripe.mutex);
+            typename uve_smap::iterator git = cursor->started ?
+                    stripe.map.upper_bound(cursor->key) : stripe.map.begin();
+            for (; git != stripe.map.end(); ++git) {
+                if (*budget == 0) return false;
+                bool pending = false;
+                *count += SyncTableMap(git->second, "", SandeshUVE::ST_SYNC,
+                        seqno, 0, "", &pending, collector);
+                uint32_t uves = git->second.size();
+                *budget = (uves < *budget) ? (*budget - uves) : 0;
+                cursor->key = git->first;
+                cursor->started = true;
+            }
+            cursor->started = false;
+        }
+        return true;
+    }
+
+    // Number of UVEs in the cache
+    uint32_t Size(void) const {
+        return uves_;
+    }
+
+    // Sum of the encoded size estimates (GetSize) of the cached UVEs,
+    // in bytes. This is what a resync of the cache sends, not the
+    // memory that the cache uses.
+    uint64_t GetEncodedSize(void) const {
+        uint64_t size = 0;
+        for (size_t idx = 0; idx < kStripes; idx++) {
+            UVEStripe &stripe = stripes_[idx];
+            tbb::mutex::scoped_lock lock(stripe.mutex);
+            for (typename uve_smap::const_iterator git = stripe.map.begin();
+                    git != stripe.map.end(); ++git) {
+                for (typename uve_table_map::const_iterator uit =
+                        git->second.begin();
+                        uit != git->second.end(); ++uit) {
+                    size += uit->data.GetSize();
+                }
+            }
+        }
+        return size;
+    }
+
+    // Memory used by the cache, in bytes. The UVE-Keys, entries and
+    // dirty sets are counted from their sizes and capacities. The heap
+    // memory held by the fields of a generated UVE struct is not known,
+    // and is counted as the encoded size estimate of the UVE (GetSize).
+    uint64_t GetMemorySize(void) const {
+        uint64_t size = 0;
+        for (size_t idx = 0; idx < kStripes; idx++) {
+            UVEStripe &stripe = stripes_[idx];
+            tbb::mutex::scoped_lock lock(stripe.mutex);
+            size += stripe.dirty.size() *
+                SandeshUVETypeMaps::TreeNodeSize(sizeof(void *));
+            for (typename uve_smap::const_iterator git = stripe.map.begin();
+                    git != stripe.map.end(); ++git) {
+                size += SandeshUVETypeMaps::TreeNodeSize(
+                        sizeof(typename uve_smap::value_type)) +
+                    SandeshUVETypeMaps::StringSize(git->first) +
+                    git->second.capacity() * sizeof(UVEMapEntry);
+                for (typename uve_table_map::const_iterator uit =
+                        git->second.begin();
+                        uit != git->second.end(); ++uit) {
+                    size += uit->data.GetSize();
+                }
+            }
+        }
+        return size;
+    }
+
     bool SendUVE(const std::string& table, const std::string& name,
                  const std::string& ctx) const {
         bool sent = false;
-        typename uve_cmap::const_accessor a;
-        if (cmap_.find(a, name)) {
-            for (typename uve_table_map::const_iterator uve_entry = a->second.begin();
-                    uve_entry != a->second.end(); uve_entry++) {
-                if (!table.empty() && uve_entry->first != table) continue;
+        UVEStripe &stripe = GetStripe(name);
+        tbb::mutex::scoped_lock lock(stripe.mutex);
+        typename uve_smap::const_iterator git = stripe.map.find(name);
+        if (git != stripe.map.end()) {
+            for (typename uve_table_map::const_iterator uve_entry = git->second.begin();
+                    uve_entry != git->second.end(); uve_entry++) {
+                if (!table.empty() && uve_entry->data.table_ != table) continue;
                 sent = true;
-                T::Send(uve_entry->second->data, uve_entry->second->level,
+                T::Send(uve_entry->data, uve_entry->level,
                     (ctx.empty() ? SandeshUVE::ST_INTROSPECT : SandeshUVE::ST_SYNC),
-                    uve_entry->second->seqno, 0, ctx);
+                    uve_entry->seqno, 0, ctx);
             }
         }
         return sent;
     }
     
     std::map<std::string, std::string> GetDSConf(void) const {
+        tbb::mutex::scoped_lock lock(uve_mutex_);
         return dsconf_;
     }
 
 private:
 
-    uve_cmap cmap_;
+    // Sync the UVEs of all tables for a given UVE-Key, removing the
+    // ones that have timed out.
+    // pending is set if any of the remaining UVEs still needs
+    // periodic processing. The UVEs are sent to all collectors,
+    // unless a collector is given.
+    uint32_t SyncTableMap(uve_table_map &tmap, const std::string &table,
+            SandeshUVE::SendType st, uint32_t seqno, uint32_t cycle,
+            const std::string &ctx, bool *pending, int collector = -1) {
+        uint32_t count = 0;
+        typename uve_table_map::iterator uit = tmap.begin();
+        while (uit != tmap.end()) {
+            bool expired = false;
+            if (!table.empty() && uit->data.table_ != table) {
+                ++uit;
+                continue;
+            }
+            // Restored UVEs have no sequence number of their own, and
+            // are synced until the application publishes them again
+            if ((seqno < uit->seqno) || (seqno == 0) || uit->restored) {
+                if (ctx.empty()) {
+                    SANDESH_LOG(INFO, __func__ << " Syncing " <<
+                        uit->data.table_ << " val " << uit->data.log() <<
+                        " proxy " << SandeshStructProxyTrait<U>::get(uit->data) <<
+                        " seq " << uit->seqno);
+                }
+                T::Send(uit->data, uit->level, st, uit->seqno, cycle, ctx,
+                    collector);
+                if ((TM != 0) && (st == SandeshUVE::ST_PERIODIC)) {
+                    if ((cycle % TM) == 0) {
+                        if (uit->data.get_deleted()) {
+                            // This UVE was marked for deletion during the
+                            // last periodic processing round, and there
+                            // have been no UVE updates
+                            expired = true;
+                        } else {
+                            // Mark this UVE to be deleted during the next
+                            // periodic processing round, unless it is updated
+                            uit->data.set_deleted(true);
+                        }
+                    }
+                }
+                count++;
+            }
+            if (expired) {
+                uit = tmap.erase(uit);
+                uves_--;
+                continue;
+            }
+            if (uit->data.get_deleted() || T::_PeriodicPending(uit->data)) {
+                *pending = true;
+            }
+            ++uit;
+        }
+        return count;
+    }
+
+    // Add a UVE for a new table of a UVE-Key. send is set if the
+    // UVE needs to be sent
+    typename uve_table_map::iterator AddEntry(uve_table_map &tmap,
+            U &data, uint32_t seqnum, uint64_t mono_usec,
+            SandeshLevel::type level, bool *send) {
+        tmap.push_back(UVEMapEntry(data.table_, seqnum, level));
+        UVEMapEntry &ume(tmap.back());
+        // DS Config is picked up under the stripe lock, so that a
+        // concurrent InitDerivedStats either sees this entry, or
+        // this entry sees the new config
+        T::_InitDerivedStats(ume.data, GetDSConf());
+        *send = T::UpdateUVE(data, ume.data, mono_usec, level);
+        uves_++;
+        return tmap.end() - 1;
+    }
+
+    // Add a UVE-Key to the stripe, and to the index of UVE-Keys
+    typename uve_smap::iterator InsertKey(UVEStripe &stripe,
+            const std::string &key) {
+        if (index_) index_->Add(key, loc_);
+        return stripe.map.insert(std::make_pair(key, uve_table_map())).first;
+    }
+
+    // Remove a UVE-Key from the stripe, and from the index of UVE-Keys
+    void EraseKey(UVEStripe &stripe, typename uve_smap::iterator git) {
+        if (index_) index_->Remove(git->first, loc_);
+        stripe.dirty.erase(&*git);
+        stripe.map.erase(git);
+    }
+
+    static typename uve_table_map::iterator FindTable(uve_table_map &tmap,
+            const std::string &table) {
+        typename uve_table_map::iterator uit = tmap.begin();
+        for (; uit != tmap.end(); ++uit) {
+            if (uit->data.table_ == table) break;
+        }
+        return uit;
+    }
+
+    UVEStripe & GetStripe(const std::string &key) const {
+        return stripes_[boost::hash_value(key) % kStripes];
+    }
+
+    mutable UVEStripe stripes_[kStripes];
+    tbb::atomic<uint32_t> uves_;
     std::map<std::string, std::string> dsconf_;
+    // Protects dsconf_
     mutable tbb::mutex uve_mutex_;
+    // Serializes InitDerivedStats, across the update of dsconf_ and the
+    // walk of the stripes. Taken before uve_mutex_ and the stripe locks
+    tbb::mutex dsconf_update_mutex_;
+    SandeshUVEKeyIndex *index_;
+    SandeshUVEKeyIndex::Location loc_;
 };
 
 #define SANDESH_UVE_DEF(x,y,z,w) \
@@ -373,6 +872,7 @@ public:
             std::string kstring(proxy);
             for (size_t idx=0; idx<SandeshUVETypeMaps::kProxyPartitions; idx++) {
                 boost::assign::ptr_map_insert(*up)(idx);
+                up->at(idx).SetKeyIndex(&key_index_, proxy, idx);
             }
             group_map_.insert(kstring ,up);
         }
@@ -417,6 +917,105 @@ public:
         return count; 
     }
 
+    // Resumable sync of the native UVE Map and then the proxy groups
+    bool ResyncUVE(uint32_t seqno, SandeshUVESyncCursor *cursor,
+            uint32_t *budget, uint32_t *count, int collector) {
+        if (cursor->partition < 0) {
+            if (!native_map_.ResyncUVE(seqno, cursor, budget, count,
+                    collector)) {
+                return false;
+            }
+            cursor->partition = 0;
+            cursor->stripe = 0;
+        }
+        while (true) {
+            uve_pmap *pp;
+            {
+                tbb::mutex::scoped_lock lock(gmutex_);
+                // Move on to the next proxy group once all partitions
+                // of the current one have been walked
+                typename uve_gmap::iterator gi =
+                    (cursor->partition < SandeshUVETypeMaps::kProxyPartitions) ?
+                    group_map_.lower_bound(cursor->proxy) :
+                    group_map_.upper_bound(cursor->proxy);
+                if (gi == group_map_.end()) return true;
+                if (gi->first != cursor->proxy) {
+                    cursor->proxy = gi->first;
+                    cursor->partition = 0;
+                    cursor->stripe = 0;
+                    cursor->started = false;
+                }
+                pp = gi->second;
+            }
+            for (; cursor->partition < SandeshUVETypeMaps::kProxyPartitions;
+                    cursor->partition++) {
+                if (!pp->at(cursor->partition).ResyncUVE(seqno, cursor,
+                        budget, count, collector)) {
+                    return false;
+                }
+                cursor->stripe = 0;
+            }
+        }
+    }
+
+    int32_t VersionSig(void) const {
+        return T::sversionsig();
+    }
+
+    // Only the native UVE Map is snapshotted
+    int32_t WriteSnapshot(boost::shared_ptr<
+            contrail::sandesh::protocol::TProtocol> oprot) const {
+        return native_map_.WriteSnapshot(oprot);
+    }
+
+    int32_t ReadSnapshot(boost::shared_ptr<
+            contrail::sandesh::protocol::TProtocol> iprot, uint32_t *count) {
+        return native_map_.ReadSnapshot(iprot, count);
+    }
+
+    uint32_t ExpireRestored(void) {
+        return native_map_.ExpireRestored();
+    }
+
+    uint64_t GetEncodedSize(void) const {
+        uint64_t size = native_map_.GetEncodedSize();
+        std::vector<uve_pmap *> pv =
+                const_cast<SandeshUVEPerTypeMapGroup<T,U,P,TM> * >(this)->GetGMaps();
+        for (size_t jdx=0; jdx<pv.size(); jdx++) {
+            for (size_t idx=0; idx<SandeshUVETypeMaps::kProxyPartitions; idx++) {
+                size += pv[jdx]->at(idx).GetEncodedSize();
+            }
+        }
+        return size;
+    }
+
+    // Memory used by the caches of the type and by its index of
+    // UVE-Keys, in bytes
+    uint64_t GetMemorySize(void) const {
+        uint64_t size = native_map_.GetMemorySize() +
+                key_index_.GetMemorySize();
+        std::vector<uve_pmap *> pv =
+                const_cast<SandeshUVEPerTypeMapGroup<T,U,P,TM> * >(this)->GetGMaps();
+        for (size_t jdx=0; jdx<pv.size(); jdx++) {
+            for (size_t idx=0; idx<SandeshUVETypeMaps::kProxyPartitions; idx++) {
+                size += pv[jdx]->at(idx).GetMemorySize();
+            }
+        }
+        return size;
+    }
+
+    uint32_t Size(void) const {
+        uint32_t size = native_map_.Size();
+        std::vector<uve_pmap *> pv =
+                const_cast<SandeshUVEPerTypeMapGroup<T,U,P,TM> * >(this)->GetGMaps();
+        for (size_t jdx=0; jdx<pv.size(); jdx++) {
+            for (size_t idx=0; idx<SandeshUVETypeMaps::kProxyPartitions; idx++) {
+                size += pv[jdx]->at(idx).Size();
+            }
+        }
+        return size;
+    }
+
     // DerivedStats for proxy groups cannot be re-configured
     // at InitGenerator time or from Introspect
     // The Proxy group configuration should be changed instead
@@ -431,12 +1030,11 @@ public:
             const std::string& ctx) const {
         bool sent = false;
         if (native_map_.SendUVE(table, name, ctx)) sent = true;
-        std::vector<uve_pmap *> pv =
-                const_cast<SandeshUVEPerTypeMapGroup<T,U,P,TM> * >(this)->GetGMaps();
-        for (size_t jdx=0; jdx<pv.size(); jdx++) {
-            for (size_t idx=0; idx<SandeshUVETypeMaps::kProxyPartitions; idx++) {
-                if (pv[jdx]->at(idx).SendUVE(table, name, ctx)) sent = true;
-            }
+        SandeshUVEKeyIndex::LocationSet locs(key_index_.Find(name));
+        for (SandeshUVEKeyIndex::LocationSet::const_iterator li =
+                locs.begin(); li != locs.end(); ++li) {
+            uve_emap *em = GetPartition(li->first, li->second);
+            if (em->SendUVE(table, name, ctx)) sent = true;
         }
         return sent;
     }
@@ -453,7 +1051,8 @@ public:
             std::string proxy = SandeshStructProxyTrait<U>::get(data);
             assert(partition < SandeshUVETypeMaps::kProxyPartitions);
             uve_pmap * pp = GetGMap(proxy);
-            return pp->at(partition).UpdateUVE(data, seqnum, mono_usec, level);
+            return pp->at(partition).UpdateUVE(data, seqnum, mono_usec,
+                    level);
         }
     }
 
@@ -461,16 +1060,20 @@ public:
     uint32_t ClearUVEs(const std::string& proxy, int partition) {
         tbb::mutex::scoped_lock lock(gmutex_);
         typename uve_gmap::iterator gi = group_map_.find(proxy);
-        if (gi != group_map_.end()) {
-            assert(partition < SandeshUVETypeMaps::kProxyPartitions);
-            return gi->second->at(partition).ClearUVEs();
-        }
-        return 0;
+        if (gi == group_map_.end()) return 0;
+        assert(partition < SandeshUVETypeMaps::kProxyPartitions);
+        return gi->second->at(partition).ClearUVEs();
     }
 
 private:
+    uve_emap * GetPartition(const std::string& proxy, int partition) const {
+        tbb::mutex::scoped_lock lock(gmutex_);
+        return &(const_cast<uve_gmap &>(group_map_).at(proxy).at(partition));
+    }
+
     mutable tbb::mutex gmutex_;
     uve_gmap group_map_;
+    SandeshUVEKeyIndex key_index_;
     SandeshUVEPerTypeMapImpl<T, U, P, TM> native_map_;
 };
 
@@ -0,0 +1,510 @@
+/*
+ * Copyright (c) 2016 Juniper Networks, Inc. All rights reserved.
+ */
+
+//
+// derived_stats_test.cc
+//
+// Derived Stats Test
+//
+
+#include "testing/gunit.h"
+
+#include <cstdlib>
+#include <map>
+#include <string>
+
+#include <base/logging.h>
+
+#include <sandesh/sandesh.h>
+#include <sandesh/derived_stats_algo.h>
+
+#include "derived_stats_test_types.h"
+
+using contrail::sandesh::DSR_OK;
+using contrail::sandesh::DSR_INVALID;
+
+// Value of a map attribute whose derived stats are computed on a member
+struct DerivedStatsTestElem {
+    DerivedStatsTestElem(uint64_t v = 0, bool d = false) :
+        value(v), deleted(d) {}
+    uint64_t get_value() const { return value; }
+    bool get_deleted() const { return deleted; }
+    uint64_t value;
+    bool deleted;
+};
+
+template <>
+struct SandeshStructDeleteTrait<DerivedStatsTestElem> {
+    static bool get(const DerivedStatsTestElem& s) { return s.get_deleted(); }
+};
+
+// What the generator emits for such a derived stat
+struct DerivedStatsTestElemValue {
+    uint64_t operator()(const DerivedStatsTestElem & _val) const {
+        return _val.get_value();
+    }
+};
+
+// DSSum as it was before its time buckets were kept in a ring.
+// The ring based version must produce the same results.
+template <typename ElemT, class SumResT>
+class DSSumMap {
+  public:
+    DSSumMap(const std::string &annotation) : samples_(0), shifter_(0),
+            start_tbin_(0), last_tbin_(0) {
+        if (annotation.empty()) {
+            range_usecs_ = 0;
+        } else {
+            range_usecs_ = ((uint64_t) strtoul(annotation.c_str(), NULL, 10))
+                    * 1000000;
+            while ((uint64_t)(1 << (shifter_ + 8)) < range_usecs_) shifter_++;
+        }
+    }
+
+    uint64_t samples_;
+    SumResT value_;
+    std::map<uint64_t, std::pair<uint64_t, ElemT> > history_buf_;
+    uint64_t range_usecs_;
+    uint8_t shifter_;
+    uint64_t start_tbin_;
+    uint64_t last_tbin_;
+
+    contrail::sandesh::DSReturnType FillResult(SumResT &res) const {
+        if (!samples_) return DSR_INVALID;
+        if (range_usecs_) {
+            uint64_t end_range =
+                    ((start_tbin_ + range_usecs_) >> shifter_) << shifter_;
+            if (end_range > last_tbin_) return DSR_INVALID;
+        }
+        res = value_;
+        return DSR_OK;
+    }
+
+    void Purge(uint64_t mono_usec) {
+        for (typename std::map<uint64_t, std::pair<uint64_t, ElemT> >::iterator
+                it = history_buf_.begin(); it != history_buf_.end(); ) {
+            uint64_t end_range =
+                    ((it->first + range_usecs_) >> shifter_) << shifter_;
+            if (end_range <= mono_usec) {
+                value_ = value_ - it->second.second;
+                samples_ = samples_ - it->second.first;
+                history_buf_.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void Update(const ElemT& raw, uint64_t mono_usec) {
+        if (!samples_) {
+            value_ = raw;
+        } else {
+            value_ = value_ + raw;
+        }
+        if (range_usecs_) {
+            uint64_t tbin = (mono_usec >> shifter_) << shifter_;
+            if (!start_tbin_) start_tbin_ = tbin;
+            last_tbin_ = tbin;
+            Purge(tbin);
+            typename std::map<uint64_t, std::pair<uint64_t, ElemT> >::iterator
+                    ut = history_buf_.find(tbin);
+            if (ut == history_buf_.end()) {
+                history_buf_[tbin] = std::make_pair(1, raw);
+            } else {
+                ut->second.second = ut->second.second + raw;
+                ut->second.first++;
+            }
+        }
+        samples_++;
+    }
+};
+
+class DerivedStatsTest : public ::testing::Test {
+protected:
+    static const uint64_t kStartUsec = 1000000;
+
+    // Feed the same random sequence to the ring and the map based
+    // DSSum, with gaps both shorter and longer than the window
+    void RandomSumCheck(const std::string &annotation, unsigned int seed) {
+        contrail::sandesh::DSSum<uint64_t, uint64_t> dssum(annotation);
+        contrail::sandesh::DSAvg<uint64_t, uint64_t> dsavg(annotation);
+        DSSumMap<uint64_t, uint64_t> ref(annotation);
+        uint64_t range_usecs = ref.range_usecs_;
+        srand(seed);
+        uint64_t now = kStartUsec;
+        for (int i = 0; i < 20000; i++) {
+            int r = rand() % 1000;
+            if (r == 0) {
+                now += range_usecs + rand() % (range_usecs + 1);
+            } else if (r < 10) {
+                now += rand() % (range_usecs / 2 + 1);
+            } else {
+                now += rand() % (range_usecs / 64 + 1);
+            }
+            uint64_t val = rand() % 1000;
+            dssum.Update(val, now);
+            dsavg.Update(val, now);
+            ref.Update(val, now);
+            ASSERT_EQ(ref.samples_, dssum.samples_) << "step " << i;
+            uint64_t res = 0, rres = 0;
+            contrail::sandesh::DSReturnType rret = ref.FillResult(rres);
+            ASSERT_EQ(rret, dssum.FillResult(res)) << "step " << i;
+            if (rret == DSR_OK) {
+                ASSERT_EQ(rres, res) << "step " << i;
+                ASSERT_EQ(rret, dsavg.FillResult(res)) << "step " << i;
+                ASSERT_EQ(rres / ref.samples_, res) << "step " << i;
+            }
+        }
+    }
+};
+
+TEST_F(DerivedStatsTest, SumAvgBasic) {
+    contrail::sandesh::DSSum<uint64_t, uint64_t> dssum("1");
+    contrail::sandesh::DSAvg<uint64_t, uint64_t> dsavg("1");
+    // 10 samples a second, over 3 seconds
+    for (int i = 0; i < 30; i++) {
+        dssum.Update(1, kStartUsec + i * 100000);
+        dsavg.Update(5, kStartUsec + i * 100000);
+    }
+    uint64_t sum, avg;
+    EXPECT_EQ(DSR_OK, dssum.FillResult(sum));
+    EXPECT_EQ(dssum.samples_, sum);
+    EXPECT_GE(sum, 9U);
+    EXPECT_LE(sum, 11U);
+    EXPECT_EQ(DSR_OK, dsavg.FillResult(avg));
+    EXPECT_EQ(5U, avg);
+    // Everything goes out of range after a gap
+    dssum.Update(1, kStartUsec + 60000000);
+    EXPECT_EQ(1U, dssum.samples_);
+    EXPECT_EQ(1U, dssum.value_);
+}
+
+TEST_F(DerivedStatsTest, SumAvgRandom) {
+    const char *ranges[] = { "1", "10", "60", "3600" };
+    for (size_t i = 0; i < sizeof(ranges) / sizeof(ranges[0]); i++) {
+        SCOPED_TRACE(ranges[i]);
+        for (unsigned int seed = 1; seed <= 4; seed++) {
+            RandomSumCheck(ranges[i], seed);
+        }
+    }
+}
+
+TEST_F(DerivedStatsTest, MapMerge) {
+    contrail::sandesh::DerivedStatsIf<contrail::sandesh::DSSum,
+        uint64_t, uint64_t> ds("", true);
+    std::map<std::string, uint64_t> raw;
+    std::map<std::string, bool> del;
+    raw["a"] = 10; del["a"] = false;
+    raw["c"] = 10; del["c"] = false;
+    ds.Update(raw, del, kStartUsec);
+    // Aggregate counters: only the increase is summed
+    raw["a"] = 15;
+    raw["b"] = 3; del["b"] = false;
+    raw["c"] = 10; del["c"] = true;
+    ds.Update(raw, del, kStartUsec + 100000);
+    std::map<std::string, uint64_t> res;
+    bool isset;
+    ds.FillResult(res, isset);
+    EXPECT_TRUE(isset);
+    EXPECT_EQ(2U, res.size());
+    EXPECT_EQ(15U, res["a"]);
+    EXPECT_EQ(3U, res["b"]);
+    // An empty map clears all the DS objects
+    ds.Update(std::map<std::string, uint64_t>(), del, kStartUsec + 200000);
+    ds.FillResult(res, isset);
+    EXPECT_FALSE(isset);
+}
+
+// The raw map is merged through the accessors, the way the generated
+// UpdateUVE does it, without building value and delete maps
+TEST_F(DerivedStatsTest, MapMergeAccessor) {
+    contrail::sandesh::DerivedStatsIf<contrail::sandesh::DSSum,
+        uint64_t, uint64_t> ds("", true);
+    contrail::sandesh::DerivedStatsIf<contrail::sandesh::DSSum,
+        uint64_t, uint64_t> dsmap("", true);
+    std::map<std::string, DerivedStatsTestElem> raw;
+    std::map<std::string, uint64_t> rawv;
+    raw["a"] = DerivedStatsTestElem(10);
+    raw["c"] = DerivedStatsTestElem(10);
+    ds.Update(raw, DerivedStatsTestElemValue(),
+        contrail::sandesh::DSMapRawDelete<DerivedStatsTestElem>(),
+        kStartUsec);
+    raw["a"] = DerivedStatsTestElem(15);
+    raw["b"] = DerivedStatsTestElem(3);
+    raw["c"] = DerivedStatsTestElem(10, true);
+    ds.Update(raw, DerivedStatsTestElemValue(),
+        contrail::sandesh::DSMapRawDelete<DerivedStatsTestElem>(),
+        kStartUsec + 100000);
+    std::map<std::string, uint64_t> res;
+    bool isset;
+    ds.FillResult(res, isset);
+    EXPECT_TRUE(isset);
+    EXPECT_EQ(2U, res.size());
+    EXPECT_EQ(15U, res["a"]);
+    EXPECT_EQ(3U, res["b"]);
+
+    // Plain values are never deleted through the trait
+    rawv["a"] = 5;
+    rawv["b"] = 7;
+    dsmap.Update(rawv, contrail::sandesh::DSMapRawElem<uint64_t>(),
+        contrail::sandesh::DSMapRawDelete<uint64_t>(), kStartUsec);
+    dsmap.FillResult(res, isset);
+    EXPECT_EQ(2U, res.size());
+    EXPECT_EQ(7U, res["b"]);
+
+    // Periodic derived stats take the same accessors
+    contrail::sandesh::DerivedStatsPeriodicIf<contrail::sandesh::DSSum,
+        uint64_t, uint64_t, contrail::sandesh::DSPeriodic<uint64_t> >
+        dsper("", false);
+    dsper.Update(raw, DerivedStatsTestElemValue(),
+        contrail::sandesh::DSMapRawDelete<DerivedStatsTestElem>(),
+        kStartUsec);
+    std::map<std::string, contrail::sandesh::DSPeriodic<uint64_t> > pres;
+    dsper.FillResult(pres, isset);
+    EXPECT_TRUE(isset);
+    EXPECT_EQ(2U, pres.size());
+    EXPECT_EQ(15U, pres["a"].staging);
+}
+
+// The DS objects are reused across periods. Each period starts from
+// zero, and a key that was not updated in a period drops out.
+TEST_F(DerivedStatsTest, PeriodicReuse) {
+    typedef contrail::sandesh::DSPeriodic<uint64_t> PeriodicResult;
+    contrail::sandesh::DerivedStatsPeriodicIf<contrail::sandesh::DSSum,
+        uint64_t, uint64_t, PeriodicResult> ds("", false);
+    contrail::sandesh::DerivedStatsPeriodicIf<contrail::sandesh::DSSum,
+        uint64_t, uint64_t, PeriodicResult> dsm("", false);
+    std::map<std::string, PeriodicResult> mres;
+    std::map<std::string, uint64_t> raw;
+    std::map<std::string, bool> del;
+    PeriodicResult res;
+    bool isset;
+    EXPECT_FALSE(ds.IsResult());
+    EXPECT_FALSE(dsm.IsResult());
+
+    ds.Update(3, kStartUsec);
+    ds.Update(4, kStartUsec + 1000);
+    raw["a"] = 3; del["a"] = false;
+    raw["b"] = 5; del["b"] = false;
+    dsm.Update(raw, del, kStartUsec);
+    EXPECT_TRUE(ds.Flush(res));
+    EXPECT_TRUE(dsm.Flush(mres));
+    ds.FillResult(res, isset);
+    EXPECT_TRUE(isset);
+    EXPECT_EQ(7U, res.value);
+    EXPECT_FALSE(res.__isset.staging);
+    dsm.FillResult(mres, isset);
+    EXPECT_EQ(2U, mres.size());
+    EXPECT_EQ(5U, mres["b"].value);
+
+    // Second period: only "a" is updated
+    ds.Update(2, kStartUsec + 2000);
+    raw.clear(); del.clear();
+    raw["a"] = 1; del["a"] = false;
+    dsm.Update(raw, del, kStartUsec + 2000);
+    res = PeriodicResult();
+    ds.FillResult(res, isset);
+    EXPECT_EQ(7U, res.value);
+    EXPECT_EQ(2U, res.staging);
+    dsm.FillResult(mres, isset);
+    EXPECT_EQ(2U, mres.size());
+    EXPECT_EQ(1U, mres["a"].staging);
+    EXPECT_FALSE(mres["b"].__isset.staging);
+    EXPECT_TRUE(ds.Flush(res));
+    EXPECT_TRUE(dsm.Flush(mres));
+    res = PeriodicResult();
+    ds.FillResult(res, isset);
+    EXPECT_EQ(2U, res.value);
+    dsm.FillResult(mres, isset);
+    EXPECT_EQ(1U, mres.size());
+    EXPECT_EQ(1U, mres["a"].value);
+
+    // A period without updates clears the results
+    EXPECT_FALSE(ds.Flush(res));
+    EXPECT_FALSE(dsm.Flush(mres));
+    EXPECT_FALSE(ds.IsResult());
+    EXPECT_FALSE(dsm.IsResult());
+    ds.FillResult(res, isset);
+    EXPECT_FALSE(isset);
+    dsm.FillResult(mres, isset);
+    EXPECT_FALSE(isset);
+}
+
+TEST_F(DerivedStatsTest, Percentile) {
+    contrail::sandesh::DSPercentile<uint64_t, PercentileResult>
+        dspct("50,99:0.01");
+    PercentileResult res;
+    EXPECT_EQ(DSR_INVALID, dspct.FillResult(res));
+    for (int i = 1; i <= 1000; i++) {
+        dspct.Update(i, kStartUsec + i * 1000);
+    }
+    EXPECT_EQ(DSR_OK, dspct.FillResult(res));
+    EXPECT_EQ(1000U, res.get_samples());
+    std::map<std::string, double> pmap(res.get_percentiles());
+    EXPECT_EQ(2U, pmap.size());
+    // Within the relative accuracy of the sketch
+    EXPECT_NEAR(500, pmap["p50"], 5);
+    EXPECT_NEAR(990, pmap["p99"], 10);
+
+    contrail::sandesh::DSPercentile<uint64_t, PercentileResult>
+        dserr("50,x");
+    PercentileResult eres;
+    EXPECT_EQ(DSR_OK, dserr.FillResult(eres));
+    EXPECT_EQ("Invalid percentile x", eres.get_error());
+}
+
+TEST_F(DerivedStatsTest, PercentileMerge) {
+    contrail::sandesh::DSPercentile<uint64_t, PercentileResult> low("50");
+    contrail::sandesh::DSPercentile<uint64_t, PercentileResult> high("50");
+    for (int i = 1; i <= 500; i++) {
+        low.Update(i, kStartUsec + i * 1000);
+        high.Update(500 + i, kStartUsec + i * 1000);
+    }
+    low.Merge(high);
+    PercentileResult res;
+    EXPECT_EQ(DSR_OK, low.FillResult(res));
+    EXPECT_EQ(1000U, res.get_samples());
+    std::map<std::string, double> pmap(res.get_percentiles());
+    EXPECT_NEAR(500, pmap["p50"], 5);
+
+    // Sketches with a bad accuracy can still be merged
+    contrail::sandesh::DSPercentile<uint64_t, PercentileResult> bad("50:2");
+    contrail::sandesh::DSPercentile<uint64_t, PercentileResult> bad2("50:2");
+    bad2.Update(1, kStartUsec);
+    bad.Merge(bad2);
+    PercentileResult eres;
+    EXPECT_EQ(DSR_OK, bad.FillResult(eres));
+    EXPECT_EQ(1U, eres.get_samples());
+    EXPECT_EQ("Invalid accuracy 2", eres.get_error());
+}
+
+// Percentiles declared in the IDL, updated through the generated code
+TEST_F(DerivedStatsTest, PercentileUVE) {
+    DerivedStatsPercentileData cache;
+    DerivedStatsPercentileTest::_InitDerivedStats(cache,
+        DerivedStatsPercentileTest::_DSConf());
+    DerivedStatsPercentileData data;
+    for (int i = 1; i <= 1000; i++) {
+        data = DerivedStatsPercentileData();
+        data.set_name("uve1");
+        data.set_latency(i);
+        std::map<std::string, uint64_t> intf;
+        intf["eth0"] = i;
+        intf["eth1"] = 2 * i;
+        data.set_intf_latency(intf);
+        EXPECT_TRUE(DerivedStatsPercentileTest::UpdateUVE(data, cache,
+            kStartUsec + i * 1000, SandeshLevel::SYS_INFO));
+    }
+
+    // Inline derived stats are filled into the last update
+    EXPECT_TRUE(data.__isset.pct_latency);
+    EXPECT_EQ(1000U, data.get_pct_latency().get_samples());
+    std::map<std::string, double> pmap(
+        data.get_pct_latency().get_percentiles());
+    EXPECT_EQ(2U, pmap.size());
+    EXPECT_NEAR(500, pmap["p50"], 5);
+    EXPECT_NEAR(990, pmap["p99"], 10);
+
+    // Per key, with the default percentiles
+    EXPECT_TRUE(data.__isset.pct_intf_latency);
+    std::map<std::string, PercentileResult> mres(
+        data.get_pct_intf_latency());
+    EXPECT_EQ(2U, mres.size());
+    pmap = mres["eth1"].get_percentiles();
+    EXPECT_EQ(3U, pmap.size());
+    EXPECT_NEAR(1000, pmap["p50"], 10);
+    EXPECT_NEAR(1900, pmap["p95"], 19);
+
+    EXPECT_TRUE(data.__isset.bad_latency);
+    EXPECT_EQ("Invalid accuracy 2", data.get_bad_latency().get_error());
+}
+
+// Percentiles of a periodic UVE, flushed the way the generated
+// LoadUVE does it at the end of each period
+TEST_F(DerivedStatsTest, PercentilePeriodicUVE) {
+    DerivedStatsPercentilePeriodicData cache;
+    DerivedStatsPercentilePeriodicTest::_InitDerivedStats(cache,
+        DerivedStatsPercentilePeriodicTest::_DSConf());
+    for (int i = 1; i <= 1000; i++) {
+        DerivedStatsPercentilePeriodicData data;
+        data.set_name("uve1");
+        data.set_latency(i);
+        std::map<std::string, uint64_t> intf;
+        intf["eth0"] = i;
+        if (i <= 500) intf["eth1"] = 2 * i;
+        data.set_intf_latency(intf);
+        DerivedStatsPercentilePeriodicTest::UpdateUVE(data, cache,
+            kStartUsec + i * 1000, SandeshLevel::SYS_INFO);
+    }
+    EXPECT_TRUE(DerivedStatsPercentilePeriodicTest::_PeriodicPending(cache));
+
+    // Before the first flush, only the staging results are filled
+    cache.__dsobj_pct_latency->FillResult(cache.pct_latency,
+        cache.__isset.pct_latency, true);
+    EXPECT_TRUE(cache.__isset.pct_latency);
+    EXPECT_FALSE(cache.get_pct_latency().__isset.value);
+    EXPECT_TRUE(cache.get_pct_latency().__isset.staging);
+    EXPECT_EQ(1000U, cache.get_pct_latency().get_staging().get_samples());
+
+    // End of the first period
+    cache.__dsobj_pct_latency->Flush(cache.pct_latency);
+    cache.__dsobj_pct_latency->FillResult(cache.pct_latency,
+        cache.__isset.pct_latency, true);
+    cache.__dsobj_pct_intf_latency->Flush(cache.pct_intf_latency);
+    cache.__dsobj_pct_intf_latency->FillResult(cache.pct_intf_latency,
+        cache.__isset.pct_intf_latency, true);
+    EXPECT_TRUE(cache.__isset.pct_latency);
+    EXPECT_TRUE(cache.get_pct_latency().__isset.value);
+    EXPECT_FALSE(cache.get_pct_latency().__isset.staging);
+    PercentileResult res(cache.get_pct_latency().get_value());
+    EXPECT_EQ(1000U, res.get_samples());
+    std::map<std::string, double> pmap(res.get_percentiles());
+    EXPECT_EQ(2U, pmap.size());
+    EXPECT_NEAR(500, pmap["p50"], 5);
+    EXPECT_NEAR(990, pmap["p99"], 10);
+    EXPECT_TRUE(cache.__isset.pct_intf_latency);
+    std::map<std::string, PercentileResult_P_> mres(
+        cache.get_pct_intf_latency());
+    EXPECT_EQ(2U, mres.size());
+    EXPECT_EQ(500U, mres["eth1"].get_value().get_samples());
+    pmap = mres["eth1"].get_value().get_percentiles();
+    EXPECT_EQ(1U, pmap.size());
+    EXPECT_NEAR(500, pmap["p50"], 5);
+
+    // The second period starts from no samples, and eth1 is not updated
+    for (int i = 1; i <= 100; i++) {
+        DerivedStatsPercentilePeriodicData data;
+        data.set_name("uve1");
+        data.set_latency(10 * i);
+        std::map<std::string, uint64_t> intf;
+        intf["eth0"] = 10 * i;
+        data.set_intf_latency(intf);
+        DerivedStatsPercentilePeriodicTest::UpdateUVE(data, cache,
+            kStartUsec + (1000 + i) * 1000, SandeshLevel::SYS_INFO);
+    }
+    cache.__dsobj_pct_latency->Flush(cache.pct_latency);
+    cache.__dsobj_pct_latency->FillResult(cache.pct_latency,
+        cache.__isset.pct_latency, true);
+    cache.__dsobj_pct_intf_latency->Flush(cache.pct_intf_latency);
+    cache.__dsobj_pct_intf_latency->FillResult(cache.pct_intf_latency,
+        cache.__isset.pct_intf_latency, true);
+    res = cache.get_pct_latency().get_value();
+    EXPECT_EQ(100U, res.get_samples());
+    pmap = res.get_percentiles();
+    EXPECT_NEAR(500, pmap["p50"], 5);
+    mres = cache.get_pct_intf_latency();
+    EXPECT_EQ(1U, mres.size());
+    EXPECT_EQ(100U, mres["eth0"].get_value().get_samples());
+
+    // A period without updates has no result
+    cache.__dsobj_pct_latency->Flush(cache.pct_latency);
+    cache.__dsobj_pct_intf_latency->Flush(cache.pct_intf_latency);
+    EXPECT_FALSE(DerivedStatsPercentilePeriodicTest::_PeriodicPending(cache));
+}
+
+int main(int argc, char **argv) {
+    LoggingInit();
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -6,22 +6,30 @@
 // sandesh_client_test.cc
 //
 
+#include <algorithm>
+#include <set>
 #include <boost/assign.hpp>
 #include <boost/asio.hpp>
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp>
 
 #include "base/logging.h"
 #include "base/test/task_test_util.h"
 
 #include "io/event_manager.h"
+#include "io/test/event_manager_test.h"
 #include "testing/gunit.h"
 
 #include <sandesh/sandesh_types.h>
+#include <sandesh/sandesh_constants.h>
 #include <sandesh/sandesh.h>
 #include <sandesh/sandesh_session.h>
 #include <sandesh/sandesh_client.h>
 #include <sandesh/sandesh_statistics.h>
+#include <sandesh/sandesh_message_builder.h>
+#include <sandesh/sandesh_uve_types.h>
 #include "sandesh_client_sm_priv.h"
+#include "sandesh_connection.h"
 #include "sandesh_test_common.h"
 
 using namespace std;
@@ -31,6 +39,7 @@ using boost::system::error_code;
 using boost::asio::ip::address;
 using namespace contrail::sandesh::protocol;
 using namespace contrail::sandesh::transport;
+using contrail::sandesh::test::SandeshServerTest;
 
 typedef boost::asio::ip::tcp::endpoint Endpoint;
 
@@ -191,6 +200,20 @@ protected:
         return collector_endpoints;
     }
 
+    // Collectors in the order they are tried
+    std::vector<Endpoint> CollectorOrder() const {
+        std::vector<Endpoint> order;
+        for (size_t i = 0; i < sm_->collector_order_.size(); i++) {
+            order.push_back(sm_->collectors_[sm_->collector_order_[i]]);
+        }
+        return order;
+    }
+
+    void SetCollectorLoad(const Endpoint &collector, uint32_t load) {
+        sm_->collector_loads_[collector] = load;
+        sm_->RankCollectors();
+    }
+
     void RunToState(SandeshClientSM::State state) {
         timer_->Start(15000,
                      boost::bind(&SandeshClientStateMachineTest::DummyTimerHandler, this));
@@ -434,6 +457,65 @@ TEST_F(SandeshClientStateMachineTest, Matrix) {
     }
 }
 
+// A collector update keeps the current collector while it is configured,
+// and otherwise picks one of the configured collectors
+TEST_F(SandeshClientStateMachineTest, CollectorUpdateOrder) {
+    std::vector<string> collectors = boost::assign::list_of
+        ("1.1.1.1")("2.2.2.2")("3.3.3.3");
+    sm_->SetCollectors(GetCollectorEndpoints(collectors));
+    task_util::WaitForIdle();
+    Endpoint collector(sm_->server());
+    std::vector<Endpoint> endpoints(GetCollectorEndpoints(collectors));
+    EXPECT_TRUE(std::find(endpoints.begin(), endpoints.end(), collector) !=
+        endpoints.end());
+    std::reverse(collectors.begin(), collectors.end());
+    sm_->SetCollectors(GetCollectorEndpoints(collectors));
+    task_util::WaitForIdle();
+    EXPECT_EQ(collector, sm_->server());
+    std::vector<string> new_collectors = boost::assign::list_of
+        ("4.4.4.4")("5.5.5.5");
+    endpoints = GetCollectorEndpoints(new_collectors);
+    sm_->SetCollectors(endpoints);
+    task_util::WaitForIdle();
+    EXPECT_TRUE(std::find(endpoints.begin(), endpoints.end(),
+        sm_->server()) != endpoints.end());
+}
+
+// Collectors with a known load trade places by load, the others keep the
+// place given by the hash
+TEST_F(SandeshClientStateMachineTest, CollectorLoadOrder) {
+    std::vector<string> collectors = boost::assign::list_of
+        ("1.1.1.1")("2.2.2.2")("3.3.3.3")("4.4.4.4");
+    sm_->SetCollectors(GetCollectorEndpoints(collectors));
+    task_util::WaitForIdle();
+    std::vector<Endpoint> order(CollectorOrder());
+    ASSERT_EQ(4U, order.size());
+    SetCollectorLoad(order[1], 5);
+    SetCollectorLoad(order[3], 1);
+    std::vector<Endpoint> expected = boost::assign::list_of
+        (order[0])(order[3])(order[2])(order[1]);
+    EXPECT_EQ(expected, CollectorOrder());
+    // A load of 0 is a known load
+    SetCollectorLoad(order[1], 0);
+    expected = boost::assign::list_of
+        (order[0])(order[1])(order[2])(order[3]);
+    EXPECT_EQ(expected, CollectorOrder());
+}
+
+// The idle hold time is jittered between half and all of the connect time
+TEST_F(SandeshClientStateMachineTest, IdleHoldTimeJitter) {
+    for (int i = 0; i < 3; i++) {
+        sm_->connect_attempts_inc();
+    }
+    int connect_time(sm_->GetConnectTime() * 1000);
+    for (int i = 0; i < 100; i++) {
+        int idle_hold_time(sm_->GetIdleHoldTime());
+        EXPECT_LE(connect_time / 2, idle_hold_time);
+        EXPECT_GE(connect_time, idle_hold_time);
+    }
+    sm_->connect_attempts_clear();
+}
+
 class SandeshClientStateMachineConnectTest : public SandeshClientStateMachineTest {
     virtual void SetUp() {
         GetToState(SandeshClientSM::CONNECT);
@@ -597,6 +679,315 @@ TEST_F(SandeshClientCloseSMSessionTest, Backoff) {
         close_interval_msec);
 }
 
+class SandeshClientFanoutTest : public ::testing::Test {
+protected:
+    static const uint32_t kFanout = 3;
+
+    SandeshClientFanoutTest() : client_(NULL) {
+        SandeshConfig config;
+        config.collector_fanout = kFanout;
+        std::vector<Endpoint> collectors;
+        collectors.push_back(Endpoint(address::from_string("1.1.1.1"), 8086));
+        client_ = new SandeshClient(&evm_, collectors, config);
+        task_util::WaitForIdle();
+    }
+
+    ~SandeshClientFanoutTest() {
+        task_util::WaitForIdle();
+        client_->Shutdown();
+        task_util::WaitForIdle();
+        TcpServerManager::DeleteServer(client_);
+        client_ = NULL;
+        task_util::WaitForIdle();
+        evm_.Shutdown();
+    }
+
+    EventManager evm_;
+    SandeshClient *client_;
+};
+
+// There are no more state machines sending than there are collectors
+TEST_F(SandeshClientFanoutTest, ActiveFanout) {
+    EXPECT_EQ(static_cast<size_t>(kFanout), client_->collector_fanout());
+    EXPECT_EQ(1U, client_->active_fanout());
+    std::vector<string> collectors = boost::assign::list_of
+        ("1.1.1.1:8086")("2.2.2.2:8086");
+    client_->ReConfigCollectors(collectors);
+    task_util::WaitForIdle();
+    EXPECT_EQ(2U, client_->active_fanout());
+    collectors = boost::assign::list_of
+        ("1.1.1.1:8086")("2.2.2.2:8086")("3.3.3.3:8086")("4.4.4.4:8086");
+    client_->ReConfigCollectors(collectors);
+    task_util::WaitForIdle();
+    EXPECT_EQ(static_cast<size_t>(kFanout), client_->active_fanout());
+    client_->ReConfigCollectors(std::vector<string>());
+    task_util::WaitForIdle();
+    EXPECT_EQ(1U, client_->active_fanout());
+}
+
+// Each state machine sends to a different collector, and fails over to a
+// collector that no other state machine sends to
+TEST_F(SandeshClientFanoutTest, DistinctCollectors) {
+    std::vector<string> collectors = boost::assign::list_of
+        ("1.1.1.1:8086")("2.2.2.2:8086")("3.3.3.3:8086")("4.4.4.4:8086");
+    client_->ReConfigCollectors(collectors);
+    task_util::WaitForIdle();
+    TaskScheduler *scheduler(TaskScheduler::GetInstance());
+    scheduler->Stop();
+    std::set<Endpoint> servers;
+    for (size_t i = 0; i < kFanout; i++) {
+        servers.insert(client_->state_machine(i)->server());
+    }
+    EXPECT_EQ(static_cast<size_t>(kFanout), servers.size());
+    std::vector<Endpoint> unused;
+    BOOST_FOREACH(const string &collector, collectors) {
+        Endpoint ep(address::from_string(
+            collector.substr(0, collector.find(':'))), 8086);
+        if (servers.find(ep) == servers.end()) {
+            unused.push_back(ep);
+        }
+    }
+    ASSERT_EQ(1U, unused.size());
+    SandeshClientSMImpl *sm = static_cast<SandeshClientSMImpl *>(
+        client_->state_machine(0));
+    EXPECT_TRUE(sm->CollectorChange());
+    EXPECT_EQ(unused[0], sm->server());
+    // With no collector left unused, the state machine stays with its own
+    sm = static_cast<SandeshClientSMImpl *>(client_->state_machine(1));
+    Endpoint server(sm->server());
+    EXPECT_FALSE(sm->CollectorChange());
+    EXPECT_EQ(server, sm->server());
+    scheduler->Start();
+}
+
+// A generator connecting to a collector that defers its admission, as
+// the only syncing slot is held by another generator
+class SandeshClientAdmissionTest : public ::testing::Test {
+protected:
+    SandeshClientAdmissionTest() : other_(NULL) {
+    }
+
+    virtual void SetUp() {
+        evm_.reset(new EventManager());
+        SandeshConfig config;
+        config.sandesh_max_syncing_connections = 1;
+        config.sandesh_max_pending_admissions = 1;
+        server_ = new SandeshServerTest(evm_.get(),
+            boost::bind(&SandeshClientAdmissionTest::ReceiveSandeshMsg,
+                this, _1, _2), config);
+        thread_.reset(new ServerThread(evm_.get()));
+    }
+
+    virtual void TearDown() {
+        task_util::WaitForIdle();
+        Sandesh::Uninit();
+        task_util::WaitForIdle();
+        if (other_ != NULL) {
+            server_->ReleaseAdmission(other_->state_machine());
+            other_->Shutdown();
+            task_util::WaitForIdle();
+            delete other_;
+        }
+        TASK_UTIL_EXPECT_FALSE(server_->HasSessions());
+        server_->Shutdown();
+        task_util::WaitForIdle();
+        TcpServerManager::DeleteServer(server_);
+        task_util::WaitForIdle();
+        evm_->Shutdown();
+        if (thread_.get() != NULL) {
+            thread_->Join();
+        }
+        task_util::WaitForIdle();
+    }
+
+    bool ReceiveSandeshMsg(SandeshSession *session,
+            const SandeshMessage *msg) {
+        return true;
+    }
+
+    SandeshServerTest *server_;
+    SandeshServerConnection *other_;
+    std::auto_ptr<ServerThread> thread_;
+    std::auto_ptr<EventManager> evm_;
+};
+
+// The generator keeps its session while deferred for longer than it
+// waits for the reply to its control message
+TEST_F(SandeshClientAdmissionTest, DeferLongerThanConnectTime) {
+    server_->Initialize(0);
+    thread_->Start();
+    int port = server_->GetPort();
+    ASSERT_LT(0, port);
+    other_ = new SandeshServerConnection(server_, Endpoint(),
+        Task::kTaskInstanceAny,
+        TaskScheduler::GetInstance()->GetTaskId("sandesh::Test::StateMachine"));
+    EXPECT_EQ(SandeshServer::ADMITTED,
+        server_->Admit(other_->state_machine()));
+    Sandesh::InitGenerator("SandeshClientAdmissionTest", "localhost",
+        "Test", "Test", evm_.get(), 0, NULL);
+    Sandesh::ConnectToCollector("127.0.0.1", port);
+    TASK_UTIL_EXPECT_TRUE(
+        Sandesh::client()->state() == SandeshClientSM::CLIENT_INIT);
+    SandeshClientSMImpl *sm = static_cast<SandeshClientSMImpl *>(
+        Sandesh::client()->state_machine());
+    usleep((sm->GetConnectTime() + 2) * 1000000);
+    EXPECT_EQ(SandeshClientSM::CLIENT_INIT, Sandesh::client()->state());
+    EXPECT_EQ(1, sm->connects());
+    // Admitted on the same session once the slot is released
+    server_->ReleaseAdmission(other_->state_machine());
+    TASK_UTIL_EXPECT_TRUE(
+        Sandesh::client()->state() == SandeshClientSM::ESTABLISHED);
+    EXPECT_EQ(1, sm->connects());
+}
+
+// A generator sending each message to two collectors
+class SandeshClientFanoutSendTest : public ::testing::Test {
+protected:
+    static const int kCollectors = 2;
+
+    virtual void SetUp() {
+        // The UVE cache outlives the generator, so each test sends its own
+        uve_name_ = ::testing::UnitTest::GetInstance()->current_test_info()->
+            name();
+        evm_.reset(new EventManager());
+        for (int i = 0; i < kCollectors; i++) {
+            servers_[i] = new SandeshServerTest(evm_.get(),
+                boost::bind(&SandeshClientFanoutSendTest::ReceiveSandeshMsg,
+                    this, i, _1, _2));
+            servers_[i]->Initialize(0);
+            uves_[i] = 0;
+            synced_uves_[i] = 0;
+        }
+        thread_.reset(new ServerThread(evm_.get()));
+        thread_->Start();
+        std::vector<std::string> collectors;
+        for (int i = 0; i < kCollectors; i++) {
+            collectors.push_back("127.0.0.1:" +
+                integerToString(servers_[i]->GetPort()));
+        }
+        SandeshConfig config;
+        config.collector_fanout = kCollectors;
+        Sandesh::InitGenerator("SandeshClientFanoutSendTest", "localhost",
+            "Test", "Test", evm_.get(), 0, collectors, NULL,
+            Sandesh::DerivedStats(), config);
+        for (int i = 0; i < kCollectors; i++) {
+            TASK_UTIL_EXPECT_TRUE(
+                Sandesh::client()->state_machine(i)->state() ==
+                SandeshClientSM::ESTABLISHED);
+        }
+    }
+
+    virtual void TearDown() {
+        task_util::WaitForIdle();
+        Sandesh::Uninit();
+        task_util::WaitForIdle();
+        for (int i = 0; i < kCollectors; i++) {
+            TASK_UTIL_EXPECT_FALSE(servers_[i]->HasSessions());
+            servers_[i]->Shutdown();
+            task_util::WaitForIdle();
+            TcpServerManager::DeleteServer(servers_[i]);
+            task_util::WaitForIdle();
+        }
+        evm_->Shutdown();
+        if (thread_.get() != NULL) {
+            thread_->Join();
+        }
+        task_util::WaitForIdle();
+    }
+
+    bool ReceiveSandeshMsg(int index, SandeshSession *session,
+            const SandeshMessage *msg) {
+        if (msg->GetMessageType() == "SandeshModuleClientTrace" &&
+                msg->ExtractMessage().find(uve_name_) != std::string::npos) {
+            uves_[index]++;
+            if (msg->GetHeader().get_Hints() &
+                    g_sandesh_constants.SANDESH_SYNC_HINT) {
+                synced_uves_[index]++;
+            }
+        }
+        return true;
+    }
+
+    // Index of the collector that the state machine sends to
+    int Collector(size_t sm) {
+        int port(Sandesh::client()->state_machine(sm)->server().port());
+        for (int i = 0; i < kCollectors; i++) {
+            if (servers_[i]->GetPort() == port) return i;
+        }
+        return -1;
+    }
+
+    SandeshMessageStats UVEStats() {
+        boost::ptr_map<std::string, SandeshMessageTypeStats> type_stats;
+        SandeshMessageStats agg_stats;
+        Sandesh::GetMsgStats(&type_stats, &agg_stats);
+        boost::ptr_map<std::string, SandeshMessageTypeStats>::iterator it(
+            type_stats.find("SandeshModuleClientTrace"));
+        if (it == type_stats.end()) {
+            return SandeshMessageStats();
+        }
+        return it->second->stats;
+    }
+
+    void SendUVE() {
+        ModuleClientState mcs;
+        mcs.set_name(uve_name_);
+        SandeshModuleClientTrace::Send(mcs);
+    }
+
+    std::string uve_name_;
+    SandeshServerTest *servers_[kCollectors];
+    tbb::atomic<int> uves_[kCollectors];
+    tbb::atomic<int> synced_uves_[kCollectors];
+    std::auto_ptr<ServerThread> thread_;
+    std::auto_ptr<EventManager> evm_;
+};
+
+// A message encoded once is queued to the session of each collector, and
+// is counted as encoded and sent once
+TEST_F(SandeshClientFanoutSendTest, EncodeOnce) {
+    EXPECT_TRUE(Sandesh::client()->encode_on_send());
+    EXPECT_NE(Collector(0), Collector(1));
+    task_util::WaitForIdle();
+    SandeshMessageStats stats(UVEStats());
+    SendUVE();
+    for (int i = 0; i < kCollectors; i++) {
+        TASK_UTIL_EXPECT_EQ(1, static_cast<int>(uves_[i]));
+    }
+    task_util::WaitForIdle();
+    for (int i = 0; i < kCollectors; i++) {
+        EXPECT_EQ(1, static_cast<int>(uves_[i]));
+    }
+    SandeshMessageStats new_stats(UVEStats());
+    EXPECT_EQ(stats.get_messages_encoded() + 1,
+        new_stats.get_messages_encoded());
+    EXPECT_EQ(stats.get_messages_sent() + 1, new_stats.get_messages_sent());
+}
+
+// The UVEs are resynced only to the collector that is connected again
+TEST_F(SandeshClientFanoutSendTest, ResyncOneCollector) {
+    SendUVE();
+    for (int i = 0; i < kCollectors; i++) {
+        TASK_UTIL_EXPECT_EQ(1, static_cast<int>(uves_[i]));
+    }
+    int resynced(Collector(1));
+    int other(Collector(0));
+    ASSERT_NE(-1, resynced);
+    ASSERT_NE(-1, other);
+    int synced(synced_uves_[resynced]);
+    int synced_other(synced_uves_[other]);
+    SandeshClientSMImpl *sm = static_cast<SandeshClientSMImpl *>(
+        Sandesh::client()->state_machine(1));
+    sm->OnSessionEvent(sm->session(), TcpSession::CLOSE);
+    TASK_UTIL_EXPECT_TRUE(synced_uves_[resynced] > synced);
+    TASK_UTIL_EXPECT_TRUE(sm->state() == SandeshClientSM::ESTABLISHED);
+    // The other collector could not have been connected to instead
+    EXPECT_EQ(resynced, Collector(1));
+    task_util::WaitForIdle();
+    EXPECT_EQ(1, static_cast<int>(uves_[other]));
+    EXPECT_EQ(synced_other, static_cast<int>(synced_uves_[other]));
+}
+
 int main(int argc, char **argv) {
     LoggingInit();
     ::testing::InitGoogleTest(&argc, argv);
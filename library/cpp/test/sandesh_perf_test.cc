@@ -27,6 +27,10 @@
 #include <sandesh/sandesh_types.h>
 #include <sandesh/sandesh_constants.h>
 #include <sandesh/sandesh.h>
+#include <sandesh/derived_stats_algo.h>
+#include <sandesh/protocol/TXMLProtocol.h>
+#include <sandesh/protocol/TXMLEscape.h>
+#include <sandesh/protocol/TXMLNumber.h>
 
 #include "sandesh_perf_test_types.h"
 
@@ -179,11 +183,34 @@ protected:
         xml1_escaped_("str1 &amp;&apos;&lt;&gt;type=\"string\" identifier=\"1\""),
         cmp_("nomatch"),
         expr_(expression) {
+        // A message sized string with a control char every few hundred
+        // bytes, where the scan dominates
+        while (long_.length() < kLongLength) {
+            long_ += xml_;
+            if (long_.length() % 256 < xml_.length()) {
+                long_ += '&';
+            }
+        }
+    }
+
+    // Reports the time per iteration and the throughput over the input
+    void Report(const char *name, uint64_t start_usec, int iterations,
+                size_t bytes) {
+        uint64_t usec = UTCTimestampUsec() - start_usec;
+        if (usec == 0) {
+            usec = 1;
+        }
+        std::cout << name << ": " << usec * 1000.0 / iterations <<
+            " ns/iteration, " << (double)bytes * iterations / usec <<
+            " MB/s" << std::endl;
     }
 
+    static const size_t kLongLength = 4096;
+
     std::string xml_;
     std::string xml1_;
     std::string xml1_escaped_;
+    std::string long_;
     std::string cmp_;
     boost::regex expr_;
 };
@@ -273,52 +300,223 @@ TEST_F(SandeshPerfTestString, Basic) {
 
 // Test with string containing XML control chars
 TEST_F(SandeshPerfTestString, DISABLED_EscapeXMLStringStream) {
+    uint64_t start(UTCTimestampUsec());
     for (int i = 0; i < 10000000; i++) {
         std::string estr(escapeXMLCharsSS(xml1_));
     }
+    Report(__FUNCTION__, start, 10000000, xml1_.length());
 }
 
 TEST_F(SandeshPerfTestString, DISABLED_EscapeXMLString) {
+    uint64_t start(UTCTimestampUsec());
     for (int i = 0; i < 10000000; i++) {
         std::string estr(escapeXMLCharsString(xml1_));
     }
+    Report(__FUNCTION__, start, 10000000, xml1_.length());
 }
 
 TEST_F(SandeshPerfTestString, DISABLED_EscapeXMLBoostRegex) {
+    uint64_t start(UTCTimestampUsec());
     for (int i = 0; i < 10000000; i++) {
         std::string estr(escapeXMLCharsBoostRegex(xml1_, expr_));
     }
+    Report(__FUNCTION__, start, 10000000, xml1_.length());
 }
 
 TEST_F(SandeshPerfTestString, DISABLED_EscapeXMLBoostSpirit) {
+    uint64_t start(UTCTimestampUsec());
     for (int i = 0; i < 10000000; i++) {
         std::string estr(escapeXMLCharsBoostSpirit(xml1_));
     }
+    Report(__FUNCTION__, start, 10000000, xml1_.length());
 }
 
 TEST_F(SandeshPerfTestString, DISABLED_EscapeXMLBoostReplace) {
+    uint64_t start(UTCTimestampUsec());
     for (int i = 0; i < 10000000; i++) {
         std::string estr(escapeXMLCharsBoostReplace(xml1_));
     }
+    Report(__FUNCTION__, start, 10000000, xml1_.length());
 }
 
 // Test with string not containing XML control chars
 TEST_F(SandeshPerfTestString, DISABLED_NoEscapeXMLFindFirstOf) {
+    uint64_t start(UTCTimestampUsec());
     for (int i = 0; i < 10000000; i++) {
         std::string estr(escapeXMLCharsFindFirstOf(xml_));
     }
+    Report(__FUNCTION__, start, 10000000, xml_.length());
 }
 
 TEST_F(SandeshPerfTestString, DISABLED_NoEscapeXMLStrpbrk) {
+    uint64_t start(UTCTimestampUsec());
     for (int i = 0; i < 10000000; i++) {
         std::string estr(escapeXMLCharsStrpbrk(xml_));
     }
+    Report(__FUNCTION__, start, 10000000, xml_.length());
 }
 
 TEST_F(SandeshPerfTestString, DISABLED_NoEscapeXMLNoop) {
+    uint64_t start(UTCTimestampUsec());
     for (int i = 0; i < 10000000; i++) {
         std::string estr(escapeXMLCharsNoop(xml_));
     }
+    Report(__FUNCTION__, start, 10000000, xml_.length());
+}
+
+TEST_F(SandeshPerfTestString, EscapeKernel) {
+    using namespace contrail::sandesh::protocol;
+    using namespace contrail::sandesh::transport;
+    boost::shared_ptr<TMemoryBuffer> btrans(new TMemoryBuffer(64));
+    EXPECT_EQ((int32_t)xml1_escaped_.length(),
+              xmlEscapeWrite(btrans.get(), xml1_.data(), xml1_.length()));
+    EXPECT_EQ(xml1_escaped_, btrans->getBufferAsString());
+    std::string ustr(xml1_escaped_);
+    ustr.resize(xmlUnescape(&ustr[0], ustr.length()));
+    EXPECT_EQ(xml1_, ustr);
+    // A control char at every offset across the vector widths, and
+    // entities which are only unescaped once
+    for (size_t i = 0; i < 80; i++) {
+        std::string str(std::string(i, 'a') + "<&amp;>" +
+                        std::string(80 - i, 'b') + "'");
+        EXPECT_EQ(escapeXMLCharsString(str),
+                  TXMLProtocol::escapeXMLControlChars(str));
+        btrans->resetBuffer();
+        xmlEscapeWrite(btrans.get(), str.data(), str.length());
+        std::string estr(btrans->getBufferAsString());
+        EXPECT_EQ(escapeXMLCharsString(str), estr);
+        estr.resize(xmlUnescape(&estr[0], estr.length()));
+        EXPECT_EQ(str, estr);
+        EXPECT_EQ(str.data() + i, xmlEscapeFind(str.data(),
+                                                str.data() + str.length()));
+        EXPECT_EQ(str.data() + i + 1, xmlFindChar(str.data(),
+                  str.data() + str.length(), '&'));
+    }
+    std::string partial("a &am &lt");
+    TXMLProtocol::unescapeXMLControlChars(partial);
+    EXPECT_EQ("a &am &lt", partial);
+}
+
+TEST_F(SandeshPerfTestString, DISABLED_EscapeXMLKernel) {
+    contrail::sandesh::transport::TMemoryBuffer btrans(64);
+    uint64_t start(UTCTimestampUsec());
+    for (int i = 0; i < 10000000; i++) {
+        btrans.resetBuffer();
+        contrail::sandesh::protocol::xmlEscapeWrite(&btrans, xml1_.data(),
+                                                    xml1_.length());
+    }
+    Report(__FUNCTION__, start, 10000000, xml1_.length());
+}
+
+TEST_F(SandeshPerfTestString, DISABLED_NoEscapeXMLKernel) {
+    contrail::sandesh::transport::TMemoryBuffer btrans(64);
+    uint64_t start(UTCTimestampUsec());
+    for (int i = 0; i < 10000000; i++) {
+        btrans.resetBuffer();
+        contrail::sandesh::protocol::xmlEscapeWrite(&btrans, xml_.data(),
+                                                    xml_.length());
+    }
+    Report(__FUNCTION__, start, 10000000, xml_.length());
+}
+
+TEST_F(SandeshPerfTestString, DISABLED_EscapeXMLLongString) {
+    uint64_t start(UTCTimestampUsec());
+    for (int i = 0; i < 100000; i++) {
+        std::string estr(escapeXMLCharsStrpbrk(long_));
+    }
+    Report(__FUNCTION__, start, 100000, long_.length());
+}
+
+TEST_F(SandeshPerfTestString, DISABLED_EscapeXMLLongKernel) {
+    contrail::sandesh::transport::TMemoryBuffer btrans(2 * kLongLength);
+    uint64_t start(UTCTimestampUsec());
+    for (int i = 0; i < 100000; i++) {
+        btrans.resetBuffer();
+        contrail::sandesh::protocol::xmlEscapeWrite(&btrans, long_.data(),
+                                                    long_.length());
+    }
+    Report(__FUNCTION__, start, 100000, long_.length());
+}
+
+TEST_F(SandeshPerfTestString, DISABLED_UnescapeXMLBoostReplace) {
+    std::string estr(escapeXMLCharsString(long_));
+    uint64_t start(UTCTimestampUsec());
+    for (int i = 0; i < 100000; i++) {
+        std::string ustr(estr);
+        boost::replace_all(ustr, "&amp;", "&");
+        boost::replace_all(ustr, "&apos;", "\'");
+        boost::replace_all(ustr, "&lt;", "<");
+        boost::replace_all(ustr, "&gt;", ">");
+    }
+    Report(__FUNCTION__, start, 100000, estr.length());
+}
+
+TEST_F(SandeshPerfTestString, DISABLED_UnescapeXMLKernel) {
+    std::string estr(escapeXMLCharsString(long_));
+    uint64_t start(UTCTimestampUsec());
+    for (int i = 0; i < 100000; i++) {
+        std::string ustr(estr);
+        contrail::sandesh::protocol::TXMLProtocol::unescapeXMLControlChars(ustr);
+    }
+    Report(__FUNCTION__, start, 100000, estr.length());
+}
+
+TEST_F(SandeshPerfTestString, NumberKernel) {
+    using namespace contrail::sandesh::protocol;
+    char buf[kXMLNumberMaxLength];
+    const int64_t ivalues[] = { 0, 1, -1, 9, 10, 99, 100, -12345,
+        2147483647LL, -2147483647LL - 1, 9223372036854775807LL,
+        -9223372036854775807LL - 1 };
+    for (size_t i = 0; i < sizeof(ivalues) / sizeof(ivalues[0]); i++) {
+        std::string str(buf, xmlFormatInteger(buf, ivalues[i]));
+        EXPECT_EQ(integerToString(ivalues[i]), str);
+        int64_t value;
+        EXPECT_EQ(str.data() + str.length(),
+                  xmlParseInteger(str.data(), str.data() + str.length(),
+                                  value));
+        EXPECT_EQ(ivalues[i], value);
+    }
+    uint64_t u64 = 18446744073709551615ULL;
+    EXPECT_EQ("18446744073709551615",
+              std::string(buf, xmlFormatInteger(buf, u64)));
+    int8_t byte = -128;
+    EXPECT_EQ("-128", std::string(buf, xmlFormatInteger(buf, byte)));
+    const double dvalues[] = { 0.0, 0.1, -1.5, 1.0 / 3, 1e100, 5e-324,
+        123456789.0 };
+    for (size_t i = 0; i < sizeof(dvalues) / sizeof(dvalues[0]); i++) {
+        uint32_t len = xmlFormatDouble(buf, dvalues[i]);
+        double value;
+        EXPECT_TRUE(xmlParseDouble(buf, buf + len, value));
+        EXPECT_EQ(dvalues[i], value);
+    }
+    EXPECT_EQ("0.1", std::string(buf, xmlFormatDouble(buf, 0.1)));
+    double value;
+    EXPECT_FALSE(xmlParseDouble(buf, buf, value));
+}
+
+TEST_F(SandeshPerfTestString, DISABLED_IntegerToString) {
+    contrail::sandesh::transport::TMemoryBuffer btrans(64);
+    uint64_t start(UTCTimestampUsec());
+    for (int i = 0; i < 10000000; i++) {
+        btrans.resetBuffer();
+        std::string str(integerToString(123456789 + i));
+        btrans.write(reinterpret_cast<const uint8_t *>(str.data()),
+                     str.length());
+    }
+    Report(__FUNCTION__, start, 10000000, 9);
+}
+
+TEST_F(SandeshPerfTestString, DISABLED_IntegerKernel) {
+    contrail::sandesh::transport::TMemoryBuffer btrans(64);
+    uint64_t start(UTCTimestampUsec());
+    for (int i = 0; i < 10000000; i++) {
+        btrans.resetBuffer();
+        char buf[contrail::sandesh::protocol::kXMLNumberMaxLength];
+        uint32_t len = contrail::sandesh::protocol::xmlFormatInteger(buf,
+                                                             123456789 + i);
+        btrans.write(reinterpret_cast<const uint8_t *>(buf), len);
+    }
+    Report(__FUNCTION__, start, 10000000, 9);
 }
 
 TEST_F(SandeshPerfTestString, DISABLED_StringAppend) {
@@ -392,6 +590,56 @@ TEST_F(SandeshPerfTestString, DISABLED_PerfTestSplitIter) {
     }
 }
 
+// Update throughput of the windowed DSSum and DSAvg derived stats
+class SandeshPerfTestDerivedStats : public ::testing::Test {
+protected:
+    static const uint64_t kStartUsec = 1000000;
+};
+
+TEST_F(SandeshPerfTestDerivedStats, DISABLED_DSSumUpdate) {
+    contrail::sandesh::DSSum<uint64_t, uint64_t> dssum("60");
+    for (int i = 0; i < 10000000; i++) {
+        dssum.Update(i, kStartUsec + i * 1000);
+    }
+}
+
+TEST_F(SandeshPerfTestDerivedStats, DISABLED_DSAvgUpdate) {
+    contrail::sandesh::DSAvg<uint64_t, uint64_t> dsavg("60");
+    uint64_t avg;
+    for (int i = 0; i < 10000000; i++) {
+        dsavg.Update(i, kStartUsec + i * 1000);
+        dsavg.FillResult(avg);
+    }
+}
+
+TEST_F(SandeshPerfTestDerivedStats, DISABLED_PercentileUpdate) {
+    contrail::sandesh::DSPercentile<uint64_t, PercentileResult>
+        dspct("50,95,99");
+    for (int i = 0; i < 10000000; i++) {
+        dspct.Update(i % 100000, kStartUsec + i * 1000);
+    }
+}
+
+TEST_F(SandeshPerfTestDerivedStats, DISABLED_MapMergeUpdate) {
+    contrail::sandesh::DerivedStatsIf<contrail::sandesh::DSSum,
+        uint64_t, uint64_t> ds("60", true);
+    std::map<std::string, uint64_t> raw;
+    std::map<std::string, bool> del;
+    for (int i = 0; i < 64; i++) {
+        std::stringstream ss;
+        ss << "intf" << i;
+        raw[ss.str()] = 0;
+        del[ss.str()] = false;
+    }
+    for (int i = 0; i < 1000000; i++) {
+        for (std::map<std::string, uint64_t>::iterator it = raw.begin();
+             it != raw.end(); ++it) {
+            it->second += i;
+        }
+        ds.Update(raw, del, kStartUsec + i * 1000);
+    }
+}
+
 int main(int argc, char **argv) {
     LoggingInit();
     ::testing::InitGoogleTest(&argc, argv);
@@ -17,6 +17,7 @@
 #include <sandesh/sandesh_types.h>
 #include <sandesh/sandesh.h>
 #include <sandesh/sandesh_client.h>
+#include <sandesh/request_pipeline.h>
 
 #include "sandesh_test_common.h"
 
@@ -184,6 +185,11 @@ class SandeshRequestTest : public ::testing::Test {
         EXPECT_EQ(ip, resp->get_ip());
         EXPECT_EQ(port, resp->get_port());
         EXPECT_EQ(status, resp->get_status());
+        // The only collector is also the first one in the list
+        ASSERT_EQ(1U, resp->get_collectors().size());
+        EXPECT_EQ(ip, resp->get_collectors()[0].get_ip());
+        EXPECT_EQ(port, resp->get_collectors()[0].get_port());
+        EXPECT_EQ(status, resp->get_collectors()[0].get_status());
         validate_done_ = true;
         cout << "*****************************************************" << endl;
     }
@@ -429,6 +435,90 @@ TEST_F(SandeshRequestTest, MessageStats) {
     TASK_UTIL_EXPECT_EQ(true, validate_done_);
 }
 
+class RequestPipelineTest : public ::testing::Test {
+ protected:
+    static const int kChunks = 16;
+
+    struct ChunkData : public RequestPipeline::InstData {
+        ChunkData() : chunk(-1) {}
+        int chunk;
+    };
+
+    virtual void SetUp() {
+        for (int i = 0; i < kChunks; i++) {
+            chunk_runs_[i] = 0;
+        }
+        chunk_order_.clear();
+        done_ = false;
+    }
+
+    static RequestPipeline::InstData *AllocChunkData(int stage) {
+        return new ChunkData;
+    }
+
+    static bool ChunkCallback(const Sandesh *sr,
+            const RequestPipeline::PipeSpec &ps, int stage, int chunk,
+            RequestPipeline::InstData *data) {
+        static_cast<ChunkData *>(data)->chunk = chunk;
+        chunk_runs_[chunk]++;
+        return true;
+    }
+
+    static bool CollectCallback(const Sandesh *sr,
+            const RequestPipeline::PipeSpec &ps, int stage, int instNum,
+            RequestPipeline::InstData *data) {
+        const RequestPipeline::StageData *sd(ps.GetStageData(0));
+        for (size_t i = 0; i < sd->size(); i++) {
+            chunk_order_.push_back(
+                static_cast<const ChunkData &>(sd->at(i)).chunk);
+        }
+        done_ = true;
+        return true;
+    }
+
+    static tbb::atomic<int> chunk_runs_[kChunks];
+    static std::vector<int> chunk_order_;
+    static tbb::atomic<bool> done_;
+};
+
+tbb::atomic<int> RequestPipelineTest::chunk_runs_[RequestPipelineTest::kChunks];
+std::vector<int> RequestPipelineTest::chunk_order_;
+tbb::atomic<bool> RequestPipelineTest::done_;
+
+// Every chunk of a chunked stage is run once, by whichever instance asks
+// next, and the next stage sees the data of the chunks in chunk order
+TEST_F(RequestPipelineTest, ChunkedStage) {
+    int task_id(TaskScheduler::GetInstance()->GetTaskId(
+        "sandesh::Test::RequestPipeline"));
+    SandeshSendingParamsSet *req(new SandeshSendingParamsSet);
+    RequestPipeline::PipeSpec ps(req);
+    req->Release();
+    RequestPipeline::StageSpec chunked;
+    chunked.taskId_ = task_id;
+    for (int i = 0; i < 3; i++) {
+        chunked.instances_.push_back(i);
+    }
+    chunked.cbFn_ = ChunkCallback;
+    chunked.allocFn_ = AllocChunkData;
+    chunked.chunks_ = kChunks;
+    // A stage that leaves out the number of chunks is not chunked
+    RequestPipeline::StageSpec collect = { task_id,
+        std::vector<int>(1, 0), CollectCallback };
+    EXPECT_EQ(0, static_cast<int>(collect.chunks_));
+    ps.stages_.push_back(chunked);
+    ps.stages_.push_back(collect);
+    RequestPipeline rp(ps);
+    task_util::WaitForIdle();
+    TASK_UTIL_EXPECT_TRUE(done_);
+    for (int i = 0; i < kChunks; i++) {
+        EXPECT_EQ(1, static_cast<int>(chunk_runs_[i])) << "chunk " << i;
+    }
+    ASSERT_EQ(static_cast<size_t>(kChunks), chunk_order_.size());
+    for (int i = 0; i < kChunks; i++) {
+        EXPECT_EQ(i, chunk_order_[i]);
+    }
+}
+
 } // end namespace
 
 int main(int argc, char **argv) {
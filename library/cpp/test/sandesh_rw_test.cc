@@ -146,6 +146,81 @@ TEST_F(SandeshReadWriteUnitTest, StructBinaryReadWrite) {
     SandeshReadWriteProcess(btrans, prot);
 }
 
+TEST_F(SandeshReadWriteUnitTest, XMLFieldTag) {
+    boost::shared_ptr<TMemoryBuffer> gtrans(new TMemoryBuffer(4096));
+    boost::shared_ptr<TXMLProtocol> gprot(new TXMLProtocol(gtrans));
+    int32_t gxfer = 0;
+    gxfer += gprot->writeFieldBegin("i32Test", T_I32, 1);
+    gxfer += gprot->writeI32(test_i32);
+    gxfer += gprot->writeFieldEnd();
+    gxfer += gprot->writeFieldBegin("listTest", T_LIST, -2);
+    gxfer += gprot->writeListBegin(T_STRING, 1);
+    gxfer += gprot->writeString("<abc>");
+    gxfer += gprot->writeListEnd();
+    gxfer += gprot->writeFieldEnd();
+
+    boost::shared_ptr<TMemoryBuffer> ttrans(new TMemoryBuffer(4096));
+    boost::shared_ptr<TXMLProtocol> tprot(new TXMLProtocol(ttrans));
+    int32_t txfer = 0;
+    std::string btag("<i32Test type=\"i32\" identifier=\"1\">");
+    std::string etag("</i32Test>");
+    txfer += tprot->writeFieldBeginTag(btag.c_str(), btag.length(), T_I32);
+    txfer += tprot->writeI32(test_i32);
+    txfer += tprot->writeFieldEndTag(etag.c_str(), etag.length());
+    btag = "<listTest type=\"list\" identifier=\"-2\">";
+    etag = "</listTest>";
+    txfer += tprot->writeFieldBeginTag(btag.c_str(), btag.length(), T_LIST);
+    txfer += tprot->writeListBegin(T_STRING, 1);
+    txfer += tprot->writeString("<abc>");
+    txfer += tprot->writeListEnd();
+    txfer += tprot->writeFieldEndTag(etag.c_str(), etag.length());
+
+    EXPECT_EQ(gxfer, txfer);
+    EXPECT_EQ(gtrans->getBufferAsString(), ttrans->getBufferAsString());
+}
+
+// Transport that does not expose its buffer, so that TXMLProtocol reads
+// a byte at a time
+class SandeshByteTransport : public TTransport {
+public:
+    SandeshByteTransport(boost::shared_ptr<TMemoryBuffer> btrans) :
+        btrans_(btrans) {
+    }
+    int32_t read_virt(uint8_t *buf, uint32_t len) {
+        return btrans_->read(buf, len);
+    }
+private:
+    boost::shared_ptr<TMemoryBuffer> btrans_;
+};
+
+TEST_F(SandeshReadWriteUnitTest, StructXMLReadNoBorrow) {
+    boost::shared_ptr<TMemoryBuffer> btrans =
+            boost::shared_ptr<TMemoryBuffer>(
+                    new TMemoryBuffer(4096));
+    boost::shared_ptr<TXMLProtocol> prot =
+            boost::shared_ptr<TXMLProtocol>(
+                    new TXMLProtocol(btrans));
+    SandeshReadWriteProcess(btrans, prot);
+    // Write the struct again and read it without the transport buffer
+    uint32_t wxfer = wstruct_test_.write(prot);
+    std::string xml(btrans->getBufferAsString());
+    EXPECT_EQ(wxfer, xml.size());
+    boost::shared_ptr<TMemoryBuffer> rtrans =
+            boost::shared_ptr<TMemoryBuffer>(
+                    new TMemoryBuffer(4096));
+    rtrans->write(reinterpret_cast<const uint8_t *>(xml.data()), xml.size());
+    boost::shared_ptr<TTransport> ttrans =
+            boost::shared_ptr<TTransport>(new SandeshByteTransport(rtrans));
+    boost::shared_ptr<TXMLProtocol> tprot =
+            boost::shared_ptr<TXMLProtocol>(
+                    new TXMLProtocol(ttrans));
+    SandeshStructTest tstruct_test;
+    uint32_t txfer = tstruct_test.read(tprot);
+    EXPECT_EQ(wxfer, txfer);
+    EXPECT_EQ(wstruct_test_, tstruct_test);
+    EXPECT_EQ(0U, rtrans->available_read());
+}
+
 
 class SandeshLogUnitTest : public ::testing::Test {
 protected:
@@ -20,6 +20,8 @@
 #include <sandesh/sandesh.h>
 #include <sandesh/sandesh_server.h>
 #include <sandesh/sandesh_session.h>
+#include <sandesh/sandesh_ctrl_types.h>
+#include <sandesh/sandesh_uve_types.h>
 
 using namespace std;
 
@@ -85,6 +87,16 @@ public:
         }
     }
 
+    bool ConsumeFlowCredit(SandeshType::type stype, int level) {
+        tbb::mutex::scoped_lock lock(send_mutex_);
+        return SandeshSession::ConsumeFlowCredit(stype, level);
+    }
+    bool FlowCreditAdmit(const SandeshElement &element) {
+        tbb::mutex::scoped_lock lock(send_mutex_);
+        return SandeshSession::FlowCreditAdmit(element);
+    }
+    bool FlowCreditBlocked() const { return flow_credit_blocked_; }
+
     int send_count() const { return send_buf_list_.size() ; }
     void send_buf(int index, uint8_t **buf, size_t *len) {
         ASSERT_LE(index, send_buf_list_.size());
@@ -556,6 +568,169 @@ TEST_F(SandeshSendMsgUnitTest, AsyncSend) {
     }
 }
 
+static uint64_t MessagesSent(const std::string &name) {
+    boost::ptr_map<std::string, SandeshMessageTypeStats> type_stats;
+    SandeshMessageStats agg_stats;
+    Sandesh::GetMsgStats(&type_stats, &agg_stats);
+    boost::ptr_map<std::string, SandeshMessageTypeStats>::iterator it(
+        type_stats.find(name));
+    return it == type_stats.end() ? 0 : it->second->stats.get_messages_sent();
+}
+
+TEST_F(SandeshSendMsgUnitTest, SendEncodedMsg) {
+    SandeshSessionTest *session2 =
+        dynamic_cast<SandeshSessionTest *>(server_->CreateSession());
+    SandeshCtrlFlowCredit *sandesh = new SandeshCtrlFlowCredit();
+    SandeshTxDropReason::type reason;
+    boost::shared_ptr<TMemoryBuffer> buffer(
+        SandeshWriter::Encode(sandesh, &reason));
+    ASSERT_TRUE(buffer);
+    SandeshEncodedMessage msg(sandesh->Name(), sandesh->type(),
+        sandesh->level(), buffer, buffer->available_read());
+    sandesh->Release();
+
+    // The message encoded once is sent as is over both sessions, and
+    // counted as sent once
+    uint64_t sent(MessagesSent(msg.name_));
+    send_action = SEND;
+    session_->writer()->SendEncodedMsg(msg, false);
+    session2->writer()->SendEncodedMsg(msg, false);
+    EXPECT_EQ(sent + 1, MessagesSent(msg.name_));
+    ASSERT_EQ(1, session_->send_count());
+    ASSERT_EQ(1, session2->send_count());
+    uint8_t *send_buf = NULL, *send_buf2 = NULL;
+    size_t buf_len, buf_len2;
+    session_->send_buf(0, &send_buf, &buf_len);
+    session2->send_buf(0, &send_buf2, &buf_len2);
+    EXPECT_EQ(msg.size_, buf_len);
+    EXPECT_EQ(buf_len, buf_len2);
+    EXPECT_EQ(0, memcmp(send_buf, send_buf2, buf_len));
+    EXPECT_EQ(0, memcmp(send_buf, FakeMessageBegin.c_str(),
+        FakeMessageBegin.size()));
+    EXPECT_EQ(msg.size_, buffer->available_read());
+
+    session2->set_observer(NULL);
+    session2->Close();
+    server_->DeleteSession(session2);
+}
+
+TEST_F(SandeshSendMsgUnitTest, EncodeBufferPool) {
+    SandeshCtrlFlowCredit *sandesh = new SandeshCtrlFlowCredit();
+    SandeshTxDropReason::type reason;
+    TMemoryBuffer *first_buffer;
+    uint32_t size;
+    {
+        boost::shared_ptr<TMemoryBuffer> buffer(
+            SandeshWriter::Encode(sandesh, &reason));
+        ASSERT_TRUE(buffer);
+        first_buffer = buffer.get();
+        size = buffer->available_read();
+        // The queued element is accounted with the encoded size
+        SandeshEncodedMessagePtr msg(new SandeshEncodedMessage(
+            sandesh->Name(), sandesh->type(), sandesh->level(), buffer,
+            size));
+        SandeshElement element(msg);
+        EXPECT_EQ(size, element.GetSize());
+    }
+    // The buffer is reused once the message is released
+    boost::shared_ptr<TMemoryBuffer> buffer(
+        SandeshWriter::Encode(sandesh, &reason));
+    ASSERT_TRUE(buffer);
+    EXPECT_EQ(first_buffer, buffer.get());
+    EXPECT_EQ(size, buffer->available_read());
+    EXPECT_EQ(0, memcmp(buffer->getBufferAsString().c_str(),
+        FakeMessageBegin.c_str(), FakeMessageBegin.size()));
+    sandesh->Release();
+}
+
+static SandeshFlowCredit FlowCredit(SandeshLevel::type level,
+                                    uint32_t credits) {
+    SandeshFlowCredit credit;
+    credit.set_level(level);
+    credit.set_credits(credits);
+    return credit;
+}
+
+TEST_F(SandeshSendMsgUnitTest, FlowCredits) {
+    // Not flow controlled until granted
+    EXPECT_TRUE(session_->ConsumeFlowCredit(SandeshType::SYSTEM,
+        SandeshLevel::SYS_DEBUG));
+    std::vector<SandeshFlowCredit> credits;
+    credits.push_back(FlowCredit(SandeshLevel::SYS_DEBUG, 2));
+    credits.push_back(FlowCredit(SandeshLevel::SYS_ERR, 0));
+    session_->SetFlowCredits(credits);
+    EXPECT_TRUE(session_->ConsumeFlowCredit(SandeshType::SYSTEM,
+        SandeshLevel::SYS_DEBUG));
+    EXPECT_TRUE(session_->ConsumeFlowCredit(SandeshType::FLOW,
+        SandeshLevel::SYS_DEBUG));
+    EXPECT_FALSE(session_->ConsumeFlowCredit(SandeshType::OBJECT,
+        SandeshLevel::SYS_DEBUG));
+    EXPECT_FALSE(session_->ConsumeFlowCredit(SandeshType::SESSION,
+        SandeshLevel::SYS_ERR));
+    // Other message types and levels absent from the grant are not
+    // flow controlled
+    EXPECT_TRUE(session_->ConsumeFlowCredit(SandeshType::UVE,
+        SandeshLevel::SYS_DEBUG));
+    EXPECT_TRUE(session_->ConsumeFlowCredit(SandeshType::RESPONSE,
+        SandeshLevel::SYS_ERR));
+    EXPECT_TRUE(session_->ConsumeFlowCredit(SandeshType::SYSTEM,
+        SandeshLevel::SYS_INFO));
+    // A grant replaces the credits left
+    credits.clear();
+    credits.push_back(FlowCredit(SandeshLevel::SYS_DEBUG, 1));
+    session_->SetFlowCredits(credits);
+    EXPECT_TRUE(session_->ConsumeFlowCredit(SandeshType::SYSTEM,
+        SandeshLevel::SYS_ERR));
+    EXPECT_TRUE(session_->ConsumeFlowCredit(SandeshType::SYSTEM,
+        SandeshLevel::SYS_DEBUG));
+    EXPECT_FALSE(session_->ConsumeFlowCredit(SandeshType::SYSTEM,
+        SandeshLevel::SYS_DEBUG));
+}
+
+static SandeshElement FlowCreditElement(SandeshLevel::type level) {
+    SandeshEncodedMessagePtr msg(new SandeshEncodedMessage(
+        "FlowCreditTest", SandeshType::SYSTEM, level,
+        boost::shared_ptr<TMemoryBuffer>(), 0));
+    return SandeshElement(msg);
+}
+
+TEST_F(SandeshSendMsgUnitTest, FlowCreditHold) {
+    std::vector<SandeshFlowCredit> credits;
+    credits.push_back(FlowCredit(SandeshLevel::SYS_DEBUG, 1));
+    credits.push_back(FlowCredit(SandeshLevel::SYS_ERR, 0));
+    session_->SetFlowCredits(credits);
+    // Only the flow controlled levels granted no credits are shed
+    EXPECT_TRUE(session_->FlowCreditShed(SandeshType::SYSTEM,
+        SandeshLevel::SYS_ERR));
+    EXPECT_FALSE(session_->FlowCreditShed(SandeshType::UVE,
+        SandeshLevel::SYS_ERR));
+    EXPECT_FALSE(session_->FlowCreditShed(SandeshType::SYSTEM,
+        SandeshLevel::SYS_DEBUG));
+    EXPECT_FALSE(session_->FlowCreditShed(SandeshType::SYSTEM,
+        SandeshLevel::SYS_INFO));
+    // Out of credits, the message is held back and sending stops
+    EXPECT_TRUE(session_->FlowCreditAdmit(
+        FlowCreditElement(SandeshLevel::SYS_DEBUG)));
+    EXPECT_FALSE(session_->FlowCreditAdmit(
+        FlowCreditElement(SandeshLevel::SYS_DEBUG)));
+    EXPECT_TRUE(session_->FlowCreditBlocked());
+    EXPECT_EQ(0, session_->GetStats().num_send_msg_fail);
+    // A message at a level granted no credits is dropped
+    EXPECT_FALSE(session_->FlowCreditAdmit(
+        FlowCreditElement(SandeshLevel::SYS_ERR)));
+    EXPECT_EQ(1, session_->GetStats().num_send_msg_fail);
+    // The next grant releases the held message, which is dropped since
+    // the session is not connected
+    credits.clear();
+    credits.push_back(FlowCredit(SandeshLevel::SYS_DEBUG, 1));
+    session_->SetFlowCredits(credits);
+    EXPECT_FALSE(session_->FlowCreditBlocked());
+    EXPECT_EQ(2, session_->GetStats().num_send_msg_fail);
+    EXPECT_EQ(0, session_->send_count());
+    EXPECT_FALSE(session_->FlowCreditShed(SandeshType::SYSTEM,
+        SandeshLevel::SYS_ERR));
+}
+
 int main(int argc, char **argv) {
     LoggingInit();
     ::testing::InitGoogleTest(&argc, argv);
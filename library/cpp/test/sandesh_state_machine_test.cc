@@ -22,6 +22,9 @@
 #include <sandesh/sandesh_server.h>
 #include <sandesh/sandesh_session.h>
 #include <sandesh/sandesh_statistics.h>
+#include <sandesh/sandesh_message_builder.h>
+#include <sandesh/protocol/TXMLProtocol.h>
+#include <sandesh/transport/TBufferTransports.h>
 #include "sandesh_connection.h"
 #include "sandesh_state_machine.h"
 #include "sandesh_test_common.h"
@@ -30,9 +33,14 @@ using namespace std;
 using namespace boost::assign;
 using namespace boost::posix_time;
 using boost::system::error_code;
+using namespace contrail::sandesh::protocol;
+using namespace contrail::sandesh::transport;
 
 typedef boost::asio::ip::tcp::endpoint Endpoint;
 
+// End of the fake message, the character before it tags the message
+static const std::string FakeMessageEnd("</str1></FakeSandesh>");
+
 class SandeshSessionMock : public SandeshSession {
 public:
     enum State {
@@ -85,8 +93,9 @@ private:
 
 class SandeshServerMock : public SandeshServer {
 public:
-    SandeshServerMock(EventManager *evm) :
-        SandeshServer(evm, SandeshConfig()),
+    SandeshServerMock(EventManager *evm,
+        const SandeshConfig &config = SandeshConfig()) :
+        SandeshServer(evm, config),
         session_(NULL),
         old_session_(NULL) {
     }
@@ -121,20 +130,31 @@ public:
 
     virtual bool ReceiveSandeshMsg(SandeshSession *session,
        const SandeshMessage *msg, bool rsc) {
+        std::string body(msg->ExtractMessage());
+        received_.push_back(body[body.size() - FakeMessageEnd.size() - 1]);
+        return true;
+    }
+
+    virtual bool ReceiveSandeshCtrlMsg(SandeshStateMachine *state_machine,
+            SandeshSession *session, const Sandesh *sandesh) {
         return true;
     }
 
     SandeshSessionMock *session() { return session_; }
     SandeshSessionMock *old_session() { return old_session_; }
+    // Tags of the data messages received, in order
+    const std::vector<char> &received() const { return received_; }
 private:
     SandeshSessionMock *session_;
     SandeshSessionMock *old_session_;
+    std::vector<char> received_;
 };
 
 class SandeshServerStateMachineTest : public ::testing::Test {
 protected:
-    SandeshServerStateMachineTest() :
-        server_(new SandeshServerMock(&evm_)),
+    SandeshServerStateMachineTest(
+        const SandeshConfig &config = SandeshConfig()) :
+        server_(new SandeshServerMock(&evm_, config)),
         timer_(TimerManager::CreateTimer(*evm_.io_service(), "Dummy timer")),
         connection_(new SandeshServerConnection(server_, dummy_, 
             Task::kTaskInstanceAny,
@@ -201,6 +221,12 @@ protected:
             VerifyState(ssm::SERVER_INIT);
             break;
         }
+        case ssm::ESTABLISHED: {
+            GetToState(ssm::SERVER_INIT);
+            EvSandeshCtrlMessageRecv();
+            VerifyState(ssm::ESTABLISHED);
+            break;
+        }
         default: {
             ASSERT_TRUE(false);
             break;
@@ -226,6 +252,7 @@ protected:
             EXPECT_TRUE(connection_->session() == NULL);
             break;
         case ssm::SERVER_INIT:
+        case ssm::ESTABLISHED:
             EXPECT_TRUE(!IdleHoldTimerRunning());
             EXPECT_TRUE(sm_->session() != NULL);
             EXPECT_TRUE(connection_->session() != NULL);
@@ -286,11 +313,49 @@ protected:
 	memcpy(data, data1, strlen(data1));
 	length = strlen(data1);
     }
-    void EvSandeshMessageRecv(SandeshSessionMock *session = NULL) {
+    void EvSandeshMessageRecv(SandeshSessionMock *session = NULL,
+                              char tag = '0') {
         session = GetSession(session);
         uint8_t msg[1024];
         contrail::sandesh::test::CreateFakeMessage(msg, sizeof(msg));
         string xml((const char *)msg, sizeof(msg));
+        xml[xml.size() - FakeMessageEnd.size() - 1] = tag;
+        sm_->OnSandeshMessage(session, xml);
+    }
+    string EncodeHeader(SandeshType::type type, SandeshLevel::type level,
+                        int32_t hints) {
+        SandeshHeader header;
+        header.set_Namespace("Test");
+        header.set_Timestamp(123456);
+        header.set_Module("SandeshStateMachineTest");
+        header.set_Source("TestMachine");
+        header.set_Type(type);
+        header.set_Level(level);
+        header.set_Hints(hints);
+        boost::shared_ptr<TMemoryBuffer> btrans(new TMemoryBuffer(512));
+        boost::shared_ptr<TXMLProtocol> prot(new TXMLProtocol(btrans));
+        EXPECT_GT(header.write(prot), 0);
+        uint8_t *hbuffer;
+        uint32_t hlen;
+        btrans->getBuffer(&hbuffer, &hlen);
+        return string((const char *)hbuffer, hlen);
+    }
+    void EvSandeshMessageRecv(SandeshType::type type,
+                              SandeshLevel::type level) {
+        string xml(EncodeHeader(type, level, 0));
+        xml += "<FakeSandesh type=\"sandesh\">"
+            "<str1 type=\"string\" identifier=\"1\">0</str1>"
+            "</FakeSandesh>";
+        sm_->OnSandeshMessage(GetSession(NULL), xml);
+    }
+    void EvSandeshCtrlMessageRecv(SandeshSessionMock *session = NULL) {
+        session = GetSession(session);
+        string xml(EncodeHeader(SandeshType::REQUEST, SandeshLevel::SYS_INFO,
+            g_sandesh_constants.SANDESH_CONTROL_HINT));
+        xml += "<SandeshCtrlClientToServer type=\"sandesh\">"
+            "<source type=\"string\" identifier=\"1\">TestMachine</source>"
+            "<module_name type=\"string\" identifier=\"2\">Test</module_name>"
+            "</SandeshCtrlClientToServer>";
         sm_->OnSandeshMessage(session, xml);
     }
     void EvInvalidTypeSandeshMessageRecv(SandeshSessionMock *session = NULL) {
@@ -348,6 +413,57 @@ protected:
     }
 
     bool IdleHoldTimerRunning() { return sm_->idle_hold_timer_->running(); }
+    size_t IngestCount() const { return sm_->ingest_count_; }
+    uint32_t FlowCreditsUsed(SandeshLevel::type level) const {
+        return sm_->flow_credits_used_[level];
+    }
+    // The session is not connected, every grant is a failed send
+    uint64_t FlowCreditGrants() {
+        return sm_->session()->GetStats().num_send_msg_fail;
+    }
+    bool RejectCloseTimerRunning() { return sm_->RejectCloseTimerRunning(); }
+    SandeshAdmissionStats AdmissionStats(SandeshStateMachine *sm) {
+        tbb::mutex::scoped_lock lock(sm->smutex_);
+        return sm->admission_stats_;
+    }
+    size_t AdmissionSyncing() const {
+        return server_->admission_syncing_.size();
+    }
+    size_t AdmissionPending() const {
+        return server_->admission_pending_.size();
+    }
+    bool AdmissionSyncing(SandeshStateMachine *sm) const {
+        return server_->admission_syncing_.count(sm) != 0;
+    }
+    // Make the sync of the state machine run out of time
+    void AdmissionSyncTimeout(SandeshStateMachine *sm) {
+        tbb::mutex::scoped_lock lock(server_->admission_mutex_);
+        server_->admission_syncing_[sm] = ClockMonotonicUsec() -
+            SandeshServer::kMaxSyncTime;
+    }
+    uint64_t MaxSyncTime() const { return SandeshServer::kMaxSyncTime; }
+    void AdmissionTimerExpired() {
+        server_->AdmissionTimerExpired();
+    }
+    // Run the admission timer until the deferred generators are told to
+    // wait again
+    void AdmissionWaitRefresh() {
+        for (int i = 0; i < SandeshServer::kAdmissionWaitRefresh; i++) {
+            server_->AdmissionTimerExpired();
+        }
+    }
+    void SetSandeshMessageDropLevel(SandeshLevel::type level) {
+        sm_->SetSandeshMessageDropLevel(0, level,
+            boost::function<void (void)>());
+    }
+    void UpdateIngestCount(size_t msg_size, bool enqueue) {
+        sm_->UpdateIngestCount(msg_size, enqueue);
+    }
+    void OnIngestBatch(SandeshSession *session,
+        const std::vector<boost::shared_ptr<const SandeshMessage> > &msgs,
+        size_t msgs_size) {
+        sm_->OnIngestBatch(session, msgs, msgs_size);
+    }
 
     EventManager evm_;
     SandeshServerMock *server_;
@@ -517,6 +633,310 @@ TEST_F(SandeshServerStateMachineTest, DeferDequeue) {
     EXPECT_EQ(ssm::SERVER_INIT, sm_->get_state());
 }
 
+static SandeshConfig IngestConfig() {
+    SandeshConfig config;
+    config.sandesh_ingest_workers = 2;
+    return config;
+}
+
+class SandeshServerStateMachineIngestTest :
+    public SandeshServerStateMachineTest {
+protected:
+    SandeshServerStateMachineIngestTest() :
+        SandeshServerStateMachineTest(IngestConfig()) {
+    }
+};
+
+// Messages handed to the ingest queue and those on the state machine
+// queue are processed in the order received
+TEST_F(SandeshServerStateMachineIngestTest, Order) {
+    GetToState(ssm::ESTABLISHED);
+    TaskScheduler::GetInstance()->Stop();
+    EvSandeshMessageRecv(NULL, '1');
+    EXPECT_EQ(1024U, IngestCount());
+    // Still handed over behind message 1 once the dequeue is deferred
+    sm_->SetDeferDequeue(true);
+    EvSandeshMessageRecv(NULL, '2');
+    EXPECT_EQ(2048U, IngestCount());
+    TaskScheduler::GetInstance()->Start();
+    task_util::WaitForIdle();
+    // The ingest queue holds them on the deferred state machine queue
+    EXPECT_EQ(0U, IngestCount());
+    EXPECT_EQ(0U, server_->received().size());
+    uint64_t sm_queue_count;
+    ASSERT_TRUE(sm_->GetQueueCount(sm_queue_count));
+    EXPECT_EQ(2048, sm_queue_count);
+    // Queued behind them
+    EvSandeshMessageRecv(NULL, '3');
+    EXPECT_EQ(0U, IngestCount());
+    ASSERT_TRUE(sm_->GetQueueCount(sm_queue_count));
+    EXPECT_EQ(3072, sm_queue_count);
+    sm_->SetDeferDequeue(false);
+    task_util::WaitForIdle();
+    // Handed over again once the state machine queue is drained
+    EvSandeshMessageRecv(NULL, '4');
+    task_util::WaitForIdle();
+    ASSERT_TRUE(sm_->GetQueueCount(sm_queue_count));
+    EXPECT_EQ(0, sm_queue_count);
+    std::vector<char> expected = list_of('1')('2')('3')('4');
+    EXPECT_EQ(expected, server_->received());
+}
+
+// Messages still on the ingest queue when the session closes are
+// dropped, and no longer count in the queue
+TEST_F(SandeshServerStateMachineIngestTest, DropAfterClose) {
+    GetToState(ssm::ESTABLISHED);
+    SandeshSessionMock *session = server_->session();
+    uint8_t msg[1024];
+    contrail::sandesh::test::CreateFakeMessage(msg, sizeof(msg));
+    SandeshMessageBuilder *builder =
+        SandeshMessageBuilder::GetInstance(SandeshMessageBuilder::XML);
+    std::vector<boost::shared_ptr<const SandeshMessage> > msgs;
+    msgs.push_back(boost::shared_ptr<const SandeshMessage>(
+        builder->Create(msg, sizeof(msg)),
+        boost::bind(&SandeshMessageBuilder::Release, builder, _1)));
+    ASSERT_TRUE(msgs[0].get() != NULL);
+    UpdateIngestCount(sizeof(msg), true);
+    EvTcpClose(session);
+    VerifyState(ssm::IDLE);
+    OnIngestBatch(session, msgs, sizeof(msg));
+    task_util::WaitForIdle();
+    EXPECT_EQ(0U, server_->received().size());
+    EXPECT_EQ(0U, IngestCount());
+}
+
+// The bytes on the ingest queue drive the queue watermarks
+TEST_F(SandeshServerStateMachineIngestTest, WaterMark) {
+    std::vector<Sandesh::QueueWaterMarkInfo> wm_info =
+        boost::assign::tuple_list_of
+            (1*1024, SandeshLevel::SYS_EMERG, true, true)
+            (512, SandeshLevel::INVALID, false, true);
+    for (int i = 0; i < wm_info.size(); i++) {
+        sm_->SetQueueWaterMarkInfo(wm_info[i]);
+    }
+    GetToState(ssm::ESTABLISHED);
+    TaskScheduler::GetInstance()->Stop();
+    EvSandeshMessageRecv();
+    EXPECT_EQ(1024U, IngestCount());
+    uint64_t sm_queue_count;
+    ASSERT_TRUE(sm_->GetQueueCount(sm_queue_count));
+    EXPECT_EQ(1024, sm_queue_count);
+    EXPECT_EQ(SandeshLevel::SYS_EMERG, MessageDropLevel());
+    EXPECT_TRUE(sm_->session()->IsReaderDeferred());
+    // Below the high watermark again, nothing changes
+    UpdateIngestCount(256, true);
+    UpdateIngestCount(256, false);
+    EXPECT_EQ(SandeshLevel::SYS_EMERG, MessageDropLevel());
+    TaskScheduler::GetInstance()->Start();
+    task_util::WaitForIdle();
+    EXPECT_EQ(0U, IngestCount());
+    EXPECT_EQ(SandeshLevel::INVALID, MessageDropLevel());
+    EXPECT_FALSE(sm_->session()->IsReaderDeferred());
+    EXPECT_EQ(1U, server_->received().size());
+}
+
+static SandeshConfig FlowCreditConfig() {
+    SandeshConfig config;
+    config.sandesh_flow_credits = true;
+    return config;
+}
+
+class SandeshServerStateMachineFlowCreditTest :
+    public SandeshServerStateMachineTest {
+protected:
+    SandeshServerStateMachineFlowCreditTest() :
+        SandeshServerStateMachineTest(FlowCreditConfig()) {
+    }
+};
+
+TEST_F(SandeshServerStateMachineFlowCreditTest, Grant) {
+    GetToState(ssm::ESTABLISHED);
+    EXPECT_EQ(1U, FlowCreditGrants());
+    // Only the flow controlled messages count, per level
+    EvSandeshMessageRecv();
+    EvSandeshMessageRecv(SandeshType::UVE, SandeshLevel::SYS_DEBUG);
+    EvSandeshMessageRecv(SandeshType::OBJECT, SandeshLevel::SYS_ERR);
+    task_util::WaitForIdle();
+    EXPECT_EQ(1U, FlowCreditsUsed(SandeshLevel::SYS_DEBUG));
+    EXPECT_EQ(1U, FlowCreditsUsed(SandeshLevel::SYS_ERR));
+    EXPECT_EQ(0U, FlowCreditsUsed(SandeshLevel::SYS_INFO));
+    // Replenished once half of the window of a level is used
+    uint32_t half_window(SandeshStateMachine::kFlowCreditWindow / 2);
+    for (uint32_t i = 0; i < half_window - 2; i++) {
+        EvSandeshMessageRecv();
+    }
+    task_util::WaitForIdle();
+    EXPECT_EQ(half_window - 1, FlowCreditsUsed(SandeshLevel::SYS_DEBUG));
+    EXPECT_EQ(1U, FlowCreditGrants());
+    EvSandeshMessageRecv();
+    task_util::WaitForIdle();
+    EXPECT_EQ(2U, FlowCreditGrants());
+    EXPECT_EQ(0U, FlowCreditsUsed(SandeshLevel::SYS_DEBUG));
+    EXPECT_EQ(0U, FlowCreditsUsed(SandeshLevel::SYS_ERR));
+}
+
+TEST_F(SandeshServerStateMachineFlowCreditTest, Drop) {
+    GetToState(ssm::ESTABLISHED);
+    EXPECT_EQ(1U, FlowCreditGrants());
+    // A change of the drop level is granted right away
+    SetSandeshMessageDropLevel(SandeshLevel::SYS_ERR);
+    task_util::WaitForIdle();
+    EXPECT_EQ(2U, FlowCreditGrants());
+    // Messages dropped on receipt do not count
+    EvSandeshMessageRecv(SandeshType::OBJECT, SandeshLevel::SYS_ERR);
+    EvSandeshMessageRecv(SandeshType::OBJECT, SandeshLevel::SYS_WARN);
+    EvSandeshMessageRecv(SandeshType::SYSTEM, SandeshLevel::SYS_CRIT);
+    task_util::WaitForIdle();
+    EXPECT_EQ(0U, FlowCreditsUsed(SandeshLevel::SYS_ERR));
+    EXPECT_EQ(0U, FlowCreditsUsed(SandeshLevel::SYS_WARN));
+    EXPECT_EQ(1U, FlowCreditsUsed(SandeshLevel::SYS_CRIT));
+    // No change, no grant
+    SetSandeshMessageDropLevel(SandeshLevel::SYS_ERR);
+    task_util::WaitForIdle();
+    EXPECT_EQ(2U, FlowCreditGrants());
+}
+
+static SandeshConfig AdmissionConfig() {
+    SandeshConfig config;
+    config.sandesh_max_syncing_connections = 1;
+    config.sandesh_max_pending_admissions = 1;
+    return config;
+}
+
+// Besides the state machine under test, two other generators compete for
+// the syncing slot and the pending list
+class SandeshServerStateMachineAdmissionTest :
+    public SandeshServerStateMachineTest {
+protected:
+    SandeshServerStateMachineAdmissionTest() :
+        SandeshServerStateMachineTest(AdmissionConfig()) {
+        for (int i = 0; i < 2; i++) {
+            others_.push_back(new SandeshServerConnection(server_, dummy_,
+                Task::kTaskInstanceAny,
+                TaskScheduler::GetInstance()->GetTaskId(
+                    "sandesh::Test::StateMachine")));
+        }
+        task_util::WaitForIdle();
+    }
+
+    ~SandeshServerStateMachineAdmissionTest() {
+        task_util::WaitForIdle();
+        for (size_t i = 0; i < others_.size(); i++) {
+            server_->ReleaseAdmission(others_[i]->state_machine());
+            others_[i]->Shutdown();
+        }
+        task_util::WaitForIdle();
+        STLDeleteValues(&others_);
+    }
+
+    SandeshStateMachine *other(int i) { return others_[i]->state_machine(); }
+
+    std::vector<SandeshServerConnection *> others_;
+};
+
+TEST_F(SandeshServerStateMachineAdmissionTest, Admit) {
+    GetToState(ssm::ESTABLISHED);
+    EXPECT_EQ(1U, AdmissionStats(sm_).get_accepts());
+    EXPECT_EQ(1U, AdmissionStats(sm_).get_admits());
+    EXPECT_TRUE(AdmissionSyncing(sm_));
+    // Already admitted
+    EXPECT_EQ(SandeshServer::ADMITTED, server_->Admit(sm_));
+    EXPECT_EQ(SandeshServer::DEFERRED, server_->Admit(other(0)));
+    // The slot is released once the sync is done
+    AdmissionSyncTimeout(sm_);
+    AdmissionTimerExpired();
+    EXPECT_GE(AdmissionStats(sm_).get_last_sync_duration_usec(),
+        MaxSyncTime());
+    EXPECT_TRUE(AdmissionSyncing(other(0)));
+    EXPECT_EQ(0U, AdmissionPending());
+    // The state machine stays established
+    VerifyState(ssm::ESTABLISHED);
+}
+
+TEST_F(SandeshServerStateMachineAdmissionTest, DeferRelease) {
+    EXPECT_EQ(SandeshServer::ADMITTED, server_->Admit(other(0)));
+    GetToState(ssm::SERVER_INIT);
+    EvSandeshCtrlMessageRecv();
+    VerifyState(ssm::SERVER_INIT);
+    EXPECT_EQ(1U, AdmissionStats(sm_).get_admits_deferred());
+    EXPECT_EQ(1U, AdmissionPending());
+    // The generator is told to wait, and told again while deferred. The
+    // session is not connected, each message fails to send
+    EXPECT_EQ(1U, sm_->session()->GetStats().num_send_msg_fail);
+    AdmissionWaitRefresh();
+    task_util::WaitForIdle();
+    VerifyState(ssm::SERVER_INIT);
+    EXPECT_EQ(2U, sm_->session()->GetStats().num_send_msg_fail);
+    // Still deferred
+    EXPECT_EQ(SandeshServer::DEFERRED, server_->Admit(sm_));
+    // Admitted when the slot is released, with the control message held
+    server_->ReleaseAdmission(other(0));
+    VerifyState(ssm::ESTABLISHED);
+    EXPECT_EQ(1U, AdmissionStats(sm_).get_admits());
+    EXPECT_TRUE(AdmissionSyncing(sm_));
+    EXPECT_EQ(0U, AdmissionPending());
+}
+
+TEST_F(SandeshServerStateMachineAdmissionTest, DeferTimeout) {
+    EXPECT_EQ(SandeshServer::ADMITTED, server_->Admit(other(0)));
+    GetToState(ssm::SERVER_INIT);
+    EvSandeshCtrlMessageRecv();
+    VerifyState(ssm::SERVER_INIT);
+    // Admitted when the sync holding the slot runs out of time
+    AdmissionSyncTimeout(other(0));
+    AdmissionTimerExpired();
+    VerifyState(ssm::ESTABLISHED);
+    EXPECT_FALSE(AdmissionSyncing(other(0)));
+    EXPECT_TRUE(AdmissionSyncing(sm_));
+}
+
+TEST_F(SandeshServerStateMachineAdmissionTest, DeferClose) {
+    EXPECT_EQ(SandeshServer::ADMITTED, server_->Admit(other(0)));
+    GetToState(ssm::SERVER_INIT);
+    EvSandeshCtrlMessageRecv();
+    VerifyState(ssm::SERVER_INIT);
+    // The pending admission is released with the session
+    EvTcpClose();
+    VerifyState(ssm::IDLE);
+    EXPECT_EQ(0U, AdmissionPending());
+    EXPECT_EQ(SandeshServer::DEFERRED, server_->Admit(other(1)));
+    // The slot goes to the next pending generator
+    server_->ReleaseAdmission(other(0));
+    task_util::WaitForIdle();
+    EXPECT_TRUE(AdmissionSyncing(other(1)));
+    VerifyState(ssm::IDLE);
+}
+
+TEST_F(SandeshServerStateMachineAdmissionTest, Reject) {
+    EXPECT_EQ(SandeshServer::ADMITTED, server_->Admit(other(0)));
+    EXPECT_EQ(SandeshServer::DEFERRED, server_->Admit(other(1)));
+    GetToState(ssm::SERVER_INIT);
+    EvSandeshCtrlMessageRecv();
+    VerifyState(ssm::SERVER_INIT);
+    EXPECT_EQ(1U, AdmissionStats(sm_).get_rejects());
+    EXPECT_EQ(1U, AdmissionPending());
+    // The session is not connected, the retry after message fails to send
+    EXPECT_EQ(1U, sm_->session()->GetStats().num_send_msg_fail);
+    // Closed if the generator does not close it
+    EXPECT_TRUE(RejectCloseTimerRunning());
+    sm_->RejectCloseTimerFired();
+    VerifyState(ssm::IDLE);
+    EXPECT_FALSE(RejectCloseTimerRunning());
+}
+
+TEST_F(SandeshServerStateMachineAdmissionTest, RejectClose) {
+    EXPECT_EQ(SandeshServer::ADMITTED, server_->Admit(other(0)));
+    EXPECT_EQ(SandeshServer::DEFERRED, server_->Admit(other(1)));
+    GetToState(ssm::SERVER_INIT);
+    EvSandeshCtrlMessageRecv();
+    VerifyState(ssm::SERVER_INIT);
+    EXPECT_TRUE(RejectCloseTimerRunning());
+    // Closed by the generator
+    EvTcpClose();
+    VerifyState(ssm::IDLE);
+    EXPECT_FALSE(RejectCloseTimerRunning());
+}
+
 class SandeshServerStateMachineIdleTest : public SandeshServerStateMachineTest {
     virtual void SetUp() {
         GetToState(ssm::IDLE);
@@ -92,6 +92,7 @@ TEST_F(SandeshStatisticsTest, DetailMsgStats) {
     EXPECT_EQ(1, test1_sms->messages_sent_dropped_write_failed);
     EXPECT_EQ(1, test1_sms->messages_sent_dropped_wrong_client_sm_state);
     EXPECT_EQ(1, test1_sms->messages_sent_dropped_sending_to_syslog);
+    EXPECT_EQ(1, test1_sms->messages_sent_dropped_no_credits);
     EXPECT_EQ(64, test1_sms->bytes_sent_dropped_no_queue);
     EXPECT_EQ(64, test1_sms->bytes_sent_dropped_no_client);
     EXPECT_EQ(64, test1_sms->bytes_sent_dropped_no_session);
@@ -102,6 +103,7 @@ TEST_F(SandeshStatisticsTest, DetailMsgStats) {
     EXPECT_EQ(64, test1_sms->bytes_sent_dropped_write_failed);
     EXPECT_EQ(64, test1_sms->bytes_sent_dropped_wrong_client_sm_state);
     EXPECT_EQ(64, test1_sms->bytes_sent_dropped_sending_to_syslog);
+    EXPECT_EQ(64, test1_sms->bytes_sent_dropped_no_credits);
     int expected_recv_msg_dropped(
         static_cast<int>(SandeshRxDropReason::MaxDropReason) -
         static_cast<int>(SandeshRxDropReason::MinDropReason) - 2);
@@ -162,6 +164,27 @@ TEST_F(SandeshStatisticsTest, BasicMsgStats) {
     }
 }
 
+// Encodes are counted apart from the sends, as a message encoded once can
+// be sent to more than one collector
+TEST_F(SandeshStatisticsTest, EncodeMsgStats) {
+    SandeshMessageStatistics msg_stats;
+    msg_stats.UpdateEncode("Test", 10);
+    msg_stats.UpdateEncode("Test", 5);
+    msg_stats.UpdateSend("Test", 64);
+    SandeshMessageStatistics::DetailStatsMap detail_mt_stats;
+    SandeshMessageStats detail_agg_mt_stats;
+    msg_stats.Get(&detail_mt_stats, &detail_agg_mt_stats);
+    SandeshMessageStatistics::DetailStatsMap::iterator test_it =
+        detail_mt_stats.find("Test");
+    ASSERT_TRUE(test_it != detail_mt_stats.end());
+    SandeshMessageStats *test_sms = &test_it->second->stats;
+    EXPECT_EQ(2, test_sms->messages_encoded);
+    EXPECT_EQ(15, test_sms->encode_time_usec);
+    EXPECT_EQ(1, test_sms->messages_sent);
+    EXPECT_EQ(2, detail_agg_mt_stats.messages_encoded);
+    EXPECT_EQ(15, detail_agg_mt_stats.encode_time_usec);
+}
+
 int main(int argc, char **argv) {
     LoggingInit();
     ::testing::InitGoogleTest(&argc, argv);
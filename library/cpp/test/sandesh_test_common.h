@@ -19,8 +19,9 @@ public:
     typedef boost::function<bool(SandeshSession *session,
         const SandeshMessage *msg)> ReceiveMsgCb;
 
-    SandeshServerTest(EventManager *evm, ReceiveMsgCb cb) :
-        SandeshServer(evm, SandeshConfig()),
+    SandeshServerTest(EventManager *evm, ReceiveMsgCb cb,
+        const SandeshConfig &config = SandeshConfig()) :
+        SandeshServer(evm, config),
         cb_(cb) {
     }
 
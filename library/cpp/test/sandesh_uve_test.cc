@@ -0,0 +1,371 @@
+//
+// Copyright (c) 2016 Juniper Networks, Inc. All rights reserved.
+//
+
+//
+// sandesh_uve_test.cc
+//
+// Sandesh UVE Cache Test
+//
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <set>
+
+#include "testing/gunit.h"
+
+#include <base/logging.h>
+
+#include <sandesh/sandesh_types.h>
+#include <sandesh/sandesh.h>
+#include <sandesh/sandesh_uve.h>
+#include <sandesh/sandesh_uve_types.h>
+
+using contrail::sandesh::protocol::TProtocol;
+
+// UVE struct of the test cache, with the members that the cache uses
+// of a generated UVE struct
+struct SandeshUVECacheTestData {
+    SandeshUVECacheTestData() : deleted(false), value(0) {
+    }
+    explicit SandeshUVECacheTestData(const std::string &table) :
+        table_(table), deleted(false), value(0) {
+    }
+    const std::string & get_name() const { return name; }
+    bool get_deleted() const { return deleted; }
+    void set_deleted(bool val) { deleted = val; }
+    std::string log() const { return name; }
+    size_t GetSize() const { return name.size() + sizeof(value); }
+    int32_t write(boost::shared_ptr<TProtocol> oprot) const {
+        int32_t xfer = 0, ret;
+        if ((ret = oprot->writeString(name)) < 0) return ret;
+        xfer += ret;
+        if ((ret = oprot->writeI32(value)) < 0) return ret;
+        xfer += ret;
+        return xfer;
+    }
+    int32_t read(boost::shared_ptr<TProtocol> iprot) {
+        int32_t xfer = 0, ret;
+        if ((ret = iprot->readString(name)) < 0) return ret;
+        xfer += ret;
+        if ((ret = iprot->readI32(value)) < 0) return ret;
+        xfer += ret;
+        return xfer;
+    }
+
+    std::string table_;
+    std::string name;
+    std::string proxy;
+    bool deleted;
+    int32_t value;
+};
+
+template<>
+struct SandeshStructProxyTrait<SandeshUVECacheTestData> {
+    static std::string get(const SandeshUVECacheTestData &s) {
+        return s.proxy;
+    }
+};
+
+// UVE sandesh of the test cache, which records the UVEs sent from the
+// cache instead of sending them
+struct SandeshUVECacheTest {
+    typedef std::vector<SandeshUVECacheTestData> SentList;
+
+    static std::map<std::string, std::string> _DSConf(void) {
+        return std::map<std::string, std::string>();
+    }
+    static void _InitDerivedStats(SandeshUVECacheTestData &_data,
+            const std::map<std::string, std::string> &_dsconf) {
+    }
+    static bool UpdateUVE(SandeshUVECacheTestData &_data,
+            SandeshUVECacheTestData &tdata, uint64_t mono_usec,
+            SandeshLevel::type Xlevel, bool Xdelta = false) {
+        tdata.name = _data.name;
+        tdata.proxy = _data.proxy;
+        tdata.value = _data.value;
+        return true;
+    }
+    static bool _PeriodicPending(const SandeshUVECacheTestData &_data) {
+        return false;
+    }
+    static int32_t lseqnum() { return 0; }
+    static const int32_t sversionsig() { return 1234; }
+    static void Send(const SandeshUVECacheTestData &cdata,
+            SandeshLevel::type Xlevel, SandeshUVE::SendType stype,
+            uint32_t seqno, uint32_t cycle, std::string ctx = "",
+            int collector = -1) {
+        sent_.push_back(cdata);
+        collectors_.insert(collector);
+    }
+
+    static SentList sent_;
+    // Collectors that the UVEs were sent to
+    static std::set<int> collectors_;
+};
+
+SandeshUVECacheTest::SentList SandeshUVECacheTest::sent_;
+std::set<int> SandeshUVECacheTest::collectors_;
+
+SANDESH_UVE_DEF(SandeshUVECacheTest, SandeshUVECacheTestData, 0, 0);
+
+static const std::string kTestTypeName("SandeshUVECacheTestData");
+static const std::string kTestTable("ObjectTestTable");
+
+class SandeshUVECacheUnitTest : public ::testing::Test {
+protected:
+    SandeshUVECacheUnitTest() : seqno_(0) {
+    }
+
+    virtual void TearDown() {
+        for (std::vector<std::pair<std::string, int> >::const_iterator it =
+                uves_.begin(); it != uves_.end(); ++it) {
+            Update(it->first, it->second, 0, true);
+        }
+        EXPECT_EQ(0U, uvemapSandeshUVECacheTest.Size());
+        SandeshUVECacheTest::sent_.clear();
+        SandeshUVECacheTest::collectors_.clear();
+    }
+
+    // Update the UVE of the given UVE-Key in the native cache, or in
+    // the given partition of proxy group kProxy
+    uint32_t Update(const std::string &name, int partition = -1,
+            int32_t value = 0, bool deleted = false) {
+        SandeshUVECacheTestData data;
+        data.table_ = kTestTable;
+        data.name = name;
+        data.value = value;
+        data.deleted = deleted;
+        if (partition != -1) {
+            data.proxy = kProxy;
+        }
+        if (!deleted) {
+            uves_.push_back(std::make_pair(name, partition));
+        }
+        uvemapSandeshUVECacheTest.UpdateUVE(data, ++seqno_, 0, partition,
+            SandeshLevel::SYS_NOTICE);
+        return seqno_;
+    }
+
+    // Number of times each UVE-Key was sent
+    std::map<std::string, int> SentCount() const {
+        std::map<std::string, int> count;
+        for (SandeshUVECacheTest::SentList::const_iterator it =
+                SandeshUVECacheTest::sent_.begin();
+                it != SandeshUVECacheTest::sent_.end(); ++it) {
+            count[it->name]++;
+        }
+        return count;
+    }
+
+    static const std::string kProxy;
+    uint32_t seqno_;
+    std::vector<std::pair<std::string, int> > uves_;
+};
+
+const std::string SandeshUVECacheUnitTest::kProxy("proxy1");
+
+TEST_F(SandeshUVECacheUnitTest, ResyncSlices) {
+    static const int kNativeUVEs = 40;
+    static const int kProxyUVEs = 20;
+    static const uint32_t kBudget = 3;
+    for (int i = 0; i < kNativeUVEs; i++) {
+        Update("native" + integerToString(i));
+    }
+    for (int i = 0; i < kProxyUVEs; i++) {
+        Update("proxy" + integerToString(i),
+            i % SandeshUVETypeMaps::kProxyPartitions);
+    }
+    // Each step is a timer tick, and resumes where the previous one
+    // stopped
+    SandeshUVETypeMaps::ResyncStart(std::map<std::string, uint32_t>());
+    uint32_t steps = 1;
+    while (!SandeshUVETypeMaps::ResyncStep(kBudget)) {
+        EXPECT_LE(SandeshUVECacheTest::sent_.size(), steps * kBudget);
+        // Skip a tick, as done when the send queue has not drained
+        SandeshUVETypeMaps::ResyncDefer();
+        steps++;
+    }
+    std::map<std::string, int> count(SentCount());
+    EXPECT_EQ(kNativeUVEs + kProxyUVEs, (int)count.size());
+    for (std::map<std::string, int>::const_iterator it = count.begin();
+            it != count.end(); ++it) {
+        EXPECT_EQ(1, it->second) << it->first;
+    }
+    EXPECT_GE(steps, (kNativeUVEs + kProxyUVEs) / kBudget);
+    SandeshUVEResyncResp resp;
+    SandeshUVETypeMaps::GetResyncStatus(&resp);
+    EXPECT_FALSE(resp.get_in_progress());
+    EXPECT_EQ((uint32_t)(kNativeUVEs + kProxyUVEs), resp.get_uves_synced());
+    EXPECT_EQ((uint32_t)(kNativeUVEs + kProxyUVEs), resp.get_uves_sent());
+    EXPECT_EQ(steps, resp.get_slices());
+    EXPECT_EQ(steps - 1, resp.get_slices_deferred());
+    // Nothing is left to send
+    SandeshUVECacheTest::sent_.clear();
+    EXPECT_TRUE(SandeshUVETypeMaps::ResyncStep(kBudget));
+    EXPECT_EQ(0U, SandeshUVECacheTest::sent_.size());
+}
+
+TEST_F(SandeshUVECacheUnitTest, ResyncSeqno) {
+    static const int kUVEs = 20;
+    uint32_t seqno = 0;
+    for (int i = 0; i < kUVEs; i++) {
+        uint32_t useqno = Update("native" + integerToString(i));
+        if (i == kUVEs / 2 - 1) seqno = useqno;
+    }
+    // UVEs that the collector has already received are walked, but not
+    // sent. The walk of the second collector is separate, and sends
+    // to that collector only.
+    std::map<std::string, uint32_t> seqnos;
+    seqnos.insert(std::make_pair(kTestTypeName, seqno));
+    SandeshUVETypeMaps::ResyncStart(seqnos, 1);
+    SandeshUVETypeMaps::ResyncStart(std::map<std::string, uint32_t>(), 0);
+    while (!SandeshUVETypeMaps::ResyncStep(2, 1)) {
+    }
+    std::map<std::string, int> count(SentCount());
+    EXPECT_EQ(kUVEs / 2, (int)count.size());
+    for (int i = 0; i < kUVEs; i++) {
+        std::string name("native" + integerToString(i));
+        EXPECT_EQ(i < kUVEs / 2 ? 0 : 1, count[name]) << name;
+    }
+    EXPECT_EQ(1U, SandeshUVECacheTest::collectors_.size());
+    EXPECT_EQ(1U, SandeshUVECacheTest::collectors_.count(1));
+    SandeshUVECacheTest::sent_.clear();
+    SandeshUVECacheTest::collectors_.clear();
+    while (!SandeshUVETypeMaps::ResyncStep(5, 0)) {
+    }
+    EXPECT_EQ((size_t)kUVEs, SentCount().size());
+    EXPECT_EQ(1U, SandeshUVECacheTest::collectors_.size());
+    EXPECT_EQ(1U, SandeshUVECacheTest::collectors_.count(0));
+    // The resync to each collector is reported
+    SandeshUVEResyncResp resp;
+    SandeshUVETypeMaps::GetResyncStatus(&resp);
+    ASSERT_LE(2U, resp.get_collectors().size());
+    EXPECT_EQ(0U, resp.get_collectors()[0].get_collector());
+    EXPECT_EQ((uint32_t)kUVEs, resp.get_collectors()[0].get_uves_sent());
+    EXPECT_EQ(1U, resp.get_collectors()[1].get_collector());
+    EXPECT_EQ((uint32_t)kUVEs / 2, resp.get_collectors()[1].get_uves_sent());
+    EXPECT_EQ((uint32_t)kUVEs, resp.get_uves_sent());
+}
+
+TEST_F(SandeshUVECacheUnitTest, EncodedSize) {
+    Update("native1");
+    Update("native22", -1, 5);
+    Update("proxyuve", 3);
+    EXPECT_EQ(3U, uvemapSandeshUVECacheTest.Size());
+    EXPECT_EQ((uint64_t)(7 + 8 + 8 + 3 * sizeof(int32_t)),
+        uvemapSandeshUVECacheTest.GetEncodedSize());
+}
+
+// The memory size counts the cache structures on top of the UVEs, and
+// comes back down as UVEs are removed
+TEST_F(SandeshUVECacheUnitTest, MemorySize) {
+    uint64_t empty(uvemapSandeshUVECacheTest.GetMemorySize());
+    Update("native1");
+    uint64_t native(uvemapSandeshUVECacheTest.GetMemorySize());
+    EXPECT_LT(empty + uvemapSandeshUVECacheTest.GetEncodedSize(), native);
+    Update("proxyuve", 3);
+    uint64_t proxy(uvemapSandeshUVECacheTest.GetMemorySize());
+    EXPECT_LT(native + (uint64_t)(8 + sizeof(int32_t)), proxy);
+    Update("native1", -1, 0, true);
+    EXPECT_GT(proxy, uvemapSandeshUVECacheTest.GetMemorySize());
+}
+
+TEST_F(SandeshUVECacheUnitTest, ProxyKeyIndex) {
+    std::string name("proxyuve");
+    Update(name, 1);
+    Update(name, 2);
+    Update(name, 2, 1);
+    Update("other", 2);
+    // A lookup by UVE-Key visits the partitions that hold the key
+    EXPECT_TRUE(uvemapSandeshUVECacheTest.SendUVE("", name, "ctx"));
+    EXPECT_EQ(2U, SandeshUVECacheTest::sent_.size());
+    SandeshUVECacheTest::sent_.clear();
+    Update(name, 1, 0, true);
+    EXPECT_TRUE(uvemapSandeshUVECacheTest.SendUVE("", name, "ctx"));
+    ASSERT_EQ(1U, SandeshUVECacheTest::sent_.size());
+    EXPECT_EQ(1, SandeshUVECacheTest::sent_[0].value);
+    SandeshUVECacheTest::sent_.clear();
+    // Clearing a partition sends the deletes, and removes its UVE-Keys
+    EXPECT_EQ(2U, SandeshUVETypeMaps::Clear(kProxy, 2));
+    EXPECT_EQ(2U, SandeshUVECacheTest::sent_.size());
+    SandeshUVECacheTest::sent_.clear();
+    EXPECT_FALSE(uvemapSandeshUVECacheTest.SendUVE("", name, "ctx"));
+    EXPECT_FALSE(uvemapSandeshUVECacheTest.SendUVE("", "other", "ctx"));
+    EXPECT_EQ(0U, SandeshUVECacheTest::sent_.size());
+    EXPECT_EQ(0U, uvemapSandeshUVECacheTest.Size());
+}
+
+TEST_F(SandeshUVECacheUnitTest, SnapshotRestoreExpire) {
+    static const int kUVEs = 10;
+    std::string path("sandesh_uve_test_snapshot." +
+        integerToString(getpid()));
+    for (int i = 0; i < kUVEs; i++) {
+        Update("native" + integerToString(i), -1, i);
+    }
+    // Proxy group UVEs are not saved
+    Update("proxyuve", 4);
+    ASSERT_TRUE(SandeshUVETypeMaps::WriteSnapshot(path));
+    for (int i = 0; i < kUVEs; i++) {
+        Update("native" + integerToString(i), -1, 0, true);
+    }
+    Update("proxyuve", 4, 0, true);
+    EXPECT_EQ(0U, uvemapSandeshUVECacheTest.Size());
+
+    // Restored UVEs are not sent until synced, and UVEs published
+    // since the restart are left alone
+    Update("native0", -1, 100);
+    EXPECT_EQ((uint32_t)(kUVEs - 1), SandeshUVETypeMaps::ReadSnapshot(path));
+    EXPECT_EQ((uint32_t)kUVEs, uvemapSandeshUVECacheTest.Size());
+    EXPECT_EQ(0U, SandeshUVECacheTest::sent_.size());
+    EXPECT_TRUE(uvemapSandeshUVECacheTest.SendUVE("", "native3", "ctx"));
+    ASSERT_EQ(1U, SandeshUVECacheTest::sent_.size());
+    EXPECT_EQ(3, SandeshUVECacheTest::sent_[0].value);
+    SandeshUVECacheTest::sent_.clear();
+    EXPECT_TRUE(uvemapSandeshUVECacheTest.SendUVE("", "native0", "ctx"));
+    ASSERT_EQ(1U, SandeshUVECacheTest::sent_.size());
+    EXPECT_EQ(100, SandeshUVECacheTest::sent_[0].value);
+    SandeshUVECacheTest::sent_.clear();
+
+    // Restored UVEs that are not published again are expired
+    Update("native1", -1, 101);
+    Update("native2", -1, 102);
+    EXPECT_EQ((uint32_t)(kUVEs - 3), SandeshUVETypeMaps::ExpireRestored());
+    EXPECT_EQ(3U, uvemapSandeshUVECacheTest.Size());
+    std::map<std::string, int> count(SentCount());
+    EXPECT_EQ((size_t)(kUVEs - 3), count.size());
+    for (SandeshUVECacheTest::SentList::const_iterator it =
+            SandeshUVECacheTest::sent_.begin();
+            it != SandeshUVECacheTest::sent_.end(); ++it) {
+        EXPECT_TRUE(it->deleted) << it->name;
+    }
+    EXPECT_EQ(0, count["native0"] + count["native1"] + count["native2"]);
+    EXPECT_EQ(0U, SandeshUVETypeMaps::ExpireRestored());
+    ::unlink(path.c_str());
+}
+
+TEST_F(SandeshUVECacheUnitTest, SnapshotCorrupt) {
+    std::string path("sandesh_uve_test_snapshot." +
+        integerToString(getpid()));
+    Update("native0");
+    ASSERT_TRUE(SandeshUVETypeMaps::WriteSnapshot(path));
+    Update("native0", -1, 0, true);
+    // Make the length of the magic string larger than the file
+    int fd = ::open(path.c_str(), O_WRONLY);
+    ASSERT_GE(fd, 0);
+    uint8_t len[4] = { 0x7f, 0xff, 0xff, 0xff };
+    EXPECT_EQ(4, ::write(fd, len, sizeof(len)));
+    ::close(fd);
+    EXPECT_EQ(0U, SandeshUVETypeMaps::ReadSnapshot(path));
+    EXPECT_EQ(0U, uvemapSandeshUVECacheTest.Size());
+    ::unlink(path.c_str());
+    // A missing snapshot restores nothing
+    EXPECT_EQ(0U, SandeshUVETypeMaps::ReadSnapshot(path));
+}
+
+int main(int argc, char **argv) {
+    LoggingInit();
+    ::testing::InitGoogleTest(&argc, argv);
+    bool success = RUN_ALL_TESTS();
+    return success;
+}
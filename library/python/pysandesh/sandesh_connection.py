@@ -104,6 +104,38 @@ class SandeshConnection(object):
             return
         if hdr.Hints & SANDESH_CONTROL_HINT:
             self._logger.debug('Received sandesh control message [%s]' % (sandesh_name))
+            if sandesh_name == 'SandeshCtrlFlowCredit':
+                # Flow credits are not supported, ignore the grant
+                self._sandesh_instance.msg_stats().update_rx_stats(
+                    sandesh_name, len(msg))
+                return
+            if sandesh_name == 'SandeshCtrlRetryAfter':
+                # The collector is busy with other generators, reset the
+                # connection and retry after the delay it asks for
+                from gen_py.sandesh_ctrl.ttypes import SandeshCtrlRetryAfter
+                retry_after = self._read_ctrl_msg(SandeshCtrlRetryAfter(),
+                    sandesh_name, msg, hdr_len)
+                if retry_after is not None:
+                    self._logger.info('Connection deferred by the Collector, '
+                        'retry after %d msec' % (retry_after.retry_after_msec))
+                    self._state_machine.set_retry_after(
+                        retry_after.retry_after_msec)
+                session.close()
+                return
+            if sandesh_name == 'SandeshCtrlAdmissionDeferred':
+                # The collector is busy with other generators, keep the
+                # connection and wait for the reply to the control message
+                from gen_py.sandesh_ctrl.ttypes import \
+                    SandeshCtrlAdmissionDeferred
+                deferred = self._read_ctrl_msg(
+                    SandeshCtrlAdmissionDeferred(), sandesh_name, msg,
+                    hdr_len)
+                if deferred is not None:
+                    self._logger.debug('Connection deferred by the '
+                        'Collector, wait %d msec' % (deferred.wait_msec))
+                    self._state_machine.on_admission_deferred(session,
+                        deferred.wait_msec)
+                return
             if sandesh_name != 'SandeshCtrlServerToClient':
                 self._sandesh_instance.msg_stats().update_rx_stats(
                     sandesh_name, len(msg),
@@ -131,4 +163,19 @@ class SandeshConnection(object):
                 msg[hdr_len:], len(msg))
     #end _receive_sandesh_msg
 
+    def _read_ctrl_msg(self, ctrl_msg, sandesh_name, msg, hdr_len):
+        transport = TTransport.TMemoryBuffer(msg[hdr_len:])
+        protocol_factory = TXMLProtocol.TXMLProtocolFactory()
+        protocol = protocol_factory.getProtocol(transport)
+        if ctrl_msg.read(protocol) == -1:
+            self._sandesh_instance.msg_stats().update_rx_stats(
+                sandesh_name, len(msg), SandeshRxDropReason.DecodingFailed)
+            self._logger.error('Failed to decode sandesh control message '
+                '"%s"' % (msg))
+            return None
+        self._sandesh_instance.msg_stats().update_rx_stats(sandesh_name,
+            len(msg))
+        return ctrl_msg
+    #end _read_ctrl_msg
+
 #end class SandeshConnection
@@ -231,6 +231,7 @@ class SandeshStateMachine(object):
         self._disable = False
         self._idle_hold_timer = None
         self._connect_timer = None
+        self._retry_after = 0
         self._collectors = collectors
         self._collector_name = None
         self._collector_index = -1
@@ -322,6 +323,21 @@ class SandeshStateMachine(object):
             self._session.close()
     #end on_sandesh_ctrl_msg_receive
 
+    def set_retry_after(self, retry_after_msec):
+        # Delay before connecting again, as asked for by the Collector
+        self._retry_after = retry_after_msec / 1000.0
+    #end set_retry_after
+
+    def on_admission_deferred(self, session, wait_msec):
+        # The Collector defers the reply to the control message, wait for
+        # as long as it asks instead of moving on to another Collector
+        if session is not self._session or \
+           self._fsm.current != State._CLIENT_INIT:
+            return
+        self._cancel_connect_timer()
+        self._start_connect_timer(max(self._CONNECT_TIME, wait_msec / 1000.0))
+    #end on_admission_deferred
+
     def on_sandesh_uve_msg_send(self, sandesh_uve):
         self.enqueue_event(Event(event = Event._EV_SANDESH_UVE_SEND,
                                  msg = sandesh_uve))
@@ -360,8 +376,12 @@ class SandeshStateMachine(object):
 
     def _start_idle_hold_timer(self):
         if self._idle_hold_timer is None:
-            if self._IDLE_HOLD_TIME:
-                self._idle_hold_timer = gevent.spawn_later(self._IDLE_HOLD_TIME,
+            # Connect again only after the delay asked for by the Collector,
+            # without changing the idle hold time for later disconnects
+            idle_hold_time = max(self._IDLE_HOLD_TIME, self._retry_after)
+            self._retry_after = 0
+            if idle_hold_time:
+                self._idle_hold_timer = gevent.spawn_later(idle_hold_time,
                                             self._idle_hold_timer_expiry_handler)
             else:
                 self.enqueue_event(Event(event = Event._EV_IDLE_HOLD_TIMER_EXPIRED))
@@ -378,9 +398,11 @@ class SandeshStateMachine(object):
         self.enqueue_event(Event(event = Event._EV_IDLE_HOLD_TIMER_EXPIRED))
     #end _idle_hold_timer_expiry_handler
     
-    def _start_connect_timer(self):
+    def _start_connect_timer(self, connect_time=None):
         if self._connect_timer is None:
-            self._connect_timer = gevent.spawn_later(self._CONNECT_TIME,
+            if connect_time is None:
+                connect_time = self._CONNECT_TIME
+            self._connect_timer = gevent.spawn_later(connect_time,
                                         self._connect_timer_expiry_handler, 
                                         self._session)
     #end _start_connect_timer
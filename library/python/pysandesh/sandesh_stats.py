@@ -168,6 +168,13 @@ class SandeshMessageStatistics(object):
                 else:
                     msg_stats.messages_sent_dropped_sending_to_syslog = 1
                     msg_stats.bytes_sent_dropped_sending_to_syslog = nbytes
+            elif drop_reason is SandeshTxDropReason.NoCredits:
+                if msg_stats.messages_sent_dropped_no_credits:
+                    msg_stats.messages_sent_dropped_no_credits += 1
+                    msg_stats.bytes_sent_dropped_no_credits += nbytes
+                else:
+                    msg_stats.messages_sent_dropped_no_credits = 1
+                    msg_stats.bytes_sent_dropped_no_credits = nbytes
             else:
                 assert 0, 'Unhandled Tx drop reason <%s>' % (str(drop_reason))
     # end _update_tx_stats_internal
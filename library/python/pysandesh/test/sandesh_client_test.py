@@ -17,6 +17,7 @@ sys.path.insert(1, sys.path[0]+'/../../../python')
 
 from pysandesh.sandesh_base import *
 from pysandesh.sandesh_client import *
+from pysandesh.sandesh_state_machine import SandeshStateMachine, State
 from pysandesh.util import *
 from gen_py.msg_test.ttypes import *
 
@@ -108,6 +109,46 @@ class SandeshClientTest(unittest.TestCase):
             close_interval_msec)
     # end test_close_sm_session
 
+    @mock.patch('pysandesh.sandesh_state_machine.gevent.spawn_later')
+    def test_retry_after(self, spawn_later):
+        sm = SandeshStateMachine(mock.MagicMock(), sandesh_global.logger(),
+            [])
+        # Connect again after the delay asked for by the collector
+        sm.set_retry_after(10000)
+        sm._start_idle_hold_timer()
+        spawn_later.assert_called_once_with(10.0,
+            sm._idle_hold_timer_expiry_handler)
+        # and after the idle hold time on later disconnects
+        spawn_later.reset_mock()
+        sm._idle_hold_timer = None
+        sm._start_idle_hold_timer()
+        spawn_later.assert_called_once_with(SandeshStateMachine._IDLE_HOLD_TIME,
+            sm._idle_hold_timer_expiry_handler)
+    # end test_retry_after
+
+    @mock.patch('pysandesh.sandesh_state_machine.gevent.kill')
+    @mock.patch('pysandesh.sandesh_state_machine.gevent.spawn_later')
+    def test_admission_deferred(self, spawn_later, kill):
+        sm = SandeshStateMachine(mock.MagicMock(), sandesh_global.logger(),
+            [])
+        session = mock.MagicMock()
+        sm._session = session
+        sm._fsm.current = State._CLIENT_INIT
+        connect_timer = mock.MagicMock()
+        sm._connect_timer = connect_timer
+        # The connect timer is extended while the admission is deferred
+        sm.on_admission_deferred(session, 60000)
+        kill.assert_called_once_with(connect_timer)
+        spawn_later.assert_called_once_with(60.0,
+            sm._connect_timer_expiry_handler, session)
+        # but not for an older session, nor once established
+        spawn_later.reset_mock()
+        sm.on_admission_deferred(mock.MagicMock(), 60000)
+        sm._fsm.current = State._ESTABLISHED
+        sm.on_admission_deferred(session, 60000)
+        self.assertFalse(spawn_later.called)
+    # end test_admission_deferred
+
 # end class SandeshClientTest
 
 if __name__ == '__main__':